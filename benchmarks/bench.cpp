@@ -0,0 +1,765 @@
+// NOTE: Runtime benchmarks for generated code.
+//
+// Every benchmark is a compute-heavy TINY program <name>.tiny and a
+// hand-written C program <name>.c doing the same work. The C version built
+// with "<cc> -O2" is the reference; each backend's build of the TINY program
+// is run on the same input, checked against the reference output and timed.
+// The table gives the median of --reps runs and the slowdown against the
+// reference, the last row the geometric mean per backend.
+//
+// Backends:
+//     jit   tiny --run (bytecode interpreter, hot loops JIT compiled)
+//     c     tiny --emit-c, then <cc> -O2
+//     free  tiny --freestanding, then <cc> -O2 -static -nostdlib (Linux)
+//     masm  tiny, then ml and link as in build\a.bat and build\l.bat (Windows)
+//
+// Usage (from the repository root, after building tiny):
+//     g++ -O2 -o bench benchmarks/bench.cpp
+//     ./bench [--tiny <path>] [--cc <compiler>] [--reps <n>] [--backend <name>]
+//             [--dir <benchmark dir>] [--work <scratch dir>] [--csv <file>] [<benchmark>...]
+//     ./bench --startup <n> [--tiny <path>] [--cc <compiler>] [--dir <benchmark dir>]
+//             [--work <scratch dir>]
+//     ./bench --vector <n> [--tiny <path>] [--reps <n>] [--dir <benchmark dir>] [--work <scratch dir>]
+// --csv appends one row per benchmark and backend, to track results over time.
+// Timings include process start-up and, for jit, compiling the program.
+//
+// --startup times exec to exit instead: startup.tiny, which reads one number
+// and writes it back, built against the C library (dynamic and static) and
+// freestanding, each spawned <n> times directly rather than through a shell.
+//
+// --vector gives the elements per cycle of the JIT's array loops in
+// vector.tiny with each tiny --vectorize setting. The program is timed for
+// <n> and 2<n> rounds so that start-up and compiling cancel out; cycles are
+// time stamp counter ticks, which run at the nominal clock.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include <chrono>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+struct benchmark
+{
+    char *Name;
+    
+    // NOTE: Read by the program from stdin, sized for tens to hundreds of milliseconds
+    // of the reference
+    char *Input;
+};
+
+static benchmark Benchmarks[] =
+{
+    {"collatz", "100000"},
+    {"branches", "20000000"},
+    {"gcd", "1500"},
+    {"boolean", "30000000"},
+    {"primes", "500000"},
+    {"calls", "32"},
+    {"sieve", "20"},
+    {"counted", "400"},
+    {"switch", "100000000"},
+    {"ifchain", "100000000"},
+    {"guarded", "100000000"},
+    {"vector", "20000"},
+};
+
+enum backend
+{
+    Backend_JIT,
+    Backend_C,
+    Backend_Freestanding,
+    Backend_MASM,
+    
+    Backend_Count
+};
+
+static char *BackendNames[] = {"jit", "c", "free", "masm"};
+
+struct bench_options
+{
+    char Tiny[1024];
+    char Directory[1024];
+    char *Compiler;
+    int Repetitions;
+    bool Backends[Backend_Count];
+    FILE *Csv;
+};
+
+#define MaxOutput 4096
+#define MaxExecutable 2560
+
+static double
+WallSeconds()
+{
+    std::chrono::duration<double> Now = std::chrono::steady_clock::now().time_since_epoch();
+    return Now.count();
+}
+
+static void
+AbsolutePath(char *Result, size_t ResultSize, char *Path)
+{
+#if defined(_WIN32)
+    if(!_fullpath(Result, Path, ResultSize))
+#else
+    char Resolved[4096];
+    if(realpath(Path, Resolved))
+    {
+        snprintf(Result, ResultSize, "%s", Resolved);
+    }
+    else
+#endif
+    {
+        snprintf(Result, ResultSize, "%s", Path);
+    }
+}
+
+static bool
+Run(char *Command)
+{
+    bool Result = (system(Command) == 0);
+    return Result;
+}
+
+static bool
+ReadFile(char *Path, char *Result, size_t ResultSize)
+{
+    bool Success = false;
+    
+    FILE *File = fopen(Path, "rb");
+    if(File)
+    {
+        size_t Size = fread(Result, 1, ResultSize - 1, File);
+        Result[Size] = 0;
+        fclose(File);
+        Success = true;
+    }
+    
+    return Success;
+}
+
+// NOTE: Builds Executable in the current (scratch) directory. The reference
+// ignores Backend.
+static bool
+Build(bench_options *Options, benchmark *Benchmark, backend Backend, bool Reference, char *Executable)
+{
+    char Command[4096];
+    bool Result = false;
+    
+    if(Reference)
+    {
+        snprintf(Executable, MaxExecutable, "ref_%s", Benchmark->Name);
+        snprintf(Command, sizeof(Command), "%s -O2 -o %s \"%s/%s.c\"",
+                 Options->Compiler, Executable, Options->Directory, Benchmark->Name);
+        Result = Run(Command);
+    }
+    else
+    {
+        switch(Backend)
+        {
+            case Backend_JIT:
+            {
+                // NOTE: Nothing to build, Run passes the source to tiny --run
+                snprintf(Executable, MaxExecutable, "\"%s\" --run \"%s/%s.tiny\"",
+                         Options->Tiny, Options->Directory, Benchmark->Name);
+                Result = true;
+            } break;
+            
+            case Backend_C:
+            {
+                snprintf(Executable, MaxExecutable, "c_%s", Benchmark->Name);
+                snprintf(Command, sizeof(Command), "\"%s\" --emit-c \"%s/%s.tiny\"",
+                         Options->Tiny, Options->Directory, Benchmark->Name);
+                Result = Run(Command);
+                if(Result)
+                {
+                    snprintf(Command, sizeof(Command), "%s -O2 -o %s test1.c", Options->Compiler, Executable);
+                    Result = Run(Command);
+                }
+            } break;
+            
+            case Backend_Freestanding:
+            {
+                snprintf(Executable, MaxExecutable, "free_%s", Benchmark->Name);
+                snprintf(Command, sizeof(Command), "\"%s\" --freestanding \"%s/%s.tiny\"",
+                         Options->Tiny, Options->Directory, Benchmark->Name);
+                Result = Run(Command);
+                if(Result)
+                {
+                    snprintf(Command, sizeof(Command),
+                             "%s -O2 -static -nostdlib -fno-builtin -fno-stack-protector -o %s test1.c",
+                             Options->Compiler, Executable);
+                    Result = Run(Command);
+                }
+            } break;
+            
+            case Backend_MASM:
+            {
+                snprintf(Executable, MaxExecutable, "masm_%s.exe", Benchmark->Name);
+                snprintf(Command, sizeof(Command), "\"%s\" \"%s/%s.tiny\"",
+                         Options->Tiny, Options->Directory, Benchmark->Name);
+                Result = Run(Command);
+                if(Result)
+                {
+                    Result = (Run("ml /nologo /c /coff /Cp test1.asm") &&
+                              Run("link /nologo /SUBSYSTEM:CONSOLE /LIBPATH:c:\\masm32\\lib test1.obj"));
+                }
+                if(Result)
+                {
+                    remove(Executable);
+                    Result = (rename("test1.exe", Executable) == 0);
+                }
+            } break;
+            
+            default: break;
+        }
+    }
+    
+    return Result;
+}
+
+static int
+CompareDoubles(const void *A, const void *B)
+{
+    double First = *(double *)A;
+    double Second = *(double *)B;
+    
+    int Result = (First < Second) ? -1 : ((First > Second) ? 1 : 0);
+    return Result;
+}
+
+// NOTE: Returns the median wall time in seconds, or a negative value if a run
+// failed or its output differs from Expected (when given)
+static double
+Measure(bench_options *Options, char *Executable, char *Expected, char *Output)
+{
+    // NOTE: Built executables are in the current directory, tiny --run is quoted
+    char *Prefix = "";
+    if(Executable[0] != '"')
+    {
+#if defined(_WIN32)
+        Prefix = ".\\";
+#else
+        Prefix = "./";
+#endif
+    }
+    
+    char Command[4096];
+    snprintf(Command, sizeof(Command), "%s%s < input.txt > output.txt", Prefix, Executable);
+    
+    double *Times = (double *)malloc(Options->Repetitions*sizeof(double));
+    double Result = -1.0;
+    
+    bool Ok = true;
+    for(int Repetition = 0;
+        Ok && (Repetition < Options->Repetitions);
+        Repetition++)
+    {
+        double Start = WallSeconds();
+        Ok = Run(Command);
+        Times[Repetition] = WallSeconds() - Start;
+        
+        if(Ok && (Repetition == 0))
+        {
+            Ok = ReadFile("output.txt", Output, MaxOutput);
+            if(Ok && Expected && strcmp(Output, Expected))
+            {
+                fprintf(stderr, "%s: output differs from the reference\n", Executable);
+                Ok = false;
+            }
+        }
+    }
+    
+    if(Ok)
+    {
+        qsort(Times, Options->Repetitions, sizeof(double), CompareDoubles);
+        Result = Times[Options->Repetitions/2];
+    }
+    
+    free(Times);
+    return Result;
+}
+
+#if !defined(_WIN32)
+// NOTE: Mean and median microseconds from spawning Executable to reaping it,
+// with input.txt as its stdin and /dev/null as its stdout. Returns false if
+// a run failed.
+static bool
+MeasureStartup(char *Executable, int Count, double *Mean, double *Median)
+{
+    posix_spawn_file_actions_t Actions;
+    posix_spawn_file_actions_init(&Actions);
+    posix_spawn_file_actions_addopen(&Actions, 0, "input.txt", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&Actions, 1, "/dev/null", O_WRONLY, 0);
+    
+    char Path[MaxExecutable + 2];
+    snprintf(Path, sizeof(Path), "./%s", Executable);
+    char *Arguments[] = {Path, 0};
+    char *Environment[] = {0};
+    
+    double *Times = (double *)malloc(Count*sizeof(double));
+    double Sum = 0.0;
+    bool Result = true;
+    for(int Run = 0;
+        Result && (Run < Count);
+        Run++)
+    {
+        double Start = WallSeconds();
+        pid_t Child;
+        int Status = 0;
+        Result = ((posix_spawn(&Child, Path, &Actions, 0, Arguments, Environment) == 0) &&
+                  (waitpid(Child, &Status, 0) == Child) &&
+                  WIFEXITED(Status) && (WEXITSTATUS(Status) == 0));
+        Times[Run] = (WallSeconds() - Start)*1000000.0;
+        Sum += Times[Run];
+    }
+    
+    if(Result)
+    {
+        qsort(Times, Count, sizeof(double), CompareDoubles);
+        *Mean = Sum/Count;
+        *Median = Times[Count/2];
+    }
+    
+    free(Times);
+    posix_spawn_file_actions_destroy(&Actions);
+    return Result;
+}
+
+static int
+StartupBenchmark(bench_options *Options, int Count)
+{
+    struct startup_build
+    {
+        char *Name;
+        char *Executable;
+        char *Tiny;
+        char *Flags;
+    };
+    startup_build Builds[] =
+    {
+        {"libc, dynamic", "startup_dynamic", "--emit-c", ""},
+        {"libc, static", "startup_static", "--emit-c", "-static"},
+        {"freestanding", "startup_free", "--freestanding", "-static -nostdlib -fno-builtin -fno-stack-protector"},
+    };
+    
+    FILE *Input = fopen("input.txt", "w");
+    fprintf(Input, "42\n");
+    fclose(Input);
+    
+    printf("%-16s %10s %10s %8s\n", "build", "mean (us)", "median", "size");
+    
+    int Failures = 0;
+    for(int BuildIndex = 0;
+        BuildIndex < (int)(sizeof(Builds)/sizeof(Builds[0]));
+        BuildIndex++)
+    {
+        startup_build *Build = Builds + BuildIndex;
+        
+        char Command[4096];
+        snprintf(Command, sizeof(Command), "\"%s\" %s \"%s/startup.tiny\"",
+                 Options->Tiny, Build->Tiny, Options->Directory);
+        bool Ok = Run(Command);
+        if(Ok)
+        {
+            snprintf(Command, sizeof(Command), "%s -O2 %s -o %s test1.c",
+                     Options->Compiler, Build->Flags, Build->Executable);
+            Ok = Run(Command);
+        }
+        
+        double Mean = 0.0;
+        double Median = 0.0;
+        if(Ok)
+        {
+            // NOTE: Warm up the page cache and the dynamic loader's files first
+            MeasureStartup(Build->Executable, 10, &Mean, &Median);
+            Ok = MeasureStartup(Build->Executable, Count, &Mean, &Median);
+        }
+        
+        if(Ok)
+        {
+            struct stat Status = {};
+            stat(Build->Executable, &Status);
+            printf("%-16s %10.1f %10.1f %7lldK\n", Build->Name, Mean, Median,
+                   (long long)(Status.st_size + 1023)/1024);
+        }
+        else
+        {
+            printf("%-16s %10s\n", Build->Name, "failed");
+            Failures++;
+        }
+    }
+    
+    return (Failures == 0) ? 0 : 1;
+}
+#endif
+
+// NOTE: Time stamp counter ticks per second, 0 where there is no such counter
+static double
+TimeStampFrequency()
+{
+    double Result = 0.0;
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    double Start = WallSeconds();
+    unsigned long long StartTicks = __rdtsc();
+    while(WallSeconds() - Start < 0.1)
+    {
+    }
+    Result = (double)(__rdtsc() - StartTicks)/(WallSeconds() - Start);
+#endif
+    
+    return Result;
+}
+
+static int
+VectorBenchmark(bench_options *Options, int Rounds)
+{
+    // NOTE: vector.tiny goes through two loops of 4096 elements per round
+    char *Settings[] = {"off", "sse2", "avx2"};
+    double ElementsPerRound = 2.0*4096.0;
+    double TicksPerSecond = TimeStampFrequency();
+    
+    printf("%-10s %10s %10s %10s %16s\n", "vectorize", "n (ms)", "2n (ms)", "ns/element", "elements/cycle");
+    
+    char Expected[2][MaxOutput];
+    char Output[MaxOutput];
+    int Failures = 0;
+    for(int SettingIndex = 0;
+        SettingIndex < (int)(sizeof(Settings)/sizeof(Settings[0]));
+        SettingIndex++)
+    {
+        char Executable[MaxExecutable];
+        snprintf(Executable, MaxExecutable, "\"%s\" --run --vectorize %s \"%s/vector.tiny\"",
+                 Options->Tiny, Settings[SettingIndex], Options->Directory);
+        
+        double Times[2];
+        bool Ok = true;
+        for(int Size = 0;
+            Ok && (Size < 2);
+            Size++)
+        {
+            FILE *Input = fopen("input.txt", "w");
+            fprintf(Input, "%d\n", Rounds*(Size + 1));
+            fclose(Input);
+            
+            // NOTE: The scalar loops' output is the reference for the others
+            Times[Size] = Measure(Options, Executable, SettingIndex ? Expected[Size] : 0,
+                                  SettingIndex ? Output : Expected[Size]);
+            Ok = (Times[Size] > 0);
+        }
+        
+        if(Ok && (Times[1] > Times[0]))
+        {
+            double Seconds = (Times[1] - Times[0])/(Rounds*ElementsPerRound);
+            printf("%-10s %10.1f %10.1f %10.3f", Settings[SettingIndex], Times[0]*1000.0, Times[1]*1000.0,
+                   Seconds*1e9);
+            if(TicksPerSecond > 0)
+            {
+                printf(" %16.2f\n", 1.0/(Seconds*TicksPerSecond));
+            }
+            else
+            {
+                printf(" %16s\n", "-");
+            }
+        }
+        else
+        {
+            printf("%-10s %10s\n", Settings[SettingIndex], "failed");
+            Failures++;
+        }
+    }
+    
+    return (Failures == 0) ? 0 : 1;
+}
+
+static void
+Usage()
+{
+    fprintf(stderr, "Usage: bench [--tiny <path>] [--cc <compiler>] [--reps <n>] [--backend <jit|c|free|masm>]\n"
+            "             [--dir <benchmark dir>] [--work <scratch dir>] [--csv <file>] [<benchmark>...]\n"
+            "       bench --startup <n> [--tiny <path>] [--cc <compiler>] [--dir <benchmark dir>]\n"
+            "             [--work <scratch dir>]\n"
+            "       bench --vector <n> [--tiny <path>] [--reps <n>] [--dir <benchmark dir>]\n"
+            "             [--work <scratch dir>]\n");
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    bench_options Options = {};
+    Options.Compiler = "gcc";
+    Options.Repetitions = 5;
+    
+    char *Tiny = "./tiny";
+    char *Directory = "benchmarks";
+    char *WorkDirectory = "bench_work";
+    char *CsvFileName = 0;
+    int StartupRuns = 0;
+    int VectorRounds = 0;
+    bool AnyBackend = false;
+    
+    int NumSelected = 0;
+    char **Selected = (char **)malloc(ArgCount*sizeof(char *));
+    
+    for(int ArgIndex = 1;
+        ArgIndex < ArgCount;
+        ArgIndex++)
+    {
+        char *Arg = Args[ArgIndex];
+        bool HasValue = (ArgIndex + 1 < ArgCount);
+        if(!strcmp(Arg, "--tiny") && HasValue)
+        {
+            Tiny = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--cc") && HasValue)
+        {
+            Options.Compiler = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--reps") && HasValue)
+        {
+            Options.Repetitions = atoi(Args[++ArgIndex]);
+        }
+        else if(!strcmp(Arg, "--dir") && HasValue)
+        {
+            Directory = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--work") && HasValue)
+        {
+            WorkDirectory = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--csv") && HasValue)
+        {
+            CsvFileName = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--startup") && HasValue)
+        {
+            StartupRuns = atoi(Args[++ArgIndex]);
+        }
+        else if(!strcmp(Arg, "--vector") && HasValue)
+        {
+            VectorRounds = atoi(Args[++ArgIndex]);
+        }
+        else if(!strcmp(Arg, "--backend") && HasValue)
+        {
+            char *Name = Args[++ArgIndex];
+            bool Found = false;
+            for(int Backend = 0;
+                Backend < Backend_Count;
+                Backend++)
+            {
+                if(!strcmp(Name, BackendNames[Backend]))
+                {
+                    Options.Backends[Backend] = true;
+                    Found = true;
+                }
+            }
+            if(!Found)
+            {
+                fprintf(stderr, "Unknown backend '%s'\n", Name);
+                return 1;
+            }
+            AnyBackend = true;
+        }
+        else if(Arg[0] == '-')
+        {
+            Usage();
+            return 1;
+        }
+        else
+        {
+            Selected[NumSelected++] = Arg;
+        }
+    }
+    
+    if(Options.Repetitions < 1)
+    {
+        Options.Repetitions = 1;
+    }
+    if(!AnyBackend)
+    {
+        Options.Backends[Backend_JIT] = true;
+        Options.Backends[Backend_C] = true;
+#if defined(_WIN32)
+        Options.Backends[Backend_MASM] = true;
+#elif defined(__linux__)
+        Options.Backends[Backend_Freestanding] = true;
+#endif
+    }
+    
+    AbsolutePath(Options.Tiny, sizeof(Options.Tiny), Tiny);
+    AbsolutePath(Options.Directory, sizeof(Options.Directory), Directory);
+    if(CsvFileName)
+    {
+        Options.Csv = fopen(CsvFileName, "a");
+        if(Options.Csv && (ftell(Options.Csv) == 0))
+        {
+            fprintf(Options.Csv, "date,benchmark,backend,reference_ms,ms,ratio\n");
+        }
+    }
+
+#if defined(_WIN32)
+    _mkdir(WorkDirectory);
+#else
+    mkdir(WorkDirectory, 0777);
+#endif
+    if(chdir(WorkDirectory) != 0)
+    {
+        fprintf(stderr, "Could not enter '%s'\n", WorkDirectory);
+        return 1;
+    }
+    
+    if(StartupRuns > 0)
+    {
+#if defined(_WIN32)
+        fprintf(stderr, "--startup needs posix_spawn\n");
+        return 1;
+#else
+        return StartupBenchmark(&Options, StartupRuns);
+#endif
+    }
+    if(VectorRounds > 0)
+    {
+        return VectorBenchmark(&Options, VectorRounds);
+    }
+    
+    char Date[32];
+    time_t Now = time(0);
+    strftime(Date, sizeof(Date), "%Y-%m-%dT%H:%M:%S", localtime(&Now));
+    
+    printf("%-10s %10s", "benchmark", "ref (ms)");
+    for(int Backend = 0;
+        Backend < Backend_Count;
+        Backend++)
+    {
+        if(Options.Backends[Backend])
+        {
+            printf(" %10s %7s", BackendNames[Backend], "ratio");
+        }
+    }
+    printf("\n");
+    
+    double LogRatioSum[Backend_Count] = {};
+    int NumRatios[Backend_Count] = {};
+    int Failures = 0;
+    
+    int NumBenchmarks = sizeof(Benchmarks)/sizeof(Benchmarks[0]);
+    for(int BenchmarkIndex = 0;
+        BenchmarkIndex < NumBenchmarks;
+        BenchmarkIndex++)
+    {
+        benchmark *Benchmark = Benchmarks + BenchmarkIndex;
+        
+        bool Wanted = (NumSelected == 0);
+        for(int SelectedIndex = 0;
+            SelectedIndex < NumSelected;
+            SelectedIndex++)
+        {
+            Wanted = Wanted || !strcmp(Selected[SelectedIndex], Benchmark->Name);
+        }
+        if(!Wanted)
+        {
+            continue;
+        }
+        
+        FILE *Input = fopen("input.txt", "w");
+        fprintf(Input, "%s\n", Benchmark->Input);
+        fclose(Input);
+        
+        char Executable[MaxExecutable];
+        char Expected[MaxOutput];
+        char Output[MaxOutput];
+        
+        double Reference = -1.0;
+        if(Build(&Options, Benchmark, Backend_Count, true, Executable))
+        {
+            Reference = Measure(&Options, Executable, 0, Expected);
+        }
+        if(Reference <= 0)
+        {
+            printf("%-10s %10s\n", Benchmark->Name, "failed");
+            Failures++;
+            continue;
+        }
+        
+        printf("%-10s %10.1f", Benchmark->Name, Reference*1000.0);
+        fflush(stdout);
+        for(int Backend = 0;
+            Backend < Backend_Count;
+            Backend++)
+        {
+            if(Options.Backends[Backend])
+            {
+                double Time = -1.0;
+                if(Build(&Options, Benchmark, (backend)Backend, false, Executable))
+                {
+                    Time = Measure(&Options, Executable, Expected, Output);
+                }
+                
+                if(Time > 0)
+                {
+                    double Ratio = Time/Reference;
+                    LogRatioSum[Backend] += log(Ratio);
+                    NumRatios[Backend]++;
+                    printf(" %10.1f %6.2fx", Time*1000.0, Ratio);
+                    if(Options.Csv)
+                    {
+                        fprintf(Options.Csv, "%s,%s,%s,%.3f,%.3f,%.4f\n", Date, Benchmark->Name,
+                                BackendNames[Backend], Reference*1000.0, Time*1000.0, Ratio);
+                    }
+                }
+                else
+                {
+                    printf(" %10s %7s", "failed", "");
+                    Failures++;
+                }
+                fflush(stdout);
+            }
+        }
+        printf("\n");
+    }
+    
+    printf("%-10s %10s", "geomean", "");
+    for(int Backend = 0;
+        Backend < Backend_Count;
+        Backend++)
+    {
+        if(Options.Backends[Backend])
+        {
+            if(NumRatios[Backend])
+            {
+                printf(" %10s %6.2fx", "", exp(LogRatioSum[Backend]/NumRatios[Backend]));
+            }
+            else
+            {
+                printf(" %10s %7s", "", "-");
+            }
+        }
+    }
+    printf("\n");
+    
+    if(Options.Csv)
+    {
+        fclose(Options.Csv);
+    }
+    free(Selected);
+    
+    return (Failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+/* Counts the values below n that satisfy mixes of comparisons */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int hits = 0;
+    int misses = 0;
+    for(int i = 0; i < n; i++)
+    {
+        int x = i % 7;
+        int y = i % 11;
+        int flag = (((x > 2) & (y < 8)) | (!(x == y) & (x + y > 9))) ^ (x == 0);
+        if(flag)
+        {
+            hits++;
+        }
+        if((!(x < y) & (y != 3)) | ((x == 6) & !(y > 5)))
+        {
+            misses++;
+        }
+    }
+    
+    printf("%d\n%d\n", hits, misses);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/* Sorts n pseudo-random values into buckets through nested IFs */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int seed = 1;
+    int a = 0, b = 0, c = 0, d = 0;
+    for(int i = 0; i < n; i++)
+    {
+        seed = (seed * 75 + 74) % 65537;
+        int r = seed % 100;
+        if(r < 50)
+        {
+            if(r < 25)
+            {
+                if(r < 10)
+                {
+                    a++;
+                }
+                else
+                {
+                    b++;
+                }
+            }
+            else
+            {
+                c += r;
+            }
+        }
+        else
+        {
+            if(r > 90)
+            {
+                d++;
+            }
+            else if(r == 75)
+            {
+                a--;
+            }
+            else
+            {
+                b += 2;
+            }
+        }
+    }
+    
+    printf("%d\n%d\n%d\n%d\n", a, b, c, d);
+    return 0;
+}
@@ -0,0 +1,36 @@
+/* Recursive fib(n), then n * 1000000 calls of a small leaf function */
+#include <stdio.h>
+
+static int
+fib(int k)
+{
+    if(k < 2)
+    {
+        return k;
+    }
+    return fib(k - 1) + fib(k - 2);
+}
+
+static int
+mix(int a, int b)
+{
+    return (a*31 + b) & 1048575;
+}
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    printf("%d\n", fib(n));
+    
+    int s = 0;
+    for(int i = 0; i < n*1000000; i++)
+    {
+        s = mix(s, i);
+    }
+    
+    printf("%d\n", s);
+    return 0;
+}
@@ -0,0 +1,30 @@
+/* Total number of Collatz steps for every start value below n */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int steps = 0;
+    for(int i = 1; i < n; i++)
+    {
+        int x = i;
+        while(x != 1)
+        {
+            if(x % 2 == 0)
+            {
+                x = x / 2;
+            }
+            else
+            {
+                x = 3 * x + 1;
+            }
+            steps++;
+        }
+    }
+    
+    printf("%d\n", steps);
+    return 0;
+}
@@ -0,0 +1,24 @@
+/* Sum of j - i over 1 <= i <= j <= 1000 with counted loops, n times */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    unsigned s = 0;
+    for(int round = 1; round <= n; round++)
+    {
+        for(int i = 1; i <= 1000; i++)
+        {
+            for(int j = i; j <= 1000; j++)
+            {
+                s = s + j - i;
+            }
+        }
+    }
+    
+    printf("%d\n", (int)s);
+    return 0;
+}
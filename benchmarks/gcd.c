@@ -0,0 +1,29 @@
+/* Sum of gcd(i, j) over 1 <= i, j <= n by Euclid's algorithm */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int sum = 0;
+    for(int i = 1; i <= n; i++)
+    {
+        for(int j = 1; j <= n; j++)
+        {
+            int a = i;
+            int b = j;
+            while(b != 0)
+            {
+                int t = a % b;
+                a = b;
+                b = t;
+            }
+            sum += a;
+        }
+    }
+    
+    printf("%d\n", sum);
+    return 0;
+}
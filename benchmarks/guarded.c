@@ -0,0 +1,33 @@
+/* Counts the values below n with seven digits among the rare ones a cheap test lets through */
+#include <stdio.h>
+
+static int
+digits(int v)
+{
+    int d = 0;
+    while(v > 0)
+    {
+        v = v / 10;
+        d++;
+    }
+    return d;
+}
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int hits = 0;
+    for(int i = 0; i < n; i++)
+    {
+        if((i % 13 == 0) && (digits(i) == 7))
+        {
+            hits++;
+        }
+    }
+    
+    printf("%d\n", hits);
+    return 0;
+}
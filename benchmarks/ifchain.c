@@ -0,0 +1,83 @@
+/* The state machine of switch.c dispatched with an if chain, n steps */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    unsigned s = 0;
+    int state = 0;
+    for(int i = 1; i <= n; i++)
+    {
+        if(state == 0)
+        {
+            s = s + 3;
+        }
+        else if(state == 1)
+        {
+            s = s - (unsigned)i;
+        }
+        else if(state == 2)
+        {
+            s = s * 3;
+        }
+        else if(state == 3)
+        {
+            s = s + (unsigned)i;
+        }
+        else if(state == 4)
+        {
+            s = s - 7;
+        }
+        else if(state == 5)
+        {
+            s = s + s;
+        }
+        else if(state == 6)
+        {
+            s = s + 12345;
+        }
+        else if(state == 7)
+        {
+            s = s - ((unsigned)i + (unsigned)i);
+        }
+        else if(state == 8)
+        {
+            s = s + 1;
+        }
+        else if(state == 9)
+        {
+            s = s * 5;
+        }
+        else if(state == 10)
+        {
+            s = s - 99;
+        }
+        else if(state == 11)
+        {
+            s = s + (unsigned)i * 2;
+        }
+        else if(state == 12)
+        {
+            s = s - 1;
+        }
+        else if(state == 13)
+        {
+            s = s + 77;
+        }
+        else if(state == 14)
+        {
+            s = s * 7;
+        }
+        else
+        {
+            s = s - (unsigned)i * 3;
+        }
+        state = (int)((s + i) & 15);
+    }
+    
+    printf("%d\n", (int)s);
+    return 0;
+}
@@ -0,0 +1,29 @@
+/* Number of primes below n by trial division */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int count = 0;
+    for(int i = 2; i < n; i++)
+    {
+        int prime = 1;
+        for(int d = 2; (d * d <= i) && prime; d++)
+        {
+            if(i % d == 0)
+            {
+                prime = 0;
+            }
+        }
+        if(prime)
+        {
+            count++;
+        }
+    }
+    
+    printf("%d\n", count);
+    return 0;
+}
@@ -0,0 +1,38 @@
+/* Number of primes below 1000000 by the sieve of Eratosthenes, n times */
+#include <stdio.h>
+
+static int composite[1000000];
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    int count = 0;
+    for(int round = 0; round < n; round++)
+    {
+        for(int i = 0; i < 1000000; i++)
+        {
+            composite[i] = 0;
+        }
+        count = 0;
+        for(int i = 2; i < 1000000; i++)
+        {
+            if(!composite[i])
+            {
+                count++;
+                if(i < 1000)
+                {
+                    for(int j = i * i; j < 1000000; j += i)
+                    {
+                        composite[j] = 1;
+                    }
+                }
+            }
+        }
+    }
+    
+    printf("%d\n", count);
+    return 0;
+}
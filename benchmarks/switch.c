@@ -0,0 +1,38 @@
+/* A state machine over 16 states dispatched with a switch, n steps */
+#include <stdio.h>
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    unsigned s = 0;
+    int state = 0;
+    for(int i = 1; i <= n; i++)
+    {
+        switch(state)
+        {
+            case 0: s = s + 3; break;
+            case 1: s = s - (unsigned)i; break;
+            case 2: s = s * 3; break;
+            case 3: s = s + (unsigned)i; break;
+            case 4: s = s - 7; break;
+            case 5: s = s + s; break;
+            case 6: s = s + 12345; break;
+            case 7: s = s - ((unsigned)i + (unsigned)i); break;
+            case 8: s = s + 1; break;
+            case 9: s = s * 5; break;
+            case 10: s = s - 99; break;
+            case 11: s = s + (unsigned)i * 2; break;
+            case 12: s = s - 1; break;
+            case 13: s = s + 77; break;
+            case 14: s = s * 7; break;
+            case 15: s = s - (unsigned)i * 3; break;
+        }
+        state = (int)((s + i) & 15);
+    }
+    
+    printf("%d\n", (int)s);
+    return 0;
+}
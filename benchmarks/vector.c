@@ -0,0 +1,36 @@
+/* A map and a sum over 4096 element arrays, n times */
+#include <stdio.h>
+
+static int a[4096];
+static int b[4096];
+static int c[4096];
+
+int
+main(void)
+{
+    int n = 0;
+    scanf("%d", &n);
+    
+    for(int i = 0; i < 4096; i++)
+    {
+        a[i] = i;
+        b[i] = 4096 - i;
+    }
+    
+    int s = 0;
+    for(int round = 0; round < n; round++)
+    {
+        for(int i = 0; i < 4096; i++)
+        {
+            c[i] = a[i] * 3 + b[i] - round;
+        }
+        s = 0;
+        for(int i = 0; i < 4096; i++)
+        {
+            s += c[i];
+        }
+    }
+    
+    printf("%d\n", s);
+    return 0;
+}
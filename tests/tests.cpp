@@ -0,0 +1,593 @@
+// NOTE: Regression tests for the compiler and its runtimes.
+//
+// Every test is a TINY program <name>.tiny with the input it reads, the
+// output it has to write and the exit status it has to end with. Each
+// backend builds and runs it, and all of them have to agree:
+//     jit   tiny --run (bytecode interpreter, hot loops JIT compiled)
+//     c     tiny --emit-c, then <cc> -O2 -Wall -Werror
+//     free  tiny --freestanding, then <cc> -O2 -Wall -Werror -static -nostdlib (Linux)
+//
+// Usage (from the repository root, after building tiny):
+//     g++ -O2 -o tests tests/tests.cpp
+//     ./tests [--tiny <path>] [--cc <compiler>] [--dir <test dir>] [--work <scratch dir>] [<test>...]
+// Exits with status 1 if any test failed.
+//
+// Compile error tests are TINY programs that must not compile: every front
+// end (--run and --emit-c) has to print the expected error and nothing else.
+//
+// The batch test compiles two inputs with the same name from different
+// directories into one --out-dir: both have to fail, neither output written.
+//
+// The cache test compiles through --cache-dir twice with a profile that
+// doesn't match the program: the second, a cache hit, has to warn too.
+//
+// The server test (not on Windows) starts tiny --server and checks that a
+// request that fails to compile leaves it able to serve the next one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+struct program_test
+{
+    char *Name;
+    
+    // NOTE: Extra options for tiny, on every backend
+    char *Flags;
+    char *Input;
+    char *Expected;
+    int Status;
+};
+
+static program_test ProgramTests[] =
+{
+    {"divide", "", "5000", "-2147483648\n-2147483648\n15000\n-9223372036854775808\n-3074457345618258602\n", 0},
+    {"read_range", "",
+     "2147483647 2147483648 -2147483649 99999999999999999999999\n"
+     "9223372036854775808 -9223372036854775809 -99999999999999999999999\n"
+     "3000000000 -3000000000 18446744073709551617\n",
+     "2147483647\n2147483647\n-2147483648\n2147483647\n"
+     "9223372036854775807\n-9223372036854775808\n-9223372036854775808\n"
+     "2147483647\n-2147483648\n9223372036854775807\n", 0},
+    {"bounds", "--check-bounds", "200000", "1225050\nError: Index out of bounds.\n", 1},
+    {"while_call", "--check-bounds", "200000", "11000110\nError: Index out of bounds.\n", 1},
+    {"for_max", "", "200000", "200001\n-2147483648\n4\n-2147483648\n200003\n-2147483648\n", 0},
+    {"for_call", "--check-bounds", "200000", "11000110\nError: Index out of bounds.\n", 1},
+};
+
+struct compile_error_test
+{
+    char *Name;
+    char *Flags;
+    char *Expected;
+};
+
+static compile_error_test CompileErrorTests[] =
+{
+    {"long_name", "", "Error: Names are at most 31 characters long.\n"},
+    {"long_number", "", "Error: Number too large.\n"},
+};
+
+enum backend
+{
+    Backend_JIT,
+    Backend_C,
+    Backend_Freestanding,
+    
+    Backend_Count
+};
+
+static char *BackendNames[] = {"jit", "c", "free"};
+
+struct test_options
+{
+    char Tiny[1024];
+    char Directory[1024];
+    char *Compiler;
+};
+
+#define MaxOutput 4096
+
+static void
+AbsolutePath(char *Result, size_t ResultSize, char *Path)
+{
+#if defined(_WIN32)
+    if(!_fullpath(Result, Path, ResultSize))
+#else
+    char Resolved[4096];
+    if(realpath(Path, Resolved))
+    {
+        snprintf(Result, ResultSize, "%s", Resolved);
+    }
+    else
+#endif
+    {
+        snprintf(Result, ResultSize, "%s", Path);
+    }
+}
+
+// NOTE: Returns the command's exit status, 128 + the signal if one killed it
+static int
+Run(char *Command)
+{
+    int Result = system(Command);
+#if !defined(_WIN32)
+    if(Result != -1)
+    {
+        Result = WIFEXITED(Result) ? WEXITSTATUS(Result) : 128 + WTERMSIG(Result);
+    }
+#endif
+    
+    return Result;
+}
+
+static bool
+ReadFile(char *Path, char *Result, size_t ResultSize)
+{
+    bool Success = false;
+    
+    FILE *File = fopen(Path, "rb");
+    if(File)
+    {
+        size_t Size = fread(Result, 1, ResultSize - 1, File);
+        Result[Size] = 0;
+        fclose(File);
+        Success = true;
+    }
+    
+    return Success;
+}
+
+static void
+WriteFile(char *Path, char *Text)
+{
+    FILE *File = fopen(Path, "wb");
+    if(File)
+    {
+        fputs(Text, File);
+        fclose(File);
+    }
+}
+
+static void
+MakeDirectory(char *Path)
+{
+#if defined(_WIN32)
+    _mkdir(Path);
+#else
+    mkdir(Path, 0777);
+#endif
+}
+
+static int
+CountOccurrences(char *Text, char *Pattern)
+{
+    int Result = 0;
+    for(char *At = strstr(Text, Pattern);
+        At;
+        At = strstr(At + 1, Pattern))
+    {
+        Result++;
+    }
+    
+    return Result;
+}
+
+// NOTE: Builds the test in the current (scratch) directory and runs it on
+// input.txt. Returns false, after saying why, if the build fails or the
+// output or exit status isn't the expected one.
+static bool
+RunProgramTest(test_options *Options, program_test *Test, backend Backend)
+{
+    char Command[4096];
+    char Program[4096];
+    bool Result = true;
+    
+    switch(Backend)
+    {
+        case Backend_JIT:
+        {
+            snprintf(Program, sizeof(Program), "\"%s\" --run %s \"%s/%s.tiny\"",
+                     Options->Tiny, Test->Flags, Options->Directory, Test->Name);
+        } break;
+        
+        case Backend_C:
+        case Backend_Freestanding:
+        {
+            bool Freestanding = (Backend == Backend_Freestanding);
+            snprintf(Command, sizeof(Command), "\"%s\" %s %s \"%s/%s.tiny\" > build.txt",
+                     Options->Tiny, Freestanding ? "--freestanding" : "--emit-c", Test->Flags,
+                     Options->Directory, Test->Name);
+            Result = (Run(Command) == 0);
+            if(Result)
+            {
+                snprintf(Command, sizeof(Command), "%s -O2 -Wall -Werror %s -o test_%s test1.c", Options->Compiler,
+                         Freestanding ? "-static -nostdlib -fno-builtin -fno-stack-protector" : "",
+                         Test->Name);
+                Result = (Run(Command) == 0);
+            }
+            if(!Result)
+            {
+                printf("    %s: build failed\n", BackendNames[Backend]);
+            }
+#if defined(_WIN32)
+            snprintf(Program, sizeof(Program), ".\\test_%s", Test->Name);
+#else
+            snprintf(Program, sizeof(Program), "./test_%s", Test->Name);
+#endif
+        } break;
+        
+        default: break;
+    }
+    
+    if(Result)
+    {
+        WriteFile("input.txt", Test->Input);
+        snprintf(Command, sizeof(Command), "%s < input.txt > output.txt", Program);
+        int Status = Run(Command);
+        
+        char Output[MaxOutput] = {};
+        ReadFile("output.txt", Output, MaxOutput);
+        if(Status != Test->Status)
+        {
+            printf("    %s: exit status %d, expected %d\n", BackendNames[Backend], Status, Test->Status);
+            Result = false;
+        }
+        if(strcmp(Output, Test->Expected))
+        {
+            printf("    %s: output\n%s    expected\n%s", BackendNames[Backend], Output, Test->Expected);
+            Result = false;
+        }
+    }
+    
+    return Result;
+}
+
+static bool
+RunCompileErrorTest(test_options *Options, compile_error_test *Test)
+{
+    char *FrontEnds[] = {"--run", "--emit-c"};
+    bool Result = true;
+    
+    for(int FrontEndIndex = 0;
+        FrontEndIndex < (int)(sizeof(FrontEnds)/sizeof(FrontEnds[0]));
+        FrontEndIndex++)
+    {
+        char Command[4096];
+        snprintf(Command, sizeof(Command), "\"%s\" %s %s \"%s/%s.tiny\" < input.txt > output.txt",
+                 Options->Tiny, FrontEnds[FrontEndIndex], Test->Flags, Options->Directory, Test->Name);
+        WriteFile("input.txt", "");
+        int Status = Run(Command);
+        
+        char Output[MaxOutput] = {};
+        ReadFile("output.txt", Output, MaxOutput);
+        if(Status != 0)
+        {
+            printf("    %s: exit status %d\n", FrontEnds[FrontEndIndex], Status);
+            Result = false;
+        }
+        if(strcmp(Output, Test->Expected))
+        {
+            printf("    %s: output\n%s    expected\n%s", FrontEnds[FrontEndIndex], Output, Test->Expected);
+            Result = false;
+        }
+    }
+    
+    return Result;
+}
+
+static bool
+RunBatchTest(test_options *Options)
+{
+    char *Source = "program;\nvar n = 1;\nbegin\nwrite n\nend.\n";
+    MakeDirectory("batch");
+    MakeDirectory("batch/a");
+    MakeDirectory("batch/b");
+    MakeDirectory("batch/out");
+    WriteFile("batch/a/p.tiny", Source);
+    WriteFile("batch/b/p.tiny", Source);
+    WriteFile("batch/a/q.tiny", Source);
+    remove("batch/out/p.c");
+    remove("batch/out/q.c");
+    
+    char Command[4096];
+    snprintf(Command, sizeof(Command), "\"%s\" --batch --emit-c --out-dir batch/out batch/a batch/b > output.txt",
+             Options->Tiny);
+    int Status = Run(Command);
+    
+    char Output[MaxOutput] = {};
+    ReadFile("output.txt", Output, MaxOutput);
+    
+    bool Result = true;
+    if((Status == 0) || !strstr(Output, "Compiled 1 files (0 failed)") || !strstr(Output, "Skipped 2 files") ||
+       (CountOccurrences(Output, "Error: Another input also writes") != 2))
+    {
+        printf("    batch: exit status %d, output\n%s", Status, Output);
+        Result = false;
+    }
+    
+    char Written[MaxOutput];
+    if(ReadFile("batch/out/p.c", Written, MaxOutput))
+    {
+        printf("    batch: wrote batch/out/p.c for one of the clashing inputs\n");
+        Result = false;
+    }
+    if(!ReadFile("batch/out/q.c", Written, MaxOutput))
+    {
+        printf("    batch: did not write batch/out/q.c\n");
+        Result = false;
+    }
+    
+    return Result;
+}
+
+static bool
+RunCacheTest(test_options *Options)
+{
+    WriteFile("profiled.tiny", "program;\nvar n = 1;\nbegin\nwrite n\nend.\n");
+    WriteFile("changed.tiny", "program;\nvar n = 1;\nbegin\nwhile n < 3\n    n = n + 1\nendwhile;\nwrite n\nend.\n");
+    remove("test1.profile");
+    
+    char Command[4096];
+    snprintf(Command, sizeof(Command), "\"%s\" --run --instrument profiled.tiny > output.txt", Options->Tiny);
+    Run(Command);
+    
+    bool Result = true;
+    for(int Pass = 0;
+        Pass < 2;
+        Pass++)
+    {
+        snprintf(Command, sizeof(Command),
+                 "\"%s\" --emit-c --cache-dir cache --profile-use test1.profile changed.tiny > output.txt",
+                 Options->Tiny);
+        int Status = Run(Command);
+        
+        char Output[MaxOutput] = {};
+        ReadFile("output.txt", Output, MaxOutput);
+        if((Status != 0) || !strstr(Output, "Warning: The profile does not match"))
+        {
+            printf("    compile %d: exit status %d, output\n%s", Pass + 1, Status, Output);
+            Result = false;
+        }
+    }
+    
+    return Result;
+}
+
+#if !defined(_WIN32)
+// NOTE: One worker, so the request after the failed one lands on the same
+// warm compiler context
+static bool
+RunServerTest(test_options *Options)
+{
+    char *Socket = "server.sock";
+    unlink(Socket);
+    
+    pid_t Server = fork();
+    if(Server == 0)
+    {
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, 1);
+        execl(Options->Tiny, Options->Tiny, "--server", Socket, "--jobs", "1", (char *)0);
+        _exit(127);
+    }
+    
+    struct stat Status;
+    for(int Try = 0;
+        (Try < 500) && (stat(Socket, &Status) != 0);
+        Try++)
+    {
+        usleep(10000);
+    }
+    
+    bool Result = true;
+    char Command[4096];
+    char Output[MaxOutput] = {};
+    
+    snprintf(Command, sizeof(Command), "\"%s\" --client %s \"%s/long_name.tiny\" > output.txt",
+             Options->Tiny, Socket, Options->Directory);
+    Run(Command);
+    ReadFile("output.txt", Output, MaxOutput);
+    if(strcmp(Output, "Error: Names are at most 31 characters long.\n"))
+    {
+        printf("    overlong name: output\n%s", Output);
+        Result = false;
+    }
+    
+    remove("test1.c");
+    snprintf(Command, sizeof(Command), "\"%s\" --client %s --emit-c \"%s/divide.tiny\" > output.txt",
+             Options->Tiny, Socket, Options->Directory);
+    int ClientStatus = Run(Command);
+    ReadFile("output.txt", Output, MaxOutput);
+    if((ClientStatus != 0) || Output[0] || (stat("test1.c", &Status) != 0))
+    {
+        printf("    next request: exit status %d, output\n%s", ClientStatus, Output);
+        Result = false;
+    }
+    
+    if(waitpid(Server, 0, WNOHANG) != 0)
+    {
+        printf("    the server exited\n");
+        Result = false;
+    }
+    
+    kill(Server, SIGTERM);
+    waitpid(Server, 0, 0);
+    unlink(Socket);
+    
+    return Result;
+}
+#endif
+
+static bool
+Wanted(char *Name, char **Selected, int NumSelected)
+{
+    bool Result = (NumSelected == 0);
+    for(int SelectedIndex = 0;
+        SelectedIndex < NumSelected;
+        SelectedIndex++)
+    {
+        Result = Result || !strcmp(Selected[SelectedIndex], Name);
+    }
+    
+    return Result;
+}
+
+static void
+Usage()
+{
+    fprintf(stderr, "Usage: tests [--tiny <path>] [--cc <compiler>] [--dir <test dir>] [--work <scratch dir>] [<test>...]\n");
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    test_options Options = {};
+    Options.Compiler = "gcc";
+    
+    char *Tiny = "./tiny";
+    char *Directory = "tests";
+    char *WorkDirectory = "test_work";
+    
+    int NumSelected = 0;
+    char **Selected = (char **)malloc(ArgCount*sizeof(char *));
+    
+    for(int ArgIndex = 1;
+        ArgIndex < ArgCount;
+        ArgIndex++)
+    {
+        char *Arg = Args[ArgIndex];
+        bool HasValue = (ArgIndex + 1 < ArgCount);
+        if(!strcmp(Arg, "--tiny") && HasValue)
+        {
+            Tiny = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--cc") && HasValue)
+        {
+            Options.Compiler = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--dir") && HasValue)
+        {
+            Directory = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--work") && HasValue)
+        {
+            WorkDirectory = Args[++ArgIndex];
+        }
+        else if(Arg[0] == '-')
+        {
+            Usage();
+            return 1;
+        }
+        else
+        {
+            Selected[NumSelected++] = Arg;
+        }
+    }
+    
+    bool Backends[Backend_Count] = {};
+    Backends[Backend_JIT] = true;
+    Backends[Backend_C] = true;
+#if defined(__linux__)
+    Backends[Backend_Freestanding] = true;
+#endif
+    
+    AbsolutePath(Options.Tiny, sizeof(Options.Tiny), Tiny);
+    AbsolutePath(Options.Directory, sizeof(Options.Directory), Directory);
+    
+    MakeDirectory(WorkDirectory);
+    if(chdir(WorkDirectory) != 0)
+    {
+        fprintf(stderr, "Could not enter '%s'\n", WorkDirectory);
+        return 1;
+    }
+    
+    int NumTests = 0;
+    int Failures = 0;
+    
+    int NumProgramTests = sizeof(ProgramTests)/sizeof(ProgramTests[0]);
+    for(int TestIndex = 0;
+        TestIndex < NumProgramTests;
+        TestIndex++)
+    {
+        program_test *Test = ProgramTests + TestIndex;
+        if(!Wanted(Test->Name, Selected, NumSelected))
+        {
+            continue;
+        }
+        
+        bool Passed = true;
+        for(int Backend = 0;
+            Backend < Backend_Count;
+            Backend++)
+        {
+            if(Backends[Backend] && !RunProgramTest(&Options, Test, (backend)Backend))
+            {
+                Passed = false;
+            }
+        }
+        
+        printf("%-16s %s\n", Test->Name, Passed ? "ok" : "FAILED");
+        NumTests++;
+        Failures += Passed ? 0 : 1;
+    }
+    
+    int NumCompileErrorTests = sizeof(CompileErrorTests)/sizeof(CompileErrorTests[0]);
+    for(int TestIndex = 0;
+        TestIndex < NumCompileErrorTests;
+        TestIndex++)
+    {
+        compile_error_test *Test = CompileErrorTests + TestIndex;
+        if(!Wanted(Test->Name, Selected, NumSelected))
+        {
+            continue;
+        }
+        
+        bool Passed = RunCompileErrorTest(&Options, Test);
+        printf("%-16s %s\n", Test->Name, Passed ? "ok" : "FAILED");
+        NumTests++;
+        Failures += Passed ? 0 : 1;
+    }
+    
+    if(Wanted("batch", Selected, NumSelected))
+    {
+        bool Passed = RunBatchTest(&Options);
+        printf("%-16s %s\n", "batch", Passed ? "ok" : "FAILED");
+        NumTests++;
+        Failures += Passed ? 0 : 1;
+    }
+    
+    if(Wanted("cache", Selected, NumSelected))
+    {
+        bool Passed = RunCacheTest(&Options);
+        printf("%-16s %s\n", "cache", Passed ? "ok" : "FAILED");
+        NumTests++;
+        Failures += Passed ? 0 : 1;
+    }
+
+#if !defined(_WIN32)
+    if(Wanted("server", Selected, NumSelected))
+    {
+        bool Passed = RunServerTest(&Options);
+        printf("%-16s %s\n", "server", Passed ? "ok" : "FAILED");
+        NumTests++;
+        Failures += Passed ? 0 : 1;
+    }
+#endif
+    
+    printf("%d tests, %d failed\n", NumTests, Failures);
+    free(Selected);
+    
+    return (Failures == 0) ? 0 : 1;
+}
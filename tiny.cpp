@@ -2,19 +2,26 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
 
 // TINY Language definition:
 
 // <program> ::= PROGRAM <top-level decls> <main> '.'
 // <main> ::= BEGIN <block> END
-// <top-level decls> ::= ( <data declaration> )*
-// <data declaration> ::= VAR <var-list>
+// <top-level decls> ::= ( <data declaration> | <routine> )*
+// <data declaration> ::= VAR [LONG] <var-list>
 // <var-list> ::= <var> ( <var> )*
-// <var> ::= <ident> [ = <integer> ]
+// <var> ::= <ident> [ = <integer> ] | <ident> '[' <integer> ']'
+// <routine> ::= ( PROCEDURE | FUNCTION [LONG] ) <ident> [ '(' [ <param> ( ',' <param> )* ] ')' ]
+//               ( <data declaration> )* BEGIN <block> END
+// <param> ::= [LONG] <ident>
 // <block> ::= (<statement>)*
-// <statement> ::= <if> | <while> | <assignment>
+// <statement> ::= <if> | <while> | <for> | <case> | <assignment> | <call> | <return>
+// <call> ::= <ident> [ '(' [ <bool-expr> ( ',' <bool-expr> )* ] ')' ]
+// <return> ::= RETURN [ <bool-expr> ]
 
-// <assignment>   :== <identifier> = <bool-expr>
+// <assignment>   :== <identifier> [ '[' <bool-expr> ']' ] = <bool-expr>
 // <bool-expr>    :== <bool-term> (<orop> <bool-term>)*
 // <bool-term>    :== <not-factor> (<andop> <not-factor>)*
 // <not-factor>   :== ['!'] <relation>
@@ -24,10 +31,16 @@
 // <term>         :== <factor> <rest>
 // <rest>         :== (<mulop> <factor>)*
 // <first factor> :== [ <adop> ] <factor>
-// <factor>       :== <var> | <number> | '(' <bool-expr> ')'
+// <factor>       :== <var> | <var> '[' <bool-expr> ']' | <number> | <call> | '(' <bool-expr> ')'
 
 // <if>     :== IF <bool-expression> <block> [ ELSE <block> ] ENDIF
 // <while>  :== WHILE <bool-expression> <block> ENDWHILE
+// <for>    :== FOR <ident> = <bool-expression> TO <bool-expression> <block> ENDFOR
+// <case>   :== CASE <bool-expression> ( OF <label> ( ',' <label> )* <block> )* [ ELSE <block> ] ENDCASE
+// <label>  :== [ '-' ] <integer>
+
+// Backends: MASM (test1.asm, default), C99 (test1.c, --emit-c) and an
+// in-process bytecode interpreter with a JIT (--run).
 
 #define Assert(Expression) if(!(Expression)) { *((int *)0) = 0; }
 #define ArrayCount(Array) (sizeof(Array)/sizeof(Array[0]))
@@ -46,6 +59,16 @@ enum token_type
     Token_Program,
     Token_Read,
     Token_Write,
+    Token_Long,
+    Token_Procedure,
+    Token_Function,
+    Token_Return,
+    Token_For,
+    Token_To,
+    Token_EndFor,
+    Token_Case,
+    Token_Of,
+    Token_EndCase,
     
     // NOTE: Not mapped to a keyword...
     
@@ -53,94 +76,487 @@ enum token_type
     Token_Operator
 };
 
+enum target
+{
+    Target_MASM,
+    
+    // NOTE: Interpreted (and JIT compiled) in process, see tiny_vm.cpp
+    Target_Bytecode,
+    
+    // NOTE: Portable C99 for the system C compiler to optimize
+    Target_C
+};
+
+struct profile;
+
+// NOTE: Everything besides the source that changes what Compile produces.
+// The compilation cache keys entries on HashOptions, so keep it complete.
+struct compile_options
+{
+    target Target;
+    
+    // NOTE: Count basic block executions and write test1.profile at exit
+    bool Instrument;
+    
+    // NOTE: Counts from an instrumented run to lay out branches and loops by
+    profile *Profile;
+    
+    // NOTE: Map generated code back to SourceName (0 for stdin): #line
+    // directives in C, so the C compiler's DWARF line table points at the
+    // TINY source, and source line comments in MASM
+    bool LineInfo;
+    char *SourceName;
+    
+    // NOTE: C for a static Linux executable without the C library: its own
+    // _start and system calls, see tiny_runtime.cpp
+    bool Freestanding;
+    
+    // NOTE: Stop the program at an array index out of bounds, unless the
+    // compiler can tell it's in bounds
+    bool CheckBounds;
+};
+
+// NOTE: Where an --instrument counter sits, see tiny_profile.cpp
+enum block_kind
+{
+    Block_Entry,
+    Block_LoopHead,
+    Block_LoopBody,
+    Block_LoopExit,
+    Block_Then,
+    Block_Else,
+    Block_Join,
+    Block_Case,
+    Block_CaseJoin
+};
+
+struct counter_site
+{
+    int Line;
+    block_kind Kind;
+};
+
+// NOTE: The type of a variable, and of the value an expression leaves in the
+// accumulator. Arithmetic on an INT and a LONG widens the INT first, storing a
+// LONG into an INT keeps the low 32 bits.
+enum value_type
+{
+    Type_Int,
+    
+    // NOTE: 64-bit, only for the C and bytecode targets
+    Type_Long
+};
+
+enum symbol_kind
+{
+    Symbol_Global,
+    
+    // NOTE: Only visible inside the routine that declares it, and kept in its
+    // frame: the parameters first, then the VARs declared before its BEGIN
+    Symbol_Parameter,
+    Symbol_Local,
+    
+    Symbol_Procedure,
+    Symbol_Function
+};
+
+// NOTE: As many as the SysV x86-64 convention passes in registers, so no
+// argument ever has to go through memory
+#define MaxParameters 6
+
+struct symbol
+{
+    char *Name;
+    symbol_kind Kind;
+    
+    // NOTE: A variable's type, or the type a FUNCTION returns
+    value_type Type;
+    
+    // NOTE: Index into the bytecode globals (a LONG takes two), into the
+    // routine's frame for a parameter or local, or into bytecode::Procedures
+    int Slot;
+    
+    // NOTE: A local's value on entry to the routine
+    long long Initial;
+    
+    int NumParameters;
+    value_type ParameterTypes[MaxParameters];
+    int NumLocals;
+    
+    // NOTE: Number of elements of an array (always a global), 0 for anything else
+    int Length;
+};
+
+#define MaxArrayLength (1 << 24)
+
+// NOTE: An INT counter the enclosing WHILE keeps in [0, Below) up to the
+// source position Until, see PlanIndexRange
+struct index_range
+{
+    symbol *Counter;
+    int Below;
+    size_t Until;
+};
+
+#define MaxIndexRanges 64
+
+// NOTE: A FOR loop around the code being compiled, see For. On MASM the
+// counter and the limit are in registers if they could get one (0 when the
+// counter is in its home and the limit on the stack), C keeps both in locals
+// for<n> and limit<n>, the bytecode the limit in a slot of its own.
+struct for_loop
+{
+    symbol *Counter;
+    char *CounterRegister;
+    char *LimitRegister;
+    int LimitSlot;
+    
+    // NOTE: Bits of the MASMParameterRegisters it took
+    int Registers;
+};
+
+#define MaxForLoops 16
+
+// NOTE: A CASE label, with the index of its arm in source order
+struct case_label
+{
+    int Value;
+    int Arm;
+};
+
+#define MaxCaseLabels 1024
+
+// NOTE: Fewer labels than this, or labels filling less than half the range
+// between the lowest and the highest, are searched rather than indexed
+#define MinCaseTable 4
+
 #define MaxTokenLength 32
+#define MaxSymbols 4096
+#define MaxErrorLength 1100
+#define MaxCounters 4096
+
+static char *Keywords[] = {0, "IF", "ELSE", "ENDIF", "WHILE", "ENDWHILE", "VAR", "BEGIN", "END", "PROGRAM", "READ", "WRITE", "LONG", "PROCEDURE", "FUNCTION", "RETURN", "FOR", "TO", "ENDFOR", "CASE", "OF", "ENDCASE"};
+
+struct output_buffer
+{
+    char *Data;
+    size_t Size;
+    size_t Capacity;
+};
 
-static char Look;
-static int LabelCount = 0;
-static int NumSymbols = 1;
-static char *SymbolTable[4096] = {};
-static token_type Token;
-static char Value[MaxTokenLength];
-static char *Keywords[] = {0, "IF", "ELSE", "ENDIF", "WHILE", "ENDWHILE", "VAR", "BEGIN", "END", "PROGRAM", "READ", "WRITE"};
+struct bytecode;
+struct time_report;
 
-static FILE *InputStream = stdin;
-static FILE *OutputStream = stdout;
+// NOTE: Everything one compilation touches, so a process can compile any
+// number of programs, one per context at a time, on as many threads as it likes.
+struct compiler_context
+{
+    target Target;
+    
+    char *Source;
+    size_t SourceSize;
+    size_t SourcePosition;
+    
+    // NOTE: 1-based source line of Look and of the start of the current
+    // token, and where in Source those lines start
+    int Line;
+    int TokenLine;
+    size_t LineStart;
+    size_t TokenLineStart;
+    
+    char Look;
+    token_type Token;
+    char Value[MaxTokenLength];
+    
+    int LabelCount;
+    int NumSymbols;
+    symbol SymbolTable[MaxSymbols];
+    int NumGlobalSlots;
+    
+    // NOTE: The PROCEDURE or FUNCTION being compiled, 0 in the main program.
+    // A Leaf routine calls nothing, on MASM its parameters stay in the
+    // registers they were passed in and it has no frame.
+    symbol *Routine;
+    bool Leaf;
+    
+    // NOTE: The last statement Block compiled was a RETURN, so a routine body
+    // ending in one needs no code for falling off its end
+    bool Returned;
+    
+    // NOTE: Bounds checks and what's known to avoid them: the ranges of the
+    // enclosing loops' counters, and the constant the previous statement
+    // stored, if it was that simple (LastConstant is the statement being
+    // compiled, PreviousConstant the one before).
+    bool CheckBounds;
+    int NumIndexRanges;
+    index_range IndexRanges[MaxIndexRanges];
+    symbol *LastConstant;
+    long long LastConstantValue;
+    symbol *PreviousConstant;
+    long long PreviousConstantValue;
+    
+    // NOTE: The enclosing FORs, innermost last, and the MASM registers they
+    // hold (bits index MASMParameterRegisters)
+    int NumForLoops;
+    for_loop ForLoops[MaxForLoops];
+    int ForRegisters;
+    
+    // NOTE: What the expression just parsed left in the accumulator: Truth if
+    // it's an INT that can only be 0 or -1, Compared if it came straight from
+    // a relation (so on MASM the flags say so too).
+    bool Truth;
+    bool Compared;
+    
+    output_buffer Output;
+    
+    // NOTE: C backend state. Each Push opens a C block holding a temporary
+    // t<depth> which the matching Pop consumes and closes.
+    int CIndent;
+    int CStackDepth;
+    
+    // NOTE: rax is only declared where LONG values are used: it's set when
+    // code loads one into it (everything else that touches rax comes after
+    // such a load). A routine or main that ends without it has the RaxSize
+    // bytes of its declaration at RaxAt cut out again, see DropUnusedRax.
+    bool UsesRax;
+    size_t RaxAt;
+    size_t RaxSize;
+    
+    // NOTE: The C runtime routines the program calls, the only ones emitted.
+    // That's known once the program is compiled, so the runtime goes in then,
+    // at RuntimeAt, see InsertRuntime.
+    bool UsesWrite;
+    bool UsesRead;
+    bool UsesReadLong;
+    bool UsesDiv;
+    bool UsesDivLong;
+    bool UsesIndexError;
+    size_t RuntimeAt;
+    
+    // NOTE: Bytecode backend output
+    bytecode *Bytecode;
+    
+    // NOTE: StatementLine is the line code is currently being generated for.
+    // With --line-info, NextCLine is the line the C compiler will give the
+    // next line of output, 0 if unknown.
+    bool LineInfo;
+    char *SourceName;
+    int StatementLine;
+    bool Freestanding;
+    int NextCLine;
+    
+    // NOTE: Every block the control flow routines open is numbered, the
+    // sites are only recorded with Instrument
+    bool Instrument;
+    int NumBlocks;
+    counter_site Counters[MaxCounters];
+    
+    // NOTE: Profile-guided layout. MASM code for cold blocks is moved to Cold
+    // and appended after the program. ProfileMismatch is set at the first
+    // block that doesn't line up with the profile, which is ignored from there on.
+    profile *Profile;
+    bool ProfileMismatch;
+    output_buffer Cold;
+    
+    // NOTE: Set by the caller for --time-report, see tiny_timing.cpp. The
+    // counters are per compilation and added to it when Compile finishes.
+    time_report *Timing;
+    int NumTokens;
+    int NumInstructions;
+    
+    // NOTE: Abort and friends jump back into Compile with the message in Error
+    jmp_buf ErrorJump;
+    char Error[MaxErrorLength];
+};
 
-static void GetName();
-static bool InSymbolTable(char *);
+static void GetName(compiler_context *Context);
+static symbol *FindSymbol(compiler_context *Context, char *);
 static bool IsWhite(char);
-static void Next();
+static void Next(compiler_context *Context);
+static void Abort(compiler_context *Context, char *String);
+
+//
+// --Buffers
+//
+
+static void
+ReserveOutput(output_buffer *Buffer, size_t Size)
+{
+    if(Buffer->Size + Size + 1 > Buffer->Capacity)
+    {
+        size_t Capacity = Buffer->Capacity ? Buffer->Capacity*2 : 4096;
+        while(Buffer->Size + Size + 1 > Capacity)
+        {
+            Capacity *= 2;
+        }
+        
+        Buffer->Data = (char *)realloc(Buffer->Data, Capacity);
+        Assert(Buffer->Data);
+        Buffer->Capacity = Capacity;
+    }
+}
+
+static void
+PrintArgs(output_buffer *Buffer, char *Format, va_list Args)
+{
+    va_list ArgsCopy;
+    va_copy(ArgsCopy, Args);
+    int Length = vsnprintf(0, 0, Format, ArgsCopy);
+    va_end(ArgsCopy);
+    
+    ReserveOutput(Buffer, Length);
+    vsnprintf(Buffer->Data + Buffer->Size, Length + 1, Format, Args);
+    Buffer->Size += Length;
+}
+
+#include "tiny_timing.cpp"
+
+static void
+Print(compiler_context *Context, char *Format, ...)
+{
+    compile_phase Previous = EnterPhase(Context, Phase_Emit);
+    
+    va_list Args;
+    va_start(Args, Format);
+    PrintArgs(&Context->Output, Format, Args);
+    va_end(Args);
+    
+    EnterPhase(Context, Previous);
+}
+
+// NOTE: Appends the rest of File to Buffer and zero terminates it
+static void
+ReadIntoBuffer(FILE *File, output_buffer *Buffer)
+{
+    size_t BytesRead;
+    do
+    {
+        ReserveOutput(Buffer, 65536);
+        BytesRead = fread(Buffer->Data + Buffer->Size, 1, 65536, File);
+        Buffer->Size += BytesRead;
+    } while(BytesRead > 0);
+    
+    Buffer->Data[Buffer->Size] = 0;
+}
+
+static unsigned long long
+HashBytes(unsigned long long Hash, void *Bytes, size_t Size)
+{
+    // NOTE: FNV-1a
+    unsigned char *At = (unsigned char *)Bytes;
+    for(size_t Index = 0;
+        Index < Size;
+        Index++)
+    {
+        Hash ^= At[Index];
+        Hash *= 1099511628211ULL;
+    }
+    
+    return Hash;
+}
+
+static char *
+ReadEntireFile(FILE *File, size_t *Size)
+{
+    output_buffer Buffer = {};
+    ReadIntoBuffer(File, &Buffer);
+    *Size = Buffer.Size;
+    
+    return Buffer.Data;
+}
+
+#include "tiny_vm.cpp"
 
 //
 // --Input processing
 //
 
 static void
-GetChar()
+GetChar(compiler_context *Context)
 {
-    Look = getc(InputStream);
+    if(Context->Look == '\n')
+    {
+        Context->Line++;
+        Context->LineStart = Context->SourcePosition;
+    }
+    
+    if(Context->SourcePosition < Context->SourceSize)
+    {
+        Context->Look = Context->Source[Context->SourcePosition++];
+    }
+    else
+    {
+        Context->Look = (char)EOF;
+    }
 }
 
 static void
-SkipComment()
+SkipComment(compiler_context *Context)
 {
-    while(Look != '}')
+    while(Context->Look != '}')
     {
-        GetChar();
-        if(Look == '{')
+        if(Context->Look == (char)EOF)
         {
-            SkipComment();
+            Abort(Context, "Unterminated comment");
+        }
+        GetChar(Context);
+        if(Context->Look == '{')
+        {
+            SkipComment(Context);
         }
     }
-    GetChar();
+    GetChar(Context);
 }
 
 static void
-SkipWhite()
+SkipWhite(compiler_context *Context)
 {
-    while(IsWhite(Look))
+    while(IsWhite(Context->Look))
     {
-        if(Look == '{')
+        if(Context->Look == '{')
         {
-            SkipComment();
+            SkipComment(Context);
         }
         else
         {
-            GetChar();
+            GetChar(Context);
         }
     }
+    
+    Context->TokenLine = Context->Line;
+    Context->TokenLineStart = Context->LineStart;
 }
 
 static void
-Abort(char *String)
+Abort(compiler_context *Context, char *String)
 {
-    fprintf(stdout, "Error: %s.\n", String);
-    exit(0);
+    snprintf(Context->Error, MaxErrorLength, "Error: %s.", String);
+    longjmp(Context->ErrorJump, 1);
 }
 
 static void
-Expected(char *String)
+Expected(compiler_context *Context, char *String)
 {
-    fprintf(stdout, "Expected: %s, Got: %s\n", String, Value);
-    exit(0);
+    snprintf(Context->Error, MaxErrorLength, "Expected: %s, Got: %s", String, Context->Value);
+    longjmp(Context->ErrorJump, 1);
 }
 
 static void
-Match(char C)
+Match(compiler_context *Context, char C)
 {
-    if(Value[0] != C)
+    if(Context->Value[0] != C)
     {
         char ExpectedString[4] = {'\'', C, '\'', 0};
-        Expected(ExpectedString);
+        Expected(Context, ExpectedString);
     }
-    Next();
+    Next(Context);
 }
 
 static void
-Undefined(char *Name)
+Undefined(compiler_context *Context, char *Name)
 {
-    printf("Undefined Identifier \'%s\'\n", Name);
-    exit(0);
+    snprintf(Context->Error, MaxErrorLength, "Undefined Identifier \'%s\'", Name);
+    longjmp(Context->ErrorJump, 1);
 }
 
 static int
@@ -163,25 +579,25 @@ Lookup(char **Table, int TableSize, char *Entry)
 }
 
 static void
-MatchString(char *String)
+MatchString(compiler_context *Context, char *String)
 {
-    if(strcmp(String, Value) != 0)
+    if(strcmp(String, Context->Value) != 0)
     {
-        Expected(String);
+        Expected(Context, String);
     }
     
-    Next();
+    Next(Context);
 }
 
 static void
-MatchToken(token_type ExpectedToken)
+MatchToken(compiler_context *Context, token_type ExpectedToken)
 {
-    if(Token != ExpectedToken)
+    if(Context->Token != ExpectedToken)
     {
-        Expected(Keywords[ExpectedToken]);
+        Expected(Context, Keywords[ExpectedToken]);
     }
     
-    Next();
+    Next(Context);
 }
 
 //
@@ -239,9 +655,75 @@ IsAddop(char C)
 }
 
 static bool
-InSymbolTable(char *Symbol)
+IsRoutine(symbol *Symbol)
+{
+    bool Result = ((Symbol->Kind == Symbol_Procedure) || (Symbol->Kind == Symbol_Function));
+    
+    return Result;
+}
+
+// NOTE: A variable in the frame of the routine being compiled. Nothing
+// outside the routine can see it, so it dies when the routine returns.
+static bool
+IsLocal(symbol *Symbol)
+{
+    bool Result = ((Symbol->Kind == Symbol_Parameter) || (Symbol->Kind == Symbol_Local));
+    
+    return Result;
+}
+
+// NOTE: Returns 0 if Name isn't declared. Searches from the most recent
+// entry, so a parameter hides a global of the same name.
+static symbol *
+FindSymbol(compiler_context *Context, char *Name)
+{
+    symbol *Result = 0;
+    
+    for(int SymbolIndex = Context->NumSymbols - 1;
+        SymbolIndex >= 1;
+        SymbolIndex--)
+    {
+        if(!strcmp(Context->SymbolTable[SymbolIndex].Name, Name))
+        {
+            Result = Context->SymbolTable + SymbolIndex;
+            break;
+        }
+    }
+    
+    return Result;
+}
+
+static symbol *
+Variable(compiler_context *Context, char *Name)
+{
+    symbol *Result = FindSymbol(Context, Name);
+    if(!Result)
+    {
+        Undefined(Context, Name);
+    }
+    if(IsRoutine(Result))
+    {
+        snprintf(Context->Error, MaxErrorLength, "\'%s\' is a routine, not a variable", Name);
+        longjmp(Context->ErrorJump, 1);
+    }
+    if(Result->Length)
+    {
+        snprintf(Context->Error, MaxErrorLength, "\'%s\' is an array, it needs an index", Name);
+        longjmp(Context->ErrorJump, 1);
+    }
+    
+    return Result;
+}
+
+// NOTE: Returns the array called Name, 0 if it's something else
+static symbol *
+FindArray(compiler_context *Context, char *Name)
 {
-    bool Result = (Lookup(SymbolTable, NumSymbols, Symbol) > 0);
+    symbol *Result = FindSymbol(Context, Name);
+    if(Result && !Result->Length)
+    {
+        Result = 0;
+    }
     
     return Result;
 }
@@ -267,107 +749,181 @@ IsRelop(char C)
 //
 
 static void
-GetName()
+GetName(compiler_context *Context)
 {
-    SkipWhite();
+    SkipWhite(Context);
     
-    if(!IsAlpha(Look))
+    if(!IsAlpha(Context->Look))
     {
-        Expected("Identifier");
+        Expected(Context, "Identifier");
     }
     
     int Index = 0;
-    while(IsAlphaNumeric(Look))
+    while(IsAlphaNumeric(Context->Look))
     {
-        Value[Index++] = toupper(Look);
-        GetChar();
+        if(Index == MaxTokenLength - 1)
+        {
+            char Message[1024];
+            snprintf(Message, sizeof(Message), "Names are at most %d characters long", MaxTokenLength - 1);
+            Abort(Context, Message);
+        }
+        Context->Value[Index++] = toupper(Context->Look);
+        GetChar(Context);
     }
-    Value[Index] = 0;
+    Context->Value[Index] = 0;
     
-    Token = Token_Identifier;
+    Context->Token = Token_Identifier;
 }
 
 static void
-GetNumber()
+GetNumber(compiler_context *Context)
 {
-    SkipWhite();
+    SkipWhite(Context);
     
-    if(!IsDigit(Look))
+    if(!IsDigit(Context->Look))
     {
-        Expected("Number");
+        Expected(Context, "Number");
     }
     
     int Index = 0;
-    while(IsDigit(Look))
+    while(IsDigit(Context->Look))
     {
-        Value[Index++] = Look;
-        GetChar();
+        // NOTE: No INT or LONG needs this many digits, so it's too large
+        // whatever the value
+        if(Index == MaxTokenLength - 1)
+        {
+            Abort(Context, "Number too large");
+        }
+        Context->Value[Index++] = Context->Look;
+        GetChar(Context);
     }
-    Value[Index] = 0;
+    Context->Value[Index] = 0;
     
-    Token = Token_Number;
+    Context->Token = Token_Number;
 }
 
 static void
-GetOp()
+GetOp(compiler_context *Context)
 {
-    SkipWhite();
+    SkipWhite(Context);
     
-    Token = Token_Operator;
-    Value[0] = Look;
-    Value[1] = 0;
+    Context->Token = Token_Operator;
+    Context->Value[0] = Context->Look;
+    Context->Value[1] = 0;
     
-    GetChar();
+    GetChar(Context);
 }
 
 static void
-Semicolon()
+Semicolon(compiler_context *Context)
 {
-    if(!strcmp(Value, ";"))
+    if(!strcmp(Context->Value, ";"))
     {
-        Next();
+        Next(Context);
     }
 }
 
 static void
-Scan()
+Scan(compiler_context *Context)
 {
-    if(Token == Token_Identifier)
+    if(Context->Token == Token_Identifier)
     {
-        Token = (token_type)Lookup(Keywords, sizeof(Keywords)/sizeof(char *), Value);
+        Context->Token = (token_type)Lookup(Keywords, sizeof(Keywords)/sizeof(char *), Context->Value);
     }
 }
 
 static void
-Next()
+Next(compiler_context *Context)
 {
-    SkipWhite();
-    if(IsAlpha(Look))
+    compile_phase Previous = EnterPhase(Context, Phase_Lex);
+    Context->NumTokens++;
+    
+    SkipWhite(Context);
+    if(IsAlpha(Context->Look))
     {
-        GetName();
+        GetName(Context);
     }
-    else if(IsDigit(Look))
+    else if(IsDigit(Context->Look))
     {
-        GetNumber();
+        GetNumber(Context);
     }
     else
     {
-        GetOp();
+        GetOp(Context);
     }
     
-    Scan();
+    Scan(Context);
+    EnterPhase(Context, Previous);
+}
+
+// NOTE: Everything Next changes, for looking ahead and coming back
+struct lexer_state
+{
+    size_t SourcePosition;
+    int Line;
+    int TokenLine;
+    size_t LineStart;
+    size_t TokenLineStart;
+    char Look;
+    token_type Token;
+    char Value[MaxTokenLength];
+    int NumTokens;
+};
+
+static void
+SaveLexer(compiler_context *Context, lexer_state *State)
+{
+    State->SourcePosition = Context->SourcePosition;
+    State->Line = Context->Line;
+    State->TokenLine = Context->TokenLine;
+    State->LineStart = Context->LineStart;
+    State->TokenLineStart = Context->TokenLineStart;
+    State->Look = Context->Look;
+    State->Token = Context->Token;
+    memcpy(State->Value, Context->Value, MaxTokenLength);
+    State->NumTokens = Context->NumTokens;
+}
+
+static void
+RestoreLexer(compiler_context *Context, lexer_state *State)
+{
+    Context->SourcePosition = State->SourcePosition;
+    Context->Line = State->Line;
+    Context->TokenLine = State->TokenLine;
+    Context->LineStart = State->LineStart;
+    Context->TokenLineStart = State->TokenLineStart;
+    Context->Look = State->Look;
+    Context->Token = State->Token;
+    memcpy(Context->Value, State->Value, MaxTokenLength);
+    Context->NumTokens = State->NumTokens;
 }
 
 static void
-NewLabel(char *Output)
+NewLabel(compiler_context *Context, char *Output)
 {
-    sprintf(Output, "L%d", LabelCount++);
+    sprintf(Output, "L%d", Context->LabelCount++);
 }
 
 static void
-PostLabel(char *Label)
+PostLabel(compiler_context *Context, char *Label)
 {
-    fprintf(OutputStream, "%s:\n", Label);
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            Print(Context, "%s:\n", Label);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            PostBytecodeLabel(Context, Label);
+        } break;
+        
+        case Target_C:
+        {
+            // NOTE: Control flow is structured in C, see BeginLoop/BeginIf
+        } break;
+    }
 }
 
 //
@@ -375,860 +931,4798 @@ PostLabel(char *Label)
 //
 
 static void
-EmitNoTab(char *Str)
+EmitNoTab(compiler_context *Context, char *Str)
 {
-    fprintf(OutputStream, "%s\n", Str);
+    Print(Context, "%s\n", Str);
+    Context->NextCLine = 0;
 }
 
 static void
-Emit(char *Str)
+Emit(compiler_context *Context, char *Str)
 {
-    fprintf(OutputStream, "\t%s", Str);
+    Print(Context, "\t%s", Str);
 }
 
 static void
-EmitLn(char *Str)
+EmitLn(compiler_context *Context, char *Str)
 {
-    Emit(Str);
-    fprintf(OutputStream, "\n");
+    Context->NumInstructions++;
+    Emit(Context, Str);
+    Print(Context, "\n");
 }
 
 static void
-EmitLn(char C)
+EmitLn(compiler_context *Context, char C)
 {
-    fprintf(OutputStream, "\t%c\n", C);
+    Context->NumInstructions++;
+    Print(Context, "\t%c\n", C);
 }
 
 static void
-EmitInstruction(char *Name, char *Param1)
+EmitInstruction(compiler_context *Context, char *Name, char *Param1)
 {
     char Line[1024];
     sprintf(Line, "%s %s", Name, Param1);
-    EmitLn(Line);
+    EmitLn(Context, Line);
 }
 
 static void
-EmitInstruction(char *Name, char Param1)
+EmitInstruction(compiler_context *Context, char *Name, char Param1)
 {
     char Line[1024];
     sprintf(Line, "%s %c", Name, Param1);
-    EmitLn(Line);
+    EmitLn(Context, Line);
 }
 
 static void
-EmitInstruction(char *Name, char *Param1, char *Param2)
+EmitInstruction(compiler_context *Context, char *Name, char *Param1, char *Param2)
 {
     char Line[1024];
     sprintf(Line, "%s %s, %s", Name, Param1, Param2);
-    EmitLn(Line);
+    EmitLn(Context, Line);
 }
 
 static void
-EmitInstruction(char *Name, char *Param1, char Param2)
+EmitInstruction(compiler_context *Context, char *Name, char *Param1, char Param2)
 {
     char Line[1024];
     sprintf(Line, "%s %s, %c", Name, Param1, Param2);
-    EmitLn(Line);
+    EmitLn(Context, Line);
 }
 
 static void
-EmitInstruction(char *Name, char Param1, char *Param2)
+EmitInstruction(compiler_context *Context, char *Name, char Param1, char *Param2)
 {
     char Line[1024];
     sprintf(Line, "%s %c, %s", Name, Param1, Param2);
-    EmitLn(Line);
+    EmitLn(Context, Line);
 }
 
 static void
-EmitInstruction(char *Name, char Param1, char Param2)
+EmitInstruction(compiler_context *Context, char *Name, char Param1, char Param2)
 {
     char Line[1024];
     sprintf(Line, "%s %c, %c", Name, Param1, Param2);
-    EmitLn(Line);
+    EmitLn(Context, Line);
 }
 
-//
-// --Code generation
-//
-
 static void
-Clear()
+EmitC(compiler_context *Context, char *Format, ...)
 {
-    EmitLn("MOV eax, 0");
+    compile_phase Previous = EnterPhase(Context, Phase_Emit);
+    Context->NumInstructions++;
+    
+    // NOTE: Line 0 is code from before the first statement, #line can't
+    // name it, so it keeps the C compiler's count and the next real line
+    // resynchronizes
+    if(Context->LineInfo && (Context->StatementLine > 0) &&
+       (Context->NextCLine != Context->StatementLine))
+    {
+        Print(Context, "#line %d \"", Context->StatementLine);
+        for(char *At = Context->SourceName;
+            *At;
+            At++)
+        {
+            if((*At == '\\') || (*At == '\"'))
+            {
+                Print(Context, "\\");
+            }
+            Print(Context, "%c", *At);
+        }
+        Print(Context, "\"\n");
+    }
+    Context->NextCLine = (Context->StatementLine > 0) ? (Context->StatementLine + 1) : 0;
+    
+    for(int Level = 0;
+        Level < Context->CIndent;
+        Level++)
+    {
+        Print(Context, "    ");
+    }
+    
+    va_list Args;
+    va_start(Args, Format);
+    PrintArgs(&Context->Output, Format, Args);
+    va_end(Args);
+    
+    Print(Context, "\n");
+    EnterPhase(Context, Previous);
 }
 
 static void
-Negate()
+PopC(compiler_context *Context, char *Format)
 {
-    EmitLn("IMUL eax, -1");
+    Assert(Context->CStackDepth > 0);
+    EmitC(Context, Format, --Context->CStackDepth);
+    Context->CIndent--;
+    EmitC(Context, "}");
 }
 
+// NOTE: Code generated from here on belongs to the line the current token is on
 static void
-LoadConstant(bool Negative)
+MarkSourceLine(compiler_context *Context)
 {
-    char Line[1024];
-    if(!Negative)
+    if(Context->StatementLine == Context->TokenLine)
     {
-        sprintf(Line, "MOV eax, %s", Value);
+        return;
     }
-    else
+    
+    Context->StatementLine = Context->TokenLine;
+    if(Context->LineInfo && (Context->Target == Target_MASM))
     {
-        sprintf(Line, "MOV eax, -%s", Value);
+        char *Text = Context->Source + Context->TokenLineStart;
+        int Length = 0;
+        while((Context->TokenLineStart + Length < Context->SourceSize) &&
+              (Text[Length] != '\n') && (Text[Length] != '\r'))
+        {
+            Length++;
+        }
+        Print(Context, "; %s:%d: %.*s\n", Context->SourceName, Context->TokenLine, Length, Text);
     }
-    EmitLn(Line);
 }
 
-static void
-LoadVariable(char *Name)
-{
-    EmitInstruction("MOV", "eax", Name);
-}
+//
+// --Code generation
+//
 
 static void
-Push()
+Clear(compiler_context *Context)
 {
-    EmitInstruction("PUSH", "eax");
+    EmitLn(Context, "MOV eax, 0");
 }
 
+// NOTE: The MASM target is 32-bit x86, which has no 64-bit registers
 static void
-PopAdd()
+RequireLongTarget(compiler_context *Context)
 {
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("ADD", "eax", "ebx");
+    if(Context->Target == Target_MASM)
+    {
+        Abort(Context, "LONG values need --emit-c or --run, the MASM target is 32-bit");
+    }
 }
 
 static void
-PopSub()
+Negate(compiler_context *Context, value_type Type)
 {
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("SUB", "eax", "ebx");
-    EmitInstruction("IMUL", "eax", "-1");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitLn(Context, "IMUL eax, -1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_NegateLong : Op_Negate);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                EmitC(Context, "rax = (long long)(0ull - (unsigned long long)rax);");
+            }
+            else
+            {
+                EmitC(Context, "eax = (int)(0u - (unsigned)eax);");
+            }
+        } break;
+    }
 }
 
-static void
-PopMul()
+// NOTE: A literal that doesn't fit in 32 bits is a LONG
+static value_type
+LoadConstant(compiler_context *Context, bool Negative)
 {
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("IMUL", "eax", "ebx");
+    unsigned long long Magnitude = 0;
+    for(char *Digit = Context->Value;
+        *Digit;
+        Digit++)
+    {
+        if(Magnitude > (0xFFFFFFFFFFFFFFFFULL - 9)/10)
+        {
+            Abort(Context, "Number too large");
+        }
+        Magnitude = Magnitude*10 + (*Digit - '0');
+    }
+    
+    unsigned long long Limit = Negative ? 0x8000000000000000ULL : 0x7FFFFFFFFFFFFFFFULL;
+    if(Magnitude > Limit)
+    {
+        Abort(Context, "Number too large");
+    }
+    long long Constant = Negative ? (long long)(0ULL - Magnitude) : (long long)Magnitude;
+    
+    value_type Result = Type_Int;
+    if((Constant < -2147483647LL - 1) || (Constant > 2147483647LL))
+    {
+        RequireLongTarget(Context);
+        Result = Type_Long;
+    }
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            char Line[1024];
+            if(!Negative)
+            {
+                sprintf(Line, "MOV eax, %s", Context->Value);
+            }
+            else
+            {
+                sprintf(Line, "MOV eax, -%s", Context->Value);
+            }
+            EmitLn(Context, Line);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(Result == Type_Long)
+            {
+                EmitOp(Context, Op_LoadLongConstant, AddLongConstant(Context, Constant));
+            }
+            else
+            {
+                EmitOp(Context, Op_LoadConstant, (int)Constant);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            if(Result == Type_Long)
+            {
+                Context->UsesRax = true;
+                if(Magnitude == 0x8000000000000000ULL)
+                {
+                    EmitC(Context, "rax = -9223372036854775807LL - 1;");
+                }
+                else
+                {
+                    EmitC(Context, "rax = %lldLL;", Constant);
+                }
+            }
+            else if(!Negative)
+            {
+                EmitC(Context, "eax = %s;", Context->Value);
+            }
+            else
+            {
+                EmitC(Context, "eax = -%s;", Context->Value);
+            }
+        } break;
+    }
+    
+    return Result;
 }
 
-static void
-PopDiv()
-{
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("DIV", "ebx", "eax");
-    EmitInstruction("MOV", "eax", "ebx");
-}
+// NOTE: Registers for the first parameters of a MASM routine, and for the
+// locals after them in a leaf. The caller saves nothing, the only live values
+// across a call are on the stack and in the caller's frame.
+static char *MASMParameterRegisters[] = {"ecx", "edx", "esi", "edi"};
 
-static void
-Store(char *Name)
+// NOTE: The FOR counting with Symbol, 0 if there isn't one
+static for_loop *
+ForLoopOf(compiler_context *Context, symbol *Symbol)
 {
-    if(!InSymbolTable(Name))
+    for_loop *Result = 0;
+    
+    for(int LoopIndex = 0;
+        LoopIndex < Context->NumForLoops;
+        LoopIndex++)
     {
-        Undefined(Name);
+        if(Context->ForLoops[LoopIndex].Counter == Symbol)
+        {
+            Result = Context->ForLoops + LoopIndex;
+        }
     }
     
-    EmitInstruction("MOV", Name, "eax");
+    return Result;
 }
 
+// NOTE: Where a MASM variable lives: a global by name, a parameter or local
+// in its register (leaf routines) or its home in the frame
 static void
-Not()
+MASMHome(compiler_context *Context, symbol *Symbol, char *Result)
 {
-    EmitInstruction("NOT", "eax");
-}
-
-static void
-PopAnd()
-{
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("AND", "eax", "ebx");
+    if(!IsLocal(Symbol))
+    {
+        sprintf(Result, "%s", Symbol->Name);
+    }
+    else if(Context->Leaf)
+    {
+        sprintf(Result, "%s", MASMParameterRegisters[Symbol->Slot]);
+    }
+    else
+    {
+        sprintf(Result, "DWORD PTR [ebp-%d]", 4*(Symbol->Slot + 1));
+    }
 }
 
+// NOTE: The MASM operand for a variable: the register of a FOR counting with
+// it, otherwise its home
 static void
-PopOr()
+MASMVariable(compiler_context *Context, symbol *Symbol, char *Result)
 {
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("OR", "eax", "ebx");
+    for_loop *Loop = ForLoopOf(Context, Symbol);
+    if(Loop && Loop->CounterRegister)
+    {
+        sprintf(Result, "%s", Loop->CounterRegister);
+    }
+    else
+    {
+        MASMHome(Context, Symbol, Result);
+    }
 }
 
 static void
-PopXor()
+CVariable(symbol *Symbol, char *Result)
 {
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("XOR", "eax", "ebx");
+    if(Symbol->Kind == Symbol_Parameter)
+    {
+        sprintf(Result, "p_%s", Symbol->Name);
+    }
+    else if(Symbol->Kind == Symbol_Local)
+    {
+        sprintf(Result, "l_%s", Symbol->Name);
+    }
+    else
+    {
+        sprintf(Result, "v_%s", Symbol->Name);
+    }
 }
 
-static void
-PopCompare()
+static value_type
+LoadVariable(compiler_context *Context, char *Name)
 {
-    EmitInstruction("POP", "ebx");
-    EmitInstruction("CMP", "ebx", "eax");
+    symbol *Symbol = Variable(Context, Name);
+    char Operand[MaxTokenLength + 32];
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            MASMVariable(Context, Symbol, Operand);
+            EmitInstruction(Context, "MOV", "eax", Operand);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(IsLocal(Symbol))
+            {
+                // NOTE: Frame slots keep an INT sign extended, one op loads either type
+                EmitOp(Context, Op_LoadLocal, Symbol->Slot);
+            }
+            else
+            {
+                EmitOp(Context, (Symbol->Type == Type_Long) ? Op_LoadLong : Op_LoadVariable, Symbol->Slot);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            CVariable(Symbol, Operand);
+            for_loop *Loop = ForLoopOf(Context, Symbol);
+            if(Loop)
+            {
+                EmitC(Context, "eax = (int)for%d;", (int)(Loop - Context->ForLoops));
+            }
+            else if(Symbol->Type == Type_Long)
+            {
+                Context->UsesRax = true;
+                EmitC(Context, "rax = %s;", Operand);
+            }
+            else
+            {
+                EmitC(Context, "eax = %s;", Operand);
+            }
+        } break;
+    }
+    
+    return Symbol->Type;
 }
 
 static void
-SetEqual()
+Push(compiler_context *Context, value_type Type)
 {
-    EmitInstruction("MOV", "eax", "0");
-    EmitInstruction("SETE", "al");
-    EmitInstruction("IMUL", "eax", "-1");
-    EmitInstruction("CMP", "eax", "-1");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "PUSH", "eax");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_Push);
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "{");
+            Context->CIndent++;
+            if(Type == Type_Long)
+            {
+                EmitC(Context, "long long t%d = rax;", Context->CStackDepth++);
+            }
+            else
+            {
+                EmitC(Context, "int t%d = eax;", Context->CStackDepth++);
+            }
+        } break;
+    }
 }
 
+// NOTE: Sign extends the accumulator to a LONG
 static void
-SetNotEqual()
+Widen(compiler_context *Context)
 {
-    EmitInstruction("MOV", "eax", "0");
-    EmitInstruction("SETNE", "al");
-    EmitInstruction("IMUL", "eax", "-1");
-    EmitInstruction("CMP", "eax", "-1");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            Assert(!"LONG on MASM");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_Extend);
+        } break;
+        
+        case Target_C:
+        {
+            Context->UsesRax = true;
+            EmitC(Context, "rax = eax;");
+        } break;
+    }
 }
 
-static void
-SetLessThan()
+// NOTE: Brings the pushed operand (of StackType) and the accumulator (of
+// Type) to a common type for a Pop routine, and returns it
+static value_type
+Promote(compiler_context *Context, value_type StackType, value_type Type)
 {
-    EmitInstruction("MOV", "eax", "0");
-    EmitInstruction("SETL", "al");
-    EmitInstruction("IMUL", "eax", "-1");
-    EmitInstruction("CMP", "eax", "-1");
+    value_type Result = Type_Int;
+    
+    if((StackType == Type_Long) || (Type == Type_Long))
+    {
+        Result = Type_Long;
+        if(Type != Type_Long)
+        {
+            Widen(Context);
+        }
+        if((StackType != Type_Long) && (Context->Target == Target_Bytecode))
+        {
+            // NOTE: C converts t<n> by itself
+            EmitOp(Context, Op_ExtendStacked);
+        }
+    }
+    
+    return Result;
 }
 
 static void
-SetGreaterThan()
+PopAdd(compiler_context *Context, value_type Type)
 {
-    EmitInstruction("MOV", "eax", "0");
-    EmitInstruction("SETG", "al");
-    EmitInstruction("IMUL", "eax", "-1");
-    EmitInstruction("CMP", "eax", "-1");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "ADD", "eax", "ebx");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_PopAddLong : Op_PopAdd);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = (long long)((unsigned long long)t%d + (unsigned long long)rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = (int)((unsigned)t%d + (unsigned)eax);");
+            }
+        } break;
+    }
 }
 
 static void
-SetLessThanOrEqual()
+PopSub(compiler_context *Context, value_type Type)
 {
-    EmitInstruction("MOV", "eax", "0");
-    EmitInstruction("SETLE", "al");
-    EmitInstruction("IMUL", "eax", "-1");
-    EmitInstruction("CMP", "eax", "-1");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "SUB", "eax", "ebx");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_PopSubLong : Op_PopSub);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = (long long)((unsigned long long)t%d - (unsigned long long)rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = (int)((unsigned)t%d - (unsigned)eax);");
+            }
+        } break;
+    }
 }
 
 static void
-SetGreaterThanOrEqual()
+PopMul(compiler_context *Context, value_type Type)
 {
-    EmitInstruction("MOV", "eax", "0");
-    EmitInstruction("SETGE", "al");
-    EmitInstruction("IMUL", "eax", "-1");
-    EmitInstruction("CMP", "eax", "-1");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "IMUL", "eax", "ebx");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_PopMulLong : Op_PopMul);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = (long long)((unsigned long long)t%d * (unsigned long long)rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = (int)((unsigned)t%d * (unsigned)eax);");
+            }
+        } break;
+    }
 }
 
 static void
-Branch(char *Label)
+PopDiv(compiler_context *Context, value_type Type)
 {
-    EmitInstruction("JMP", Label);
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            // NOTE: IDIV traps on the smallest value over -1, which wraps
+            // around on every target instead. edx is kept, it may hold a
+            // parameter, a local or a FOR counter.
+            char NegateLabel[MaxTokenLength];
+            char DoneLabel[MaxTokenLength];
+            NewLabel(Context, NegateLabel);
+            NewLabel(Context, DoneLabel);
+            EmitInstruction(Context, "MOV", "ebx", "eax");
+            EmitInstruction(Context, "POP", "eax");
+            EmitInstruction(Context, "CMP", "ebx", "-1");
+            EmitInstruction(Context, "JE", NegateLabel);
+            EmitInstruction(Context, "PUSH", "edx");
+            EmitLn(Context, "CDQ");
+            EmitInstruction(Context, "IDIV", "ebx");
+            EmitInstruction(Context, "POP", "edx");
+            EmitInstruction(Context, "JMP", DoneLabel);
+            PostLabel(Context, NegateLabel);
+            EmitInstruction(Context, "NEG", "eax");
+            PostLabel(Context, DoneLabel);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_PopDivLong : Op_PopDiv);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = tiny_div_long(t%d, rax);");
+                Context->UsesDivLong = true;
+            }
+            else
+            {
+                PopC(Context, "eax = tiny_div(t%d, eax);");
+                Context->UsesDiv = true;
+            }
+        } break;
+    }
 }
 
+// NOTE: Stores the accumulator, of Type, converted to the variable's type
 static void
-BranchFalse(char *Label)
+Store(compiler_context *Context, char *Name, value_type Type)
 {
-    EmitInstruction("JNE", Label);
+    symbol *Symbol = Variable(Context, Name);
+    bool Local = IsLocal(Symbol);
+    char Operand[MaxTokenLength + 32];
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            MASMVariable(Context, Symbol, Operand);
+            EmitInstruction(Context, "MOV", Operand, "eax");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(Symbol->Type == Type_Long)
+            {
+                if(Type != Type_Long)
+                {
+                    Widen(Context);
+                }
+                EmitOp(Context, Local ? Op_StoreLocalLong : Op_StoreLong, Symbol->Slot);
+            }
+            else
+            {
+                // NOTE: Keeps the low 32 bits of a LONG
+                EmitOp(Context, Local ? Op_StoreLocal : Op_Store, Symbol->Slot);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            CVariable(Symbol, Operand);
+            if((Type == Type_Long) && (Symbol->Type == Type_Long))
+            {
+                EmitC(Context, "%s = rax;", Operand);
+            }
+            else if(Type == Type_Long)
+            {
+                EmitC(Context, "%s = (int)rax;", Operand);
+            }
+            else
+            {
+                EmitC(Context, "%s = eax;", Operand);
+            }
+        } break;
+    }
 }
 
+// NOTE: Turns a LONG index into the INT it's used as. The bytecode ops only
+// look at the low 32 bits anyway, and MASM has no LONGs.
 static void
-EmitRead()
+NarrowIndex(compiler_context *Context)
 {
-    EmitInstruction("LEA", "eax", Value);
-    EmitInstruction("PUSH", "eax");
-    EmitInstruction("LEA", "eax", "ReadFormat");
-    EmitInstruction("PUSH", "eax");
-    EmitInstruction("CALL", "_imp__scanf");
-    EmitInstruction("ADD", "ESP", "8");
+    if(Context->Target == Target_C)
+    {
+        EmitC(Context, "eax = (int)rax;");
+    }
 }
 
+// NOTE: Stops the program unless the index in the accumulator is in
+// [0, Length), one unsigned compare covers both ends
 static void
-EmitWrite()
+CheckIndex(compiler_context *Context, symbol *Array)
 {
-    EmitInstruction("PUSH", Value);
-    EmitInstruction("LEA", "eax", "PrintFormat");
-    EmitInstruction("PUSH", "eax");
-    EmitInstruction("CALL", "_imp__printf");
-    EmitInstruction("ADD", "ESP", "8");
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            char Length[32];
+            sprintf(Length, "%d", Array->Length);
+            EmitInstruction(Context, "CMP", "eax", Length);
+            EmitInstruction(Context, "JAE", "TinyIndexError");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_CheckIndex, Array->Length);
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "if((unsigned)eax >= %du) tiny_index_error();", Array->Length);
+            Context->UsesIndexError = true;
+        } break;
+    }
 }
 
-
-//
-// --Parsing - Expressions
-//
-
-// NOTE: Expression grammer
-// <assignment>   :== <identifier> = <bool-expr>
-// <bool-expr>    :== <bool-term> (<orop> <bool-term>)*
-// <bool-term>    :== <not-factor> (<andop> <not-factor>)*
-// <not-factor>   :== ['!'] <relation>
-// <relation>     :== <expression> [ <relop> <expression> ]
-// <expression>   :== <first-term> (<addop> <term>)*
-// <first-term>   :== <first-factor> <rest>
-// <term>         :== <factor> <rest>
-// <rest>         :== (<mulop> <factor>)*
-// <first factor> :== [ <adop> ] <factor>
-// <factor>       :== <var> | <number> | '(' <bool-expr> ')'
-
-static void BoolExpression();
-static void Block();
-
-static void
-Factor()
+// NOTE: Loads the element the accumulator indexes
+static value_type
+LoadElement(compiler_context *Context, symbol *Array)
 {
-    if(!strcmp(Value, "("))
-    {
-        MatchString("(");
-        BoolExpression();
-        MatchString(")");
-    }
-    else
+    bool Long = (Array->Type == Type_Long);
+    
+    switch(Context->Target)
     {
-        if(Token == Token_Number)
-        {
-            LoadConstant(false);
-        }
-        else if(Token == Token_Identifier)
+        case Target_MASM:
         {
-            LoadVariable(Value);
-        }
-        else
+            char Operand[MaxTokenLength + 32];
+            sprintf(Operand, "DWORD PTR %s[eax*4]", Array->Name);
+            EmitInstruction(Context, "MOV", "eax", Operand);
+        } break;
+        
+        case Target_Bytecode:
         {
-            Expected("Math factor");
-        }
+            EmitOp(Context, Long ? Op_LoadElementLong : Op_LoadElement, Array->Slot);
+        } break;
         
-        Next();
+        case Target_C:
+        {
+            if(Long)
+            {
+                Context->UsesRax = true;
+                EmitC(Context, "rax = v_%s[eax];", Array->Name);
+            }
+            else
+            {
+                EmitC(Context, "eax = v_%s[eax];", Array->Name);
+            }
+        } break;
     }
+    
+    return Array->Type;
 }
 
+// NOTE: Stores the accumulator, of Type, converted to the element type, into
+// the element the pushed index selects
 static void
-NegativeFactor()
+StoreElement(compiler_context *Context, symbol *Array, value_type Type)
 {
-    MatchString("-");
-    if(IsDigit(Value[0]))
-    {
-        GetNumber();
-        LoadConstant(true);
-    }
-    else
+    bool Long = (Array->Type == Type_Long);
+    
+    switch(Context->Target)
     {
-        Factor();
-        Negate();
+        case Target_MASM:
+        {
+            char Operand[MaxTokenLength + 32];
+            sprintf(Operand, "DWORD PTR %s[ebx*4]", Array->Name);
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "MOV", Operand, "eax");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(Long && (Type != Type_Long))
+            {
+                Widen(Context);
+            }
+            EmitOp(Context, Long ? Op_StoreElementLong : Op_StoreElement, Array->Slot);
+        } break;
+        
+        case Target_C:
+        {
+            char Format[MaxTokenLength + 32];
+            if(Long && (Type == Type_Long))
+            {
+                sprintf(Format, "v_%s[t%%d] = rax;", Array->Name);
+            }
+            else if(Type == Type_Long)
+            {
+                sprintf(Format, "v_%s[t%%d] = (int)rax;", Array->Name);
+            }
+            else
+            {
+                sprintf(Format, "v_%s[t%%d] = eax;", Array->Name);
+            }
+            PopC(Context, Format);
+        } break;
     }
 }
 
 static void
-FirstFactor()
+Not(compiler_context *Context, value_type Type)
 {
-    if(!strcmp(Value, "+"))
-    {
-        MatchString("+");
-        Factor();
-    }
-    else if(!strcmp(Value, "-"))
+    switch(Context->Target)
     {
-        NegativeFactor();
-    }
-    else
-    {
-        Factor();
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "NOT", "eax");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_NotLong : Op_Not);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                EmitC(Context, "rax = ~rax;");
+            }
+            else
+            {
+                EmitC(Context, "eax = ~eax;");
+            }
+        } break;
     }
 }
 
+// NOTE: Conditions branch on the low 32 bits, so a LONG becomes 0 or -1 first
 static void
-Multiply()
+TestLong(compiler_context *Context)
 {
-    MatchString("*");
-    Factor();
-    PopMul();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            Assert(!"LONG on MASM");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_TestLong);
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "eax = -(rax != 0);");
+        } break;
+    }
 }
 
 static void
-Divide()
+PopAnd(compiler_context *Context, value_type Type)
 {
-    MatchString("/");
-    Factor();
-    PopDiv();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "AND", "eax", "ebx");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_PopAndLong : Op_PopAnd);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = t%d & rax;");
+            }
+            else
+            {
+                PopC(Context, "eax = t%d & eax;");
+            }
+        } break;
+    }
 }
 
 static void
-RestOfTerms()
+PopOr(compiler_context *Context, value_type Type)
 {
-    while(IsMulop(Value[0]))
+    switch(Context->Target)
     {
-        Push();
-        if(!strcmp(Value, "*"))
+        case Target_MASM:
         {
-            Multiply();
-        }
-        else if(!strcmp(Value, "/"))
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "OR", "eax", "ebx");
+        } break;
+        
+        case Target_Bytecode:
         {
-            Divide();
-        }
+            EmitOp(Context, (Type == Type_Long) ? Op_PopOrLong : Op_PopOr);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = t%d | rax;");
+            }
+            else
+            {
+                PopC(Context, "eax = t%d | eax;");
+            }
+        } break;
     }
 }
 
 static void
-Term()
+PopXor(compiler_context *Context, value_type Type)
 {
-    Factor();
-    RestOfTerms();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "XOR", "eax", "ebx");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_PopXorLong : Op_PopXor);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "rax = t%d ^ rax;");
+            }
+            else
+            {
+                PopC(Context, "eax = t%d ^ eax;");
+            }
+        } break;
+    }
 }
 
 static void
-FirstTerm()
+PopCompare(compiler_context *Context)
 {
-    FirstFactor();
-    RestOfTerms();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "POP", "ebx");
+            EmitInstruction(Context, "CMP", "ebx", "eax");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            // NOTE: The Set* ops pop and compare themselves
+        } break;
+        
+        case Target_C:
+        {
+            // NOTE: The Set* routines pop and compare themselves
+        } break;
+    }
 }
 
 static void
-Add()
+SetEqual(compiler_context *Context, value_type Type)
 {
-    MatchString("+");
-    Term();
-    PopAdd();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "MOV", "eax", "0");
+            EmitInstruction(Context, "SETE", "al");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+            EmitInstruction(Context, "CMP", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_SetEqualLong : Op_SetEqual);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "eax = -(t%d == rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = -(t%d == eax);");
+            }
+        } break;
+    }
 }
 
 static void
-Subtract()
+SetNotEqual(compiler_context *Context, value_type Type)
 {
-    MatchString("-");
-    Term();
-    PopSub();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "MOV", "eax", "0");
+            EmitInstruction(Context, "SETNE", "al");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+            EmitInstruction(Context, "CMP", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_SetNotEqualLong : Op_SetNotEqual);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "eax = -(t%d != rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = -(t%d != eax);");
+            }
+        } break;
+    }
 }
 
 static void
-Expression()
+SetLessThan(compiler_context *Context, value_type Type)
 {
-    FirstTerm();
-    
-    while(IsAddop(Value[0]))
+    switch(Context->Target)
     {
-        Push();
-        if(!strcmp(Value, "+"))
+        case Target_MASM:
         {
-            Add();
-        }
-        else if(!strcmp(Value, "-"))
+            EmitInstruction(Context, "MOV", "eax", "0");
+            EmitInstruction(Context, "SETL", "al");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+            EmitInstruction(Context, "CMP", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
         {
-            Subtract();
-        }
+            EmitOp(Context, (Type == Type_Long) ? Op_SetLessThanLong : Op_SetLessThan);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "eax = -(t%d < rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = -(t%d < eax);");
+            }
+        } break;
     }
 }
 
 static void
-Equals()
+SetGreaterThan(compiler_context *Context, value_type Type)
 {
-    Next();
-    Expression();
-    PopCompare();
-    SetEqual();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "MOV", "eax", "0");
+            EmitInstruction(Context, "SETG", "al");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+            EmitInstruction(Context, "CMP", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_SetGreaterThanLong : Op_SetGreaterThan);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "eax = -(t%d > rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = -(t%d > eax);");
+            }
+        } break;
+    }
 }
 
 static void
-NotEquals()
+SetLessThanOrEqual(compiler_context *Context, value_type Type)
 {
-    Next();
-    Expression();
-    PopCompare();
-    SetNotEqual();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "MOV", "eax", "0");
+            EmitInstruction(Context, "SETLE", "al");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+            EmitInstruction(Context, "CMP", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_SetLessThanOrEqualLong : Op_SetLessThanOrEqual);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "eax = -(t%d <= rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = -(t%d <= eax);");
+            }
+        } break;
+    }
 }
 
 static void
-LessThanOrEqual()
+SetGreaterThanOrEqual(compiler_context *Context, value_type Type)
 {
-    Next();
-    Expression();
-    PopCompare();
-    SetLessThanOrEqual();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "MOV", "eax", "0");
+            EmitInstruction(Context, "SETGE", "al");
+            EmitInstruction(Context, "IMUL", "eax", "-1");
+            EmitInstruction(Context, "CMP", "eax", "-1");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, (Type == Type_Long) ? Op_SetGreaterThanOrEqualLong : Op_SetGreaterThanOrEqual);
+        } break;
+        
+        case Target_C:
+        {
+            if(Type == Type_Long)
+            {
+                PopC(Context, "eax = -(t%d >= rax);");
+            }
+            else
+            {
+                PopC(Context, "eax = -(t%d >= eax);");
+            }
+        } break;
+    }
 }
 
 static void
-GreaterThanOrEqual()
+Branch(compiler_context *Context, char *Label)
 {
-    Next();
-    Expression();
-    PopCompare();
-    SetGreaterThanOrEqual();
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "JMP", Label);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_Branch, LabelIndex(Label));
+        } break;
+        
+        case Target_C:
+        {
+            // NOTE: Control flow is structured in C, see BeginLoop/BeginIf
+        } break;
+    }
 }
 
 static void
-LessThan()
+BranchFalse(compiler_context *Context, char *Label)
 {
-    Next();
-    if(!strcmp(Value, "="))
-    {
-        LessThanOrEqual();
-    }
-    else if(!strcmp(Value, ">"))
-    {
-        NotEquals();
-    }
-    else
+    switch(Context->Target)
     {
-        Expression();
-        PopCompare();
-        SetLessThan();
+        case Target_MASM:
+        {
+            EmitInstruction(Context, "JNE", Label);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_BranchFalse, LabelIndex(Label));
+        } break;
+        
+        case Target_C:
+        {
+            // NOTE: Control flow is structured in C, see BeginLoop/BeginIf
+        } break;
     }
 }
 
-
+// NOTE: Only the MASM layout code needs the inverted branch
 static void
-GreaterThan()
+BranchTrue(compiler_context *Context, char *Label)
 {
-    Next();
-    if(!strcmp(Value, "="))
-    {
-        GreaterThanOrEqual();
-    }
-    else
-    {
-        Expression();
-        PopCompare();
-        SetGreaterThan();
-    }
+    Assert(Context->Target == Target_MASM);
+    EmitInstruction(Context, "JE", Label);
 }
 
+// NOTE: Short-circuit skips past the rest of a condition with the accumulator
+// as it is. On MASM a relation's flags are used as they stand, and still agree
+// with the accumulator at the join; anything else is tested. In C each skip
+// opens a block, JoinSkips closes them.
 static void
-Relation()
+SkipIf(compiler_context *Context, bool WhenTrue, char *Label)
 {
-    Expression();
-    if(IsRelop(Value[0]))
+    switch(Context->Target)
     {
-        Push();
-        if(!strcmp(Value, "="))
+        case Target_MASM:
         {
-            Equals();
-        }
-        else if(!strcmp(Value, "<"))
+            if(Context->Compared)
+            {
+                EmitInstruction(Context, WhenTrue ? (char *)"JE" : (char *)"JNE", Label);
+            }
+            else
+            {
+                EmitInstruction(Context, "TEST", "eax", "eax");
+                EmitInstruction(Context, WhenTrue ? (char *)"JNZ" : (char *)"JZ", Label);
+            }
+        } break;
+        
+        case Target_Bytecode:
         {
-            LessThan();
-        }
-        else if(!strcmp(Value, ">"))
+            EmitOp(Context, WhenTrue ? Op_BranchTrue : Op_BranchFalse, LabelIndex(Label));
+        } break;
+        
+        case Target_C:
         {
-            GreaterThan();
-        }
+            EmitC(Context, WhenTrue ? (char *)"if(!eax)" : (char *)"if(eax)");
+            EmitC(Context, "{");
+            Context->CIndent++;
+        } break;
     }
 }
 
-static void
-NotFactor()
+// NOTE: The skips leave an INT, so the value that got past them has to be one
+// too. Compared is whether every skip was taken on a relation's flags.
+static value_type
+JoinSkips(compiler_context *Context, value_type Type, int NumSkips, char *Label, bool Compared)
 {
-    if(!strcmp(Value, "!"))
+    if(Type == Type_Long)
+    {
+        TestLong(Context);
+        Context->Truth = true;
+    }
+    
+    if(Context->Target == Target_C)
     {
-        MatchString("!");
-        Relation();
-        Not();
+        for(int Skip = 0;
+            Skip < NumSkips;
+            Skip++)
+        {
+            Context->CIndent--;
+            EmitC(Context, "}");
+        }
     }
     else
     {
-        Relation();
+        PostLabel(Context, Label);
     }
+    Context->Compared = Compared && Context->Compared;
+    
+    return Type_Int;
 }
 
 static void
-BoolTerm()
+EmitRead(compiler_context *Context)
 {
-    NotFactor();
+    symbol *Symbol = Variable(Context, Context->Value);
+    bool Long = (Symbol->Type == Type_Long);
+    bool Local = IsLocal(Symbol);
+    char Operand[MaxTokenLength + 32];
     
-    while(!strcmp(Value, "&"))
+    switch(Context->Target)
     {
-        MatchString("&");
-        Push();
-        NotFactor();
-        PopAnd();
+        case Target_MASM:
+        {
+            // NOTE: A routine that reads isn't a leaf, so this is a global or in the frame
+            Assert(!Local || !Context->Leaf);
+            MASMVariable(Context, Symbol, Operand);
+            EmitInstruction(Context, "LEA", "eax", Operand);
+            EmitInstruction(Context, "CALL", "TinyRead");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(Local)
+            {
+                EmitOp(Context, Long ? Op_ReadLocalLong : Op_ReadLocal, Symbol->Slot);
+            }
+            else
+            {
+                EmitOp(Context, Long ? Op_ReadLong : Op_Read, Symbol->Slot);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            CVariable(Symbol, Operand);
+            if(Long)
+            {
+                EmitC(Context, "tiny_read_long(&%s);", Operand);
+                Context->UsesReadLong = true;
+            }
+            else
+            {
+                EmitC(Context, "tiny_read(&%s);", Operand);
+                Context->UsesRead = true;
+            }
+        } break;
     }
 }
 
 static void
-BoolOr()
+EmitWrite(compiler_context *Context)
 {
-    MatchString("|");
-    BoolTerm();
-    PopOr();
+    symbol *Symbol = Variable(Context, Context->Value);
+    char Operand[MaxTokenLength + 32];
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            MASMVariable(Context, Symbol, Operand);
+            EmitInstruction(Context, "MOV", "eax", Operand);
+            EmitInstruction(Context, "CALL", "TinyWrite");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(IsLocal(Symbol))
+            {
+                EmitOp(Context, Op_WriteLocal, Symbol->Slot);
+            }
+            else
+            {
+                EmitOp(Context, (Symbol->Type == Type_Long) ? Op_WriteLong : Op_Write, Symbol->Slot);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            CVariable(Symbol, Operand);
+            for_loop *Loop = ForLoopOf(Context, Symbol);
+            if(Loop)
+            {
+                sprintf(Operand, "(int)for%d", (int)(Loop - Context->ForLoops));
+            }
+            EmitC(Context, "tiny_write(%s);", Operand);
+            Context->UsesWrite = true;
+        } break;
+    }
 }
 
+// NOTE: Before a call, stores the counters of the enclosing FORs to their
+// homes, where the routine can see them. On MASM the routine is free to use
+// the registers, so their limits go on the stack.
 static void
-BoolXor()
+SaveForLoops(compiler_context *Context)
 {
-    MatchString("^");
-    BoolTerm();
-    PopXor();
+    char Home[MaxTokenLength + 32];
+    for(int LoopIndex = 0;
+        LoopIndex < Context->NumForLoops;
+        LoopIndex++)
+    {
+        for_loop *Loop = Context->ForLoops + LoopIndex;
+        if(Context->Target == Target_MASM)
+        {
+            // NOTE: A leaf makes no calls, so the register is never the home
+            if(Loop->CounterRegister)
+            {
+                MASMHome(Context, Loop->Counter, Home);
+                EmitInstruction(Context, "MOV", Home, Loop->CounterRegister);
+            }
+            if(Loop->LimitRegister)
+            {
+                EmitInstruction(Context, "PUSH", Loop->LimitRegister);
+            }
+        }
+        else if((Context->Target == Target_C) && !IsLocal(Loop->Counter))
+        {
+            CVariable(Loop->Counter, Home);
+            EmitC(Context, "%s = (int)for%d;", Home, LoopIndex);
+        }
+    }
 }
 
+// NOTE: After the call, picks the counters up again, the routine may have
+// changed them
 static void
-BoolExpression()
+RestoreForLoops(compiler_context *Context)
 {
-    BoolTerm();
-    
-    while(IsOrop(Value[0]))
+    char Home[MaxTokenLength + 32];
+    for(int LoopIndex = Context->NumForLoops - 1;
+        LoopIndex >= 0;
+        LoopIndex--)
     {
-        Push();
-        
-        if(!strcmp(Value, "|"))
+        for_loop *Loop = Context->ForLoops + LoopIndex;
+        if(Context->Target == Target_MASM)
         {
-            BoolOr();
+            if(Loop->LimitRegister)
+            {
+                EmitInstruction(Context, "POP", Loop->LimitRegister);
+            }
+            if(Loop->CounterRegister)
+            {
+                MASMHome(Context, Loop->Counter, Home);
+                EmitInstruction(Context, "MOV", Loop->CounterRegister, Home);
+            }
         }
-        else if(!strcmp(Value, "^"))
+        else if((Context->Target == Target_C) && !IsLocal(Loop->Counter))
         {
-            BoolXor();
+            CVariable(Loop->Counter, Home);
+            EmitC(Context, "for%d = %s;", LoopIndex, Home);
         }
     }
 }
 
-//
-// --Parsing - Control Structures
-//
-
-// <if>     :== IF <bool-expression> <block> [ ELSE <block> ] ENDIF
-// <while>  :== WHILE <bool-expression> <block> ENDWHILE
-
+// NOTE: Calls Routine. All arguments but the last were pushed, the last is in
+// the accumulator; Types holds each one's type after conversion to its
+// parameter. A FUNCTION leaves its result in the accumulator.
 static void
-If()
+EmitCall(compiler_context *Context, symbol *Routine, value_type *Types)
 {
-    BoolExpression();
-    
-    char FalseLabel[MaxTokenLength];
-    char DoneLabel[MaxTokenLength];
-    NewLabel(FalseLabel);
-    strncpy(DoneLabel, FalseLabel, MaxTokenLength);
-    
-    BranchFalse(FalseLabel);
-    Block();
+    int NumArguments = Routine->NumParameters;
     
-    if(Token == Token_Else)
+    switch(Context->Target)
     {
-        MatchString("l");
-        NewLabel(FalseLabel);
-        PostLabel(FalseLabel);
-        Block();
+        case Target_MASM:
+        {
+            char Label[MaxTokenLength + 8];
+            sprintf(Label, "P_%s", Routine->Name);
+            if(NumArguments > 0)
+            {
+                EmitInstruction(Context, "MOV", MASMParameterRegisters[NumArguments - 1], "eax");
+            }
+            for(int Argument = NumArguments - 2;
+                Argument >= 0;
+                Argument--)
+            {
+                EmitInstruction(Context, "POP", MASMParameterRegisters[Argument]);
+            }
+            EmitInstruction(Context, "CALL", Label);
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_Call, Routine->Slot);
+        } break;
+        
+        case Target_C:
+        {
+            // NOTE: The C compiler passes them in registers, SysV on x86-64
+            char Call[MaxTokenLength + MaxParameters*32];
+            int Length = sprintf(Call, "f_%s(", Routine->Name);
+            for(int Argument = 0;
+                Argument < NumArguments;
+                Argument++)
+            {
+                if(Argument > 0)
+                {
+                    Length += sprintf(Call + Length, ", ");
+                }
+                if((Routine->ParameterTypes[Argument] == Type_Int) && (Types[Argument] == Type_Long))
+                {
+                    Length += sprintf(Call + Length, "(int)");
+                }
+                if(Argument < NumArguments - 1)
+                {
+                    Length += sprintf(Call + Length, "t%d", Context->CStackDepth - (NumArguments - 1) + Argument);
+                }
+                else
+                {
+                    Length += sprintf(Call + Length, "%s", (Types[Argument] == Type_Long) ? "rax" : "eax");
+                }
+            }
+            sprintf(Call + Length, ")");
+            
+            if(Routine->Kind == Symbol_Procedure)
+            {
+                EmitC(Context, "%s;", Call);
+            }
+            else if(Routine->Type == Type_Long)
+            {
+                Context->UsesRax = true;
+                EmitC(Context, "rax = %s;", Call);
+            }
+            else
+            {
+                EmitC(Context, "eax = %s;", Call);
+            }
+            
+            // NOTE: Close the blocks the pushed arguments were held in
+            for(int Argument = 0;
+                Argument < NumArguments - 1;
+                Argument++)
+            {
+                Context->CStackDepth--;
+                Context->CIndent--;
+                EmitC(Context, "}");
+            }
+        } break;
     }
-    
-    PostLabel(DoneLabel);
-    MatchToken(Token_Endif);
 }
 
+// NOTE: Leaves the routine being compiled. A FUNCTION returns the
+// accumulator, which holds a value of Type.
 static void
-While()
+EmitReturn(compiler_context *Context, value_type Type)
 {
-    Next();
-    char ConditionLabel[MaxTokenLength];
-    char DoneLabel[MaxTokenLength];
-    NewLabel(ConditionLabel);
-    NewLabel(DoneLabel);
+    symbol *Routine = Context->Routine;
+    bool Function = (Routine->Kind == Symbol_Function);
     
-    PostLabel(ConditionLabel);
-    BoolExpression();
-    BranchFalse(DoneLabel);
-    Block();
-    MatchToken(Token_EndWhile);
-    Branch(ConditionLabel);
+    // NOTE: Returning from inside FORs leaves them: a global counter goes
+    // home, MASM limits on the stack are dropped (a frame drops them anyway)
+    int StackedLimits = 0;
+    char Home[MaxTokenLength + 32];
+    for(int LoopIndex = 0;
+        LoopIndex < Context->NumForLoops;
+        LoopIndex++)
+    {
+        for_loop *Loop = Context->ForLoops + LoopIndex;
+        if(Context->Target == Target_MASM)
+        {
+            if(Loop->CounterRegister && !IsLocal(Loop->Counter))
+            {
+                MASMHome(Context, Loop->Counter, Home);
+                EmitInstruction(Context, "MOV", Home, Loop->CounterRegister);
+            }
+            StackedLimits += Loop->LimitRegister ? 0 : 1;
+        }
+        else if((Context->Target == Target_C) && !IsLocal(Loop->Counter))
+        {
+            CVariable(Loop->Counter, Home);
+            EmitC(Context, "%s = (int)for%d;", Home, LoopIndex);
+        }
+    }
     
-    PostLabel(DoneLabel);
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            if(Context->Leaf && StackedLimits)
+            {
+                char Size[16];
+                sprintf(Size, "%d", 4*StackedLimits);
+                EmitInstruction(Context, "ADD", "esp", Size);
+            }
+            if(!Context->Leaf)
+            {
+                EmitInstruction(Context, "MOV", "esp", "ebp");
+                EmitInstruction(Context, "POP", "ebp");
+            }
+            EmitLn(Context, "RET");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(Function && (Routine->Type == Type_Long) && (Type != Type_Long))
+            {
+                Widen(Context);
+            }
+            EmitOp(Context, Op_Return);
+        } break;
+        
+        case Target_C:
+        {
+            if(!Function)
+            {
+                EmitC(Context, "return;");
+            }
+            else if((Type == Type_Long) && (Routine->Type == Type_Int))
+            {
+                EmitC(Context, "return (int)rax;");
+            }
+            else if(Type == Type_Long)
+            {
+                EmitC(Context, "return rax;");
+            }
+            else
+            {
+                EmitC(Context, "return eax;");
+            }
+        } break;
+    }
 }
 
+#include "tiny_profile.cpp"
+#include "tiny_runtime.cpp"
+
 //
-// --Parsing - Program Structure
+// --Control flow
 //
 
-static void
-Read()
-{
-    GetName();
-    EmitRead();
-    Next();
-}
+// NOTE: MASM and bytecode lower loops and ifs to labels and branches, the C
+// backend keeps them structured.
 
 static void
-Write()
+BeginLoop(compiler_context *Context, loop_layout *Layout, char *ConditionLabel)
 {
-    GetName();
-    EmitWrite();
-    Next();
+    if(Context->Target == Target_C)
+    {
+        EmitC(Context, "for(;;)");
+        EmitC(Context, "{");
+        Context->CIndent++;
+    }
+    else if(Layout->Rotate)
+    {
+        // NOTE: The condition is cut out again in ExitLoopIfFalse
+        Layout->ConditionStart = Context->Output.Size;
+    }
+    else
+    {
+        PostLabel(Context, ConditionLabel);
+    }
+    CountBlock(Context, Block_LoopHead);
 }
 
 static void
-Assignment()
+ExitLoopIfFalse(compiler_context *Context, loop_layout *Layout, char *ConditionLabel, char *DoneLabel)
 {
-    int SymbolIndex = Lookup(SymbolTable, NumSymbols, Value);
-    Assert(SymbolIndex != 0);
-    char *Variable = SymbolTable[SymbolIndex];
-    
-    Next();
-    MatchString("=");
-    BoolExpression();
-    Store(Variable);
+    if(Context->Target == Target_C)
+    {
+        if(Layout->Hot)
+        {
+            EmitC(Context, "if(TINY_UNLIKELY(!eax)) break;");
+        }
+        else
+        {
+            EmitC(Context, "if(!eax) break;");
+        }
+    }
+    else if(Layout->Rotate)
+    {
+        output_buffer *Output = &Context->Output;
+        size_t Size = Output->Size - Layout->ConditionStart;
+        ReserveOutput(&Layout->Condition, Size);
+        memcpy(Layout->Condition.Data, Output->Data + Layout->ConditionStart, Size);
+        Layout->Condition.Size = Size;
+        
+        // NOTE: A FOR tests its condition in place on the way in and steps
+        // its counter at the bottom, see EndLoop
+        if(Layout->For)
+        {
+            EmitInstruction(Context, "JG", DoneLabel);
+        }
+        else
+        {
+            Output->Size = Layout->ConditionStart;
+            Branch(Context, ConditionLabel);
+        }
+        PostLabel(Context, Layout->BodyLabel);
+    }
+    else
+    {
+        BranchFalse(Context, DoneLabel);
+    }
+    CountBlock(Context, Block_LoopBody);
 }
 
 static void
-Block()
+EndLoop(compiler_context *Context, loop_layout *Layout, char *ConditionLabel, char *DoneLabel)
 {
-    while((Token != Token_EndWhile) && (Token != Token_Else) && (Token != Token_End))
+    if(Context->Target == Target_C)
+    {
+        Context->CIndent--;
+        EmitC(Context, "}");
+    }
+    else if(Layout->Rotate)
     {
-        if(Token == Token_If)
+        if(!Layout->For)
         {
-            If();
+            PostLabel(Context, ConditionLabel);
         }
-        else if(Token == Token_While)
+        ReserveOutput(&Context->Output, Layout->Condition.Size);
+        memcpy(Context->Output.Data + Context->Output.Size, Layout->Condition.Data, Layout->Condition.Size);
+        Context->Output.Size += Layout->Condition.Size;
+        free(Layout->Condition.Data);
+        Layout->Condition = {};
+        
+        if(Layout->For)
         {
-            While();
+            // NOTE: Goes on while the counter was below the limit, so a limit
+            // of the largest INT ends the loop rather than wrapping around
+            // into it. LEA and MOV leave the CMP's flags alone.
+            for_loop *Loop = Layout->For;
+            char Step[MaxTokenLength + 32];
+            if(Loop->CounterRegister)
+            {
+                sprintf(Step, "[%s + 1]", Loop->CounterRegister);
+                EmitInstruction(Context, "LEA", Loop->CounterRegister, Step);
+            }
+            else
+            {
+                MASMHome(Context, Loop->Counter, Step);
+                EmitInstruction(Context, "MOV", "eax", Step);
+                EmitInstruction(Context, "LEA", "eax", "[eax + 1]");
+                EmitInstruction(Context, "MOV", Step, "eax");
+            }
+            EmitInstruction(Context, "JL", Layout->BodyLabel);
         }
-        else if(Token == Token_Read)
+        else
         {
-            Read();
+            BranchTrue(Context, Layout->BodyLabel);
         }
-        else if(Token == Token_Write)
+        PostLabel(Context, DoneLabel);
+    }
+    else
+    {
+        Branch(Context, ConditionLabel);
+        PostLabel(Context, DoneLabel);
+    }
+    CountBlock(Context, Block_LoopExit);
+}
+
+static void
+BeginIf(compiler_context *Context, if_layout *Layout, char *FalseLabel)
+{
+    if(Context->Target == Target_C)
+    {
+        if(Layout->Likely)
         {
-            Write();
+            EmitC(Context, "if(TINY_LIKELY(eax))");
         }
-        else if(Token == Token_Identifier)
+        else if(Layout->Unlikely)
         {
-            Assignment();
+            EmitC(Context, "if(TINY_UNLIKELY(eax))");
         }
         else
         {
-            char Message[1024];
-            sprintf(Message, "Unexpected \'%s\'", Value);
-            Abort(Message);
+            EmitC(Context, "if(eax)");
         }
-        
-        Semicolon();
+        EmitC(Context, "{");
+        Context->CIndent++;
+    }
+    else if(Layout->ColdThen)
+    {
+        // NOTE: MASM only, ELSE (or whatever follows) falls through
+        BranchTrue(Context, Layout->ThenLabel);
+        Layout->ColdStart = Context->Output.Size;
+        PostLabel(Context, Layout->ThenLabel);
+    }
+    else
+    {
+        BranchFalse(Context, FalseLabel);
+    }
+    CountBlock(Context, Block_Then);
+}
+
+static void
+BeginElse(compiler_context *Context, if_layout *Layout, char *FalseLabel, char *DoneLabel)
+{
+    if(Context->Target == Target_C)
+    {
+        Context->CIndent--;
+        EmitC(Context, "}");
+        EmitC(Context, "else");
+        EmitC(Context, "{");
+        Context->CIndent++;
     }
+    else if(Layout->ColdThen)
+    {
+        MoveToColdSection(Context, Layout->ColdStart, DoneLabel);
+    }
+    else if(Layout->ColdElse)
+    {
+        // NOTE: THEN falls through to the join, ELSE is moved out in EndIf
+        Layout->ColdStart = Context->Output.Size;
+        PostLabel(Context, FalseLabel);
+    }
+    else
+    {
+        Branch(Context, DoneLabel);
+        PostLabel(Context, FalseLabel);
+    }
+    CountBlock(Context, Block_Else);
 }
 
 static void
-Header()
+EndIf(compiler_context *Context, if_layout *Layout, bool HasElse, char *DoneLabel)
 {
-    EmitNoTab(".386");
-    EmitNoTab(".model flat, stdcall");
-    EmitNoTab("option casemap:none");
-    EmitNoTab("include C:\\masm32\\include\\windows.inc");
-    EmitNoTab("include C:\\masm32\\include\\kernel32.inc");
-    EmitNoTab("includelib C:\\masm32\\lib\\kernel32.lib");
-    EmitNoTab("include C:\\masm32\\include\\msvcrt.inc");
-    EmitNoTab("includelib C:\\masm32\\lib\\msvcrt.lib");
-    EmitNoTab(".data");
-    EmitNoTab("PrintFormat db \"%d\", 13, 10, 0");
-    EmitNoTab("ReadFormat db \"%d\", 0");
+    if(Context->Target == Target_C)
+    {
+        Context->CIndent--;
+        EmitC(Context, "}");
+    }
+    else
+    {
+        if((Layout->ColdThen && !HasElse) || (Layout->ColdElse && HasElse))
+        {
+            MoveToColdSection(Context, Layout->ColdStart, DoneLabel);
+        }
+        PostLabel(Context, DoneLabel);
+    }
+    CountBlock(Context, Block_Join);
 }
 
+//
+// --Parsing - Expressions
+//
+
+// NOTE: Expression grammer
+// <assignment>   :== <identifier> [ '[' <bool-expr> ']' ] = <bool-expr>
+// <bool-expr>    :== <bool-term> (<orop> <bool-term>)*
+// <bool-term>    :== <not-factor> (<andop> <not-factor>)*
+// <not-factor>   :== ['!'] <relation>
+// <relation>     :== <expression> [ <relop> <expression> ]
+// <expression>   :== <first-term> (<addop> <term>)*
+// <first-term>   :== <first-factor> <rest>
+// <term>         :== <factor> <rest>
+// <rest>         :== (<mulop> <factor>)*
+// <first factor> :== [ <adop> ] <factor>
+// <factor>       :== <var> | <var> '[' <bool-expr> ']' | <number> | <call> | '(' <bool-expr> ')'
+
+static value_type BoolExpression(compiler_context *Context);
+static void Block(compiler_context *Context);
+
+// NOTE: Returns the PROCEDURE or FUNCTION called Name, 0 if it's something else
+static symbol *
+FindRoutine(compiler_context *Context, char *Name)
+{
+    symbol *Result = FindSymbol(Context, Name);
+    if(Result && !IsRoutine(Result))
+    {
+        Result = 0;
+    }
+    
+    return Result;
+}
 
 static void
-Main()
+WrongArguments(compiler_context *Context, symbol *Routine)
 {
-    MatchToken(Token_Begin);
-    EmitNoTab(".code");
-    PostLabel("MAIN");
+    char Message[1024];
+    sprintf(Message, "\'%s\' takes %d arguments", Routine->Name, Routine->NumParameters);
+    Abort(Context, Message);
+}
+
+// NOTE: Arguments are evaluated left to right and converted to their
+// parameter's type, all but the last are pushed. Returns the type of the
+// result a FUNCTION leaves in the accumulator.
+static value_type
+Call(compiler_context *Context, symbol *Routine)
+{
+    value_type Types[MaxParameters];
+    int NumArguments = 0;
+    
+    SaveForLoops(Context);
+    Next(Context);
+    if(!strcmp(Context->Value, "("))
+    {
+        Next(Context);
+        while(strcmp(Context->Value, ")"))
+        {
+            if(NumArguments > 0)
+            {
+                MatchString(Context, ",");
+                Push(Context, Types[NumArguments - 1]);
+            }
+            if(NumArguments == Routine->NumParameters)
+            {
+                WrongArguments(Context, Routine);
+            }
+            
+            value_type Type = BoolExpression(Context);
+            if((Routine->ParameterTypes[NumArguments] == Type_Long) && (Type != Type_Long))
+            {
+                Widen(Context);
+                Type = Type_Long;
+            }
+            Types[NumArguments++] = Type;
+        }
+        MatchString(Context, ")");
+    }
     
-    Block();
+    if(NumArguments != Routine->NumParameters)
+    {
+        WrongArguments(Context, Routine);
+    }
+    EmitCall(Context, Routine, Types);
+    RestoreForLoops(Context);
     
-    MatchToken(Token_End);
-    EmitLn("call ExitProcess");
-    EmitNoTab("end MAIN");
+    return Routine->Type;
 }
 
-static void
-AddEntry(char *Name)
+//
+// --Bounds checks
+//
+
+// NOTE: Whether the current token can't continue an expression, so one ends
+// before it: a ';', a keyword or the name starting the next statement
+static bool
+EndsExpression(compiler_context *Context)
 {
-    char *Symbol = (char *)malloc(strlen(Name) + 1);
-    memcpy(Symbol, Name, strlen(Name) + 1);
+    bool Result = (!strcmp(Context->Value, ";") || (Context->Token == Token_Identifier) ||
+                   ((Context->Token != Token_Number) && (Context->Token != Token_Operator)));
     
-    Assert(NumSymbols < sizeof(SymbolTable)/sizeof(char *));
-    SymbolTable[NumSymbols++] = Symbol;
+    return Result;
 }
 
-static void
-Alloc(char *Name)
+// NOTE: Returns the value of the current token if it's a literal that makes
+// up the whole expression, -1 otherwise. The next token has to be End, or
+// with End 0 anything EndsExpression accepts.
+static long long
+LoneNumber(compiler_context *Context, char *End)
 {
-    if(InSymbolTable(Name))
+    long long Result = -1;
+    
+    if(Context->Token == Token_Number)
     {
-        Abort("Duplicate variable name");
+        long long Value = strtoll(Context->Value, 0, 10);
+        
+        lexer_state Saved;
+        SaveLexer(Context, &Saved);
+        Next(Context);
+        if(End ? !strcmp(Context->Value, End) : EndsExpression(Context))
+        {
+            Result = Value;
+        }
+        RestoreLexer(Context, &Saved);
     }
     
-    AddEntry(Name);
-    
-    fprintf(OutputStream, "%s DWORD ", Name);
+    return Result;
+}
+
+// NOTE: With the current token after '[', tells whether the index is known
+// to be in bounds before it's compiled: a literal is checked right here, a
+// counter on its own against the ranges of the enclosing loops
+static bool
+IndexInBounds(compiler_context *Context, symbol *Array)
+{
+    bool Result = false;
     
-    Next();
-    if(!strcmp(Value, "="))
+    long long Constant = LoneNumber(Context, "]");
+    if(Constant >= 0)
     {
-        GetNumber();
-        fprintf(OutputStream, "%s\n", Value);
-        Next();
+        if(Constant >= Array->Length)
+        {
+            char Message[1024];
+            sprintf(Message, "Index %s is out of bounds, \'%s\' has %d elements", Context->Value, Array->Name, Array->Length);
+            Abort(Context, Message);
+        }
+        Result = true;
     }
-    else
+    else if(Context->Token == Token_Identifier)
     {
-        fprintf(OutputStream, "?\n");
+        symbol *Counter = FindSymbol(Context, Context->Value);
+        size_t Position = Context->SourcePosition;
+        
+        lexer_state Saved;
+        SaveLexer(Context, &Saved);
+        Next(Context);
+        bool Alone = !strcmp(Context->Value, "]");
+        RestoreLexer(Context, &Saved);
+        
+        for(int RangeIndex = 0;
+            Alone && !Result && (RangeIndex < Context->NumIndexRanges);
+            RangeIndex++)
+        {
+            index_range *Range = Context->IndexRanges + RangeIndex;
+            Result = ((Range->Counter == Counter) && (Position < Range->Until) && (Range->Below <= Array->Length));
+        }
     }
+    
+    return Result;
 }
 
-static void
-Decl()
+// NOTE: With the current token after a counter's '=', whether the statement
+// is <counter> = <counter> + <integer>, adding at most Most
+static bool
+IsIncrement(compiler_context *Context, symbol *Counter, long long Most)
 {
-    GetName();
-    Alloc(Value);
+    bool Result = false;
     
-    while(!strcmp(Value, ","))
+    Next(Context);
+    if((Context->Token == Token_Identifier) && !strcmp(Context->Value, Counter->Name))
     {
-        GetName();
-        Alloc(Value);
+        Next(Context);
+        if(!strcmp(Context->Value, "+"))
+        {
+            Next(Context);
+            long long Step = LoneNumber(Context, 0);
+            Result = ((Step >= 0) && (Step <= Most));
+        }
     }
     
-    Semicolon();
+    return Result;
 }
 
-static void
-TopDecls()
+// NOTE: With the current token at the start of a WHILE's condition, looks
+// ahead for a counter the loop keeps in range. That takes a condition
+// <counter> < <integer> (or <=), a statement right before the loop setting
+// the counter to a constant >= 0, and a body that only ever adds a constant
+// >= 0 to it, outside any inner loop. A global counter also takes a body
+// that calls no routine: the call could set it to anything, negative too, and
+// the next iteration would index with that before the condition caught it.
+// Then the counter is in [0, Below) in every iteration up to the first
+// statement that changes it.
+static bool
+PlanIndexRange(compiler_context *Context, index_range *Range)
 {
-    while(Token != Token_Begin)
+    bool Result = false;
+    
+    symbol *Counter = (Context->Token == Token_Identifier) ? FindSymbol(Context, Context->Value) : 0;
+    if(!Counter || (Counter != Context->PreviousConstant) || (Counter->Type != Type_Int))
+    {
+        return Result;
+    }
+    
+    lexer_state Saved;
+    SaveLexer(Context, &Saved);
+    
+    long long Below = -1;
+    Next(Context);
+    if(!strcmp(Context->Value, "<"))
     {
-        if(Token == Token_Var)
+        Next(Context);
+        bool OrEqual = !strcmp(Context->Value, "=");
+        if(OrEqual)
         {
-            Decl();
+            Next(Context);
         }
-        else
+        Below = LoneNumber(Context, 0);
+        if((Below >= 0) && OrEqual)
         {
-            char Message[1024];
-            sprintf(Message, "Unrecognized Keyword \'%s\'", Value);
-            Abort(Message);
+            Below++;
+        }
+    }
+    
+    if((Below > Context->PreviousConstantValue) && (Below <= MaxArrayLength))
+    {
+        Result = true;
+        Range->Counter = Counter;
+        Range->Below = (int)Below;
+        Range->Until = (size_t)-1;
+        
+        Next(Context);
+        int Loops = 0;
+        while(Result && !((Loops == 0) && (Context->Token == Token_EndWhile)) && (Context->Value[0] != (char)EOF))
+        {
+            if((Context->Token == Token_Identifier) && !strcmp(Context->Value, Counter->Name))
+            {
+                size_t At = Context->SourcePosition;
+                Next(Context);
+                if(!strcmp(Context->Value, "="))
+                {
+                    // NOTE: Could be a comparison, that just loses the range
+                    Result = ((Loops == 0) && IsIncrement(Context, Counter, 2147483647LL - Below));
+                    if(At < Range->Until)
+                    {
+                        Range->Until = At;
+                    }
+                }
+                continue;
+            }
+            
+            if((Context->Token == Token_Identifier) && (Counter->Kind == Symbol_Global) &&
+               FindRoutine(Context, Context->Value))
+            {
+                Result = false;
+            }
+            else if(Context->Token == Token_Read)
+            {
+                Next(Context);
+                Result = strcmp(Context->Value, Counter->Name) != 0;
+            }
+            else if((Context->Token == Token_While) || (Context->Token == Token_For))
+            {
+                Loops++;
+            }
+            else if((Context->Token == Token_EndWhile) || (Context->Token == Token_EndFor))
+            {
+                Loops--;
+            }
+            Next(Context);
         }
     }
+    
+    RestoreLexer(Context, &Saved);
+    
+    return Result;
 }
 
+// NOTE: Compiles '[' <bool-expr> ']' after an array's name, leaving the index
+// in the accumulator as an INT, checked unless it's known to be in bounds
 static void
-Program()
+Index(compiler_context *Context, symbol *Array)
 {
-    MatchToken(Token_Program);
-    Semicolon();
-    Header();
-    TopDecls();
-    Main();
+    Next(Context);
+    MatchString(Context, "[");
+    bool InBounds = IndexInBounds(Context, Array);
+    if(BoolExpression(Context) == Type_Long)
+    {
+        NarrowIndex(Context);
+    }
+    MatchString(Context, "]");
+    
+    if(Context->CheckBounds && !InBounds)
+    {
+        CheckIndex(Context, Array);
+    }
 }
 
-static void
-Init()
+static value_type
+Factor(compiler_context *Context)
+{
+    value_type Result = Type_Int;
+    
+    symbol *Routine = (Context->Token == Token_Identifier) ? FindRoutine(Context, Context->Value) : 0;
+    symbol *Array = (Context->Token == Token_Identifier) ? FindArray(Context, Context->Value) : 0;
+    if(!strcmp(Context->Value, "("))
+    {
+        MatchString(Context, "(");
+        Result = BoolExpression(Context);
+        MatchString(Context, ")");
+    }
+    else if(Routine)
+    {
+        if(Routine->Kind != Symbol_Function)
+        {
+            char Message[1024];
+            sprintf(Message, "\'%s\' is a PROCEDURE, it has no value", Routine->Name);
+            Abort(Context, Message);
+        }
+        Result = Call(Context, Routine);
+        Context->Truth = Context->Compared = false;
+    }
+    else if(Array)
+    {
+        Index(Context, Array);
+        Result = LoadElement(Context, Array);
+        Context->Truth = Context->Compared = false;
+    }
+    else
+    {
+        if(Context->Token == Token_Number)
+        {
+            Result = LoadConstant(Context, false);
+        }
+        else if(Context->Token == Token_Identifier)
+        {
+            Result = LoadVariable(Context, Context->Value);
+        }
+        else
+        {
+            Expected(Context, "Math factor");
+        }
+        
+        Next(Context);
+        Context->Truth = Context->Compared = false;
+    }
+    
+    return Result;
+}
+
+static value_type
+NegativeFactor(compiler_context *Context)
 {
-    char OutputFileName[1024];
-    sprintf(OutputFileName, "test1.asm");
-    OutputStream = fopen(OutputFileName, "w");
+    value_type Result;
     
-    GetChar();
-    Next();
+    MatchString(Context, "-");
+    if(IsDigit(Context->Value[0]))
+    {
+        GetNumber(Context);
+        Result = LoadConstant(Context, true);
+    }
+    else
+    {
+        Result = Factor(Context);
+        Negate(Context, Result);
+    }
+    Context->Truth = Context->Compared = false;
+    
+    return Result;
 }
 
-int
-main()
+static value_type
+FirstFactor(compiler_context *Context)
 {
-    Init();
-    Program();
+    value_type Result;
     
-    if(InputStream != stdin)
+    if(!strcmp(Context->Value, "+"))
     {
-        fclose(InputStream);
+        MatchString(Context, "+");
+        Result = Factor(Context);
+    }
+    else if(!strcmp(Context->Value, "-"))
+    {
+        Result = NegativeFactor(Context);
     }
-    if(OutputStream != stdout)
+    else
     {
-        fclose(OutputStream);
+        Result = Factor(Context);
     }
-}
\ No newline at end of file
+    
+    return Result;
+}
+
+static value_type
+Multiply(compiler_context *Context, value_type Left)
+{
+    MatchString(Context, "*");
+    value_type Result = Promote(Context, Left, Factor(Context));
+    PopMul(Context, Result);
+    
+    return Result;
+}
+
+static value_type
+Divide(compiler_context *Context, value_type Left)
+{
+    MatchString(Context, "/");
+    value_type Result = Promote(Context, Left, Factor(Context));
+    PopDiv(Context, Result);
+    
+    return Result;
+}
+
+static value_type
+RestOfTerms(compiler_context *Context, value_type Type)
+{
+    while(IsMulop(Context->Value[0]))
+    {
+        Push(Context, Type);
+        if(!strcmp(Context->Value, "*"))
+        {
+            Type = Multiply(Context, Type);
+        }
+        else if(!strcmp(Context->Value, "/"))
+        {
+            Type = Divide(Context, Type);
+        }
+        Context->Truth = Context->Compared = false;
+    }
+    
+    return Type;
+}
+
+static value_type
+Term(compiler_context *Context)
+{
+    value_type Result = RestOfTerms(Context, Factor(Context));
+    
+    return Result;
+}
+
+static value_type
+FirstTerm(compiler_context *Context)
+{
+    value_type Result = RestOfTerms(Context, FirstFactor(Context));
+    
+    return Result;
+}
+
+static value_type
+Add(compiler_context *Context, value_type Left)
+{
+    MatchString(Context, "+");
+    value_type Result = Promote(Context, Left, Term(Context));
+    PopAdd(Context, Result);
+    
+    return Result;
+}
+
+static value_type
+Subtract(compiler_context *Context, value_type Left)
+{
+    MatchString(Context, "-");
+    value_type Result = Promote(Context, Left, Term(Context));
+    PopSub(Context, Result);
+    
+    return Result;
+}
+
+static value_type
+Expression(compiler_context *Context)
+{
+    value_type Result = FirstTerm(Context);
+    
+    while(IsAddop(Context->Value[0]))
+    {
+        Push(Context, Result);
+        if(!strcmp(Context->Value, "+"))
+        {
+            Result = Add(Context, Result);
+        }
+        else if(!strcmp(Context->Value, "-"))
+        {
+            Result = Subtract(Context, Result);
+        }
+        Context->Truth = Context->Compared = false;
+    }
+    
+    return Result;
+}
+
+// NOTE: The relations below return the type the two sides were compared in,
+// the result itself is always an INT
+
+static value_type
+CompareWith(compiler_context *Context, value_type Left)
+{
+    value_type Result = Promote(Context, Left, Expression(Context));
+    PopCompare(Context);
+    
+    return Result;
+}
+
+static void
+Equals(compiler_context *Context, value_type Left)
+{
+    Next(Context);
+    SetEqual(Context, CompareWith(Context, Left));
+}
+
+static void
+NotEquals(compiler_context *Context, value_type Left)
+{
+    Next(Context);
+    SetNotEqual(Context, CompareWith(Context, Left));
+}
+
+static void
+LessThanOrEqual(compiler_context *Context, value_type Left)
+{
+    Next(Context);
+    SetLessThanOrEqual(Context, CompareWith(Context, Left));
+}
+
+static void
+GreaterThanOrEqual(compiler_context *Context, value_type Left)
+{
+    Next(Context);
+    SetGreaterThanOrEqual(Context, CompareWith(Context, Left));
+}
+
+static void
+LessThan(compiler_context *Context, value_type Left)
+{
+    Next(Context);
+    if(!strcmp(Context->Value, "="))
+    {
+        LessThanOrEqual(Context, Left);
+    }
+    else if(!strcmp(Context->Value, ">"))
+    {
+        NotEquals(Context, Left);
+    }
+    else
+    {
+        SetLessThan(Context, CompareWith(Context, Left));
+    }
+}
+
+
+static void
+GreaterThan(compiler_context *Context, value_type Left)
+{
+    Next(Context);
+    if(!strcmp(Context->Value, "="))
+    {
+        GreaterThanOrEqual(Context, Left);
+    }
+    else
+    {
+        SetGreaterThan(Context, CompareWith(Context, Left));
+    }
+}
+
+static value_type
+Relation(compiler_context *Context)
+{
+    value_type Result = Expression(Context);
+    if(IsRelop(Context->Value[0]))
+    {
+        Push(Context, Result);
+        if(!strcmp(Context->Value, "="))
+        {
+            Equals(Context, Result);
+        }
+        else if(!strcmp(Context->Value, "<"))
+        {
+            LessThan(Context, Result);
+        }
+        else if(!strcmp(Context->Value, ">"))
+        {
+            GreaterThan(Context, Result);
+        }
+        Result = Type_Int;
+        Context->Truth = true;
+        Context->Compared = true;
+    }
+    
+    return Result;
+}
+
+static value_type
+NotFactor(compiler_context *Context)
+{
+    value_type Result;
+    
+    if(!strcmp(Context->Value, "!"))
+    {
+        MatchString(Context, "!");
+        Result = Relation(Context);
+        Not(Context, Result);
+        Context->Compared = false;
+    }
+    else
+    {
+        Result = Relation(Context);
+    }
+    
+    return Result;
+}
+
+// NOTE: The bitwise operators below give a truth value when both sides are one
+
+static value_type
+BoolAnd(compiler_context *Context, value_type Left)
+{
+    bool Truth = Context->Truth;
+    MatchString(Context, "&");
+    value_type Result = Promote(Context, Left, NotFactor(Context));
+    PopAnd(Context, Result);
+    Context->Truth = Truth && Context->Truth;
+    Context->Compared = false;
+    
+    return Result;
+}
+
+static value_type
+BoolTerm(compiler_context *Context)
+{
+    value_type Result = NotFactor(Context);
+    
+    while(!strcmp(Context->Value, "&"))
+    {
+        Push(Context, Result);
+        Result = BoolAnd(Context, Result);
+    }
+    
+    return Result;
+}
+
+static value_type
+BoolOr(compiler_context *Context, value_type Left)
+{
+    bool Truth = Context->Truth;
+    MatchString(Context, "|");
+    value_type Result = Promote(Context, Left, BoolTerm(Context));
+    PopOr(Context, Result);
+    Context->Truth = Truth && Context->Truth;
+    Context->Compared = false;
+    
+    return Result;
+}
+
+static value_type
+BoolXor(compiler_context *Context, value_type Left)
+{
+    bool Truth = Context->Truth;
+    MatchString(Context, "^");
+    value_type Result = Promote(Context, Left, BoolTerm(Context));
+    PopXor(Context, Result);
+    Context->Truth = Truth && Context->Truth;
+    Context->Compared = false;
+    
+    return Result;
+}
+
+static value_type
+BoolExpression(compiler_context *Context)
+{
+    value_type Result = BoolTerm(Context);
+    
+    while(IsOrop(Context->Value[0]))
+    {
+        Push(Context, Result);
+        
+        if(!strcmp(Context->Value, "|"))
+        {
+            Result = BoolOr(Context, Result);
+        }
+        else if(!strcmp(Context->Value, "^"))
+        {
+            Result = BoolXor(Context, Result);
+        }
+    }
+    
+    return Result;
+}
+
+// NOTE: Conditions short-circuit. Once the left of an & is a truth value
+// that's 0, or the left of an | one that's -1, it's the answer and the right
+// isn't evaluated; when it isn't, the answer is the right's value. Anything
+// else, x & y say, is still worked out bit by bit, so a condition holds
+// exactly when the same BoolExpression stored would be nonzero. Parentheses
+// around an operand short-circuit inside too.
+
+static value_type ConditionExpression(compiler_context *Context);
+
+// NOTE: With the current token '(', whether the parentheses make up a whole
+// operand of & or |: nothing after them can still be part of a relation
+static bool
+LoneParens(compiler_context *Context)
+{
+    lexer_state Saved;
+    SaveLexer(Context, &Saved);
+    
+    int Depth = 0;
+    do
+    {
+        if(!strcmp(Context->Value, "("))
+        {
+            Depth++;
+        }
+        else if(!strcmp(Context->Value, ")"))
+        {
+            Depth--;
+        }
+        Next(Context);
+    } while((Depth > 0) && (Context->Value[0] != (char)EOF));
+    
+    bool Result = (!strcmp(Context->Value, "&") || IsOrop(Context->Value[0]) ||
+                   !strcmp(Context->Value, ")") || EndsExpression(Context));
+    RestoreLexer(Context, &Saved);
+    
+    return Result;
+}
+
+static value_type
+ConditionFactor(compiler_context *Context)
+{
+    value_type Result;
+    
+    bool Negated = !strcmp(Context->Value, "!");
+    if(Negated)
+    {
+        MatchString(Context, "!");
+    }
+    
+    if(!strcmp(Context->Value, "(") && LoneParens(Context))
+    {
+        MatchString(Context, "(");
+        Result = ConditionExpression(Context);
+        MatchString(Context, ")");
+    }
+    else
+    {
+        Result = Relation(Context);
+    }
+    
+    if(Negated)
+    {
+        Not(Context, Result);
+        Context->Compared = false;
+    }
+    
+    return Result;
+}
+
+static value_type
+ConditionTerm(compiler_context *Context)
+{
+    value_type Result = ConditionFactor(Context);
+    
+    char FalseLabel[MaxTokenLength];
+    int NumSkips = 0;
+    bool Compared = true;
+    while(!strcmp(Context->Value, "&"))
+    {
+        if(Context->Truth)
+        {
+            if(!NumSkips)
+            {
+                NewLabel(Context, FalseLabel);
+            }
+            MatchString(Context, "&");
+            Compared = Compared && Context->Compared;
+            SkipIf(Context, false, FalseLabel);
+            NumSkips++;
+            Result = ConditionFactor(Context);
+        }
+        else
+        {
+            Push(Context, Result);
+            Result = BoolAnd(Context, Result);
+        }
+    }
+    
+    if(NumSkips)
+    {
+        Result = JoinSkips(Context, Result, NumSkips, FalseLabel, Compared);
+    }
+    
+    return Result;
+}
+
+static value_type
+ConditionExpression(compiler_context *Context)
+{
+    value_type Result = ConditionTerm(Context);
+    
+    char TrueLabel[MaxTokenLength];
+    int NumSkips = 0;
+    bool Compared = true;
+    while(IsOrop(Context->Value[0]))
+    {
+        if(!strcmp(Context->Value, "|") && Context->Truth)
+        {
+            if(!NumSkips)
+            {
+                NewLabel(Context, TrueLabel);
+            }
+            MatchString(Context, "|");
+            Compared = Compared && Context->Compared;
+            SkipIf(Context, true, TrueLabel);
+            NumSkips++;
+            Result = ConditionTerm(Context);
+        }
+        else
+        {
+            Push(Context, Result);
+            
+            if(!strcmp(Context->Value, "|"))
+            {
+                Result = BoolOr(Context, Result);
+            }
+            else if(!strcmp(Context->Value, "^"))
+            {
+                Result = BoolXor(Context, Result);
+            }
+        }
+    }
+    
+    if(NumSkips)
+    {
+        Result = JoinSkips(Context, Result, NumSkips, TrueLabel, Compared);
+    }
+    
+    return Result;
+}
+
+// NOTE: A BoolExpression that IF and WHILE branch on
+static void
+Condition(compiler_context *Context)
+{
+    if(ConditionExpression(Context) == Type_Long)
+    {
+        TestLong(Context);
+        Context->Truth = true;
+    }
+    
+    // NOTE: BranchFalse is JNE, so on MASM the flags have to be equal exactly
+    // when the condition holds. A relation leaves them that way already.
+    if((Context->Target == Target_MASM) && !Context->Compared)
+    {
+        if(!Context->Truth)
+        {
+            EmitInstruction(Context, "NEG", "eax");
+            EmitInstruction(Context, "SBB", "eax", "eax");
+        }
+        EmitInstruction(Context, "CMP", "eax", "-1");
+    }
+}
+
+//
+// --Parsing - Control Structures
+//
+
+// <if>     :== IF <bool-expression> <block> [ ELSE <block> ] ENDIF
+// <while>  :== WHILE <bool-expression> <block> ENDWHILE
+// <for>    :== FOR <ident> = <bool-expression> TO <bool-expression> <block> ENDFOR
+// <case>   :== CASE <bool-expression> ( OF <label> ( ',' <label> )* <block> )* [ ELSE <block> ] ENDCASE
+// <label>  :== [ '-' ] <integer>
+
+static void
+If(compiler_context *Context)
+{
+    Next(Context);
+    Condition(Context);
+    
+    char FalseLabel[MaxTokenLength];
+    char DoneLabel[MaxTokenLength];
+    NewLabel(Context, FalseLabel);
+    strncpy(DoneLabel, FalseLabel, MaxTokenLength);
+    
+    if_layout Layout;
+    PlanIf(Context, &Layout);
+    
+    BeginIf(Context, &Layout, FalseLabel);
+    Block(Context);
+    
+    MarkSourceLine(Context);
+    bool HasElse = (Context->Token == Token_Else);
+    if(HasElse)
+    {
+        Next(Context);
+        NewLabel(Context, DoneLabel);
+        BeginElse(Context, &Layout, FalseLabel, DoneLabel);
+        Block(Context);
+        MarkSourceLine(Context);
+    }
+    
+    EndIf(Context, &Layout, HasElse, DoneLabel);
+    MatchToken(Context, Token_Endif);
+}
+
+static void
+While(compiler_context *Context)
+{
+    Next(Context);
+    index_range Range;
+    bool Ranged = (Context->CheckBounds && (Context->NumIndexRanges < MaxIndexRanges) &&
+                   PlanIndexRange(Context, &Range));
+    if(Ranged)
+    {
+        Context->IndexRanges[Context->NumIndexRanges++] = Range;
+    }
+    
+    char ConditionLabel[MaxTokenLength];
+    char DoneLabel[MaxTokenLength];
+    NewLabel(Context, ConditionLabel);
+    NewLabel(Context, DoneLabel);
+    
+    loop_layout Layout;
+    PlanLoop(Context, &Layout);
+    
+    BeginLoop(Context, &Layout, ConditionLabel);
+    Condition(Context);
+    ExitLoopIfFalse(Context, &Layout, ConditionLabel, DoneLabel);
+    Block(Context);
+    MarkSourceLine(Context);
+    MatchToken(Context, Token_EndWhile);
+    EndLoop(Context, &Layout, ConditionLabel, DoneLabel);
+    
+    if(Ranged)
+    {
+        Context->NumIndexRanges--;
+    }
+}
+
+// NOTE: The block of a FOR can't assign its counter
+static void
+ProtectForCounter(compiler_context *Context, symbol *Symbol)
+{
+    if(Symbol && ForLoopOf(Context, Symbol))
+    {
+        char Message[1024];
+        sprintf(Message, "\'%s\' is the counter of an enclosing FOR", Symbol->Name);
+        Abort(Context, Message);
+    }
+}
+
+// NOTE: With the current token at the start of a FOR's block, looks ahead to
+// its ENDFOR for how deep the FORs inside it nest, and for where it first
+// names a routine ((size_t)-1 if it doesn't)
+static void
+ScanForBody(compiler_context *Context, int *InnerLoops, size_t *FirstCall)
+{
+    *InnerLoops = 0;
+    *FirstCall = (size_t)-1;
+    
+    lexer_state Saved;
+    SaveLexer(Context, &Saved);
+    
+    int Depth = 0;
+    while(!((Depth == 0) && (Context->Token == Token_EndFor)) && (Context->Value[0] != (char)EOF))
+    {
+        if(Context->Token == Token_For)
+        {
+            Depth++;
+            if(Depth > *InnerLoops)
+            {
+                *InnerLoops = Depth;
+            }
+        }
+        else if(Context->Token == Token_EndFor)
+        {
+            Depth--;
+        }
+        else if((Context->Token == Token_Identifier) && FindRoutine(Context, Context->Value) &&
+                (Context->SourcePosition < *FirstCall))
+        {
+            *FirstCall = Context->SourcePosition;
+        }
+        Next(Context);
+    }
+    
+    RestoreLexer(Context, &Saved);
+}
+
+// NOTE: Gives a MASM FOR the registers it can have. esi and edi survive
+// TinyRead and TinyWrite, and SaveForLoops saves them around calls; a leaf
+// calls nothing and has whichever of MASMParameterRegisters its parameters
+// and locals leave. Inner loops run more often, so a FOR leaves two
+// registers for every level of FORs nested in it.
+static void
+PlanForRegisters(compiler_context *Context, for_loop *Loop, int InnerLoops)
+{
+    int NumRegisters = (int)ArrayCount(MASMParameterRegisters);
+    symbol *Routine = Context->Routine;
+    int First = Context->Leaf ? (Routine->NumParameters + Routine->NumLocals) : 2;
+    
+    int NumFree = 0;
+    int Free[ArrayCount(MASMParameterRegisters)];
+    for(int Register = First;
+        Register < NumRegisters;
+        Register++)
+    {
+        if(!(Context->ForRegisters & (1 << Register)))
+        {
+            Free[NumFree++] = Register;
+        }
+    }
+    int Spare = NumFree - 2*InnerLoops;
+    int Taken = 0;
+    
+    // NOTE: A leaf's parameter or local is in a register already
+    if(Context->Leaf && IsLocal(Loop->Counter))
+    {
+        Loop->CounterRegister = MASMParameterRegisters[Loop->Counter->Slot];
+    }
+    else if(Taken < Spare)
+    {
+        Loop->CounterRegister = MASMParameterRegisters[Free[Taken]];
+        Loop->Registers |= (1 << Free[Taken++]);
+    }
+    if(Taken < Spare)
+    {
+        Loop->LimitRegister = MASMParameterRegisters[Free[Taken]];
+        Loop->Registers |= (1 << Free[Taken++]);
+    }
+    Context->ForRegisters |= Loop->Registers;
+}
+
+// NOTE: The counter goes through every value from the first expression to
+// the second. The counter is set first, then the limit is evaluated, once.
+// The block can't assign the counter; a routine it calls can, and the loop
+// goes on from there. At the end the counter is one past the limit, or the
+// first value if the block never ran. A limit of the largest INT still ends
+// the loop, the counter wrapping around to the smallest.
+//
+// MASM keeps the counter and the limit in registers when it can. The
+// condition is tested on the way in, and an iteration ends in CMP/LEA/JL,
+// going on while the counter was below the limit. The counter goes back to
+// its home when the loop exits, returns or calls a routine. C keeps the
+// limit and a 64-bit counter in locals, so the step can't wrap around. The
+// bytecode is that of the equivalent WHILE, with the limit in a slot of its
+// own, which is what the JIT and its vectorizer look for. Unless the limit is
+// a literal below the largest INT, the step then leaves the loop when the
+// counter wraps around.
+static void
+For(compiler_context *Context)
+{
+    int Line = Context->TokenLine;
+    Next(Context);
+    if(Context->Token != Token_Identifier)
+    {
+        Expected(Context, "Identifier");
+    }
+    symbol *Counter = Variable(Context, Context->Value);
+    if(Counter->Type != Type_Int)
+    {
+        Abort(Context, "A FOR counts with an INT variable");
+    }
+    ProtectForCounter(Context, Counter);
+    if(Context->NumForLoops == MaxForLoops)
+    {
+        Abort(Context, "FOR loops nested too deep");
+    }
+    
+    Next(Context);
+    MatchString(Context, "=");
+    long long First = LoneNumber(Context, Keywords[Token_To]);
+    Store(Context, Counter->Name, BoolExpression(Context));
+    MatchToken(Context, Token_To);
+    long long Last = LoneNumber(Context, 0);
+    value_type LimitType = BoolExpression(Context);
+    
+    int InnerLoops;
+    size_t FirstCall;
+    ScanForBody(Context, &InnerLoops, &FirstCall);
+    
+    // NOTE: With constant bounds the counter stays in [First, Last]. Not for
+    // a global when the block calls a routine: that could set it to anything,
+    // and the rest of the iteration would index with it.
+    bool Ranged = (Context->CheckBounds && (Context->NumIndexRanges < MaxIndexRanges) &&
+                   (First >= 0) && (Last >= 0) && (Last < MaxArrayLength) &&
+                   (IsLocal(Counter) || (FirstCall == (size_t)-1)));
+    if(Ranged)
+    {
+        index_range *Range = Context->IndexRanges + Context->NumIndexRanges++;
+        Range->Counter = Counter;
+        Range->Below = (int)Last + 1;
+        Range->Until = (size_t)-1;
+    }
+    
+    // NOTE: The limit is in the accumulator
+    int LoopIndex = Context->NumForLoops;
+    for_loop *Loop = Context->ForLoops + LoopIndex;
+    *Loop = {};
+    Loop->Counter = Counter;
+    char Home[MaxTokenLength + 32];
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            PlanForRegisters(Context, Loop, InnerLoops);
+            if(Loop->LimitRegister)
+            {
+                EmitInstruction(Context, "MOV", Loop->LimitRegister, "eax");
+            }
+            else
+            {
+                EmitInstruction(Context, "PUSH", "eax");
+            }
+            MASMHome(Context, Counter, Home);
+            if(Loop->CounterRegister && strcmp(Loop->CounterRegister, Home))
+            {
+                EmitInstruction(Context, "MOV", Loop->CounterRegister, Home);
+            }
+        } break;
+        
+        case Target_Bytecode:
+        {
+            Loop->LimitSlot = DeclareForLimit(Context);
+            EmitOp(Context, Context->Routine ? Op_StoreLocal : Op_Store, Loop->LimitSlot);
+        } break;
+        
+        case Target_C:
+        {
+            CVariable(Counter, Home);
+            EmitC(Context, "{");
+            Context->CIndent++;
+            EmitC(Context, "int limit%d = %s;", LoopIndex, (LimitType == Type_Long) ? "(int)rax" : "eax");
+            EmitC(Context, "long long for%d = %s;", LoopIndex, Home);
+        } break;
+    }
+    Context->NumForLoops++;
+    
+    char ConditionLabel[MaxTokenLength];
+    char DoneLabel[MaxTokenLength];
+    NewLabel(Context, ConditionLabel);
+    NewLabel(Context, DoneLabel);
+    
+    // NOTE: The condition's block is on the FOR's line, as a WHILE's is
+    int BlockLine = Context->TokenLine;
+    Context->TokenLine = Line;
+    
+    loop_layout Layout;
+    PlanLoop(Context, &Layout);
+    if((Context->Target == Target_MASM) && !Layout.Rotate)
+    {
+        Layout.Rotate = true;
+        NewLabel(Context, Layout.BodyLabel);
+    }
+    Layout.For = Loop;
+    
+    BeginLoop(Context, &Layout, ConditionLabel);
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            char *Limit = Loop->LimitRegister ? Loop->LimitRegister : (char *)"DWORD PTR [esp]";
+            if(Loop->CounterRegister)
+            {
+                EmitInstruction(Context, "CMP", Loop->CounterRegister, Limit);
+            }
+            else if(Loop->LimitRegister)
+            {
+                EmitInstruction(Context, "CMP", Home, Limit);
+            }
+            else
+            {
+                EmitInstruction(Context, "MOV", "eax", Home);
+                EmitInstruction(Context, "CMP", "eax", Limit);
+            }
+        } break;
+        
+        case Target_Bytecode:
+        {
+            LoadVariable(Context, Counter->Name);
+            Push(Context, Type_Int);
+            EmitOp(Context, Context->Routine ? Op_LoadLocal : Op_LoadVariable, Loop->LimitSlot);
+            SetLessThanOrEqual(Context, Type_Int);
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "eax = (for%d <= limit%d);", LoopIndex, LoopIndex);
+        } break;
+    }
+    Context->TokenLine = BlockLine;
+    ExitLoopIfFalse(Context, &Layout, ConditionLabel, DoneLabel);
+    
+    Block(Context);
+    MarkSourceLine(Context);
+    MatchToken(Context, Token_EndFor);
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            // NOTE: EndLoop steps the counter with the condition
+        } break;
+        
+        case Target_Bytecode:
+        {
+            LoadVariable(Context, Counter->Name);
+            Push(Context, Type_Int);
+            EmitOp(Context, Op_LoadConstant, 1);
+            PopAdd(Context, Type_Int);
+            Store(Context, Counter->Name, Type_Int);
+            
+            // NOTE: The accumulator still holds the counter, and adding the
+            // smallest INT to it gives 0 only when it wrapped around. Only a
+            // limit of the largest INT gets there, which a literal below it
+            // rules out.
+            if((Last < 0) || (Last >= INT_MAX))
+            {
+                Push(Context, Type_Int);
+                EmitOp(Context, Op_LoadConstant, INT_MIN);
+                PopAdd(Context, Type_Int);
+                BranchFalse(Context, DoneLabel);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "for%d++;", LoopIndex);
+        } break;
+    }
+    EndLoop(Context, &Layout, ConditionLabel, DoneLabel);
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            if(Loop->CounterRegister && strcmp(Loop->CounterRegister, Home))
+            {
+                EmitInstruction(Context, "MOV", Home, Loop->CounterRegister);
+            }
+            if(!Loop->LimitRegister)
+            {
+                EmitInstruction(Context, "ADD", "esp", "4");
+            }
+        } break;
+        
+        case Target_Bytecode:
+        {
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "%s = (int)for%d;", Home, LoopIndex);
+            Context->CIndent--;
+            EmitC(Context, "}");
+        } break;
+    }
+    
+    Context->ForRegisters &= ~Loop->Registers;
+    Context->NumForLoops--;
+    if(Ranged)
+    {
+        Context->NumIndexRanges--;
+    }
+}
+
+// NOTE: Reads a CASE label, an INT literal, and moves past it
+static int
+CaseLabel(compiler_context *Context)
+{
+    bool Negative = !strcmp(Context->Value, "-");
+    if(Negative)
+    {
+        Next(Context);
+    }
+    if(Context->Token != Token_Number)
+    {
+        Expected(Context, "Number");
+    }
+    
+    long long Value = strtoll(Context->Value, 0, 10);
+    if(Negative)
+    {
+        Value = -Value;
+    }
+    if((strlen(Context->Value) > 10) || (Value < -2147483647LL - 1) || (Value > 2147483647LL))
+    {
+        Abort(Context, "CASE label out of the INT range");
+    }
+    Next(Context);
+    
+    return (int)Value;
+}
+
+// NOTE: With the current token after a CASE's selector, looks ahead to its
+// ENDCASE for the labels of its arms in source order (not those of a CASE
+// inside them). Returns the number of arms, ELSE not counted.
+static int
+ScanCaseLabels(compiler_context *Context, case_label *Labels, int *NumLabels, bool *HasElse)
+{
+    int Result = 0;
+    *NumLabels = 0;
+    *HasElse = false;
+    
+    lexer_state Saved;
+    SaveLexer(Context, &Saved);
+    
+    // NOTE: An ELSE or OF inside an IF or CASE in an arm isn't this CASE's
+    int Depth = 0;
+    while(!((Depth == 0) && (Context->Token == Token_EndCase)) && (Context->Value[0] != (char)EOF))
+    {
+        if((Context->Token == Token_If) || (Context->Token == Token_Case))
+        {
+            Depth++;
+        }
+        else if((Context->Token == Token_Endif) || (Context->Token == Token_EndCase))
+        {
+            Depth--;
+        }
+        else if((Depth == 0) && (Context->Token == Token_Else))
+        {
+            *HasElse = true;
+        }
+        else if((Depth == 0) && (Context->Token == Token_Of))
+        {
+            if(*HasElse)
+            {
+                Abort(Context, "A CASE's ELSE comes after its OFs");
+            }
+            
+            do
+            {
+                Next(Context);
+                int Value = CaseLabel(Context);
+                for(int Label = 0;
+                    Label < *NumLabels;
+                    Label++)
+                {
+                    if(Labels[Label].Value == Value)
+                    {
+                        char Message[1024];
+                        sprintf(Message, "Duplicate CASE label %d", Value);
+                        Abort(Context, Message);
+                    }
+                }
+                if(*NumLabels == MaxCaseLabels)
+                {
+                    Abort(Context, "Too many CASE labels");
+                }
+                Labels[*NumLabels].Value = Value;
+                Labels[*NumLabels].Arm = Result;
+                (*NumLabels)++;
+            } while(!strcmp(Context->Value, ","));
+            Result++;
+            continue;
+        }
+        Next(Context);
+    }
+    
+    RestoreLexer(Context, &Saved);
+    
+    return Result;
+}
+
+static int
+CompareCaseLabels(const void *A, const void *B)
+{
+    int Left = ((case_label *)A)->Value;
+    int Right = ((case_label *)B)->Value;
+    int Result = (Left < Right) ? -1 : ((Left > Right) ? 1 : 0);
+    
+    return Result;
+}
+
+// NOTE: MASM, a balanced binary search of the sorted labels from First to
+// Last for the selector in eax, the last few compared one by one
+static void
+EmitCaseSearch(compiler_context *Context, case_label *Labels, int First, int Last,
+               int FirstArmLabel, char *DefaultLabel)
+{
+    char Operand[MaxTokenLength];
+    char ArmLabel[MaxTokenLength];
+    if(Last - First + 1 < MinCaseTable)
+    {
+        for(int Label = First;
+            Label <= Last;
+            Label++)
+        {
+            sprintf(Operand, "%d", Labels[Label].Value);
+            sprintf(ArmLabel, "L%d", FirstArmLabel + Labels[Label].Arm);
+            EmitInstruction(Context, "CMP", "eax", Operand);
+            EmitInstruction(Context, "JE", ArmLabel);
+        }
+        Branch(Context, DefaultLabel);
+    }
+    else
+    {
+        int Middle = First + (Last - First)/2;
+        char UpperLabel[MaxTokenLength];
+        NewLabel(Context, UpperLabel);
+        
+        sprintf(Operand, "%d", Labels[Middle].Value);
+        sprintf(ArmLabel, "L%d", FirstArmLabel + Labels[Middle].Arm);
+        EmitInstruction(Context, "CMP", "eax", Operand);
+        EmitInstruction(Context, "JE", ArmLabel);
+        EmitInstruction(Context, "JG", UpperLabel);
+        EmitCaseSearch(Context, Labels, First, Middle - 1, FirstArmLabel, DefaultLabel);
+        PostLabel(Context, UpperLabel);
+        EmitCaseSearch(Context, Labels, Middle + 1, Last, FirstArmLabel, DefaultLabel);
+    }
+}
+
+// NOTE: Runs the arm one of whose labels is the selector, or the ELSE if
+// none is (nothing without an ELSE). Arms don't fall through into each other.
+//
+// The selector is evaluated once, and the labels are known before the arms
+// are compiled (ScanCaseLabels), so the dispatch comes first. MASM bounds
+// checks a dense set of labels and jumps through a table of the arms'
+// addresses; a sparse set gets a balanced binary search of compares on eax,
+// see MinCaseTable. C leaves the choice to the C compiler with a switch. The
+// bytecode has Op_Case, which the interpreter indexes or searches the same
+// way and the JIT turns into the binary search.
+static void
+Case(compiler_context *Context)
+{
+    Next(Context);
+    if(BoolExpression(Context) != Type_Int)
+    {
+        Abort(Context, "CASE selects on an INT");
+    }
+    
+    case_label Labels[MaxCaseLabels];
+    int NumLabels;
+    bool HasElse;
+    int NumArms = ScanCaseLabels(Context, Labels, &NumLabels, &HasElse);
+    
+    case_label Sorted[MaxCaseLabels];
+    memcpy(Sorted, Labels, NumLabels*sizeof(case_label));
+    qsort(Sorted, NumLabels, sizeof(case_label), CompareCaseLabels);
+    long long Range = NumLabels ? ((long long)Sorted[NumLabels - 1].Value - Sorted[0].Value + 1) : 0;
+    bool Dense = ((NumLabels >= MinCaseTable) && (Range <= 2*NumLabels));
+    
+    // NOTE: Arm n starts at L<FirstArmLabel + n>, the ELSE (or without one
+    // the end) at DefaultLabel
+    char ArmLabel[MaxTokenLength];
+    int FirstArmLabel = Context->LabelCount;
+    for(int Arm = 0;
+        Arm < NumArms;
+        Arm++)
+    {
+        NewLabel(Context, ArmLabel);
+    }
+    char DoneLabel[MaxTokenLength];
+    char DefaultLabel[MaxTokenLength];
+    NewLabel(Context, DoneLabel);
+    strncpy(DefaultLabel, DoneLabel, MaxTokenLength);
+    if(HasElse)
+    {
+        NewLabel(Context, DefaultLabel);
+    }
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            if(!NumLabels)
+            {
+                Branch(Context, DefaultLabel);
+            }
+            else if(Dense)
+            {
+                char Operand[MaxTokenLength + 32];
+                if(Sorted[0].Value)
+                {
+                    sprintf(Operand, "%d", Sorted[0].Value);
+                    EmitInstruction(Context, "SUB", "eax", Operand);
+                }
+                sprintf(Operand, "%d", (int)(Range - 1));
+                EmitInstruction(Context, "CMP", "eax", Operand);
+                EmitInstruction(Context, "JA", DefaultLabel);
+                
+                char TableLabel[MaxTokenLength];
+                NewLabel(Context, TableLabel);
+                sprintf(Operand, "DWORD PTR %s[eax*4]", TableLabel);
+                EmitInstruction(Context, "JMP", Operand);
+                
+                EmitNoTab(Context, ".data");
+                int Label = 0;
+                for(int Entry = 0;
+                    Entry < Range;
+                    Entry++)
+                {
+                    char *Target = DefaultLabel;
+                    if(Sorted[Label].Value == Sorted[0].Value + Entry)
+                    {
+                        sprintf(ArmLabel, "L%d", FirstArmLabel + Sorted[Label++].Arm);
+                        Target = ArmLabel;
+                    }
+                    Print(Context, "%s\tDWORD %s\n", Entry ? "" : TableLabel, Target);
+                }
+                EmitNoTab(Context, ".code");
+            }
+            else
+            {
+                EmitCaseSearch(Context, Sorted, 0, NumLabels - 1, FirstArmLabel, DefaultLabel);
+            }
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(!NumLabels)
+            {
+                Branch(Context, DefaultLabel);
+            }
+            else
+            {
+                EmitOp(Context, Op_Case, DeclareCaseTable(Context, Sorted, NumLabels, Dense,
+                                                          FirstArmLabel, DefaultLabel));
+            }
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "switch(eax)");
+            EmitC(Context, "{");
+            Context->CIndent++;
+        } break;
+    }
+    
+    for(int Arm = 0;
+        Context->Token == Token_Of;
+        Arm++)
+    {
+        Next(Context);
+        CaseLabel(Context);
+        while(!strcmp(Context->Value, ","))
+        {
+            Next(Context);
+            CaseLabel(Context);
+        }
+        
+        sprintf(ArmLabel, "L%d", FirstArmLabel + Arm);
+        PostLabel(Context, ArmLabel);
+        if(Context->Target == Target_C)
+        {
+            for(int Label = 0;
+                Label < NumLabels;
+                Label++)
+            {
+                if(Labels[Label].Arm == Arm)
+                {
+                    EmitC(Context, "case %d:", Labels[Label].Value);
+                }
+            }
+            EmitC(Context, "{");
+            Context->CIndent++;
+        }
+        CountBlock(Context, Block_Case);
+        
+        Block(Context);
+        MarkSourceLine(Context);
+        
+        if(Context->Target == Target_C)
+        {
+            EmitC(Context, "break;");
+            Context->CIndent--;
+            EmitC(Context, "}");
+        }
+        else if(HasElse || (Arm < NumArms - 1))
+        {
+            Branch(Context, DoneLabel);
+        }
+    }
+    
+    if(HasElse)
+    {
+        MatchToken(Context, Token_Else);
+        PostLabel(Context, DefaultLabel);
+        if(Context->Target == Target_C)
+        {
+            EmitC(Context, "default:");
+            EmitC(Context, "{");
+            Context->CIndent++;
+        }
+        CountBlock(Context, Block_Case);
+        
+        Block(Context);
+        MarkSourceLine(Context);
+        
+        if(Context->Target == Target_C)
+        {
+            EmitC(Context, "break;");
+            Context->CIndent--;
+            EmitC(Context, "}");
+        }
+    }
+    
+    if(Context->Target == Target_C)
+    {
+        Context->CIndent--;
+        EmitC(Context, "}");
+    }
+    PostLabel(Context, DoneLabel);
+    CountBlock(Context, Block_CaseJoin);
+    MatchToken(Context, Token_EndCase);
+}
+
+//
+// --Parsing - Program Structure
+//
+
+static void
+Read(compiler_context *Context)
+{
+    GetName(Context);
+    ProtectForCounter(Context, FindSymbol(Context, Context->Value));
+    EmitRead(Context);
+    Next(Context);
+}
+
+static void
+Write(compiler_context *Context)
+{
+    GetName(Context);
+    EmitWrite(Context);
+    Next(Context);
+}
+
+static void
+Assignment(compiler_context *Context)
+{
+    symbol *Array = FindArray(Context, Context->Value);
+    if(Array)
+    {
+        Index(Context, Array);
+        Push(Context, Type_Int);
+        MatchString(Context, "=");
+        StoreElement(Context, Array, BoolExpression(Context));
+        return;
+    }
+    
+    symbol *Symbol = Variable(Context, Context->Value);
+    ProtectForCounter(Context, Symbol);
+    
+    Next(Context);
+    MatchString(Context, "=");
+    if(Context->CheckBounds && (Symbol->Type == Type_Int))
+    {
+        long long Constant = LoneNumber(Context, 0);
+        if((Constant >= 0) && (Constant <= 2147483647LL))
+        {
+            Context->LastConstant = Symbol;
+            Context->LastConstantValue = Constant;
+        }
+    }
+    value_type Type = BoolExpression(Context);
+    Store(Context, Symbol->Name, Type);
+}
+
+static void
+Return(compiler_context *Context)
+{
+    if(!Context->Routine)
+    {
+        Abort(Context, "RETURN outside a PROCEDURE or FUNCTION");
+    }
+    
+    Next(Context);
+    value_type Type = Type_Int;
+    if(Context->Routine->Kind == Symbol_Function)
+    {
+        Type = BoolExpression(Context);
+    }
+    EmitReturn(Context, Type);
+}
+
+static void
+Block(compiler_context *Context)
+{
+    Context->Returned = false;
+    while((Context->Token != Token_EndWhile) && (Context->Token != Token_EndFor) && (Context->Token != Token_Else) &&
+          (Context->Token != Token_Endif) && (Context->Token != Token_Of) && (Context->Token != Token_EndCase) &&
+          (Context->Token != Token_End))
+    {
+        MarkSourceLine(Context);
+        Context->PreviousConstant = Context->LastConstant;
+        Context->PreviousConstantValue = Context->LastConstantValue;
+        Context->LastConstant = 0;
+        bool Returned = false;
+        
+        if(Context->Token == Token_If)
+        {
+            If(Context);
+            
+            // NOTE: Whatever the branches stored isn't known after the IF
+            Context->LastConstant = 0;
+        }
+        else if(Context->Token == Token_While)
+        {
+            While(Context);
+            Context->LastConstant = 0;
+        }
+        else if(Context->Token == Token_For)
+        {
+            For(Context);
+            Context->LastConstant = 0;
+        }
+        else if(Context->Token == Token_Case)
+        {
+            Case(Context);
+            Context->LastConstant = 0;
+        }
+        else if(Context->Token == Token_Read)
+        {
+            Read(Context);
+        }
+        else if(Context->Token == Token_Write)
+        {
+            Write(Context);
+        }
+        else if(Context->Token == Token_Return)
+        {
+            Return(Context);
+            Returned = true;
+        }
+        else if(Context->Token == Token_Identifier)
+        {
+            symbol *Routine = FindRoutine(Context, Context->Value);
+            if(Routine)
+            {
+                // NOTE: A FUNCTION's result is dropped
+                Call(Context, Routine);
+            }
+            else
+            {
+                Assignment(Context);
+            }
+        }
+        else
+        {
+            char Message[1024];
+            sprintf(Message, "Unexpected \'%s\'", Context->Value);
+            Abort(Context, Message);
+        }
+        
+        Semicolon(Context);
+        Context->Returned = Returned;
+    }
+}
+
+static void
+Header(compiler_context *Context)
+{
+    if(Context->Target == Target_C)
+    {
+        if(Context->Freestanding)
+        {
+            if(Context->Instrument)
+            {
+                Abort(Context, "--instrument writes its profile through the C library, it can't be used with --freestanding");
+            }
+        }
+        else
+        {
+            EmitNoTab(Context, "#include <stdio.h>");
+            if(Context->CheckBounds)
+            {
+                EmitNoTab(Context, "#include <stdlib.h>");
+            }
+            EmitNoTab(Context, "");
+        }
+        Context->RuntimeAt = Context->Output.Size;
+        if(Context->Profile)
+        {
+            EmitNoTab(Context, "#if defined(__GNUC__)");
+            EmitNoTab(Context, "#define TINY_LIKELY(x) __builtin_expect(!!(x), 1)");
+            EmitNoTab(Context, "#define TINY_UNLIKELY(x) __builtin_expect(!!(x), 0)");
+            EmitNoTab(Context, "#else");
+            EmitNoTab(Context, "#define TINY_LIKELY(x) (x)");
+            EmitNoTab(Context, "#define TINY_UNLIKELY(x) (x)");
+            EmitNoTab(Context, "#endif");
+            EmitNoTab(Context, "");
+        }
+        if(Context->Instrument)
+        {
+            EmitNoTab(Context, "extern unsigned long long tiny_counters[];");
+            EmitNoTab(Context, "static void tiny_write_profile(void);");
+            EmitNoTab(Context, "");
+        }
+    }
+    if(Context->Target != Target_MASM)
+    {
+        return;
+    }
+    
+    EmitNoTab(Context, ".386");
+    EmitNoTab(Context, ".model flat, stdcall");
+    EmitNoTab(Context, "option casemap:none");
+    EmitNoTab(Context, "include C:\\masm32\\include\\windows.inc");
+    EmitNoTab(Context, "include C:\\masm32\\include\\kernel32.inc");
+    EmitNoTab(Context, "includelib C:\\masm32\\lib\\kernel32.lib");
+    EmitNoTab(Context, "include C:\\masm32\\include\\msvcrt.inc");
+    EmitNoTab(Context, "includelib C:\\masm32\\lib\\msvcrt.lib");
+    EmitNoTab(Context, ".data");
+}
+
+// NOTE: C: the accumulators a routine or main starts with. The casts keep
+// them used whatever the code does with them.
+static void
+DeclareCRegisters(compiler_context *Context)
+{
+    EmitC(Context, "int eax = 0;");
+    EmitC(Context, "(void)eax;");
+    
+    Context->UsesRax = false;
+    Context->RaxAt = Context->Output.Size;
+    EmitC(Context, "long long rax = 0;");
+    EmitC(Context, "(void)rax;");
+    Context->RaxSize = Context->Output.Size - Context->RaxAt;
+}
+
+// NOTE: C: at the end of a routine or main, cuts rax out if it had no LONGs
+static void
+DropUnusedRax(compiler_context *Context)
+{
+    if(Context->UsesRax)
+    {
+        return;
+    }
+    
+    output_buffer *Output = &Context->Output;
+    size_t After = Context->RaxAt + Context->RaxSize;
+    memmove(Output->Data + Context->RaxAt, Output->Data + After, Output->Size - After);
+    Output->Size -= Context->RaxSize;
+}
+
+static void
+Main(compiler_context *Context)
+{
+    MatchToken(Context, Token_Begin);
+    if(Context->Target == Target_MASM)
+    {
+        EmitNoTab(Context, ".code");
+    }
+    else if(Context->Target == Target_C)
+    {
+        EmitNoTab(Context, "");
+        EmitNoTab(Context, "int");
+        EmitNoTab(Context, "main(void)");
+        EmitNoTab(Context, "{");
+        Context->CIndent = 1;
+        DeclareCRegisters(Context);
+    }
+    PostLabel(Context, "MAIN");
+    MarkSourceLine(Context);
+    CountBlock(Context, Block_Entry);
+    
+    Context->LastConstant = 0;
+    Block(Context);
+    
+    MatchToken(Context, Token_End);
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            if(Context->Instrument)
+            {
+                EmitLn(Context, "call TinyWriteProfile");
+            }
+            EmitLn(Context, "call TinyFlush");
+            EmitLn(Context, "call ExitProcess");
+            if(Context->Cold.Size)
+            {
+                // NOTE: Out of line blocks from the profile, each jumps back when done
+                ReserveOutput(&Context->Output, Context->Cold.Size);
+                memcpy(Context->Output.Data + Context->Output.Size, Context->Cold.Data, Context->Cold.Size);
+                Context->Output.Size += Context->Cold.Size;
+            }
+            if(Context->Instrument)
+            {
+                EmitProfileWriter(Context);
+                EmitNoTab(Context, ".code");
+            }
+            EmitRuntime(Context);
+            EmitNoTab(Context, "end MAIN");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EnterPhase(Context, Phase_Passes);
+            FinishBytecode(Context);
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "tiny_flush();");
+            if(Context->Instrument)
+            {
+                EmitC(Context, "tiny_write_profile();");
+            }
+            EmitC(Context, "return 0;");
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            DropUnusedRax(Context);
+            if(Context->Instrument)
+            {
+                EmitProfileWriter(Context);
+            }
+            InsertRuntime(Context);
+        } break;
+    }
+}
+
+// NOTE: Only gives globals their Slot, the caller sets it for anything else
+static symbol *
+AddEntry(compiler_context *Context, char *Name, symbol_kind Kind, value_type Type)
+{
+    if(Context->NumSymbols >= ArrayCount(Context->SymbolTable))
+    {
+        Abort(Context, "Too many names");
+    }
+    symbol *Symbol = Context->SymbolTable + Context->NumSymbols++;
+    
+    Symbol->Name = (char *)malloc(strlen(Name) + 1);
+    memcpy(Symbol->Name, Name, strlen(Name) + 1);
+    Symbol->Kind = Kind;
+    Symbol->Type = Type;
+    Symbol->Slot = 0;
+    Symbol->Initial = 0;
+    Symbol->NumParameters = 0;
+    Symbol->NumLocals = 0;
+    Symbol->Length = 0;
+    
+    if(Kind == Symbol_Global)
+    {
+        // NOTE: LONGs are 8-byte aligned in the bytecode globals
+        if(Type == Type_Long)
+        {
+            Context->NumGlobalSlots += (Context->NumGlobalSlots & 1);
+        }
+        Symbol->Slot = Context->NumGlobalSlots;
+        Context->NumGlobalSlots += (Type == Type_Long) ? 2 : 1;
+    }
+    
+    return Symbol;
+}
+
+// NOTE: A VAR of the routine being compiled. It can hide a global and takes
+// the next frame slot, it's given its initial value on every entry.
+static void
+AllocLocal(compiler_context *Context, char *Name, value_type Type)
+{
+    symbol *Previous = FindSymbol(Context, Name);
+    if(Previous && IsLocal(Previous))
+    {
+        Abort(Context, "Duplicate variable name");
+    }
+    if(Type == Type_Long)
+    {
+        RequireLongTarget(Context);
+    }
+    
+    symbol *Routine = Context->Routine;
+    symbol *Symbol = AddEntry(Context, Name, Symbol_Local, Type);
+    Symbol->Slot = Routine->NumParameters + Routine->NumLocals++;
+    
+    Next(Context);
+    if(!strcmp(Context->Value, "["))
+    {
+        Abort(Context, "Arrays can only be declared outside routines");
+    }
+    if(!strcmp(Context->Value, "="))
+    {
+        GetNumber(Context);
+        Symbol->Initial = (Type == Type_Long) ? strtoll(Context->Value, 0, 10) : atoi(Context->Value);
+        Next(Context);
+    }
+}
+
+// NOTE: VAR A[N] declares the elements A[0] to A[N - 1], all 0 at the start.
+// The current token is the '['.
+static void
+AllocArray(compiler_context *Context, symbol *Symbol)
+{
+    GetNumber(Context);
+    long long Length = strtoll(Context->Value, 0, 10);
+    if((Length < 1) || (Length > MaxArrayLength))
+    {
+        Abort(Context, "Arrays have 1 to 16777216 elements");
+    }
+    Symbol->Length = (int)Length;
+    
+    // NOTE: AddEntry made room for one element
+    Context->NumGlobalSlots += (Symbol->Length - 1)*((Symbol->Type == Type_Long) ? 2 : 1);
+    
+    if(Context->Target == Target_MASM)
+    {
+        Print(Context, "%s DWORD %d DUP(0)\n", Symbol->Name, Symbol->Length);
+    }
+    else if((Context->Target == Target_C) && (Symbol->Type == Type_Long))
+    {
+        Print(Context, "static long long v_%s[%d];\n", Symbol->Name, Symbol->Length);
+    }
+    else if(Context->Target == Target_C)
+    {
+        Print(Context, "static int v_%s[%d];\n", Symbol->Name, Symbol->Length);
+    }
+    DeclareGlobal(Context, Symbol, 0);
+    
+    Next(Context);
+    MatchString(Context, "]");
+    if(!strcmp(Context->Value, "="))
+    {
+        Abort(Context, "An array can\'t have an initial value, it starts out all 0");
+    }
+}
+
+static void
+Alloc(compiler_context *Context, char *Name, value_type Type)
+{
+    if(Context->Routine)
+    {
+        AllocLocal(Context, Name, Type);
+        return;
+    }
+    
+    if(FindSymbol(Context, Name))
+    {
+        Abort(Context, "Duplicate variable name");
+    }
+    if(Type == Type_Long)
+    {
+        RequireLongTarget(Context);
+    }
+    
+    symbol *Symbol = AddEntry(Context, Name, Symbol_Global, Type);
+    
+    // NOTE: Name is the token, it's gone after Next
+    Next(Context);
+    if(!strcmp(Context->Value, "["))
+    {
+        AllocArray(Context, Symbol);
+        return;
+    }
+    
+    if(Context->Target == Target_MASM)
+    {
+        Print(Context, "%s DWORD ", Symbol->Name);
+    }
+    else if((Context->Target == Target_C) && (Type == Type_Long))
+    {
+        Print(Context, "static long long v_%s = ", Symbol->Name);
+    }
+    else if(Context->Target == Target_C)
+    {
+        Print(Context, "static int v_%s = ", Symbol->Name);
+    }
+    
+    if(!strcmp(Context->Value, "="))
+    {
+        GetNumber(Context);
+        if(Context->Target == Target_MASM)
+        {
+            Print(Context, "%s\n", Context->Value);
+        }
+        else if((Context->Target == Target_C) && (Type == Type_Long))
+        {
+            Print(Context, "%sLL;\n", Context->Value);
+        }
+        else if(Context->Target == Target_C)
+        {
+            Print(Context, "%s;\n", Context->Value);
+        }
+        DeclareGlobal(Context, Symbol, (Type == Type_Long) ? strtoll(Context->Value, 0, 10) : atoi(Context->Value));
+        Next(Context);
+    }
+    else
+    {
+        if(Context->Target == Target_MASM)
+        {
+            Print(Context, "?\n");
+        }
+        else if(Context->Target == Target_C)
+        {
+            Print(Context, "0;\n");
+        }
+        DeclareGlobal(Context, Symbol, 0);
+    }
+}
+
+static void
+Decl(compiler_context *Context)
+{
+    value_type Type = Type_Int;
+    GetName(Context);
+    if(!strcmp(Context->Value, Keywords[Token_Long]))
+    {
+        Type = Type_Long;
+        GetName(Context);
+    }
+    Alloc(Context, Context->Value, Type);
+    
+    while(!strcmp(Context->Value, ","))
+    {
+        GetName(Context);
+        Alloc(Context, Context->Value, Type);
+    }
+    
+    Semicolon(Context);
+}
+
+// NOTE: Reads the parameter list, if there is one, into Routine and declares
+// the parameters. They stay in the symbol table until the routine's END.
+static void
+Parameters(compiler_context *Context, symbol *Routine)
+{
+    if(strcmp(Context->Value, "("))
+    {
+        return;
+    }
+    
+    Next(Context);
+    while(strcmp(Context->Value, ")"))
+    {
+        if(Routine->NumParameters > 0)
+        {
+            MatchString(Context, ",");
+        }
+        
+        value_type Type = Type_Int;
+        if(Context->Token == Token_Long)
+        {
+            RequireLongTarget(Context);
+            Type = Type_Long;
+            Next(Context);
+        }
+        if(Context->Token != Token_Identifier)
+        {
+            Expected(Context, "Parameter");
+        }
+        
+        if(Routine->NumParameters == MaxParameters)
+        {
+            Abort(Context, "Too many parameters, at most 6 are passed in registers");
+        }
+        if((Context->Target == Target_MASM) && (Routine->NumParameters == ArrayCount(MASMParameterRegisters)))
+        {
+            Abort(Context, "Too many parameters, the MASM target passes at most 4 in registers");
+        }
+        symbol *Previous = FindSymbol(Context, Context->Value);
+        if(Previous && (Previous->Kind == Symbol_Parameter))
+        {
+            Abort(Context, "Duplicate parameter name");
+        }
+        
+        symbol *Parameter = AddEntry(Context, Context->Value, Symbol_Parameter, Type);
+        Parameter->Slot = Routine->NumParameters;
+        Routine->ParameterTypes[Routine->NumParameters++] = Type;
+        Next(Context);
+    }
+    Next(Context);
+}
+
+// NOTE: Looks ahead through the body of the routine being declared, from its
+// BEGIN to its END, for anything that makes a call: READ, WRITE or the name
+// of a routine
+static bool
+IsLeafBody(compiler_context *Context)
+{
+    bool Result = true;
+    
+    lexer_state Saved;
+    SaveLexer(Context, &Saved);
+    
+    Next(Context);
+    while(Result && (Context->Token != Token_End) && (Context->Value[0] != (char)EOF))
+    {
+        if((Context->Token == Token_Read) || (Context->Token == Token_Write) ||
+           ((Context->Token == Token_Identifier) && FindRoutine(Context, Context->Value)))
+        {
+            Result = false;
+        }
+        Next(Context);
+    }
+    
+    RestoreLexer(Context, &Saved);
+    
+    return Result;
+}
+
+// NOTE: MASM routines take their arguments in MASMParameterRegisters and
+// return in eax. A leaf leaves them there, keeps its locals in the registers
+// after them and needs no frame. Anything else gets an ebp frame with the
+// parameters, then the locals, stored below ebp.
+static void
+BeginRoutine(compiler_context *Context)
+{
+    symbol *Routine = Context->Routine;
+    symbol *ParameterSymbols = Context->SymbolTable + Context->NumSymbols - Routine->NumLocals - Routine->NumParameters;
+    symbol *Locals = ParameterSymbols + Routine->NumParameters;
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            char Label[MaxTokenLength + 8];
+            sprintf(Label, "P_%s", Routine->Name);
+            EmitNoTab(Context, ".code");
+            PostLabel(Context, Label);
+            if(!Context->Leaf)
+            {
+                EmitInstruction(Context, "PUSH", "ebp");
+                EmitInstruction(Context, "MOV", "ebp", "esp");
+                for(int Parameter = 0;
+                    Parameter < Routine->NumParameters;
+                    Parameter++)
+                {
+                    EmitInstruction(Context, "PUSH", MASMParameterRegisters[Parameter]);
+                }
+            }
+            for(int Local = 0;
+                Local < Routine->NumLocals;
+                Local++)
+            {
+                char Initial[32];
+                sprintf(Initial, "%d", (int)Locals[Local].Initial);
+                if(Context->Leaf)
+                {
+                    EmitInstruction(Context, "MOV", MASMParameterRegisters[Locals[Local].Slot], Initial);
+                }
+                else
+                {
+                    EmitInstruction(Context, "PUSH", Initial);
+                }
+            }
+        } break;
+        
+        case Target_Bytecode:
+        {
+            // NOTE: DeclareProcedure has recorded where it starts and sized the
+            // frame, a call doesn't clear it
+            for(int Local = 0;
+                Local < Routine->NumLocals;
+                Local++)
+            {
+                symbol *Symbol = Locals + Local;
+                if(Symbol->Type == Type_Long)
+                {
+                    EmitOp(Context, Op_LoadLongConstant, AddLongConstant(Context, Symbol->Initial));
+                    EmitOp(Context, Op_StoreLocalLong, Symbol->Slot);
+                }
+                else
+                {
+                    EmitOp(Context, Op_LoadConstant, (int)Symbol->Initial);
+                    EmitOp(Context, Op_StoreLocal, Symbol->Slot);
+                }
+            }
+        } break;
+        
+        case Target_C:
+        {
+            char Declaration[MaxTokenLength + MaxParameters*(MaxTokenLength + 16)];
+            int Length = sprintf(Declaration, "f_%s(", Routine->Name);
+            for(int Parameter = 0;
+                Parameter < Routine->NumParameters;
+                Parameter++)
+            {
+                symbol *Symbol = ParameterSymbols + Parameter;
+                Length += sprintf(Declaration + Length, "%s%s p_%s", (Parameter > 0) ? ", " : "",
+                                  (Symbol->Type == Type_Long) ? "long long" : "int", Symbol->Name);
+            }
+            sprintf(Declaration + Length, "%s)", (Routine->NumParameters > 0) ? "" : "void");
+            
+            EmitNoTab(Context, "");
+            if(Routine->Kind == Symbol_Procedure)
+            {
+                EmitNoTab(Context, "static void");
+            }
+            else if(Routine->Type == Type_Long)
+            {
+                EmitNoTab(Context, "static long long");
+            }
+            else
+            {
+                EmitNoTab(Context, "static int");
+            }
+            EmitNoTab(Context, Declaration);
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            DeclareCRegisters(Context);
+            for(int Local = 0;
+                Local < Routine->NumLocals;
+                Local++)
+            {
+                symbol *Symbol = Locals + Local;
+                if(Symbol->Type == Type_Long)
+                {
+                    EmitC(Context, "long long l_%s = %lldLL;", Symbol->Name, Symbol->Initial);
+                }
+                else
+                {
+                    EmitC(Context, "int l_%s = %d;", Symbol->Name, (int)Symbol->Initial);
+                }
+            }
+        } break;
+    }
+    CountBlock(Context, Block_Entry);
+}
+
+// NOTE: Falling off the end of a FUNCTION returns 0. A body ending in a
+// RETURN can't fall off it.
+static void
+EndRoutine(compiler_context *Context)
+{
+    bool Function = (Context->Routine->Kind == Symbol_Function);
+    bool FallsOff = !Context->Returned;
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            if(FallsOff)
+            {
+                if(Function)
+                {
+                    Clear(Context);
+                }
+                EmitReturn(Context, Type_Int);
+            }
+            EmitNoTab(Context, ".data");
+        } break;
+        
+        case Target_Bytecode:
+        {
+            if(FallsOff)
+            {
+                if(Function)
+                {
+                    EmitOp(Context, Op_LoadConstant, 0);
+                }
+                EmitReturn(Context, Type_Int);
+            }
+        } break;
+        
+        case Target_C:
+        {
+            if(FallsOff && Function)
+            {
+                EmitC(Context, "return 0;");
+            }
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            DropUnusedRax(Context);
+        } break;
+    }
+}
+
+static void
+RoutineDecl(compiler_context *Context)
+{
+    MarkSourceLine(Context);
+    symbol_kind Kind = (Context->Token == Token_Function) ? Symbol_Function : Symbol_Procedure;
+    value_type Type = Type_Int;
+    
+    Next(Context);
+    if((Kind == Symbol_Function) && (Context->Token == Token_Long))
+    {
+        RequireLongTarget(Context);
+        Type = Type_Long;
+        Next(Context);
+    }
+    if(Context->Token != Token_Identifier)
+    {
+        Expected(Context, "Identifier");
+    }
+    if(FindSymbol(Context, Context->Value))
+    {
+        Abort(Context, "Duplicate name");
+    }
+    
+    symbol *Routine = AddEntry(Context, Context->Value, Kind, Type);
+    int ScopeStart = Context->NumSymbols;
+    Next(Context);
+    Parameters(Context, Routine);
+    
+    Context->Routine = Routine;
+    while(Context->Token == Token_Var)
+    {
+        Decl(Context);
+    }
+    
+    // NOTE: A MASM leaf needs a register for every parameter and local
+    int FrameSize = Routine->NumParameters + Routine->NumLocals;
+    Context->Leaf = ((Context->Target == Target_MASM) && (FrameSize <= ArrayCount(MASMParameterRegisters)) &&
+                     IsLeafBody(Context));
+    Routine->Slot = DeclareProcedure(Context, Routine);
+    BeginRoutine(Context);
+    
+    MatchToken(Context, Token_Begin);
+    Context->LastConstant = 0;
+    Block(Context);
+    MarkSourceLine(Context);
+    EndRoutine(Context);
+    MatchToken(Context, Token_End);
+    Semicolon(Context);
+    
+    // NOTE: The parameters and locals go out of scope
+    for(int SymbolIndex = ScopeStart;
+        SymbolIndex < Context->NumSymbols;
+        SymbolIndex++)
+    {
+        free(Context->SymbolTable[SymbolIndex].Name);
+    }
+    Context->NumSymbols = ScopeStart;
+    Context->Routine = 0;
+    Context->Leaf = false;
+    Context->Returned = false;
+}
+
+static void
+TopDecls(compiler_context *Context)
+{
+    while(Context->Token != Token_Begin)
+    {
+        if(Context->Token == Token_Var)
+        {
+            Decl(Context);
+        }
+        else if((Context->Token == Token_Procedure) || (Context->Token == Token_Function))
+        {
+            RoutineDecl(Context);
+        }
+        else
+        {
+            char Message[1024];
+            sprintf(Message, "Unrecognized Keyword \'%s\'", Context->Value);
+            Abort(Context, Message);
+        }
+    }
+}
+
+static void
+Program(compiler_context *Context)
+{
+    MatchToken(Context, Token_Program);
+    Semicolon(Context);
+    Header(Context);
+    TopDecls(Context);
+    Main(Context);
+}
+
+static void
+Init(compiler_context *Context)
+{
+    GetChar(Context);
+    Next(Context);
+}
+
+//
+// --Library interface
+//
+
+static void
+ResetCompilerContext(compiler_context *Context, target Target)
+{
+    for(int SymbolIndex = 1;
+        SymbolIndex < Context->NumSymbols;
+        SymbolIndex++)
+    {
+        free(Context->SymbolTable[SymbolIndex].Name);
+    }
+    
+    Context->Target = Target;
+    Context->Source = 0;
+    Context->SourceSize = 0;
+    Context->SourcePosition = 0;
+    Context->Line = 1;
+    Context->TokenLine = 1;
+    Context->LineStart = 0;
+    Context->TokenLineStart = 0;
+    Context->Look = 0;
+    Context->LabelCount = 0;
+    Context->NumSymbols = 1;
+    Context->NumGlobalSlots = 1;
+    Context->Routine = 0;
+    Context->Leaf = false;
+    Context->Returned = false;
+    Context->CheckBounds = false;
+    Context->NumIndexRanges = 0;
+    Context->NumForLoops = 0;
+    Context->ForRegisters = 0;
+    Context->Truth = false;
+    Context->Compared = false;
+    Context->LastConstant = 0;
+    Context->PreviousConstant = 0;
+    Context->Output.Size = 0;
+    Context->CIndent = 0;
+    Context->CStackDepth = 0;
+    Context->UsesRax = false;
+    Context->RaxAt = 0;
+    Context->RaxSize = 0;
+    Context->UsesWrite = false;
+    Context->UsesRead = false;
+    Context->UsesReadLong = false;
+    Context->UsesDiv = false;
+    Context->UsesDivLong = false;
+    Context->UsesIndexError = false;
+    Context->RuntimeAt = 0;
+    Context->NumTokens = 0;
+    Context->NumInstructions = 0;
+    Context->Instrument = false;
+    Context->NumBlocks = 0;
+    Context->Profile = 0;
+    Context->ProfileMismatch = false;
+    Context->LineInfo = false;
+    Context->Freestanding = false;
+    Context->SourceName = 0;
+    Context->StatementLine = 0;
+    Context->NextCLine = 0;
+    Context->Cold.Size = 0;
+    Context->Error[0] = 0;
+    
+    if(Target == Target_Bytecode)
+    {
+        if(!Context->Bytecode)
+        {
+            Context->Bytecode = new bytecode();
+        }
+        ResetBytecode(Context->Bytecode);
+    }
+}
+
+// NOTE: Folds every field into Hash, the source name whole however long it is
+static unsigned long long
+HashOptions(unsigned long long Hash, compile_options *Options)
+{
+    unsigned long long ProfileHash = Options->Profile ? Options->Profile->Hash : 0;
+    char *LineInfoName = Options->LineInfo ? (Options->SourceName ? Options->SourceName : (char *)"stdin") : (char *)"";
+    unsigned char Flags[4] =
+    {
+        (unsigned char)Options->Target,
+        (unsigned char)(Options->Instrument ? 1 : 0),
+        (unsigned char)(Options->Freestanding ? 1 : 0),
+        (unsigned char)(Options->CheckBounds ? 1 : 0),
+    };
+    
+    unsigned long long Result = HashBytes(Hash, Flags, sizeof(Flags));
+    Result = HashBytes(Result, &ProfileHash, sizeof(ProfileHash));
+    Result = HashBytes(Result, LineInfoName, strlen(LineInfoName) + 1);
+    
+    return Result;
+}
+
+// NOTE: Compiles SourceSize bytes of TINY source for Options. On success the
+// generated code is in Context->Output (or Context->Bytecode for
+// Target_Bytecode); on failure Context->Error holds the message. A context can
+// be reused for any number of compilations and keeps its buffers between them.
+static bool
+Compile(compiler_context *Context, char *Source, size_t SourceSize, compile_options *Options)
+{
+    ResetCompilerContext(Context, Options->Target);
+    Context->Instrument = Options->Instrument;
+    Context->Profile = Options->Profile;
+    Context->LineInfo = Options->LineInfo;
+    Context->Freestanding = Options->Freestanding;
+    Context->CheckBounds = Options->CheckBounds;
+    Context->SourceName = Options->SourceName ? Options->SourceName : (char *)"stdin";
+    if(Options->Target == Target_Bytecode)
+    {
+        snprintf(Context->Bytecode->SourceName, sizeof(Context->Bytecode->SourceName), "%s", Context->SourceName);
+    }
+    Context->Source = Source;
+    Context->SourceSize = SourceSize;
+    
+    // NOTE: volatile because these live across the setjmp below
+    volatile double CpuStart = Context->Timing ? CpuSeconds() : 0;
+    volatile compile_phase Previous = EnterPhase(Context, Phase_Parse);
+    
+    volatile bool Result = false;
+    if(setjmp(Context->ErrorJump) == 0)
+    {
+        Init(Context);
+        Program(Context);
+        Result = true;
+    }
+    
+    EnterPhase(Context, Previous);
+    if(Result && Context->Profile && (Context->NumBlocks != Context->Profile->NumCounters))
+    {
+        Context->ProfileMismatch = true;
+    }
+    if(Context->Timing)
+    {
+        time_report *Report = Context->Timing;
+        Report->Cpu += CpuSeconds() - CpuStart;
+        Report->Compilations++;
+        Report->Characters += Context->SourcePosition;
+        Report->Tokens += Context->NumTokens;
+        Report->Symbols += Context->NumSymbols - 1;
+        Report->Labels += Context->LabelCount;
+        Report->Instructions += Context->NumInstructions;
+    }
+    
+    ReserveOutput(&Context->Output, 0);
+    Context->Output.Data[Context->Output.Size] = 0;
+    
+    return Result;
+}
+
+static void
+FreeCompilerContext(compiler_context *Context)
+{
+    ResetCompilerContext(Context, Target_MASM);
+    free(Context->Output.Data);
+    free(Context->Cold.Data);
+    delete Context->Bytecode;
+    
+    Context->Output = {};
+    Context->Cold = {};
+    Context->Bytecode = 0;
+}
+
+#include "tiny_cache.cpp"
+#include "tiny_driver.cpp"
+#include "tiny_server.cpp"
+
+// NOTE: Usage: tiny [--emit-c] [--run [--no-jit] [--jit-threshold <n>] [--perf-map] [--jitdump]]
+//                   [--jit-stress <n>] [--vectorize <off|sse2|avx2>]
+//                   [--instrument] [--profile-use <profile>] [--line-info] [--freestanding]
+//                   [--check-bounds]
+//                   [--cache-dir <dir> [--cache-size <MB>]] [--time-report[=json]]
+//                   [--cost-report[=json]] [<source file>]
+//              tiny --batch [--emit-c] [--jobs <n>] [--out-dir <dir>] [--cache-dir <dir>]
+//                   [--time-report[=json]] <file or directory>...
+//              tiny --server <socket> [--jobs <n>] [--cache-dir <dir>]
+//              tiny --client <socket> [--emit-c] [--instrument] [--freestanding] [--check-bounds]
+//                   [<source file>]
+//              tiny --server-bench <socket> <n> <source file>
+// Without a source file the program is read from stdin. --emit-c writes C99
+// to test1.c instead of MASM to test1.asm. --run interprets the
+// program instead of writing test1.asm and JIT compiles its hot WHILE loops on
+// a background thread. --jit-stress runs <n> copies of the program at once
+// and checks their output against the interpreter, and that loops that got
+// hot were compiled. --batch compiles every
+// input in parallel into its own output file, see tiny_driver.cpp.
+// --cache-dir reuses earlier MASM or C output for identical source and options,
+// see tiny_cache.cpp; --cache-size bounds the directory (default 256 MB).
+// --server stays resident and compiles what --client sends it over a Unix
+// domain socket, see tiny_server.cpp. --time-report prints where compile time
+// went as a table (or JSON), see tiny_timing.cpp. --instrument makes the
+// program count its basic blocks into test1.profile, see tiny_profile.cpp;
+// --profile-use lays out branches and loops by such a profile. --line-info
+// maps the output back to source lines for debuggers and profilers.
+// --freestanding writes C for a static Linux executable that doesn't need the
+// C library, see tiny_runtime.cpp. --check-bounds stops the program at an
+// array index out of bounds; indexes the compiler can prove in bounds aren't
+// checked. Without it an index out of bounds is undefined, as in C.
+// --vectorize picks the instructions for the JIT's vectorized array loops
+// (default: the widest the machine has), see tiny_vector.cpp.
+// --perf-map and --jitdump name the JIT's loops for Linux perf, see
+// tiny_perf.cpp. --cost-report estimates the cycles per iteration of every
+// WHILE loop as the JIT would compile it, see tiny_cost.cpp.
+int
+main(int ArgCount, char **Args)
+{
+    // NOTE: The client forwards everything after the socket untouched
+    if((ArgCount >= 3) && !strcmp(Args[1], "--client"))
+    {
+        return RunClient(Args[2], ArgCount - 3, Args + 3);
+    }
+    if((ArgCount >= 5) && !strcmp(Args[1], "--server-bench"))
+    {
+        return RunServerBenchmark(Args[2], atoi(Args[3]), Args[4]);
+    }
+    
+    target Target = Target_MASM;
+    char *InputFileName = 0;
+    bool Batch = false;
+    int NumBatchInputs = 0;
+    char **BatchInputs = (char **)malloc(ArgCount*sizeof(char *));
+    char *OutputDirectory = 0;
+    int NumJobs = 0;
+    bool JitEnabled = true;
+    int JitThreshold = 1000;
+    int StressCount = 0;
+    int VectorWidth = -1;
+    char *CacheDirectory = 0;
+    char *ServerSocket = 0;
+    bool Instrument = false;
+    char *ProfileFileNameUsed = 0;
+    bool LineInfo = false;
+    bool Freestanding = false;
+    bool CheckBounds = false;
+    bool PerfMap = false;
+    bool JitDump = false;
+    bool TimeReport = false;
+    bool TimeReportJson = false;
+    bool CostReport = false;
+    bool CostReportJson = false;
+    size_t CacheSize = 256;
+    int ExitCode = 0;
+    
+    for(int ArgIndex = 1;
+        ArgIndex < ArgCount;
+        ArgIndex++)
+    {
+        char *Arg = Args[ArgIndex];
+        if(!strcmp(Arg, "--emit-c"))
+        {
+            Target = Target_C;
+        }
+        else if(!strcmp(Arg, "--run"))
+        {
+            Target = Target_Bytecode;
+        }
+        else if(!strcmp(Arg, "--no-jit"))
+        {
+            JitEnabled = false;
+        }
+        else if(!strcmp(Arg, "--jit-threshold") && (ArgIndex + 1 < ArgCount))
+        {
+            JitThreshold = atoi(Args[++ArgIndex]);
+        }
+        else if(!strcmp(Arg, "--jit-stress") && (ArgIndex + 1 < ArgCount))
+        {
+            Target = Target_Bytecode;
+            StressCount = atoi(Args[++ArgIndex]);
+        }
+        else if(!strcmp(Arg, "--vectorize") && (ArgIndex + 1 < ArgCount))
+        {
+            char *Level = Args[++ArgIndex];
+            VectorWidth = !strcmp(Level, "avx2") ? 8 : (!strcmp(Level, "sse2") ? 4 : 0);
+        }
+        else if(!strcmp(Arg, "--instrument"))
+        {
+            Instrument = true;
+        }
+        else if(!strcmp(Arg, "--profile-use") && (ArgIndex + 1 < ArgCount))
+        {
+            ProfileFileNameUsed = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--line-info"))
+        {
+            LineInfo = true;
+        }
+        else if(!strcmp(Arg, "--freestanding"))
+        {
+            Target = Target_C;
+            Freestanding = true;
+        }
+        else if(!strcmp(Arg, "--check-bounds"))
+        {
+            CheckBounds = true;
+        }
+        else if(!strcmp(Arg, "--perf-map"))
+        {
+            PerfMap = true;
+        }
+        else if(!strcmp(Arg, "--jitdump"))
+        {
+            JitDump = true;
+        }
+        else if(!strcmp(Arg, "--batch"))
+        {
+            Batch = true;
+        }
+        else if(!strcmp(Arg, "--jobs") && (ArgIndex + 1 < ArgCount))
+        {
+            NumJobs = atoi(Args[++ArgIndex]);
+        }
+        else if(!strcmp(Arg, "--out-dir") && (ArgIndex + 1 < ArgCount))
+        {
+            OutputDirectory = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--server") && (ArgIndex + 1 < ArgCount))
+        {
+            ServerSocket = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--time-report") || !strcmp(Arg, "--time-report=json"))
+        {
+            TimeReport = true;
+            TimeReportJson = (Arg[13] == '=');
+        }
+        else if(!strcmp(Arg, "--cost-report") || !strcmp(Arg, "--cost-report=json"))
+        {
+            Target = Target_Bytecode;
+            CostReport = true;
+            CostReportJson = (Arg[13] == '=');
+        }
+        else if(!strcmp(Arg, "--cache-dir") && (ArgIndex + 1 < ArgCount))
+        {
+            CacheDirectory = Args[++ArgIndex];
+        }
+        else if(!strcmp(Arg, "--cache-size") && (ArgIndex + 1 < ArgCount))
+        {
+            CacheSize = (size_t)atoi(Args[++ArgIndex]);
+        }
+        else if(Arg[0] == '-')
+        {
+            fprintf(stdout, "Error: Unknown option \'%s\'.\n", Arg);
+            return 0;
+        }
+        else
+        {
+            InputFileName = Arg;
+            BatchInputs[NumBatchInputs++] = Arg;
+        }
+    }
+    
+    if(VectorWidth > BestVectorWidth())
+    {
+        // NOTE: Without the JIT there's nothing to vectorize anyway
+        if(BestVectorWidth())
+        {
+            fprintf(stdout, "Warning: This machine can't run AVX2, loops are vectorized with SSE2.\n");
+        }
+        VectorWidth = BestVectorWidth();
+    }
+    
+    compile_options Options = {};
+    Options.Target = Target;
+    Options.Instrument = Instrument;
+    Options.LineInfo = LineInfo;
+    Options.SourceName = InputFileName;
+    Options.Freestanding = Freestanding;
+    Options.CheckBounds = CheckBounds;
+    if(ProfileFileNameUsed)
+    {
+        Options.Profile = LoadProfile(ProfileFileNameUsed);
+        if(!Options.Profile)
+        {
+            fprintf(stdout, "Error: Could not read profile \'%s\'.\n", ProfileFileNameUsed);
+            return 0;
+        }
+    }
+    
+    compile_cache *Cache = 0;
+    if(CacheDirectory)
+    {
+        Cache = new compile_cache();
+        OpenCache(Cache, CacheDirectory, CacheSize*1024*1024);
+    }
+    
+    time_report *Timing = 0;
+    if(TimeReport)
+    {
+        Timing = new time_report();
+        InitTimeReport(Timing);
+    }
+    
+    if(ServerSocket)
+    {
+        free(BatchInputs);
+        return RunServer(ServerSocket, Cache, NumJobs);
+    }
+    
+    if(Batch)
+    {
+        if(Target == Target_Bytecode)
+        {
+            fprintf(stdout, "Error: --batch writes MASM or C, not bytecode.\n");
+            return 0;
+        }
+        
+        int Failures = RunBatch(BatchInputs, NumBatchInputs, OutputDirectory, &Options, Cache, Timing, NumJobs);
+        if(Timing)
+        {
+            PrintTimeReport(stdout, Timing, TimeReportJson);
+        }
+        free(BatchInputs);
+        delete Cache;
+        delete Timing;
+        
+        return (Failures == 0) ? 0 : 1;
+    }
+    free(BatchInputs);
+    
+    FILE *InputStream = stdin;
+    if(InputFileName)
+    {
+        InputStream = fopen(InputFileName, "rb");
+        if(!InputStream)
+        {
+            fprintf(stdout, "Error: Could not open input file.\n");
+            return 0;
+        }
+    }
+    
+    if(Timing)
+    {
+        SwitchPhase(Timing, Phase_Read);
+    }
+    size_t SourceSize;
+    char *Source = ReadEntireFile(InputStream, &SourceSize);
+    if(InputStream != stdin)
+    {
+        fclose(InputStream);
+    }
+    if(Timing)
+    {
+        SwitchPhase(Timing, Phase_Idle);
+    }
+    
+    static compiler_context Context;
+    Context.Timing = Timing;
+    bool Compiled = CompileCached(Cache, &Context, Source, SourceSize, &Options);
+    if(Compiled && Context.ProfileMismatch)
+    {
+        fprintf(stdout, "Warning: The profile does not match the program, it was only used up to the first difference.\n");
+    }
+    
+    if(!Compiled)
+    {
+        fprintf(stdout, "%s\n", Context.Error);
+    }
+    else if(CostReport)
+    {
+        PrintLoopCosts(stdout, Context.Bytecode, CostReportJson);
+    }
+    else if(StressCount > 0)
+    {
+        if(!RunJitStress(Context.Bytecode, StressCount, JitThreshold, VectorWidth))
+        {
+            ExitCode = 1;
+        }
+    }
+    else if(Target == Target_Bytecode)
+    {
+        static vm Machine;
+        InitVM(&Machine, Context.Bytecode);
+        Machine.JitEnabled = Machine.JitEnabled && JitEnabled;
+        Machine.JitThreshold = JitThreshold;
+        if(VectorWidth >= 0)
+        {
+            Machine.VectorWidth = VectorWidth;
+        }
+        if(Machine.JitEnabled)
+        {
+            if((PerfMap || JitDump) && !OpenPerfOutput(PerfMap, JitDump))
+            {
+                fprintf(stdout, "Warning: Could not write perf symbols for the JIT.\n");
+            }
+            StartJitWorkers(1);
+        }
+        RunBytecode(&Machine);
+        FreeVM(&Machine);
+        if(Instrument)
+        {
+            WriteProfile(&Context, Machine.Counters);
+        }
+    }
+    else
+    {
+        FILE *OutputStream = fopen((Target == Target_C) ? "test1.c" : "test1.asm", "w");
+        if(OutputStream)
+        {
+            fwrite(Context.Output.Data, 1, Context.Output.Size, OutputStream);
+            fclose(OutputStream);
+        }
+    }
+    
+    if(Timing)
+    {
+        PrintTimeReport(stdout, Timing, TimeReportJson);
+    }
+    
+    FreeCompilerContext(&Context);
+    free(Source);
+    delete Cache;
+    if(Options.Profile)
+    {
+        FreeProfile(Options.Profile);
+    }
+    delete Timing;
+    
+    return ExitCode;
+}
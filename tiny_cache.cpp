@@ -0,0 +1,368 @@
+// NOTE: Content-addressed compilation cache (--cache-dir).
+//
+// An entry is the generated code for one (source, compiler build, options)
+// triple, stored in a file named after a 128-bit hash of all three. A hit
+// copies the file into Context->Output without lexing or parsing. Entries are
+// written to a private temporary file and renamed into place, so concurrent
+// writers (threads or processes) never expose a partial entry and the last
+// rename wins with identical contents. Hits touch the entry's modification
+// time; when the directory grows past its size limit the least recently used
+// entries are deleted.
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#define CompilerBuild "tiny " __DATE__ " " __TIME__
+
+// NOTE: 32 hex digits
+#define CacheKeyLength 32
+
+struct compile_cache
+{
+    char Directory[1024];
+    size_t MaxSize;
+    
+    // NOTE: Guards TotalSize and eviction
+    std::mutex Mutex;
+    
+    // NOTE: Estimate, recounted from the directory whenever it passes MaxSize
+    size_t TotalSize;
+    
+    std::atomic<int> Hits;
+    std::atomic<int> Misses;
+};
+
+struct cache_entry
+{
+    char Name[CacheKeyLength + 8];
+    size_t Size;
+    time_t LastUsed;
+};
+
+static std::atomic<unsigned int> CacheTemporaryCounter;
+
+static void
+CacheKey(char *Key, char *Source, size_t SourceSize, compile_options *Options)
+{
+    unsigned long long Hashes[2] = {14695981039346656037ULL, 7809847782465536322ULL};
+    for(int HashIndex = 0;
+        HashIndex < 2;
+        HashIndex++)
+    {
+        Hashes[HashIndex] = HashBytes(Hashes[HashIndex], (void *)CompilerBuild, sizeof(CompilerBuild));
+        Hashes[HashIndex] = HashOptions(Hashes[HashIndex], Options);
+        Hashes[HashIndex] = HashBytes(Hashes[HashIndex], &SourceSize, sizeof(SourceSize));
+        Hashes[HashIndex] = HashBytes(Hashes[HashIndex], Source, SourceSize);
+    }
+    
+    snprintf(Key, CacheKeyLength + 1, "%016llx%016llx", Hashes[0], Hashes[1]);
+}
+
+static char *
+CacheExtension(compile_options *Options)
+{
+    char *Result = ".asm";
+    if(Options->Target == Target_C)
+    {
+        Result = ".c";
+    }
+    
+    return Result;
+}
+
+static bool
+IsCacheEntryName(char *Name)
+{
+    // NOTE: <key>.asm or <key>.c, temporaries have more after the extension
+    size_t Length = strlen(Name);
+    bool Result = (((Length == CacheKeyLength + 4) && !strcmp(Name + CacheKeyLength, ".asm")) ||
+                   ((Length == CacheKeyLength + 2) && !strcmp(Name + CacheKeyLength, ".c")));
+    
+    return Result;
+}
+
+//
+// --Platform
+//
+
+static void
+MakeDirectory(char *Path)
+{
+#if defined(_WIN32)
+    _mkdir(Path);
+#else
+    mkdir(Path, 0777);
+#endif
+}
+
+static bool
+ReplaceFile(char *From, char *To)
+{
+#if defined(_WIN32)
+    bool Result = (MoveFileExA(From, To, MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+    bool Result = (rename(From, To) == 0);
+#endif
+    
+    return Result;
+}
+
+static void
+TouchFile(char *Path)
+{
+#if defined(_WIN32)
+    _utime(Path, 0);
+#else
+    utime(Path, 0);
+#endif
+}
+
+static int
+ProcessID()
+{
+#if defined(_WIN32)
+    int Result = _getpid();
+#else
+    int Result = (int)getpid();
+#endif
+    
+    return Result;
+}
+
+// NOTE: Returns a malloc'd array of the cache entries in Directory
+static cache_entry *
+ListCacheEntries(char *Directory, int *Count)
+{
+    int MaxEntries = 256;
+    int NumEntries = 0;
+    cache_entry *Entries = (cache_entry *)malloc(MaxEntries*sizeof(cache_entry));
+
+#if defined(_WIN32)
+    char Pattern[1100];
+    snprintf(Pattern, sizeof(Pattern), "%s\\*", Directory);
+    
+    WIN32_FIND_DATAA FindData;
+    HANDLE Find = FindFirstFileA(Pattern, &FindData);
+    if(Find != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if(IsCacheEntryName(FindData.cFileName))
+            {
+                if(NumEntries == MaxEntries)
+                {
+                    MaxEntries *= 2;
+                    Entries = (cache_entry *)realloc(Entries, MaxEntries*sizeof(cache_entry));
+                }
+                
+                cache_entry *Entry = Entries + NumEntries++;
+                strcpy(Entry->Name, FindData.cFileName);
+                Entry->Size = ((size_t)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow;
+                ULARGE_INTEGER Time;
+                Time.LowPart = FindData.ftLastWriteTime.dwLowDateTime;
+                Time.HighPart = FindData.ftLastWriteTime.dwHighDateTime;
+                Entry->LastUsed = (time_t)(Time.QuadPart / 10000000ULL);
+            }
+        } while(FindNextFileA(Find, &FindData));
+        FindClose(Find);
+    }
+#else
+    DIR *Dir = opendir(Directory);
+    if(Dir)
+    {
+        while(dirent *DirEntry = readdir(Dir))
+        {
+            if(IsCacheEntryName(DirEntry->d_name))
+            {
+                // NOTE: IsCacheEntryName bounds the length, so the name fits
+                char Name[CacheKeyLength + 8];
+                strcpy(Name, DirEntry->d_name);
+                
+                char Path[1100];
+                snprintf(Path, sizeof(Path), "%s/%s", Directory, Name);
+                
+                struct stat Status;
+                if(stat(Path, &Status) == 0)
+                {
+                    if(NumEntries == MaxEntries)
+                    {
+                        MaxEntries *= 2;
+                        Entries = (cache_entry *)realloc(Entries, MaxEntries*sizeof(cache_entry));
+                    }
+                    
+                    cache_entry *Entry = Entries + NumEntries++;
+                    strcpy(Entry->Name, Name);
+                    Entry->Size = (size_t)Status.st_size;
+                    Entry->LastUsed = Status.st_mtime;
+                }
+            }
+        }
+        closedir(Dir);
+    }
+#endif
+    
+    *Count = NumEntries;
+    return Entries;
+}
+
+//
+// --Cache
+//
+
+static int
+CompareLastUsed(const void *A, const void *B)
+{
+    cache_entry *First = (cache_entry *)A;
+    cache_entry *Second = (cache_entry *)B;
+    
+    int Result = (First->LastUsed < Second->LastUsed) ? -1 : ((First->LastUsed > Second->LastUsed) ? 1 : 0);
+    return Result;
+}
+
+// NOTE: Call with Cache->Mutex held. Recounts the directory and deletes least
+// recently used entries until it is back under 90% of the limit.
+static void
+EvictCacheEntries(compile_cache *Cache)
+{
+    int NumEntries;
+    cache_entry *Entries = ListCacheEntries(Cache->Directory, &NumEntries);
+    
+    size_t TotalSize = 0;
+    for(int EntryIndex = 0;
+        EntryIndex < NumEntries;
+        EntryIndex++)
+    {
+        TotalSize += Entries[EntryIndex].Size;
+    }
+    
+    if(TotalSize > Cache->MaxSize)
+    {
+        qsort(Entries, NumEntries, sizeof(cache_entry), CompareLastUsed);
+        
+        size_t Target = Cache->MaxSize - Cache->MaxSize/10;
+        for(int EntryIndex = 0;
+            (EntryIndex < NumEntries) && (TotalSize > Target);
+            EntryIndex++)
+        {
+            char Path[1100];
+            snprintf(Path, sizeof(Path), "%s/%s", Cache->Directory, Entries[EntryIndex].Name);
+            
+            // NOTE: Another process may have evicted it already
+            remove(Path);
+            TotalSize -= Entries[EntryIndex].Size;
+        }
+    }
+    
+    Cache->TotalSize = TotalSize;
+    free(Entries);
+}
+
+static void
+OpenCache(compile_cache *Cache, char *Directory, size_t MaxSize)
+{
+    snprintf(Cache->Directory, sizeof(Cache->Directory), "%s", Directory);
+    Cache->MaxSize = MaxSize;
+    MakeDirectory(Cache->Directory);
+    
+    std::lock_guard<std::mutex> Lock(Cache->Mutex);
+    EvictCacheEntries(Cache);
+}
+
+static bool
+ReadCacheEntry(char *Path, output_buffer *Output)
+{
+    bool Result = false;
+    
+    FILE *File = fopen(Path, "rb");
+    if(File)
+    {
+        Output->Size = 0;
+        ReadIntoBuffer(File, Output);
+        fclose(File);
+        TouchFile(Path);
+        
+        Result = true;
+    }
+    
+    return Result;
+}
+
+static void
+WriteCacheEntry(compile_cache *Cache, char *Path, output_buffer *Output)
+{
+    char TemporaryPath[1200];
+    snprintf(TemporaryPath, sizeof(TemporaryPath), "%s.tmp.%d.%u",
+             Path, ProcessID(), CacheTemporaryCounter.fetch_add(1));
+    
+    FILE *File = fopen(TemporaryPath, "wb");
+    if(File)
+    {
+        bool Written = (fwrite(Output->Data, 1, Output->Size, File) == Output->Size);
+        Written = (fclose(File) == 0) && Written;
+        
+        if(!Written || !ReplaceFile(TemporaryPath, Path))
+        {
+            remove(TemporaryPath);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> Lock(Cache->Mutex);
+            Cache->TotalSize += Output->Size;
+            if(Cache->TotalSize > Cache->MaxSize)
+            {
+                EvictCacheEntries(Cache);
+            }
+        }
+    }
+}
+
+// NOTE: Compile, going through Cache when there is one. Bytecode is never cached.
+static bool
+CompileCached(compile_cache *Cache, compiler_context *Context, char *Source, size_t SourceSize,
+              compile_options *Options)
+{
+    bool Result = false;
+    
+    if(!Cache || (Options->Target == Target_Bytecode))
+    {
+        Result = Compile(Context, Source, SourceSize, Options);
+    }
+    else
+    {
+        char Key[CacheKeyLength + 1];
+        CacheKey(Key, Source, SourceSize, Options);
+        
+        char Path[1100];
+        snprintf(Path, sizeof(Path), "%s/%s%s", Cache->Directory, Key, CacheExtension(Options));
+        
+        if(ReadCacheEntry(Path, &Context->Output))
+        {
+            Cache->Hits++;
+            Context->Error[0] = 0;
+            Context->ProfileMismatch = false;
+            Result = true;
+        }
+        else
+        {
+            // NOTE: Output laid out from a profile that doesn't match isn't
+            // stored, so a hit never has to bring back the warning about it
+            Cache->Misses++;
+            Result = Compile(Context, Source, SourceSize, Options);
+            if(Result && !Context->ProfileMismatch)
+            {
+                WriteCacheEntry(Cache, Path, &Context->Output);
+            }
+        }
+    }
+    
+    return Result;
+}
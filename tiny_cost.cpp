@@ -0,0 +1,855 @@
+// NOTE: Static cost model for JIT compiled loops (--cost-report).
+//
+// Every WHILE loop is translated exactly as the JIT would translate it and the
+// machine code is decoded back into instructions. The decoder only knows the
+// handful of forms TranslateLoop emits; anything else is reported, so a change
+// to the emitter shows up here too.
+//
+// One iteration is the path from the loop head to the back-edge with every
+// conditional branch falling through: every IF condition true and every inner
+// loop going around once. Unconditional forward jumps are followed. A READ,
+// WRITE, call or RETURN leaves the native code for the interpreter, which
+// isn't modelled.
+//
+// Each instruction has a latency, fused-domain uops and the execution ports
+// its unfused uops can go to, roughly Skylake's (Agner Fog's tables,
+// uops.info). The estimate for an iteration is the largest of
+//     - the loop-carried dependency chain: variables live in memory, so this is
+//       usually a load, some arithmetic and a store forwarded to the next load
+//     - the most loaded port, every uop split evenly over its ports
+//     - the divider, which isn't pipelined
+//     - the front end, four fused uops or one taken branch per cycle
+// It ignores caches, branch mispredictions and the exact scheduler, so it's
+// for comparing code generation, not for predicting run time.
+
+#define CostIterations 16
+#define MaxCostPath 16384
+#define MaxCostSlots 1024
+
+enum cost_port
+{
+    Port_0 = 0x01,
+    Port_1 = 0x02,
+    Port_2 = 0x04,
+    Port_3 = 0x08,
+    Port_4 = 0x10,
+    Port_5 = 0x20,
+    Port_6 = 0x40,
+    Port_7 = 0x80,
+    
+    Ports_ALU = Port_0 | Port_1 | Port_5 | Port_6,
+    Ports_06 = Port_0 | Port_6,
+    Ports_Load = Port_2 | Port_3,
+    Ports_StoreAddress = Port_2 | Port_3 | Port_7,
+    Ports_StoreData = Port_4,
+};
+
+#define NumCostPorts 8
+
+enum cost_register
+{
+    Reg_EAX = 0x01,
+    Reg_ECX = 0x02,
+    Reg_EDX = 0x04,
+    Reg_R9 = 0x08,
+    Reg_Flags = 0x10,
+};
+
+#define NumCostRegisters 5
+
+enum cost_operand
+{
+    Operand_None,
+    Operand_Imm32,
+    
+    // NOTE: Only the low 32 bits are kept in cost_instruction::Operand
+    Operand_Imm64,
+    Operand_Disp32,
+    Operand_Rel32,
+};
+
+enum cost_access
+{
+    Access_None,
+    Access_Load,
+    Access_Store,
+    Access_LoadStore,
+    Access_Push,
+    Access_Pop,
+};
+
+enum cost_flow
+{
+    Flow_None,
+    
+    // NOTE: Conditional, assumed not taken
+    Flow_Branch,
+    Flow_Jump,
+};
+
+struct cost_form
+{
+    int Length;
+    unsigned char Bytes[4];
+    cost_operand Operand;
+    
+    // NOTE: printf format, given the operand if there is one
+    char *Name;
+    
+    int Latency;
+    int FusedUops;
+    int Ports[4];
+    
+    // NOTE: Further uops that can go to any ALU port, and cycles the divider is busy
+    int ExtraALUUops;
+    int DividerCycles;
+    
+    int Reads;
+    int Writes;
+    cost_access Access;
+    cost_flow Flow;
+    
+    // NOTE: Addresses the frame ([r10 + disp32]) rather than the globals
+    bool Frame;
+    
+    // NOTE: Array elements ([r8 + index*scale + disp32]); the element isn't
+    // known, so these don't take part in the memory dependencies
+    bool Indexed;
+};
+
+// NOTE: Every form TranslateLoop emits inside a loop body, see the comments there
+static cost_form CostForms[] =
+{
+    {1, {0xB8}, Operand_Imm32, "mov eax, %d", 1, 1, {Ports_ALU}, 0, 0, 0, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x41, 0x8B, 0x80}, Operand_Disp32, "mov eax, [r8+%d]", 5, 1, {Ports_Load}, 0, 0, 0, Reg_EAX, Access_Load, Flow_None, false, false},
+    {3, {0x41, 0x89, 0x80}, Operand_Disp32, "mov [r8+%d], eax", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_EAX, 0, Access_Store, Flow_None, false, false},
+    {3, {0x49, 0xFF, 0x80}, Operand_Disp32, "inc qword [r8+%d]", 6, 2, {Ports_Load, Ports_ALU, Ports_StoreAddress, Ports_StoreData}, 0, 0, 0, Reg_Flags, Access_LoadStore, Flow_None, false, false},
+    {1, {0x50}, Operand_None, "push rax", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_EAX, 0, Access_Push, Flow_None, false, false},
+    {1, {0x59}, Operand_None, "pop rcx", 5, 1, {Ports_Load}, 0, 0, 0, Reg_ECX, Access_Pop, Flow_None, false, false},
+    {2, {0xF7, 0xD8}, Operand_None, "neg eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0xF7, 0xD0}, Operand_None, "not eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_EAX, Access_None, Flow_None, false, false},
+    {2, {0x01, 0xC8}, Operand_None, "add eax, ecx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x29, 0xC1}, Operand_None, "sub ecx, eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_ECX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x89, 0xC8}, Operand_None, "mov eax, ecx", 1, 1, {Ports_ALU}, 0, 0, Reg_ECX, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0xAF, 0xC1}, Operand_None, "imul eax, ecx", 3, 1, {Port_1}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x21, 0xC8}, Operand_None, "and eax, ecx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x09, 0xC8}, Operand_None, "or eax, ecx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x31, 0xC8}, Operand_None, "xor eax, ecx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x39, 0xC1}, Operand_None, "cmp ecx, eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x85, 0xC0}, Operand_None, "test eax, eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x83, 0xF8, 0xFF}, Operand_None, "cmp eax, -1", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0x94, 0xC0}, Operand_None, "sete al", 1, 1, {Ports_06}, 0, 0, Reg_EAX | Reg_Flags, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0x95, 0xC0}, Operand_None, "setne al", 1, 1, {Ports_06}, 0, 0, Reg_EAX | Reg_Flags, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0x9C, 0xC0}, Operand_None, "setl al", 1, 1, {Ports_06}, 0, 0, Reg_EAX | Reg_Flags, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0x9D, 0xC0}, Operand_None, "setge al", 1, 1, {Ports_06}, 0, 0, Reg_EAX | Reg_Flags, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0x9E, 0xC0}, Operand_None, "setle al", 1, 1, {Ports_06}, 0, 0, Reg_EAX | Reg_Flags, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0x9F, 0xC0}, Operand_None, "setg al", 1, 1, {Ports_06}, 0, 0, Reg_EAX | Reg_Flags, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x0F, 0xB6, 0xC0}, Operand_None, "movzx eax, al", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x41, 0x89, 0xC1}, Operand_None, "mov r9d, eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_R9, Access_None, Flow_None, false, false},
+    {1, {0x99}, Operand_None, "cdq", 1, 1, {Ports_06}, 0, 0, Reg_EAX, Reg_EDX, Access_None, Flow_None, false, false},
+    {3, {0x41, 0xF7, 0xF9}, Operand_None, "idiv r9d", 26, 10, {Port_0, Port_1, Port_5, Port_6}, 6, 6, Reg_EAX | Reg_EDX | Reg_R9, Reg_EAX | Reg_EDX | Reg_Flags, Access_None, Flow_None, false, false},
+    
+    // NOTE: LONG, the registers are tracked as their low halves
+    {2, {0x48, 0xB8}, Operand_Imm64, "mov rax, imm64", 1, 1, {Ports_ALU}, 0, 0, 0, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x49, 0x8B, 0x80}, Operand_Disp32, "mov rax, [r8+%d]", 5, 1, {Ports_Load}, 0, 0, 0, Reg_EAX, Access_Load, Flow_None, false, false},
+    {3, {0x49, 0x89, 0x80}, Operand_Disp32, "mov [r8+%d], rax", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_EAX, 0, Access_Store, Flow_None, false, false},
+    {3, {0x49, 0x8B, 0x82}, Operand_Disp32, "mov rax, [r10+%d]", 5, 1, {Ports_Load}, 0, 0, 0, Reg_EAX, Access_Load, Flow_None, true, false},
+    {3, {0x49, 0x89, 0x82}, Operand_Disp32, "mov [r10+%d], rax", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_EAX, 0, Access_Store, Flow_None, true, false},
+    {3, {0x48, 0x63, 0xC0}, Operand_None, "movsxd rax, eax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x63, 0xC9}, Operand_None, "movsxd rcx, ecx", 1, 1, {Ports_ALU}, 0, 0, Reg_ECX, Reg_ECX, Access_None, Flow_None, false, false},
+    {1, {0x51}, Operand_None, "push rcx", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_ECX, 0, Access_Push, Flow_None, false, false},
+    {3, {0x48, 0xF7, 0xD8}, Operand_None, "neg rax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0xF7, 0xD0}, Operand_None, "not rax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_EAX, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x01, 0xC8}, Operand_None, "add rax, rcx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x29, 0xC1}, Operand_None, "sub rcx, rax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_ECX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x89, 0xC8}, Operand_None, "mov rax, rcx", 1, 1, {Ports_ALU}, 0, 0, Reg_ECX, Reg_EAX, Access_None, Flow_None, false, false},
+    {4, {0x48, 0x0F, 0xAF, 0xC1}, Operand_None, "imul rax, rcx", 3, 1, {Port_1}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x21, 0xC8}, Operand_None, "and rax, rcx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x09, 0xC8}, Operand_None, "or rax, rcx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x31, 0xC8}, Operand_None, "xor rax, rcx", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_EAX | Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x39, 0xC1}, Operand_None, "cmp rcx, rax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX | Reg_ECX, Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x48, 0x85, 0xC0}, Operand_None, "test rax, rax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_Flags, Access_None, Flow_None, false, false},
+    {4, {0x48, 0x83, 0xF8, 0xFF}, Operand_None, "cmp rax, -1", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_Flags, Access_None, Flow_None, false, false},
+    {3, {0x49, 0x89, 0xC1}, Operand_None, "mov r9, rax", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_R9, Access_None, Flow_None, false, false},
+    {2, {0x48, 0x99}, Operand_None, "cqo", 1, 1, {Ports_06}, 0, 0, Reg_EAX, Reg_EDX, Access_None, Flow_None, false, false},
+    {3, {0x49, 0xF7, 0xF9}, Operand_None, "idiv r9", 42, 57, {Port_0, Port_1, Port_5, Port_6}, 53, 24, Reg_EAX | Reg_EDX | Reg_R9, Reg_EAX | Reg_EDX | Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x0F, 0x84}, Operand_Rel32, "jz %+d", 0, 1, {Ports_06}, 0, 0, Reg_Flags, 0, Access_None, Flow_Branch, false, false},
+    {2, {0x0F, 0x85}, Operand_Rel32, "jnz %+d", 0, 1, {Ports_06}, 0, 0, Reg_Flags, 0, Access_None, Flow_Branch, false, false},
+    {1, {0xE9}, Operand_Rel32, "jmp %+d", 0, 1, {Port_6}, 0, 0, 0, 0, Access_None, Flow_Jump, false, false},
+    
+    // NOTE: Arrays
+    {4, {0x41, 0x8B, 0x84, 0x80}, Operand_Disp32, "mov eax, [r8+rax*4+%d]", 5, 1, {Ports_Load}, 0, 0, Reg_EAX, Reg_EAX, Access_Load, Flow_None, false, true},
+    {4, {0x49, 0x8B, 0x84, 0xC0}, Operand_Disp32, "mov rax, [r8+rax*8+%d]", 5, 1, {Ports_Load}, 0, 0, Reg_EAX, Reg_EAX, Access_Load, Flow_None, false, true},
+    {4, {0x41, 0x89, 0x84, 0x88}, Operand_Disp32, "mov [r8+rcx*4+%d], eax", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_EAX | Reg_ECX, 0, Access_Store, Flow_None, false, true},
+    {4, {0x49, 0x89, 0x84, 0xC8}, Operand_Disp32, "mov [r8+rcx*8+%d], rax", 0, 1, {Ports_StoreAddress, Ports_StoreData}, 0, 0, Reg_EAX | Reg_ECX, 0, Access_Store, Flow_None, false, true},
+    {1, {0x3D}, Operand_Imm32, "cmp eax, %d", 1, 1, {Ports_ALU}, 0, 0, Reg_EAX, Reg_Flags, Access_None, Flow_None, false, false},
+    {2, {0x0F, 0x83}, Operand_Rel32, "jae %+d", 0, 1, {Ports_06}, 0, 0, Reg_Flags, 0, Access_None, Flow_Branch, false, false},
+    
+    // NOTE: CASE
+    {2, {0x0F, 0x8F}, Operand_Rel32, "jg %+d", 0, 1, {Ports_06}, 0, 0, Reg_Flags, 0, Access_None, Flow_Branch, false, false},
+};
+
+static char *PortNames[NumCostPorts] = {"p0", "p1", "p2", "p3", "p4", "p5", "p6", "p7"};
+
+struct cost_instruction
+{
+    cost_form *Form;
+    int Offset;
+    int Operand;
+    int Line;
+    
+    // NOTE: Index into loop_cost::Slots for memory accesses, the stack depth for push/pop
+    int Slot;
+};
+
+struct cost_node
+{
+    double Finish;
+    
+    // NOTE: Index of the instruction (over all simulated iterations) that this
+    // one waited for last, -1 if none
+    int Critical;
+};
+
+struct loop_cost
+{
+    bool Compiled;
+    
+    // NOTE: Set when the code held an instruction CostForms doesn't know
+    int UnknownOffset;
+    
+    int FirstLine;
+    int LastLine;
+    
+    int NumInstructions;
+    cost_instruction *Path;
+    
+    int NumSlots;
+    int Slots[MaxCostSlots];
+    
+    int FusedUops;
+    int TakenBranches;
+    int InnerLoops;
+    int SideExits;
+    
+    double PortPressure[NumCostPorts];
+    double DividerCycles;
+    
+    double ChainCycles;
+    int ChainLength;
+    int *Chain;
+    
+    double Cycles;
+    char *Bound;
+};
+
+static int
+CostFormSize(cost_form *Form)
+{
+    int Result = Form->Length;
+    if(Form->Operand == Operand_Imm64)
+    {
+        Result += 8;
+    }
+    else if(Form->Operand != Operand_None)
+    {
+        Result += 4;
+    }
+    
+    return Result;
+}
+
+static cost_form *
+DecodeCostForm(unsigned char *Code, int Size, int Offset, int *Operand)
+{
+    cost_form *Result = 0;
+    
+    int NumForms = sizeof(CostForms)/sizeof(CostForms[0]);
+    for(int FormIndex = 0;
+        !Result && (FormIndex < NumForms);
+        FormIndex++)
+    {
+        cost_form *Form = CostForms + FormIndex;
+        int FormSize = CostFormSize(Form);
+        if((Offset + FormSize <= Size) && !memcmp(Code + Offset, Form->Bytes, Form->Length))
+        {
+            Result = Form;
+            *Operand = 0;
+            if(Form->Operand != Operand_None)
+            {
+                unsigned char *At = Code + Offset + Form->Length;
+                *Operand = (int)((unsigned int)At[0] | ((unsigned int)At[1] << 8) |
+                                 ((unsigned int)At[2] << 16) | ((unsigned int)At[3] << 24));
+            }
+        }
+    }
+    
+    return Result;
+}
+
+
+static int
+CostSlot(loop_cost *Cost, int Displacement)
+{
+    int Result = -1;
+    for(int SlotIndex = 0;
+        (Result < 0) && (SlotIndex < Cost->NumSlots);
+        SlotIndex++)
+    {
+        if(Cost->Slots[SlotIndex] == Displacement)
+        {
+            Result = SlotIndex;
+        }
+    }
+    
+    if((Result < 0) && (Cost->NumSlots < MaxCostSlots))
+    {
+        Result = Cost->NumSlots++;
+        Cost->Slots[Result] = Displacement;
+    }
+    
+    return Result;
+}
+
+// NOTE: Walks one iteration of the loop's native code into Cost->Path
+static void
+WalkCostPath(loop_cost *Cost, bytecode *Program, loop *Loop, unsigned char *Code, int Size, int *OpOffsets)
+{
+    int NumRegionOps = Loop->BackEdge - Loop->Head + 1;
+    int Head = OpOffsets[0];
+    
+    // NOTE: The back-edge is the last op, a jmp; exit stubs follow it
+    int RegionEnd = OpOffsets[NumRegionOps - 1] + 5;
+    
+    int Op = 0;
+    int Depth = 0;
+    int At = Head;
+    bool Done = false;
+    while(!Done && (Cost->NumInstructions < MaxCostPath))
+    {
+        int Operand;
+        cost_form *Form = DecodeCostForm(Code, Size, At, &Operand);
+        if(!Form || (At >= RegionEnd))
+        {
+            Cost->UnknownOffset = At - Head;
+            break;
+        }
+        
+        while((Op + 1 < NumRegionOps) && (OpOffsets[Op + 1] <= At))
+        {
+            Op++;
+        }
+        while((Op > 0) && (OpOffsets[Op] > At))
+        {
+            Op--;
+        }
+        
+        cost_instruction *Instruction = Cost->Path + Cost->NumInstructions++;
+        Instruction->Form = Form;
+        Instruction->Offset = At - Head;
+        Instruction->Operand = Operand;
+        Instruction->Line = Program->Ops[Loop->Head + Op].Line;
+        Instruction->Slot = -1;
+        switch(Form->Access)
+        {
+            case Access_Load:
+            case Access_Store:
+            case Access_LoadStore:
+            {
+                // NOTE: Frame slots are keyed apart from the (non-negative) global offsets
+                if(!Form->Indexed)
+                {
+                    Instruction->Slot = CostSlot(Cost, Form->Frame ? ~Operand : Operand);
+                }
+            } break;
+            
+            case Access_Push:
+            {
+                Instruction->Slot = Depth++;
+            } break;
+            
+            case Access_Pop:
+            {
+                Instruction->Slot = --Depth;
+            } break;
+            
+            default: break;
+        }
+        
+        int Next = At + CostFormSize(Form);
+        if(Form->Flow == Flow_Jump)
+        {
+            int Target = Next + Operand;
+            if(Target == Head)
+            {
+                Done = true;
+            }
+            else if(Target >= RegionEnd)
+            {
+                // NOTE: A side exit, the interpreter comes back at the next back-edge
+                Cost->SideExits++;
+            }
+            else if(Target < At)
+            {
+                Cost->InnerLoops++;
+            }
+            else
+            {
+                Cost->TakenBranches++;
+                Next = Target;
+            }
+        }
+        
+        At = Next;
+    }
+    
+    // NOTE: The back-edge itself
+    Cost->TakenBranches++;
+}
+
+static void
+CountPortPressure(loop_cost *Cost)
+{
+    for(int InstructionIndex = 0;
+        InstructionIndex < Cost->NumInstructions;
+        InstructionIndex++)
+    {
+        cost_form *Form = Cost->Path[InstructionIndex].Form;
+        Cost->FusedUops += Form->FusedUops;
+        Cost->DividerCycles += Form->DividerCycles;
+        
+        for(int UopIndex = 0;
+            UopIndex < 4 + Form->ExtraALUUops;
+            UopIndex++)
+        {
+            int Ports = (UopIndex < 4) ? Form->Ports[UopIndex] : Ports_ALU;
+            if(!Ports)
+            {
+                continue;
+            }
+            
+            int NumPorts = 0;
+            for(int Port = 0;
+                Port < NumCostPorts;
+                Port++)
+            {
+                NumPorts += (Ports >> Port) & 1;
+            }
+            for(int Port = 0;
+                Port < NumCostPorts;
+                Port++)
+            {
+                if(Ports & (1 << Port))
+                {
+                    Cost->PortPressure[Port] += 1.0 / NumPorts;
+                }
+            }
+        }
+    }
+}
+
+// NOTE: Runs CostIterations iterations on unlimited execution units, so only
+// latencies count. The slope of the finish times is the loop-carried chain;
+// following the critical inputs back from the last instruction until one
+// repeats gives the chain itself.
+static void
+FindCriticalChain(loop_cost *Cost)
+{
+    int N = Cost->NumInstructions;
+    cost_node *Nodes = (cost_node *)malloc(CostIterations*N*sizeof(cost_node));
+    
+    double RegisterReady[NumCostRegisters] = {};
+    int RegisterProducer[NumCostRegisters];
+    double *SlotReady = (double *)calloc(Cost->NumSlots + MaxVMStack, sizeof(double));
+    int *SlotProducer = (int *)malloc((Cost->NumSlots + MaxVMStack)*sizeof(int));
+    for(int Register = 0;
+        Register < NumCostRegisters;
+        Register++)
+    {
+        RegisterProducer[Register] = -1;
+    }
+    for(int SlotIndex = 0;
+        SlotIndex < Cost->NumSlots + MaxVMStack;
+        SlotIndex++)
+    {
+        SlotProducer[SlotIndex] = -1;
+    }
+    
+    double IterationFinish[CostIterations] = {};
+    for(int Iteration = 0;
+        Iteration < CostIterations;
+        Iteration++)
+    {
+        for(int InstructionIndex = 0;
+            InstructionIndex < N;
+            InstructionIndex++)
+        {
+            cost_instruction *Instruction = Cost->Path + InstructionIndex;
+            cost_form *Form = Instruction->Form;
+            cost_node *Node = Nodes + Iteration*N + InstructionIndex;
+            
+            // NOTE: Stack slots live after the variables
+            int Slot = Instruction->Slot;
+            if((Form->Access == Access_Push) || (Form->Access == Access_Pop))
+            {
+                Slot += Cost->NumSlots;
+            }
+            
+            double Start = 0;
+            Node->Critical = -1;
+            
+            // NOTE: Branches are predicted, they don't wait for their flags
+            int Reads = (Form->Flow == Flow_None) ? Form->Reads : 0;
+            for(int Register = 0;
+                Register < NumCostRegisters;
+                Register++)
+            {
+                if((Reads & (1 << Register)) && (RegisterReady[Register] > Start))
+                {
+                    Start = RegisterReady[Register];
+                    Node->Critical = RegisterProducer[Register];
+                }
+            }
+            if(((Form->Access == Access_Load) || (Form->Access == Access_LoadStore) ||
+                (Form->Access == Access_Pop)) && (Slot >= 0) && (SlotReady[Slot] > Start))
+            {
+                Start = SlotReady[Slot];
+                Node->Critical = SlotProducer[Slot];
+            }
+            
+            Node->Finish = Start + Form->Latency;
+            for(int Register = 0;
+                Register < NumCostRegisters;
+                Register++)
+            {
+                if(Form->Writes & (1 << Register))
+                {
+                    RegisterReady[Register] = Node->Finish;
+                    RegisterProducer[Register] = Iteration*N + InstructionIndex;
+                }
+            }
+            if(((Form->Access == Access_Store) || (Form->Access == Access_LoadStore) ||
+                (Form->Access == Access_Push)) && (Slot >= 0))
+            {
+                SlotReady[Slot] = Node->Finish;
+                SlotProducer[Slot] = Iteration*N + InstructionIndex;
+            }
+            
+            if(Node->Finish > IterationFinish[Iteration])
+            {
+                IterationFinish[Iteration] = Node->Finish;
+            }
+        }
+    }
+    
+    int Half = CostIterations/2;
+    Cost->ChainCycles = (IterationFinish[CostIterations - 1] - IterationFinish[Half - 1]) / (CostIterations - Half);
+    
+    // NOTE: Walk back from the instruction that finished last
+    int Last = (CostIterations - 1)*N;
+    for(int InstructionIndex = 0;
+        InstructionIndex < N;
+        InstructionIndex++)
+    {
+        if(Nodes[(CostIterations - 1)*N + InstructionIndex].Finish > Nodes[Last].Finish)
+        {
+            Last = (CostIterations - 1)*N + InstructionIndex;
+        }
+    }
+    
+    int *Seen = (int *)malloc(N*sizeof(int));
+    for(int InstructionIndex = 0;
+        InstructionIndex < N;
+        InstructionIndex++)
+    {
+        Seen[InstructionIndex] = -1;
+    }
+    
+    int *Walk = (int *)malloc(CostIterations*N*sizeof(int));
+    int WalkLength = 0;
+    int CycleStart = -1;
+    for(int At = Last;
+        (At >= 0) && (CycleStart < 0);
+        At = Nodes[At].Critical)
+    {
+        int InstructionIndex = At % N;
+        if(Seen[InstructionIndex] >= 0)
+        {
+            CycleStart = Seen[InstructionIndex];
+        }
+        else
+        {
+            Seen[InstructionIndex] = WalkLength;
+            Walk[WalkLength++] = InstructionIndex;
+        }
+    }
+    
+    // NOTE: Without a loop-carried chain report the longest chain in an iteration
+    int First = (CycleStart >= 0) ? CycleStart : 0;
+    Cost->ChainLength = WalkLength - First;
+    Cost->Chain = (int *)malloc((Cost->ChainLength + 1)*sizeof(int));
+    for(int ChainIndex = 0;
+        ChainIndex < Cost->ChainLength;
+        ChainIndex++)
+    {
+        Cost->Chain[ChainIndex] = Walk[WalkLength - 1 - ChainIndex];
+    }
+    
+    // NOTE: Start a loop-carried chain at its first instruction in the path
+    if(CycleStart >= 0)
+    {
+        int Earliest = 0;
+        for(int ChainIndex = 1;
+            ChainIndex < Cost->ChainLength;
+            ChainIndex++)
+        {
+            if(Cost->Chain[ChainIndex] < Cost->Chain[Earliest])
+            {
+                Earliest = ChainIndex;
+            }
+        }
+        for(int ChainIndex = 0;
+            ChainIndex < Cost->ChainLength;
+            ChainIndex++)
+        {
+            Walk[ChainIndex] = Cost->Chain[(Earliest + ChainIndex) % Cost->ChainLength];
+        }
+        memcpy(Cost->Chain, Walk, Cost->ChainLength*sizeof(int));
+    }
+    
+    free(Walk);
+    free(Seen);
+    free(SlotProducer);
+    free(SlotReady);
+    free(Nodes);
+}
+
+static void
+EstimateLoopCost(loop_cost *Cost, vm *Machine, loop *Loop)
+{
+    *Cost = {};
+    Cost->UnknownOffset = -1;
+    
+    bytecode *Program = Machine->Program;
+    for(int PC = Loop->Head;
+        PC <= Loop->BackEdge;
+        PC++)
+    {
+        int Line = Program->Ops[PC].Line;
+        if(Line && (!Cost->FirstLine || (Line < Cost->FirstLine)))
+        {
+            Cost->FirstLine = Line;
+        }
+        if(Line > Cost->LastLine)
+        {
+            Cost->LastLine = Line;
+        }
+    }
+    
+    code_buffer Sizing = {};
+    int Size = TranslateLoop(Machine, Loop, &Sizing);
+    if(Size > 0)
+    {
+        code_buffer Buffer = {};
+        Buffer.Base = (unsigned char *)malloc(Size);
+        Buffer.Max = Size;
+        int *OpOffsets = (int *)malloc((Loop->BackEdge - Loop->Head + 1)*sizeof(int));
+        TranslateLoop(Machine, Loop, &Buffer, OpOffsets);
+        
+        Cost->Compiled = true;
+        Cost->Path = (cost_instruction *)malloc(MaxCostPath*sizeof(cost_instruction));
+        WalkCostPath(Cost, Program, Loop, Buffer.Base, Size, OpOffsets);
+        if(Cost->NumInstructions > 0)
+        {
+            CountPortPressure(Cost);
+            FindCriticalChain(Cost);
+        }
+        
+        free(OpOffsets);
+        free(Buffer.Base);
+    }
+    
+    Cost->Cycles = Cost->ChainCycles;
+    Cost->Bound = "dependency chain";
+    for(int Port = 0;
+        Port < NumCostPorts;
+        Port++)
+    {
+        if(Cost->PortPressure[Port] > Cost->Cycles)
+        {
+            Cost->Cycles = Cost->PortPressure[Port];
+            Cost->Bound = PortNames[Port];
+        }
+    }
+    if(Cost->DividerCycles > Cost->Cycles)
+    {
+        Cost->Cycles = Cost->DividerCycles;
+        Cost->Bound = "divider";
+    }
+    if(Cost->FusedUops / 4.0 > Cost->Cycles)
+    {
+        Cost->Cycles = Cost->FusedUops / 4.0;
+        Cost->Bound = "front end";
+    }
+    if(Cost->TakenBranches > Cost->Cycles)
+    {
+        Cost->Cycles = Cost->TakenBranches;
+        Cost->Bound = "taken branches";
+    }
+}
+
+static void
+FreeLoopCost(loop_cost *Cost)
+{
+    free(Cost->Path);
+    free(Cost->Chain);
+}
+
+static void
+FormatCostInstruction(cost_instruction *Instruction, char *Result, size_t ResultSize)
+{
+    snprintf(Result, ResultSize, Instruction->Form->Name, Instruction->Operand);
+}
+
+// NOTE: One entry per WHILE loop, innermost first (the order of their back-edges)
+static void
+PrintLoopCosts(FILE *Stream, bytecode *Program, bool Json)
+{
+    vm *Machine = new vm();
+    InitVM(Machine, Program);
+    
+    // NOTE: The estimate is for the scalar code, a vectorized loop is only
+    // reported as such (see tiny_vector.cpp)
+    int VectorWidth = Machine->VectorWidth;
+    Machine->VectorWidth = 0;
+    
+    if(Json)
+    {
+        fprintf(Stream, "{\"loops\": [");
+    }
+    
+    for(int LoopIndex = 0;
+        LoopIndex < Program->NumLoops;
+        LoopIndex++)
+    {
+        loop_cost Cost;
+        EstimateLoopCost(&Cost, Machine, Program->Loops + LoopIndex);
+        
+        vector_loop Vector;
+        bool Vectorized = (VectorWidth && MatchVectorLoop(Program, Program->Loops + LoopIndex, &Vector));
+        
+        char Text[64];
+        if(Json)
+        {
+            fprintf(Stream, "%s\n  {\"loop\": %d, \"file\": \"", LoopIndex ? "," : "", LoopIndex);
+            for(char *At = Program->SourceName;
+                *At;
+                At++)
+            {
+                if((*At == '"') || (*At == '\\'))
+                {
+                    fputc('\\', Stream);
+                }
+                fputc(*At, Stream);
+            }
+            fprintf(Stream, "\", \"first_line\": %d, \"last_line\": %d, \"compiled\": %s",
+                    Cost.FirstLine, Cost.LastLine, Cost.Compiled ? "true" : "false");
+            if(Cost.Compiled && Vectorized)
+            {
+                fprintf(Stream, ", \"vector_lanes\": %d", VectorWidth);
+            }
+            if(Cost.Compiled)
+            {
+                fprintf(Stream, ", \"cycles\": %.2f, \"bound\": \"%s\", \"instructions\": %d, \"fused_uops\": %d, "
+                        "\"taken_branches\": %d, \"inner_loops\": %d, \"side_exits\": %d, \"chain_cycles\": %.2f, "
+                        "\"divider_cycles\": %.2f, \"ports\": {",
+                        Cost.Cycles, Cost.Bound, Cost.NumInstructions, Cost.FusedUops, Cost.TakenBranches,
+                        Cost.InnerLoops, Cost.SideExits, Cost.ChainCycles, Cost.DividerCycles);
+                for(int Port = 0;
+                    Port < NumCostPorts;
+                    Port++)
+                {
+                    fprintf(Stream, "%s\"%s\": %.2f", Port ? ", " : "", PortNames[Port], Cost.PortPressure[Port]);
+                }
+                fprintf(Stream, "}, \"chain\": [");
+                for(int ChainIndex = 0;
+                    ChainIndex < Cost.ChainLength;
+                    ChainIndex++)
+                {
+                    cost_instruction *Instruction = Cost.Path + Cost.Chain[ChainIndex];
+                    FormatCostInstruction(Instruction, Text, sizeof(Text));
+                    fprintf(Stream, "%s{\"line\": %d, \"offset\": %d, \"instruction\": \"%s\"}",
+                            ChainIndex ? ", " : "", Instruction->Line, Instruction->Offset, Text);
+                }
+                fprintf(Stream, "]");
+                if(Cost.UnknownOffset >= 0)
+                {
+                    fprintf(Stream, ", \"unknown_instruction_offset\": %d", Cost.UnknownOffset);
+                }
+            }
+            fprintf(Stream, "}");
+        }
+        else
+        {
+            fprintf(Stream, "loop %d (%s:%d-%d): ", LoopIndex, Program->SourceName, Cost.FirstLine, Cost.LastLine);
+            if(!Cost.Compiled)
+            {
+                fprintf(Stream, "not compiled by the JIT\n");
+            }
+            else
+            {
+                fprintf(Stream, "%.2f cycles/iteration, bound by %s\n", Cost.Cycles, Cost.Bound);
+                if(Vectorized)
+                {
+                    fprintf(Stream, "    vectorized %d lanes wide when entered from the top, the estimate is per scalar iteration\n",
+                            VectorWidth);
+                }
+                fprintf(Stream, "    %d instructions, %d fused uops, %d taken branches", Cost.NumInstructions,
+                        Cost.FusedUops, Cost.TakenBranches);
+                if(Cost.InnerLoops)
+                {
+                    fprintf(Stream, ", %d inner loops counted once", Cost.InnerLoops);
+                }
+                if(Cost.SideExits)
+                {
+                    fprintf(Stream, ", %d side exits (I/O, calls) not counted", Cost.SideExits);
+                }
+                fprintf(Stream, "\n    ports:");
+                for(int Port = 0;
+                    Port < NumCostPorts;
+                    Port++)
+                {
+                    fprintf(Stream, " %s %.2f", PortNames[Port], Cost.PortPressure[Port]);
+                }
+                fprintf(Stream, "  divider %.2f\n", Cost.DividerCycles);
+                
+                fprintf(Stream, "    chain: %.2f cycles\n", Cost.ChainCycles);
+                for(int ChainIndex = 0;
+                    ChainIndex < Cost.ChainLength;
+                    ChainIndex++)
+                {
+                    cost_instruction *Instruction = Cost.Path + Cost.Chain[ChainIndex];
+                    FormatCostInstruction(Instruction, Text, sizeof(Text));
+                    fprintf(Stream, "        +%-5d %-20s line %d\n", Instruction->Offset, Text, Instruction->Line);
+                }
+                if(Cost.UnknownOffset >= 0)
+                {
+                    fprintf(Stream, "    stopped at an unknown instruction at +%d\n", Cost.UnknownOffset);
+                }
+            }
+        }
+        
+        FreeLoopCost(&Cost);
+    }
+    
+    if(Json)
+    {
+        fprintf(Stream, "%s]}\n", Program->NumLoops ? "\n" : "");
+    }
+    else if(!Program->NumLoops)
+    {
+        fprintf(Stream, "%s: no WHILE loops\n", Program->SourceName);
+    }
+    
+    delete Machine;
+}
@@ -0,0 +1,564 @@
+// NOTE: Batch compilation (tiny --batch).
+//
+// Inputs are source files or directories (every *.tiny file in them). Each
+// worker thread owns a compiler_context and a deque of inputs; it takes work
+// from the back of its own deque and, once that is empty, steals from the
+// front of the others. Every input gets an output file next to it (or in
+// --out-dir) named after the input with the backend's extension. Inputs whose
+// output files would be the same (p.tiny in two directories, with --out-dir)
+// fail before anything is compiled, none of them overwrites the other.
+
+#include <chrono>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#endif
+
+struct batch_job
+{
+    char *InputFileName;
+    char OutputFileName[1024];
+    
+    // NOTE: Another input writes the same output file, this one isn't compiled
+    bool Clashes;
+    
+    bool Succeeded;
+    double Milliseconds;
+    size_t SourceSize;
+};
+
+struct work_deque
+{
+    std::mutex Mutex;
+    int *Jobs;
+    int First;
+    int OnePastLast;
+};
+
+struct batch
+{
+    compile_options Options;
+    compile_cache *Cache;
+    
+    // NOTE: Workers time into their own report and add it to this one at the end
+    time_report *Timing;
+    
+    int NumJobs;
+    batch_job *Jobs;
+    
+    int NumWorkers;
+    work_deque *Deques;
+    
+    std::mutex PrintMutex;
+};
+
+static bool
+HasExtension(char *FileName, char *Extension)
+{
+    size_t NameLength = strlen(FileName);
+    size_t ExtensionLength = strlen(Extension);
+    
+    bool Result = ((NameLength > ExtensionLength) &&
+                   !strcmp(FileName + NameLength - ExtensionLength, Extension));
+    
+    return Result;
+}
+
+static void
+OutputFileNameFor(char *Result, char *InputFileName, char *OutputDirectory, target Target)
+{
+    char *BaseName = InputFileName;
+    if(OutputDirectory)
+    {
+        for(char *At = InputFileName; *At; At++)
+        {
+            if((*At == '/') || (*At == '\\'))
+            {
+                BaseName = At + 1;
+            }
+        }
+        snprintf(Result, 1024, "%s/%s", OutputDirectory, BaseName);
+    }
+    else
+    {
+        snprintf(Result, 1024, "%s", InputFileName);
+    }
+    
+    char *Dot = strrchr(Result, '.');
+    char *Slash = strrchr(Result, '/');
+    if(Dot && (!Slash || (Dot > Slash)))
+    {
+        *Dot = 0;
+    }
+    
+    size_t Length = strlen(Result);
+    snprintf(Result + Length, 1024 - Length, (Target == Target_C) ? ".c" : ".asm");
+}
+
+static int
+CompareOutputFileNames(const void *A, const void *B)
+{
+    batch_job *First = *(batch_job **)A;
+    batch_job *Second = *(batch_job **)B;
+    
+    int Result = strcmp(First->OutputFileName, Second->OutputFileName);
+    return Result;
+}
+
+// NOTE: Marks every job whose output file name another job has too, returns
+// how many there are
+static int
+MarkClashingOutputs(batch_job *Jobs, int NumJobs)
+{
+    batch_job **Sorted = (batch_job **)malloc((NumJobs + 1)*sizeof(batch_job *));
+    for(int JobIndex = 0;
+        JobIndex < NumJobs;
+        JobIndex++)
+    {
+        Sorted[JobIndex] = Jobs + JobIndex;
+    }
+    qsort(Sorted, NumJobs, sizeof(batch_job *), CompareOutputFileNames);
+    
+    int Result = 0;
+    for(int JobIndex = 1;
+        JobIndex < NumJobs;
+        JobIndex++)
+    {
+        if(!strcmp(Sorted[JobIndex - 1]->OutputFileName, Sorted[JobIndex]->OutputFileName))
+        {
+            Result += Sorted[JobIndex - 1]->Clashes ? 1 : 2;
+            Sorted[JobIndex - 1]->Clashes = true;
+            Sorted[JobIndex]->Clashes = true;
+        }
+    }
+    
+    free(Sorted);
+    
+    return Result;
+}
+
+static char *
+CopyString(char *String)
+{
+    size_t Size = strlen(String) + 1;
+    char *Result = (char *)malloc(Size);
+    memcpy(Result, String, Size);
+    
+    return Result;
+}
+
+static char *
+JoinPath(char *Directory, char *Name)
+{
+    size_t Size = strlen(Directory) + strlen(Name) + 2;
+    char *Result = (char *)malloc(Size);
+    snprintf(Result, Size, "%s/%s", Directory, Name);
+    
+    return Result;
+}
+
+// NOTE: Appends every *.tiny file in Directory to Names, returns the new count
+static int
+ListSourceFiles(char *Directory, char ***Names, int NumNames, int *MaxNames)
+{
+#if defined(_WIN32)
+    char Pattern[1024];
+    snprintf(Pattern, sizeof(Pattern), "%s\\*.tiny", Directory);
+    
+    WIN32_FIND_DATAA FindData;
+    HANDLE Find = FindFirstFileA(Pattern, &FindData);
+    if(Find != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if(!(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                if(NumNames == *MaxNames)
+                {
+                    *MaxNames *= 2;
+                    *Names = (char **)realloc(*Names, *MaxNames*sizeof(char *));
+                }
+                (*Names)[NumNames++] = JoinPath(Directory, FindData.cFileName);
+            }
+        } while(FindNextFileA(Find, &FindData));
+        FindClose(Find);
+    }
+#else
+    DIR *Dir = opendir(Directory);
+    if(Dir)
+    {
+        while(dirent *Entry = readdir(Dir))
+        {
+            if(HasExtension(Entry->d_name, ".tiny"))
+            {
+                if(NumNames == *MaxNames)
+                {
+                    *MaxNames *= 2;
+                    *Names = (char **)realloc(*Names, *MaxNames*sizeof(char *));
+                }
+                (*Names)[NumNames++] = JoinPath(Directory, Entry->d_name);
+            }
+        }
+        closedir(Dir);
+    }
+#endif
+    
+    return NumNames;
+}
+
+static bool
+IsDirectory(char *Path)
+{
+#if defined(_WIN32)
+    DWORD Attributes = GetFileAttributesA(Path);
+    bool Result = ((Attributes != INVALID_FILE_ATTRIBUTES) &&
+                   (Attributes & FILE_ATTRIBUTE_DIRECTORY));
+#else
+    DIR *Dir = opendir(Path);
+    bool Result = (Dir != 0);
+    if(Dir)
+    {
+        closedir(Dir);
+    }
+#endif
+    
+    return Result;
+}
+
+//
+// --Work stealing
+//
+
+static bool
+PopOwnJob(work_deque *Deque, int *Job)
+{
+    std::lock_guard<std::mutex> Lock(Deque->Mutex);
+    
+    bool Result = (Deque->First < Deque->OnePastLast);
+    if(Result)
+    {
+        *Job = Deque->Jobs[--Deque->OnePastLast];
+    }
+    
+    return Result;
+}
+
+static bool
+StealJob(work_deque *Deque, int *Job)
+{
+    std::lock_guard<std::mutex> Lock(Deque->Mutex);
+    
+    bool Result = (Deque->First < Deque->OnePastLast);
+    if(Result)
+    {
+        *Job = Deque->Jobs[Deque->First++];
+    }
+    
+    return Result;
+}
+
+static bool
+NextJob(batch *Batch, int WorkerIndex, int *Job)
+{
+    bool Result = PopOwnJob(Batch->Deques + WorkerIndex, Job);
+    
+    // NOTE: Jobs are never added once the batch starts, so one pass over the
+    // other deques that finds nothing means the batch is drained.
+    for(int Offset = 1;
+        !Result && (Offset < Batch->NumWorkers);
+        Offset++)
+    {
+        Result = StealJob(Batch->Deques + (WorkerIndex + Offset) % Batch->NumWorkers, Job);
+    }
+    
+    return Result;
+}
+
+static void
+CompileJob(batch *Batch, compiler_context *Context, batch_job *Job)
+{
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    
+    Job->Succeeded = false;
+    char *Error = 0;
+    
+    FILE *InputStream = fopen(Job->InputFileName, "rb");
+    if(InputStream)
+    {
+        compile_phase Previous = EnterPhase(Context, Phase_Read);
+        char *Source = ReadEntireFile(InputStream, &Job->SourceSize);
+        fclose(InputStream);
+        EnterPhase(Context, Previous);
+        
+        compile_options Options = Batch->Options;
+        Options.SourceName = Job->InputFileName;
+        if(CompileCached(Batch->Cache, Context, Source, Job->SourceSize, &Options))
+        {
+            FILE *OutputStream = fopen(Job->OutputFileName, "w");
+            if(OutputStream)
+            {
+                Job->Succeeded = (fwrite(Context->Output.Data, 1, Context->Output.Size, OutputStream) == Context->Output.Size);
+                Job->Succeeded = (fclose(OutputStream) == 0) && Job->Succeeded;
+            }
+            if(!Job->Succeeded)
+            {
+                Error = "Error: Could not write output file.";
+            }
+        }
+        else
+        {
+            Error = Context->Error;
+        }
+        
+        free(Source);
+    }
+    else
+    {
+        Error = "Error: Could not open input file.";
+    }
+    
+    std::chrono::duration<double, std::milli> Elapsed = std::chrono::steady_clock::now() - Start;
+    Job->Milliseconds = Elapsed.count();
+    
+    if(Error)
+    {
+        std::lock_guard<std::mutex> Lock(Batch->PrintMutex);
+        fprintf(stdout, "%s: %s\n", Job->InputFileName, Error);
+    }
+}
+
+static void
+BatchWorker(batch *Batch, int WorkerIndex)
+{
+    compiler_context *Context = new compiler_context();
+    
+    time_report Timing;
+    InitTimeReport(&Timing);
+    if(Batch->Timing)
+    {
+        Context->Timing = &Timing;
+    }
+    
+    int Job;
+    while(NextJob(Batch, WorkerIndex, &Job))
+    {
+        CompileJob(Batch, Context, Batch->Jobs + Job);
+    }
+    
+    if(Batch->Timing)
+    {
+        std::lock_guard<std::mutex> Lock(Batch->PrintMutex);
+        MergeTimeReport(Batch->Timing, &Timing);
+    }
+    
+    FreeCompilerContext(Context);
+    delete Context;
+}
+
+//
+// --Driver
+//
+
+static int
+CompareDoubles(const void *A, const void *B)
+{
+    double First = *(double *)A;
+    double Second = *(double *)B;
+    
+    int Result = (First < Second) ? -1 : ((First > Second) ? 1 : 0);
+    return Result;
+}
+
+static double
+Percentile(double *Sorted, int Count, double Fraction)
+{
+    // NOTE: Nearest rank
+    int Rank = (int)(Fraction*Count + 0.999999);
+    if(Rank < 1)
+    {
+        Rank = 1;
+    }
+    if(Rank > Count)
+    {
+        Rank = Count;
+    }
+    
+    double Result = Sorted[Rank - 1];
+    return Result;
+}
+
+// NOTE: Returns the number of inputs that failed to compile or clashed
+static int
+RunBatch(char **Inputs, int NumInputs, char *OutputDirectory, compile_options *Options,
+         compile_cache *Cache, time_report *Timing, int NumWorkers)
+{
+    int MaxNames = 64;
+    int NumNames = 0;
+    char **Names = (char **)malloc(MaxNames*sizeof(char *));
+    for(int InputIndex = 0;
+        InputIndex < NumInputs;
+        InputIndex++)
+    {
+        if(IsDirectory(Inputs[InputIndex]))
+        {
+            NumNames = ListSourceFiles(Inputs[InputIndex], &Names, NumNames, &MaxNames);
+        }
+        else
+        {
+            if(NumNames == MaxNames)
+            {
+                MaxNames *= 2;
+                Names = (char **)realloc(Names, MaxNames*sizeof(char *));
+            }
+            Names[NumNames++] = CopyString(Inputs[InputIndex]);
+        }
+    }
+    
+    if(NumWorkers <= 0)
+    {
+        unsigned int NumCores = std::thread::hardware_concurrency();
+        NumWorkers = (NumCores > 0) ? (int)NumCores : 1;
+    }
+    if(NumWorkers > NumNames)
+    {
+        NumWorkers = (NumNames > 0) ? NumNames : 1;
+    }
+    
+    batch *Batch = new batch();
+    Batch->Options = *Options;
+    Batch->Cache = Cache;
+    Batch->Timing = Timing;
+    Batch->NumJobs = NumNames;
+    Batch->Jobs = new batch_job[NumNames]();
+    Batch->NumWorkers = NumWorkers;
+    Batch->Deques = new work_deque[NumWorkers]();
+    
+    for(int WorkerIndex = 0;
+        WorkerIndex < NumWorkers;
+        WorkerIndex++)
+    {
+        Batch->Deques[WorkerIndex].Jobs = (int *)malloc((NumNames/NumWorkers + 1)*sizeof(int));
+    }
+    
+    for(int JobIndex = 0;
+        JobIndex < NumNames;
+        JobIndex++)
+    {
+        batch_job *Job = Batch->Jobs + JobIndex;
+        Job->InputFileName = Names[JobIndex];
+        OutputFileNameFor(Job->OutputFileName, Job->InputFileName, OutputDirectory, Options->Target);
+    }
+    
+    int NumClashes = MarkClashingOutputs(Batch->Jobs, NumNames);
+    if(NumClashes > 0)
+    {
+        for(int JobIndex = 0;
+            JobIndex < NumNames;
+            JobIndex++)
+        {
+            batch_job *Job = Batch->Jobs + JobIndex;
+            if(Job->Clashes)
+            {
+                fprintf(stdout, "%s: Error: Another input also writes '%s'.\n",
+                        Job->InputFileName, Job->OutputFileName);
+            }
+        }
+    }
+    
+    // NOTE: Deal the inputs out round-robin, stealing evens out the rest
+    int NumDealt = 0;
+    for(int JobIndex = 0;
+        JobIndex < NumNames;
+        JobIndex++)
+    {
+        if(!Batch->Jobs[JobIndex].Clashes)
+        {
+            work_deque *Deque = Batch->Deques + (NumDealt++ % NumWorkers);
+            Deque->Jobs[Deque->OnePastLast++] = JobIndex;
+        }
+    }
+    
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    
+    std::thread *Workers = new std::thread[NumWorkers];
+    for(int WorkerIndex = 0;
+        WorkerIndex < NumWorkers;
+        WorkerIndex++)
+    {
+        Workers[WorkerIndex] = std::thread(BatchWorker, Batch, WorkerIndex);
+    }
+    for(int WorkerIndex = 0;
+        WorkerIndex < NumWorkers;
+        WorkerIndex++)
+    {
+        Workers[WorkerIndex].join();
+    }
+    
+    std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+    double Seconds = Elapsed.count();
+    
+    // NOTE: The figures are over the inputs that were compiled, the clashing
+    // ones are only counted
+    int NumCompiled = 0;
+    int Failures = 0;
+    size_t TotalSourceSize = 0;
+    double *Latencies = (double *)malloc((NumNames + 1)*sizeof(double));
+    for(int JobIndex = 0;
+        JobIndex < NumNames;
+        JobIndex++)
+    {
+        batch_job *Job = Batch->Jobs + JobIndex;
+        if(!Job->Clashes)
+        {
+            Latencies[NumCompiled++] = Job->Milliseconds;
+            TotalSourceSize += Job->SourceSize;
+            if(!Job->Succeeded)
+            {
+                Failures++;
+            }
+        }
+    }
+    qsort(Latencies, NumCompiled, sizeof(double), CompareDoubles);
+    
+    fprintf(stdout, "Compiled %d files (%d failed) on %d threads in %.3f s\n",
+            NumCompiled, Failures, NumWorkers, Seconds);
+    if(NumClashes > 0)
+    {
+        fprintf(stdout, "Skipped %d files whose output files clash\n", NumClashes);
+    }
+    if(NumCompiled > 0)
+    {
+        fprintf(stdout, "Throughput: %.1f files/s, %.2f MB/s of source\n",
+                NumCompiled / Seconds, (TotalSourceSize / (1024.0*1024.0)) / Seconds);
+        fprintf(stdout, "Latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+                Percentile(Latencies, NumCompiled, 0.50),
+                Percentile(Latencies, NumCompiled, 0.90),
+                Percentile(Latencies, NumCompiled, 0.99),
+                Latencies[NumCompiled - 1]);
+    }
+    if(Cache)
+    {
+        fprintf(stdout, "Cache: %d hits, %d misses\n", Cache->Hits.load(), Cache->Misses.load());
+    }
+    
+    free(Latencies);
+    delete[] Workers;
+    for(int WorkerIndex = 0;
+        WorkerIndex < NumWorkers;
+        WorkerIndex++)
+    {
+        free(Batch->Deques[WorkerIndex].Jobs);
+    }
+    delete[] Batch->Deques;
+    delete[] Batch->Jobs;
+    delete Batch;
+    for(int NameIndex = 0;
+        NameIndex < NumNames;
+        NameIndex++)
+    {
+        free(Names[NameIndex]);
+    }
+    free(Names);
+    
+    return Failures + NumClashes;
+}
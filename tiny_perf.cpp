@@ -0,0 +1,268 @@
+// NOTE: Symbols for JIT code in Linux perf (--perf-map, --jitdump).
+//
+// perf can't see into the anonymous pages the JIT writes loops to, so samples
+// there show up as raw addresses. Two ways to name them:
+//
+// --perf-map appends "<start> <size> <name>" for every compiled loop to
+// /tmp/perf-<pid>.map, which perf report reads as is. The name carries the
+// loop's source lines, e.g. "tiny:loop3 [test1.tiny:12-18]".
+//
+// --jitdump writes /tmp/jit-<pid>.dump in the jitdump format
+// (tools/perf/Documentation/jitdump-specification.txt): a copy of each loop's
+// machine code plus a line table, so perf annotate can disassemble it and
+// attribute samples to TINY lines. The file is mapped executable once so the
+// mmap shows up in perf.data; afterwards
+//     perf record -k 1 tiny --run --jitdump test1.tiny
+//     perf inject --jit -i perf.data -o perf.jit.data
+//     perf report -i perf.jit.data
+// turns the records into ELF images perf can use.
+//
+// Both are written by the JIT workers as loops finish compiling, under one
+// lock, and flushed after every record so a program that crashes or gets
+// killed still leaves usable files behind.
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+struct perf_output
+{
+    std::mutex Mutex;
+    
+    FILE *Map;
+    FILE *Dump;
+    
+    // NOTE: The executable mapping of Dump that marks it for perf record
+    void *DumpMarker;
+    size_t DumpMarkerSize;
+    
+    unsigned long long CodeIndex;
+};
+
+// NOTE: Never freed, JIT workers may still report while main exits
+static perf_output *PerfOutput = 0;
+
+#if defined(__linux__)
+
+#define JitDumpMagic 0x4A695444
+#define JitDumpVersion 1
+#define JitDumpMachine 62 // NOTE: EM_X86_64
+
+enum jit_dump_record
+{
+    JitDump_CodeLoad = 0,
+    JitDump_DebugInfo = 2,
+};
+
+#pragma pack(push, 1)
+struct jit_dump_header
+{
+    unsigned int Magic;
+    unsigned int Version;
+    unsigned int HeaderSize;
+    unsigned int Machine;
+    unsigned int Pad;
+    unsigned int Pid;
+    unsigned long long Timestamp;
+    unsigned long long Flags;
+};
+
+struct jit_dump_prefix
+{
+    unsigned int ID;
+    unsigned int TotalSize;
+    unsigned long long Timestamp;
+};
+
+// NOTE: Followed by the null-terminated name and CodeSize bytes of code
+struct jit_dump_code_load
+{
+    jit_dump_prefix Prefix;
+    unsigned int Pid;
+    unsigned int Tid;
+    unsigned long long VirtualAddress;
+    unsigned long long CodeAddress;
+    unsigned long long CodeSize;
+    unsigned long long CodeIndex;
+};
+
+// NOTE: Followed by NumEntries jit_dump_line_entry, each followed by its
+// null-terminated file name
+struct jit_dump_debug_info
+{
+    jit_dump_prefix Prefix;
+    unsigned long long CodeAddress;
+    unsigned long long NumEntries;
+};
+
+struct jit_dump_line_entry
+{
+    unsigned long long Address;
+    unsigned int Line;
+    unsigned int Discriminator;
+};
+#pragma pack(pop)
+
+// NOTE: perf record -k 1 stamps its samples with CLOCK_MONOTONIC
+static unsigned long long
+PerfTimestamp()
+{
+    timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    
+    unsigned long long Result = (unsigned long long)Time.tv_sec*1000000000ULL + Time.tv_nsec;
+    return Result;
+}
+
+#endif
+
+static bool
+OpenPerfOutput(bool Map, bool Dump)
+{
+    bool Result = false;
+
+#if defined(__linux__)
+    perf_output *Output = new perf_output();
+    Result = true;
+    
+    char Path[64];
+    if(Map)
+    {
+        snprintf(Path, sizeof(Path), "/tmp/perf-%d.map", (int)getpid());
+        Output->Map = fopen(Path, "w");
+        Result = Result && Output->Map;
+    }
+    if(Dump)
+    {
+        snprintf(Path, sizeof(Path), "/tmp/jit-%d.dump", (int)getpid());
+        Output->Dump = fopen(Path, "w+b");
+        if(Output->Dump)
+        {
+            Output->DumpMarkerSize = (size_t)sysconf(_SC_PAGESIZE);
+            Output->DumpMarker = mmap(0, Output->DumpMarkerSize, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                                      fileno(Output->Dump), 0);
+            if(Output->DumpMarker == MAP_FAILED)
+            {
+                Output->DumpMarker = 0;
+            }
+            
+            jit_dump_header Header = {};
+            Header.Magic = JitDumpMagic;
+            Header.Version = JitDumpVersion;
+            Header.HeaderSize = sizeof(Header);
+            Header.Machine = JitDumpMachine;
+            Header.Pid = (unsigned int)getpid();
+            Header.Timestamp = PerfTimestamp();
+            fwrite(&Header, sizeof(Header), 1, Output->Dump);
+            fflush(Output->Dump);
+        }
+        Result = Result && Output->Dump && Output->DumpMarker;
+    }
+    
+    PerfOutput = Output;
+#endif
+    
+    return Result;
+}
+
+// NOTE: Called by a JIT worker once Loop's code at Base is final. OpOffsets
+// holds the native offset of each op from Loop->Head to Loop->BackEdge.
+static void
+ReportJitCode(vm *Machine, loop *Loop, unsigned char *Base, int Size, int *OpOffsets)
+{
+#if defined(__linux__)
+    bytecode *Program = Machine->Program;
+    int LoopIndex = (int)(Loop - Program->Loops);
+    
+    int FirstLine = 0;
+    int LastLine = 0;
+    for(int PC = Loop->Head;
+        PC <= Loop->BackEdge;
+        PC++)
+    {
+        int Line = Program->Ops[PC].Line;
+        if(Line && (!FirstLine || (Line < FirstLine)))
+        {
+            FirstLine = Line;
+        }
+        if(Line > LastLine)
+        {
+            LastLine = Line;
+        }
+    }
+    
+    char Name[512];
+    snprintf(Name, sizeof(Name), "tiny:loop%d [%s:%d-%d]", LoopIndex, Program->SourceName, FirstLine, LastLine);
+    
+    std::lock_guard<std::mutex> Lock(PerfOutput->Mutex);
+    
+    if(PerfOutput->Map)
+    {
+        fprintf(PerfOutput->Map, "%llx %x %s\n", (unsigned long long)Base, Size, Name);
+        fflush(PerfOutput->Map);
+    }
+    
+    if(PerfOutput->Dump)
+    {
+        unsigned long long Timestamp = PerfTimestamp();
+        size_t FileNameSize = strlen(Program->SourceName) + 1;
+        
+        // NOTE: One line entry wherever the source line changes
+        int NumEntries = 0;
+        int PreviousLine = -1;
+        for(int PC = Loop->Head;
+            PC <= Loop->BackEdge;
+            PC++)
+        {
+            int Line = Program->Ops[PC].Line;
+            if(Line && (Line != PreviousLine))
+            {
+                NumEntries++;
+                PreviousLine = Line;
+            }
+        }
+        
+        jit_dump_debug_info DebugInfo = {};
+        DebugInfo.Prefix.ID = JitDump_DebugInfo;
+        DebugInfo.Prefix.TotalSize = (unsigned int)(sizeof(DebugInfo) +
+                                                     NumEntries*(sizeof(jit_dump_line_entry) + FileNameSize));
+        DebugInfo.Prefix.Timestamp = Timestamp;
+        DebugInfo.CodeAddress = (unsigned long long)Base;
+        DebugInfo.NumEntries = NumEntries;
+        fwrite(&DebugInfo, sizeof(DebugInfo), 1, PerfOutput->Dump);
+        
+        PreviousLine = -1;
+        for(int PC = Loop->Head;
+            PC <= Loop->BackEdge;
+            PC++)
+        {
+            int Line = Program->Ops[PC].Line;
+            if(Line && (Line != PreviousLine))
+            {
+                jit_dump_line_entry Entry = {};
+                Entry.Address = (unsigned long long)(Base + OpOffsets[PC - Loop->Head]);
+                Entry.Line = Line;
+                fwrite(&Entry, sizeof(Entry), 1, PerfOutput->Dump);
+                fwrite(Program->SourceName, FileNameSize, 1, PerfOutput->Dump);
+                PreviousLine = Line;
+            }
+        }
+        
+        size_t NameSize = strlen(Name) + 1;
+        jit_dump_code_load CodeLoad = {};
+        CodeLoad.Prefix.ID = JitDump_CodeLoad;
+        CodeLoad.Prefix.TotalSize = (unsigned int)(sizeof(CodeLoad) + NameSize + Size);
+        CodeLoad.Prefix.Timestamp = Timestamp;
+        CodeLoad.Pid = (unsigned int)getpid();
+        CodeLoad.Tid = (unsigned int)syscall(SYS_gettid);
+        CodeLoad.VirtualAddress = (unsigned long long)Base;
+        CodeLoad.CodeAddress = (unsigned long long)Base;
+        CodeLoad.CodeSize = Size;
+        CodeLoad.CodeIndex = PerfOutput->CodeIndex++;
+        fwrite(&CodeLoad, sizeof(CodeLoad), 1, PerfOutput->Dump);
+        fwrite(Name, NameSize, 1, PerfOutput->Dump);
+        fwrite(Base, Size, 1, PerfOutput->Dump);
+        fflush(PerfOutput->Dump);
+    }
+#endif
+}
@@ -0,0 +1,437 @@
+// NOTE: Basic block profiling (--instrument).
+//
+// Every basic block the control flow routines open gets a 64-bit counter that
+// is incremented on entry: the program entry, each PROCEDURE's and FUNCTION's
+// entry, each WHILE's and FOR's condition (once per iteration plus the final
+// test), body and exit, each IF's THEN, ELSE and join, and each CASE's arms
+// and join. The counter remembers the source line the block starts on. At
+// exit the program writes test1.profile:
+//
+//     tiny-profile 1 <number of counters>
+//     <line> <kind> <count>        (one line per counter, in counter order)
+//
+// The counter order only depends on the source, so a later compilation of the
+// same program can line the counts up with its own blocks.
+
+#define ProfileFileName "test1.profile"
+
+static char *BlockKindNames[] = {"entry", "while", "do", "endwhile", "then", "else", "endif", "of", "endcase"};
+
+struct profile
+{
+    int NumCounters;
+    counter_site *Sites;
+    unsigned long long *Counts;
+    
+    // NOTE: For a Block_Then or Block_LoopHead, the count of its Block_Join or Block_LoopExit
+    unsigned long long *Closing;
+    
+    // NOTE: Of the file, so cached output compiled with a different profile isn't reused
+    unsigned long long Hash;
+};
+
+// NOTE: Returns the site of the next block if the profile has it, 0 without
+// a profile or once the program and the profile have gone different ways
+static int
+NextProfiledBlock(compiler_context *Context, block_kind Kind)
+{
+    int Result = -1;
+    
+    profile *Profile = Context->Profile;
+    if(Profile && !Context->ProfileMismatch)
+    {
+        int Index = Context->NumBlocks;
+        if((Index < Profile->NumCounters) &&
+           (Profile->Sites[Index].Kind == Kind) &&
+           (Profile->Sites[Index].Line == Context->TokenLine))
+        {
+            Result = Index;
+        }
+        else
+        {
+            Context->ProfileMismatch = true;
+        }
+    }
+    
+    return Result;
+}
+
+static void
+CountBlock(compiler_context *Context, block_kind Kind)
+{
+    NextProfiledBlock(Context, Kind);
+    int Index = Context->NumBlocks++;
+    
+    if(!Context->Instrument)
+    {
+        return;
+    }
+    
+    if(Index >= MaxCounters)
+    {
+        Abort(Context, "Too many basic blocks to instrument");
+    }
+    
+    Context->Counters[Index].Line = Context->TokenLine;
+    Context->Counters[Index].Kind = Kind;
+    
+    switch(Context->Target)
+    {
+        case Target_MASM:
+        {
+            // NOTE: Leaves eax alone, flags are dead at block boundaries
+            Print(Context, "\tADD DWORD PTR TinyCounters[%d], 1\n", Index*8);
+            Print(Context, "\tADC DWORD PTR TinyCounters[%d], 0\n", Index*8 + 4);
+            Context->NumInstructions += 2;
+        } break;
+        
+        case Target_Bytecode:
+        {
+            EmitOp(Context, Op_Count, Index);
+        } break;
+        
+        case Target_C:
+        {
+            EmitC(Context, "tiny_counters[%d]++;", Index);
+        } break;
+    }
+}
+
+// NOTE: Emits the counters, their sites and the routine that writes them out.
+// Called after the main program: MASM gets a PROC plus a second .data section,
+// C the definitions tiny_write_profile and tiny_counters were declared with.
+static void
+EmitProfileWriter(compiler_context *Context)
+{
+    int NumCounters = Context->NumBlocks;
+    int NumDeclared = (NumCounters > 0) ? NumCounters : 1;
+    
+    if(Context->Target == Target_MASM)
+    {
+        EmitNoTab(Context, "TinyWriteProfile PROC");
+        EmitInstruction(Context, "LEA", "eax", "ProfileMode");
+        EmitInstruction(Context, "PUSH", "eax");
+        EmitInstruction(Context, "LEA", "eax", "ProfileName");
+        EmitInstruction(Context, "PUSH", "eax");
+        EmitInstruction(Context, "CALL", "_imp__fopen");
+        EmitInstruction(Context, "ADD", "ESP", "8");
+        EmitInstruction(Context, "TEST", "eax", "eax");
+        EmitInstruction(Context, "JZ", "TinyWriteProfileDone");
+        EmitInstruction(Context, "PUSH", "esi");
+        EmitInstruction(Context, "MOV", "esi", "eax");
+        
+        char Operand[64];
+        sprintf(Operand, "%d", NumCounters);
+        EmitInstruction(Context, "PUSH", Operand);
+        EmitInstruction(Context, "LEA", "eax", "ProfileHeader");
+        EmitInstruction(Context, "PUSH", "eax");
+        EmitInstruction(Context, "PUSH", "esi");
+        EmitInstruction(Context, "CALL", "_imp__fprintf");
+        EmitInstruction(Context, "ADD", "ESP", "12");
+        
+        // NOTE: Unrolled, one fprintf per counter
+        for(int Index = 0;
+            Index < NumCounters;
+            Index++)
+        {
+            counter_site *Site = Context->Counters + Index;
+            sprintf(Operand, "DWORD PTR TinyCounters[%d]", Index*8 + 4);
+            EmitInstruction(Context, "PUSH", Operand);
+            sprintf(Operand, "DWORD PTR TinyCounters[%d]", Index*8);
+            EmitInstruction(Context, "PUSH", Operand);
+            sprintf(Operand, "ProfileKind%d", Site->Kind);
+            EmitInstruction(Context, "LEA", "eax", Operand);
+            EmitInstruction(Context, "PUSH", "eax");
+            sprintf(Operand, "%d", Site->Line);
+            EmitInstruction(Context, "PUSH", Operand);
+            EmitInstruction(Context, "LEA", "eax", "ProfileFormat");
+            EmitInstruction(Context, "PUSH", "eax");
+            EmitInstruction(Context, "PUSH", "esi");
+            EmitInstruction(Context, "CALL", "_imp__fprintf");
+            EmitInstruction(Context, "ADD", "ESP", "24");
+        }
+        
+        EmitInstruction(Context, "PUSH", "esi");
+        EmitInstruction(Context, "CALL", "_imp__fclose");
+        EmitInstruction(Context, "ADD", "ESP", "4");
+        EmitInstruction(Context, "POP", "esi");
+        PostLabel(Context, "TinyWriteProfileDone");
+        EmitLn(Context, "RET");
+        EmitNoTab(Context, "TinyWriteProfile ENDP");
+        
+        EmitNoTab(Context, ".data");
+        Print(Context, "ProfileName db \"%s\", 0\n", ProfileFileName);
+        EmitNoTab(Context, "ProfileMode db \"w\", 0");
+        EmitNoTab(Context, "ProfileHeader db \"tiny-profile 1 %d\", 10, 0");
+        EmitNoTab(Context, "ProfileFormat db \"%d %s %I64u\", 10, 0");
+        for(int Kind = 0;
+            Kind < ArrayCount(BlockKindNames);
+            Kind++)
+        {
+            Print(Context, "ProfileKind%d db \"%s\", 0\n", Kind, BlockKindNames[Kind]);
+        }
+        Print(Context, "TinyCounters QWORD %d DUP(0)\n", NumDeclared);
+    }
+    else if(Context->Target == Target_C)
+    {
+        EmitNoTab(Context, "");
+        Print(Context, "unsigned long long tiny_counters[%d];\n", NumDeclared);
+        Print(Context, "static const int tiny_profile_lines[%d] = {", NumDeclared);
+        for(int Index = 0;
+            Index < NumCounters;
+            Index++)
+        {
+            Print(Context, "%s%d", Index ? ", " : "", Context->Counters[Index].Line);
+        }
+        Print(Context, "%s};\n", NumCounters ? "" : "0");
+        Print(Context, "static const char *const tiny_profile_kinds[%d] = {", NumDeclared);
+        for(int Index = 0;
+            Index < NumCounters;
+            Index++)
+        {
+            Print(Context, "%s\"%s\"", Index ? ", " : "", BlockKindNames[Context->Counters[Index].Kind]);
+        }
+        Print(Context, "%s};\n", NumCounters ? "" : "0");
+        
+        EmitNoTab(Context, "");
+        EmitNoTab(Context, "static void");
+        EmitNoTab(Context, "tiny_write_profile(void)");
+        EmitNoTab(Context, "{");
+        Context->CIndent = 1;
+        EmitC(Context, "FILE *file = fopen(\"%s\", \"w\");", ProfileFileName);
+        EmitC(Context, "if(file)");
+        EmitC(Context, "{");
+        Context->CIndent++;
+        EmitC(Context, "fprintf(file, \"tiny-profile 1 %%d\\n\", %d);", NumCounters);
+        EmitC(Context, "for(int i = 0; i < %d; i++)", NumCounters);
+        EmitC(Context, "{");
+        Context->CIndent++;
+        EmitC(Context, "fprintf(file, \"%%d %%s %%llu\\n\", tiny_profile_lines[i], tiny_profile_kinds[i], tiny_counters[i]);");
+        Context->CIndent--;
+        EmitC(Context, "}");
+        EmitC(Context, "fclose(file);");
+        Context->CIndent--;
+        EmitC(Context, "}");
+        Context->CIndent = 0;
+        EmitNoTab(Context, "}");
+    }
+}
+
+// NOTE: For --run, where the counts live in the vm rather than the program
+static void
+WriteProfile(compiler_context *Context, unsigned long long *Counts)
+{
+    FILE *File = fopen(ProfileFileName, "w");
+    if(File)
+    {
+        fprintf(File, "tiny-profile 1 %d\n", Context->NumBlocks);
+        for(int Index = 0;
+            Index < Context->NumBlocks;
+            Index++)
+        {
+            counter_site *Site = Context->Counters + Index;
+            fprintf(File, "%d %s %llu\n", Site->Line, BlockKindNames[Site->Kind], Counts[Index]);
+        }
+        fclose(File);
+    }
+}
+
+//
+// --Profile use
+//
+
+static void
+FreeProfile(profile *Profile)
+{
+    free(Profile->Sites);
+    free(Profile->Counts);
+    free(Profile->Closing);
+    free(Profile);
+}
+
+// NOTE: Returns 0 if the file is missing or not a profile
+static profile *
+LoadProfile(char *FileName)
+{
+    FILE *File = fopen(FileName, "rb");
+    if(!File)
+    {
+        return 0;
+    }
+    
+    size_t Size;
+    char *Text = ReadEntireFile(File, &Size);
+    fclose(File);
+    
+    profile *Result = (profile *)calloc(1, sizeof(profile));
+    Result->Hash = HashBytes(14695981039346656037ULL, Text, Size);
+    
+    int Consumed = 0;
+    int NumCounters = 0;
+    bool Ok = ((sscanf(Text, "tiny-profile 1 %d%n", &NumCounters, &Consumed) == 1) &&
+               (NumCounters >= 0) && (NumCounters <= MaxCounters));
+    if(Ok)
+    {
+        Result->NumCounters = NumCounters;
+        Result->Sites = (counter_site *)calloc(NumCounters + 1, sizeof(counter_site));
+        Result->Counts = (unsigned long long *)calloc(NumCounters + 1, sizeof(unsigned long long));
+        Result->Closing = (unsigned long long *)calloc(NumCounters + 1, sizeof(unsigned long long));
+    }
+    
+    char *At = Text + Consumed;
+    for(int Index = 0;
+        Ok && (Index < NumCounters);
+        Index++)
+    {
+        char Kind[16];
+        Ok = (sscanf(At, "%d %15s %llu%n", &Result->Sites[Index].Line, Kind,
+                     &Result->Counts[Index], &Consumed) == 3);
+        At += Consumed;
+        
+        int KindIndex = -1;
+        for(int Candidate = 0;
+            Ok && (Candidate < ArrayCount(BlockKindNames));
+            Candidate++)
+        {
+            if(!strcmp(Kind, BlockKindNames[Candidate]))
+            {
+                KindIndex = Candidate;
+            }
+        }
+        Ok = Ok && (KindIndex >= 0);
+        Result->Sites[Index].Kind = (block_kind)KindIndex;
+    }
+    
+    // NOTE: Blocks nest like the source, so a stack pairs each IF and WHILE
+    // with the block that closes it
+    int *Open = (int *)malloc((NumCounters + 1)*sizeof(int));
+    int NumOpen = 0;
+    for(int Index = 0;
+        Ok && (Index < NumCounters);
+        Index++)
+    {
+        block_kind Kind = Result->Sites[Index].Kind;
+        if((Kind == Block_Then) || (Kind == Block_LoopHead))
+        {
+            Open[NumOpen++] = Index;
+        }
+        else if((Kind == Block_Join) || (Kind == Block_LoopExit))
+        {
+            Ok = (NumOpen > 0);
+            if(Ok)
+            {
+                Result->Closing[Open[--NumOpen]] = Result->Counts[Index];
+            }
+        }
+    }
+    
+    free(Open);
+    free(Text);
+    
+    if(!Ok)
+    {
+        FreeProfile(Result);
+        Result = 0;
+    }
+    
+    return Result;
+}
+
+// NOTE: How an IF is laid out. By default THEN falls through and ELSE follows
+// it; the colder side of a profiled IF moves out of line (MASM) or is marked
+// unlikely (C).
+struct if_layout
+{
+    bool ColdThen;
+    bool ColdElse;
+    bool Likely;
+    bool Unlikely;
+    
+    char ThenLabel[MaxTokenLength];
+    size_t ColdStart;
+};
+
+// NOTE: A rotated loop tests its condition at the bottom, so the body and the
+// test are contiguous and the back-edge is the only taken branch.
+struct loop_layout
+{
+    bool Rotate;
+    bool Hot;
+    
+    // NOTE: The FOR whose loop this is. On MASM its rotated condition ends in
+    // a CMP of the counter, see For
+    for_loop *For;
+    
+    char BodyLabel[MaxTokenLength];
+    size_t ConditionStart;
+    output_buffer Condition;
+};
+
+static void
+PlanIf(compiler_context *Context, if_layout *Layout)
+{
+    *Layout = {};
+    
+    int Block = NextProfiledBlock(Context, Block_Then);
+    if(Block >= 0)
+    {
+        unsigned long long Then = Context->Profile->Counts[Block];
+        unsigned long long Entries = Context->Profile->Closing[Block];
+        unsigned long long Else = (Entries > Then) ? (Entries - Then) : 0;
+        
+        // NOTE: Bytecode keeps source order, the interpreter and the JIT don't care
+        bool MASM = (Context->Target == Target_MASM);
+        bool C = (Context->Target == Target_C);
+        Layout->ColdThen = MASM && (Then < Else);
+        Layout->ColdElse = MASM && (Else < Then);
+        Layout->Likely = C && (Else < Then);
+        Layout->Unlikely = C && (Then < Else);
+        
+        if(Layout->ColdThen)
+        {
+            NewLabel(Context, Layout->ThenLabel);
+        }
+    }
+}
+
+static void
+PlanLoop(compiler_context *Context, loop_layout *Layout)
+{
+    *Layout = {};
+    
+    int Block = NextProfiledBlock(Context, Block_LoopHead);
+    if(Block >= 0)
+    {
+        // NOTE: The head runs once more than the body per entry, the exit once per entry
+        unsigned long long Tests = Context->Profile->Counts[Block];
+        unsigned long long Entries = Context->Profile->Closing[Block];
+        unsigned long long Iterations = (Tests > Entries) ? (Tests - Entries) : 0;
+        
+        Layout->Hot = (Iterations > Entries);
+        Layout->Rotate = Layout->Hot && (Context->Target == Target_MASM);
+        if(Layout->Rotate)
+        {
+            NewLabel(Context, Layout->BodyLabel);
+        }
+    }
+}
+
+// NOTE: Moves the MASM code emitted since Start to the cold section, followed
+// by a jump back to ResumeLabel
+static void
+MoveToColdSection(compiler_context *Context, size_t Start, char *ResumeLabel)
+{
+    output_buffer *Output = &Context->Output;
+    output_buffer *Cold = &Context->Cold;
+    
+    char Jump[MaxTokenLength + 16];
+    size_t JumpSize = snprintf(Jump, sizeof(Jump), "\tJMP %s\n", ResumeLabel);
+    
+    size_t Size = Output->Size - Start;
+    ReserveOutput(Cold, Size + JumpSize);
+    memcpy(Cold->Data + Cold->Size, Output->Data + Start, Size);
+    memcpy(Cold->Data + Cold->Size + Size, Jump, JumpSize);
+    Cold->Size += Size + JumpSize;
+    Output->Size = Start;
+    Context->NumInstructions++;
+}
@@ -0,0 +1,568 @@
+// NOTE: Input and output runtime for READ and WRITE.
+//
+// Rather than a printf per WRITE, compiled programs convert the value to
+// decimal themselves and append it to a 64 KB buffer, which goes to the
+// operating system in one write when it fills up, before the program waits
+// for input (so prompts show up) and at exit.
+//
+// Rather than a scanf per READ, stdin is read in 64 KB blocks (or, from C on
+// POSIX, mapped whole when it is a regular file) and the integer is parsed
+// straight out of the buffer. Like scanf("%d") it skips leading white space,
+// takes an optional sign, and leaves the variable alone when no digits follow
+// or the input has ended. Values out of range saturate to the variable's
+// smallest or largest value, as they do in the bytecode VM. In C both work on
+// 64 bits, so LONG variables go through the same routines.
+//
+// The runtime is emitted into every program, after the code in MASM and
+// before main in C, so there is still one file to assemble or compile. C only
+// gets the routines the program calls, so it builds with -Wall -Werror; that
+// is known at the end, so the runtime is emitted then and moved up front.
+//
+// The bytes written are the ones printf used to produce. For MASM that is the
+// value, then PrintFormat's CR LF with the LF expanded to CR LF again by
+// msvcrt's text mode stdout: CR CR LF. C's "\n" went through the same
+// translation on Windows, which _write on a text mode handle still does.
+//
+// With --freestanding the C runtime doesn't use the C library at all: read
+// and write become raw Linux system calls and the program brings its own
+// _start, which calls main and exits through exit_group. Built with
+//     cc -O2 -static -nostdlib -fno-builtin -fno-stack-protector -o test1 test1.c
+// the executable is a few KB, maps no shared objects, and runs nothing
+// before main, so exec to exit is mostly the kernel's own cost. stdin is
+// always read in blocks there rather than mapped.
+//
+// Division in C goes through tiny_div and tiny_div_long, so the smallest
+// value divided by -1 wraps around as it does on the other targets.
+//
+// With --check-bounds an index out of range goes to TinyIndexError or
+// tiny_index_error, which flush what was written so far, print the error
+// and exit with status 1.
+
+#define RuntimeOutputSize 65536
+#define RuntimeInputSize 65536
+
+static void
+EmitFreestandingStart(compiler_context *Context)
+{
+    EmitNoTab(Context, "/* Build with: cc -O2 -static -nostdlib -fno-builtin -fno-stack-protector */");
+    EmitNoTab(Context, "#if !defined(__linux__) || !(defined(__x86_64__) || defined(__aarch64__))");
+    EmitNoTab(Context, "#error --freestanding output needs Linux on x86-64 or AArch64");
+    EmitNoTab(Context, "#endif");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "#if defined(__x86_64__)");
+    EmitNoTab(Context, "#define TINY_SYS_READ 0");
+    EmitNoTab(Context, "#define TINY_SYS_WRITE 1");
+    EmitNoTab(Context, "#define TINY_SYS_EXIT_GROUP 231");
+    EmitNoTab(Context, "#else");
+    EmitNoTab(Context, "#define TINY_SYS_READ 63");
+    EmitNoTab(Context, "#define TINY_SYS_WRITE 64");
+    EmitNoTab(Context, "#define TINY_SYS_EXIT_GROUP 94");
+    EmitNoTab(Context, "#endif");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "static long");
+    EmitNoTab(Context, "tiny_syscall(long number, long a, long b, long c)");
+    EmitNoTab(Context, "{");
+    Context->CIndent = 1;
+    EmitNoTab(Context, "#if defined(__x86_64__)");
+    EmitC(Context, "long result;");
+    EmitC(Context, "__asm__ volatile(\"syscall\" : \"=a\"(result) : \"a\"(number), \"D\"(a), \"S\"(b), \"d\"(c) : \"rcx\", \"r11\", \"memory\");");
+    EmitC(Context, "return result;");
+    EmitNoTab(Context, "#else");
+    EmitC(Context, "register long x8 __asm__(\"x8\") = number;");
+    EmitC(Context, "register long x0 __asm__(\"x0\") = a;");
+    EmitC(Context, "register long x1 __asm__(\"x1\") = b;");
+    EmitC(Context, "register long x2 __asm__(\"x2\") = c;");
+    EmitC(Context, "__asm__ volatile(\"svc #0\" : \"+r\"(x0) : \"r\"(x8), \"r\"(x1), \"r\"(x2) : \"memory\");");
+    EmitC(Context, "return x0;");
+    EmitNoTab(Context, "#endif");
+    Context->CIndent = 0;
+    EmitNoTab(Context, "}");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "#define read(fd, buffer, size) tiny_syscall(TINY_SYS_READ, (fd), (long)(buffer), (long)(size))");
+    EmitNoTab(Context, "#define write(fd, buffer, size) tiny_syscall(TINY_SYS_WRITE, (fd), (long)(buffer), (long)(size))");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "int main(void);");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "__attribute__((used, noreturn)) static void");
+    EmitNoTab(Context, "tiny_start(void)");
+    EmitNoTab(Context, "{");
+    Context->CIndent = 1;
+    EmitC(Context, "tiny_syscall(TINY_SYS_EXIT_GROUP, main(), 0, 0);");
+    EmitC(Context, "for(;;) {}");
+    Context->CIndent = 0;
+    EmitNoTab(Context, "}");
+    EmitNoTab(Context, "");
+    
+    // NOTE: The kernel enters with the stack 16 byte aligned and no return
+    // address, the call puts it where the ABI expects it at a function entry
+    EmitNoTab(Context, "#if defined(__x86_64__)");
+    EmitNoTab(Context, "__asm__(\".text\\n.globl _start\\n_start:\\n\\txor %ebp, %ebp\\n\\tcall tiny_start\\n\");");
+    EmitNoTab(Context, "#else");
+    EmitNoTab(Context, "__asm__(\".text\\n.globl _start\\n_start:\\n\\tmov x29, #0\\n\\tmov x30, #0\\n\\tbl tiny_start\\n\");");
+    EmitNoTab(Context, "#endif");
+    EmitNoTab(Context, "");
+}
+
+// NOTE: C: the input buffer and tiny_parse, which tiny_read and tiny_read_long
+// go through
+static void
+EmitTinyParse(compiler_context *Context)
+{
+    Print(Context, "static char tiny_input[%d];\n", RuntimeInputSize);
+    EmitNoTab(Context, "static const char *tiny_input_at;");
+    EmitNoTab(Context, "static const char *tiny_input_end;");
+    if(!Context->Freestanding)
+    {
+        EmitNoTab(Context, "static int tiny_input_started;");
+    }
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "static int");
+    EmitNoTab(Context, "tiny_fill(void)");
+    EmitNoTab(Context, "{");
+    Context->CIndent = 1;
+    if(!Context->Freestanding)
+    {
+        EmitNoTab(Context, "#if !defined(_WIN32)");
+        EmitC(Context, "if(!tiny_input_started)");
+        EmitC(Context, "{");
+        Context->CIndent++;
+        EmitC(Context, "tiny_input_started = 1;");
+        EmitC(Context, "struct stat status;");
+        EmitC(Context, "off_t offset = lseek(0, 0, SEEK_CUR);");
+        EmitC(Context, "if((fstat(0, &status) == 0) && S_ISREG(status.st_mode) && (offset >= 0) && (status.st_size > offset))");
+        EmitC(Context, "{");
+        Context->CIndent++;
+        EmitC(Context, "void *map = mmap(0, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, 0, 0);");
+        EmitC(Context, "if(map != MAP_FAILED)");
+        EmitC(Context, "{");
+        Context->CIndent++;
+        EmitC(Context, "tiny_input_at = (const char *)map + offset;");
+        EmitC(Context, "tiny_input_end = (const char *)map + status.st_size;");
+        EmitC(Context, "tiny_input_started = 2;");
+        EmitC(Context, "return 1;");
+        Context->CIndent--;
+        EmitC(Context, "}");
+        Context->CIndent--;
+        EmitC(Context, "}");
+        Context->CIndent--;
+        EmitC(Context, "}");
+        EmitC(Context, "if(tiny_input_started == 2) return 0;");
+        EmitNoTab(Context, "#endif");
+    }
+    EmitC(Context, "tiny_flush();");
+    EmitC(Context, "int count = (int)read(0, tiny_input, sizeof(tiny_input));");
+    EmitC(Context, "if(count <= 0) return 0;");
+    EmitC(Context, "tiny_input_at = tiny_input;");
+    EmitC(Context, "tiny_input_end = tiny_input + count;");
+    EmitC(Context, "return 1;");
+    Context->CIndent = 0;
+    EmitNoTab(Context, "}");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "static int");
+    EmitNoTab(Context, "tiny_peek(void)");
+    EmitNoTab(Context, "{");
+    Context->CIndent = 1;
+    EmitC(Context, "return ((tiny_input_at < tiny_input_end) || tiny_fill()) ? (unsigned char)*tiny_input_at : -1;");
+    Context->CIndent = 0;
+    EmitNoTab(Context, "}");
+    EmitNoTab(Context, "");
+    EmitNoTab(Context, "static int");
+    EmitNoTab(Context, "tiny_parse(long long *result)");
+    EmitNoTab(Context, "{");
+    Context->CIndent = 1;
+    EmitC(Context, "int c = tiny_peek();");
+    EmitC(Context, "while((c == ' ') || ((unsigned int)(c - '\\t') < 5))");
+    EmitC(Context, "{");
+    Context->CIndent++;
+    EmitC(Context, "tiny_input_at++;");
+    EmitC(Context, "c = tiny_peek();");
+    Context->CIndent--;
+    EmitC(Context, "}");
+    EmitC(Context, "int negative = (c == '-');");
+    EmitC(Context, "if(negative || (c == '+'))");
+    EmitC(Context, "{");
+    Context->CIndent++;
+    EmitC(Context, "tiny_input_at++;");
+    EmitC(Context, "c = tiny_peek();");
+    Context->CIndent--;
+    EmitC(Context, "}");
+    EmitC(Context, "if((unsigned int)(c - '0') >= 10) return 0;");
+    EmitC(Context, "unsigned long long value = 0;");
+    EmitC(Context, "do");
+    EmitC(Context, "{");
+    Context->CIndent++;
+    EmitC(Context, "value = (value < 922337203685477581ull) ? value*10 + (unsigned int)(c - '0') : 9223372036854775808ull;");
+    EmitC(Context, "tiny_input_at++;");
+    EmitC(Context, "c = tiny_peek();");
+    Context->CIndent--;
+    EmitC(Context, "} while((unsigned int)(c - '0') < 10);");
+    EmitC(Context, "if(value > 9223372036854775807ull) value = negative ? 9223372036854775808ull : 9223372036854775807ull;");
+    EmitC(Context, "*result = negative ? (long long)(0ull - value) : (long long)value;");
+    EmitC(Context, "return 1;");
+    Context->CIndent = 0;
+    EmitNoTab(Context, "}");
+    EmitNoTab(Context, "");
+}
+
+static void
+EmitRuntime(compiler_context *Context)
+{
+    char Operand[64];
+    
+    if(Context->Target == Target_MASM)
+    {
+        // NOTE: Value in eax. The digits are written backwards in front of
+        // TinyLineEnd, then copied to the buffer along with the line end.
+        EmitNoTab(Context, "TinyWrite PROC");
+        EmitInstruction(Context, "PUSH", "esi");
+        EmitInstruction(Context, "PUSH", "edi");
+        sprintf(Operand, "%d", RuntimeOutputSize - 16);
+        EmitInstruction(Context, "CMP", "TinyOutputSize", Operand);
+        EmitInstruction(Context, "JBE", "TinyWriteConvert");
+        EmitInstruction(Context, "PUSH", "eax");
+        EmitLn(Context, "CALL TinyFlush");
+        EmitInstruction(Context, "POP", "eax");
+        PostLabel(Context, "TinyWriteConvert");
+        EmitInstruction(Context, "MOV", "esi", "eax");
+        EmitInstruction(Context, "LEA", "edi", "TinyLineEnd");
+        EmitInstruction(Context, "TEST", "eax", "eax");
+        EmitInstruction(Context, "JNS", "TinyWriteDigit");
+        
+        // NOTE: DIV is unsigned, so the most negative value comes out right too
+        EmitInstruction(Context, "NEG", "eax");
+        PostLabel(Context, "TinyWriteDigit");
+        EmitInstruction(Context, "XOR", "edx", "edx");
+        EmitInstruction(Context, "MOV", "ecx", "10");
+        EmitInstruction(Context, "DIV", "ecx");
+        EmitInstruction(Context, "ADD", "dl", "'0'");
+        EmitInstruction(Context, "DEC", "edi");
+        EmitInstruction(Context, "MOV", "BYTE PTR [edi]", "dl");
+        EmitInstruction(Context, "TEST", "eax", "eax");
+        EmitInstruction(Context, "JNZ", "TinyWriteDigit");
+        EmitInstruction(Context, "TEST", "esi", "esi");
+        EmitInstruction(Context, "JNS", "TinyWriteCopy");
+        EmitInstruction(Context, "DEC", "edi");
+        EmitInstruction(Context, "MOV", "BYTE PTR [edi]", "'-'");
+        PostLabel(Context, "TinyWriteCopy");
+        EmitInstruction(Context, "MOV", "esi", "edi");
+        EmitInstruction(Context, "LEA", "ecx", "TinyLineEnd + 3");
+        EmitInstruction(Context, "SUB", "ecx", "esi");
+        EmitInstruction(Context, "MOV", "edi", "TinyOutputSize");
+        EmitInstruction(Context, "ADD", "TinyOutputSize", "ecx");
+        EmitInstruction(Context, "LEA", "edi", "TinyOutput[edi]");
+        EmitLn(Context, "REP MOVSB");
+        EmitInstruction(Context, "POP", "edi");
+        EmitInstruction(Context, "POP", "esi");
+        EmitLn(Context, "RET");
+        EmitNoTab(Context, "TinyWrite ENDP");
+        
+        EmitNoTab(Context, "TinyFlush PROC");
+        EmitInstruction(Context, "CMP", "TinyOutputSize", "0");
+        EmitInstruction(Context, "JE", "TinyFlushDone");
+        EmitInstruction(Context, "PUSH", "STD_OUTPUT_HANDLE");
+        EmitLn(Context, "CALL GetStdHandle");
+        EmitInstruction(Context, "PUSH", "0");
+        EmitInstruction(Context, "PUSH", "OFFSET TinyWritten");
+        EmitInstruction(Context, "PUSH", "TinyOutputSize");
+        EmitInstruction(Context, "PUSH", "OFFSET TinyOutput");
+        EmitInstruction(Context, "PUSH", "eax");
+        EmitLn(Context, "CALL WriteFile");
+        EmitInstruction(Context, "MOV", "TinyOutputSize", "0");
+        PostLabel(Context, "TinyFlushDone");
+        EmitLn(Context, "RET");
+        EmitNoTab(Context, "TinyFlush ENDP");
+        
+        // NOTE: Address of the variable in eax. TinyPeek returns the next
+        // input byte in eax, or -1 at the end of the input.
+        EmitNoTab(Context, "TinyRead PROC");
+        EmitInstruction(Context, "PUSH", "ebx");
+        EmitInstruction(Context, "PUSH", "esi");
+        EmitInstruction(Context, "PUSH", "edi");
+        EmitInstruction(Context, "MOV", "edi", "eax");
+        PostLabel(Context, "TinyReadSkip");
+        EmitLn(Context, "CALL TinyPeek");
+        EmitInstruction(Context, "CMP", "eax", "' '");
+        EmitInstruction(Context, "JE", "TinyReadNext");
+        
+        // NOTE: \t \n \v \f \r
+        EmitInstruction(Context, "LEA", "ecx", "[eax - 9]");
+        EmitInstruction(Context, "CMP", "ecx", "5");
+        EmitInstruction(Context, "JAE", "TinyReadSign");
+        PostLabel(Context, "TinyReadNext");
+        EmitInstruction(Context, "INC", "TinyInputAt");
+        EmitInstruction(Context, "JMP", "TinyReadSkip");
+        PostLabel(Context, "TinyReadSign");
+        EmitInstruction(Context, "XOR", "esi", "esi");
+        EmitInstruction(Context, "CMP", "eax", "'+'");
+        EmitInstruction(Context, "JE", "TinyReadSkipSign");
+        EmitInstruction(Context, "CMP", "eax", "'-'");
+        EmitInstruction(Context, "JNE", "TinyReadFirst");
+        EmitInstruction(Context, "INC", "esi");
+        PostLabel(Context, "TinyReadSkipSign");
+        EmitInstruction(Context, "INC", "TinyInputAt");
+        EmitLn(Context, "CALL TinyPeek");
+        PostLabel(Context, "TinyReadFirst");
+        EmitInstruction(Context, "LEA", "ecx", "[eax - '0']");
+        EmitInstruction(Context, "CMP", "ecx", "10");
+        EmitInstruction(Context, "JAE", "TinyReadDone");
+        EmitInstruction(Context, "XOR", "ebx", "ebx");
+        
+        // NOTE: The magnitude in ebx stops at 80000000h, which is INT_MIN
+        // negated and one more than INT_MAX otherwise
+        PostLabel(Context, "TinyReadDigit");
+        EmitInstruction(Context, "CMP", "ebx", "214748364");
+        EmitInstruction(Context, "JA", "TinyReadSaturate");
+        EmitLn(Context, "IMUL ebx, ebx, 10");
+        EmitInstruction(Context, "ADD", "ebx", "ecx");
+        EmitInstruction(Context, "CMP", "ebx", "80000000h");
+        EmitInstruction(Context, "JBE", "TinyReadNextDigit");
+        PostLabel(Context, "TinyReadSaturate");
+        EmitInstruction(Context, "MOV", "ebx", "80000000h");
+        PostLabel(Context, "TinyReadNextDigit");
+        EmitInstruction(Context, "INC", "TinyInputAt");
+        EmitLn(Context, "CALL TinyPeek");
+        EmitInstruction(Context, "LEA", "ecx", "[eax - '0']");
+        EmitInstruction(Context, "CMP", "ecx", "10");
+        EmitInstruction(Context, "JB", "TinyReadDigit");
+        EmitInstruction(Context, "TEST", "esi", "esi");
+        EmitInstruction(Context, "JNZ", "TinyReadNegative");
+        EmitInstruction(Context, "CMP", "ebx", "80000000h");
+        EmitInstruction(Context, "JNE", "TinyReadStore");
+        EmitInstruction(Context, "DEC", "ebx");
+        EmitInstruction(Context, "JMP", "TinyReadStore");
+        PostLabel(Context, "TinyReadNegative");
+        EmitInstruction(Context, "NEG", "ebx");
+        PostLabel(Context, "TinyReadStore");
+        EmitInstruction(Context, "MOV", "[edi]", "ebx");
+        PostLabel(Context, "TinyReadDone");
+        EmitInstruction(Context, "POP", "edi");
+        EmitInstruction(Context, "POP", "esi");
+        EmitInstruction(Context, "POP", "ebx");
+        EmitLn(Context, "RET");
+        EmitNoTab(Context, "TinyRead ENDP");
+        
+        EmitNoTab(Context, "TinyPeek PROC");
+        EmitInstruction(Context, "MOV", "edx", "TinyInputAt");
+        EmitInstruction(Context, "CMP", "edx", "TinyInputEnd");
+        EmitInstruction(Context, "JB", "TinyPeekByte");
+        EmitLn(Context, "CALL TinyFlush");
+        EmitInstruction(Context, "PUSH", "STD_INPUT_HANDLE");
+        EmitLn(Context, "CALL GetStdHandle");
+        EmitInstruction(Context, "PUSH", "0");
+        EmitInstruction(Context, "PUSH", "OFFSET TinyInputCount");
+        sprintf(Operand, "%d", RuntimeInputSize);
+        EmitInstruction(Context, "PUSH", Operand);
+        EmitInstruction(Context, "PUSH", "OFFSET TinyInput");
+        EmitInstruction(Context, "PUSH", "eax");
+        EmitLn(Context, "CALL ReadFile");
+        EmitInstruction(Context, "TEST", "eax", "eax");
+        EmitInstruction(Context, "JZ", "TinyPeekEnd");
+        EmitInstruction(Context, "MOV", "eax", "TinyInputCount");
+        EmitInstruction(Context, "TEST", "eax", "eax");
+        EmitInstruction(Context, "JZ", "TinyPeekEnd");
+        EmitInstruction(Context, "LEA", "edx", "TinyInput");
+        EmitInstruction(Context, "MOV", "TinyInputAt", "edx");
+        EmitInstruction(Context, "ADD", "eax", "edx");
+        EmitInstruction(Context, "MOV", "TinyInputEnd", "eax");
+        PostLabel(Context, "TinyPeekByte");
+        EmitInstruction(Context, "MOVZX", "eax", "BYTE PTR [edx]");
+        EmitLn(Context, "RET");
+        PostLabel(Context, "TinyPeekEnd");
+        EmitInstruction(Context, "MOV", "eax", "-1");
+        EmitLn(Context, "RET");
+        EmitNoTab(Context, "TinyPeek ENDP");
+        
+        if(Context->CheckBounds)
+        {
+            EmitNoTab(Context, "TinyIndexError PROC");
+            EmitLn(Context, "CALL TinyFlush");
+            EmitInstruction(Context, "PUSH", "STD_OUTPUT_HANDLE");
+            EmitLn(Context, "CALL GetStdHandle");
+            EmitInstruction(Context, "PUSH", "0");
+            EmitInstruction(Context, "PUSH", "OFFSET TinyWritten");
+            EmitInstruction(Context, "PUSH", "29");
+            EmitInstruction(Context, "PUSH", "OFFSET TinyIndexMessage");
+            EmitInstruction(Context, "PUSH", "eax");
+            EmitLn(Context, "CALL WriteFile");
+            EmitInstruction(Context, "PUSH", "1");
+            EmitLn(Context, "CALL ExitProcess");
+            EmitNoTab(Context, "TinyIndexError ENDP");
+        }
+        
+        EmitNoTab(Context, ".data");
+        EmitNoTab(Context, "TinyOutputSize DWORD 0");
+        EmitNoTab(Context, "TinyWritten DWORD 0");
+        EmitNoTab(Context, "TinyDigits db 12 DUP(0)");
+        EmitNoTab(Context, "TinyLineEnd db 13, 13, 10");
+        EmitNoTab(Context, "TinyInputAt DWORD 0");
+        EmitNoTab(Context, "TinyInputEnd DWORD 0");
+        EmitNoTab(Context, "TinyInputCount DWORD 0");
+        if(Context->CheckBounds)
+        {
+            EmitNoTab(Context, "TinyIndexMessage db \"Error: Index out of bounds.\", 13, 10");
+        }
+        EmitNoTab(Context, ".data?");
+        Print(Context, "TinyOutput db %d DUP(?)\n", RuntimeOutputSize);
+        Print(Context, "TinyInput db %d DUP(?)\n", RuntimeInputSize);
+    }
+    else if(Context->Target == Target_C)
+    {
+        // NOTE: Not from any source line, so no #line for --line-info
+        bool LineInfo = Context->LineInfo;
+        Context->LineInfo = false;
+        
+        if(Context->Freestanding)
+        {
+            EmitFreestandingStart(Context);
+        }
+        else
+        {
+            EmitNoTab(Context, "#if defined(_WIN32)");
+            EmitNoTab(Context, "#include <io.h>");
+            EmitNoTab(Context, "#define read _read");
+            EmitNoTab(Context, "#define write _write");
+            EmitNoTab(Context, "#else");
+            EmitNoTab(Context, "#include <sys/mman.h>");
+            EmitNoTab(Context, "#include <sys/stat.h>");
+            EmitNoTab(Context, "#include <unistd.h>");
+            EmitNoTab(Context, "#endif");
+            EmitNoTab(Context, "");
+        }
+        Print(Context, "static char tiny_output[%d];\n", RuntimeOutputSize);
+        EmitNoTab(Context, "static int tiny_output_size;");
+        EmitNoTab(Context, "");
+        EmitNoTab(Context, "static void");
+        EmitNoTab(Context, "tiny_flush(void)");
+        EmitNoTab(Context, "{");
+        Context->CIndent = 1;
+        EmitC(Context, "int at = 0;");
+        EmitC(Context, "while(at < tiny_output_size)");
+        EmitC(Context, "{");
+        Context->CIndent++;
+        EmitC(Context, "int written = (int)write(1, tiny_output + at, tiny_output_size - at);");
+        EmitC(Context, "if(written <= 0) break;");
+        EmitC(Context, "at += written;");
+        Context->CIndent--;
+        EmitC(Context, "}");
+        EmitC(Context, "tiny_output_size = 0;");
+        Context->CIndent = 0;
+        EmitNoTab(Context, "}");
+        EmitNoTab(Context, "");
+        if(Context->UsesWrite)
+        {
+            EmitNoTab(Context, "static void");
+            EmitNoTab(Context, "tiny_write(long long value)");
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            EmitC(Context, "if(tiny_output_size > (int)sizeof(tiny_output) - 24) tiny_flush();");
+            EmitC(Context, "char digits[20];");
+            EmitC(Context, "int start = (int)sizeof(digits);");
+            EmitC(Context, "unsigned long long magnitude = (value < 0) ? 0ull - (unsigned long long)value : (unsigned long long)value;");
+            EmitC(Context, "do");
+            EmitC(Context, "{");
+            Context->CIndent++;
+            EmitC(Context, "digits[--start] = (char)('0' + magnitude %% 10);");
+            EmitC(Context, "magnitude /= 10;");
+            Context->CIndent--;
+            EmitC(Context, "} while(magnitude);");
+            EmitC(Context, "if(value < 0) digits[--start] = '-';");
+            EmitC(Context, "while(start < (int)sizeof(digits)) tiny_output[tiny_output_size++] = digits[start++];");
+            EmitC(Context, "tiny_output[tiny_output_size++] = '\\n';");
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            EmitNoTab(Context, "");
+        }
+        if(Context->UsesRead || Context->UsesReadLong)
+        {
+            EmitTinyParse(Context);
+        }
+        if(Context->UsesRead)
+        {
+            EmitNoTab(Context, "static void");
+            EmitNoTab(Context, "tiny_read(int *variable)");
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            EmitC(Context, "long long value;");
+            EmitC(Context, "if(tiny_parse(&value)) *variable = (value > 2147483647) ? 2147483647 : ((value < -2147483647 - 1) ? -2147483647 - 1 : (int)value);");
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            EmitNoTab(Context, "");
+        }
+        if(Context->UsesReadLong)
+        {
+            EmitNoTab(Context, "static void");
+            EmitNoTab(Context, "tiny_read_long(long long *variable)");
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            EmitC(Context, "long long value;");
+            EmitC(Context, "if(tiny_parse(&value)) *variable = value;");
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            EmitNoTab(Context, "");
+        }
+        
+        // NOTE: The smallest value over -1 wraps around rather than trapping
+        if(Context->UsesDiv)
+        {
+            EmitNoTab(Context, "static int");
+            EmitNoTab(Context, "tiny_div(int left, int right)");
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            EmitC(Context, "return (right == -1) ? (int)(0u - (unsigned int)left) : left / right;");
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            EmitNoTab(Context, "");
+        }
+        if(Context->UsesDivLong)
+        {
+            EmitNoTab(Context, "static long long");
+            EmitNoTab(Context, "tiny_div_long(long long left, long long right)");
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            EmitC(Context, "return (right == -1) ? (long long)(0ull - (unsigned long long)left) : left / right;");
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            EmitNoTab(Context, "");
+        }
+        
+        if(Context->UsesIndexError)
+        {
+            EmitNoTab(Context, "static void");
+            EmitNoTab(Context, "tiny_index_error(void)");
+            EmitNoTab(Context, "{");
+            Context->CIndent = 1;
+            EmitC(Context, "tiny_flush();");
+            EmitC(Context, "write(1, \"Error: Index out of bounds.\\n\", 28);");
+            if(Context->Freestanding)
+            {
+                EmitC(Context, "tiny_syscall(TINY_SYS_EXIT_GROUP, 1, 0, 0);");
+            }
+            else
+            {
+                EmitC(Context, "exit(1);");
+            }
+            Context->CIndent = 0;
+            EmitNoTab(Context, "}");
+            EmitNoTab(Context, "");
+        }
+        
+        Context->LineInfo = LineInfo;
+    }
+}
+
+// NOTE: C: emits the runtime after the program, now that what it calls is
+// known, and moves it up to Context->RuntimeAt in front of the code
+static void
+InsertRuntime(compiler_context *Context)
+{
+    output_buffer *Output = &Context->Output;
+    size_t Start = Output->Size;
+    EmitRuntime(Context);
+    
+    size_t Size = Output->Size - Start;
+    char *Runtime = (char *)malloc(Size);
+    memcpy(Runtime, Output->Data + Start, Size);
+    memmove(Output->Data + Context->RuntimeAt + Size, Output->Data + Context->RuntimeAt, Start - Context->RuntimeAt);
+    memcpy(Output->Data + Context->RuntimeAt, Runtime, Size);
+    free(Runtime);
+}
@@ -0,0 +1,558 @@
+// NOTE: Resident compile server (tiny --server) and its thin client.
+//
+// The server listens on a Unix domain socket. Each of its worker threads
+// blocks in accept on the shared listening socket and keeps one warm
+// compiler_context (output buffer, symbol table) across requests; all workers
+// share the --cache-dir cache if one was given. A connection carries exactly
+// one request:
+//
+//     request:  u32 NumArgs, NumArgs x (u32 Length, bytes), u32 SourceSize, source
+//     response: u32 Succeeded, u32 Length, message, u32 Length, output file name,
+//               u32 Length, generated code
+//
+// tiny --client <socket> <args> forwards its own arguments and the source (the
+// input file or stdin) and writes the output file into its working directory
+// exactly as a cold "tiny <args>" would. Integers are sent in host byte order;
+// both ends are on the same machine.
+
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#define MaxServerArgs 64
+#define MaxServerArgLength 1024
+
+struct server
+{
+    int Listener;
+    compile_cache *Cache;
+};
+
+//
+// --Sockets
+//
+
+static bool
+SendAll(int Socket, void *Data, size_t Size)
+{
+    char *At = (char *)Data;
+    while(Size > 0)
+    {
+        ssize_t Sent = send(Socket, At, Size, 0);
+        if(Sent < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        At += Sent;
+        Size -= Sent;
+    }
+    
+    return true;
+}
+
+static bool
+ReceiveAll(int Socket, void *Data, size_t Size)
+{
+    char *At = (char *)Data;
+    while(Size > 0)
+    {
+        ssize_t Received = recv(Socket, At, Size, 0);
+        if(Received < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if(Received == 0)
+        {
+            return false;
+        }
+        At += Received;
+        Size -= Received;
+    }
+    
+    return true;
+}
+
+static bool
+SendBlock(int Socket, void *Data, size_t Size)
+{
+    unsigned int Length = (unsigned int)Size;
+    bool Result = SendAll(Socket, &Length, sizeof(Length)) && SendAll(Socket, Data, Size);
+    
+    return Result;
+}
+
+// NOTE: Receives a length-prefixed block into Buffer, zero terminated
+static bool
+ReceiveBlock(int Socket, output_buffer *Buffer, size_t MaxSize)
+{
+    bool Result = false;
+    
+    unsigned int Length;
+    if(ReceiveAll(Socket, &Length, sizeof(Length)) && (Length <= MaxSize))
+    {
+        Buffer->Size = 0;
+        ReserveOutput(Buffer, Length);
+        if(ReceiveAll(Socket, Buffer->Data, Length))
+        {
+            Buffer->Size = Length;
+            Buffer->Data[Length] = 0;
+            Result = true;
+        }
+    }
+    
+    return Result;
+}
+
+static bool
+MakeSocketAddress(sockaddr_un *Address, char *Path)
+{
+    *Address = {};
+    Address->sun_family = AF_UNIX;
+    
+    bool Result = (strlen(Path) < sizeof(Address->sun_path));
+    if(Result)
+    {
+        strcpy(Address->sun_path, Path);
+    }
+    
+    return Result;
+}
+
+static int
+ConnectToServer(char *Path)
+{
+    int Result = -1;
+    
+    sockaddr_un Address;
+    if(MakeSocketAddress(&Address, Path))
+    {
+        Result = socket(AF_UNIX, SOCK_STREAM, 0);
+        if((Result >= 0) && (connect(Result, (sockaddr *)&Address, sizeof(Address)) != 0))
+        {
+            close(Result);
+            Result = -1;
+        }
+    }
+    
+    return Result;
+}
+
+//
+// --Server
+//
+
+static void
+ServeRequest(server *Server, compiler_context *Context, int Socket, output_buffer *Request)
+{
+    compile_options Options = {};
+    Options.Target = Target_MASM;
+    
+    char Message[MaxErrorLength] = "";
+    bool Succeeded = false;
+    
+    unsigned int NumArgs;
+    bool Received = ReceiveAll(Socket, &NumArgs, sizeof(NumArgs)) && (NumArgs <= MaxServerArgs);
+    for(unsigned int ArgIndex = 0;
+        Received && (ArgIndex < NumArgs);
+        ArgIndex++)
+    {
+        Received = ReceiveBlock(Socket, Request, MaxServerArgLength);
+        if(Received && !Message[0])
+        {
+            char *Arg = Request->Data;
+            if(!strcmp(Arg, "--emit-c"))
+            {
+                Options.Target = Target_C;
+            }
+            else if(!strcmp(Arg, "--instrument"))
+            {
+                Options.Instrument = true;
+            }
+            else if(!strcmp(Arg, "--freestanding"))
+            {
+                Options.Target = Target_C;
+                Options.Freestanding = true;
+            }
+            else if(!strcmp(Arg, "--check-bounds"))
+            {
+                Options.CheckBounds = true;
+            }
+            else if(!strcmp(Arg, "--run") || !strcmp(Arg, "--jit-stress") || !strcmp(Arg, "--batch"))
+            {
+                snprintf(Message, sizeof(Message), "Error: The compile server only writes MASM or C.");
+            }
+            else if(Arg[0] == '-')
+            {
+                snprintf(Message, sizeof(Message), "Error: Unknown option \'%s\'.", Arg);
+            }
+        }
+    }
+    
+    // NOTE: Source last, the context's source stays in Request while compiling
+    if(Received && ReceiveBlock(Socket, Request, 0x7FFFFFFF))
+    {
+        char *OutputFileName = (Options.Target == Target_C) ? (char *)"test1.c" : (char *)"test1.asm";
+        output_buffer *Output = &Context->Output;
+        if(!Message[0])
+        {
+            Succeeded = CompileCached(Server->Cache, Context, Request->Data, Request->Size, &Options);
+            if(!Succeeded)
+            {
+                snprintf(Message, sizeof(Message), "%s", Context->Error);
+            }
+        }
+        
+        unsigned int Status = Succeeded ? 1 : 0;
+        size_t OutputSize = Succeeded ? Output->Size : 0;
+        if(SendAll(Socket, &Status, sizeof(Status)) &&
+           SendBlock(Socket, Message, strlen(Message)) &&
+           SendBlock(Socket, OutputFileName, strlen(OutputFileName)))
+        {
+            SendBlock(Socket, Output->Data, OutputSize);
+        }
+    }
+}
+
+static void
+ServerWorker(server *Server)
+{
+    compiler_context *Context = new compiler_context();
+    ReserveOutput(&Context->Output, 0);
+    output_buffer Request = {};
+    
+    for(;;)
+    {
+        int Socket = accept(Server->Listener, 0, 0);
+        if(Socket < 0)
+        {
+            if((errno == EINTR) || (errno == ECONNABORTED))
+            {
+                continue;
+            }
+            break;
+        }
+        
+        ServeRequest(Server, Context, Socket, &Request);
+        close(Socket);
+    }
+    
+    free(Request.Data);
+    FreeCompilerContext(Context);
+    delete Context;
+}
+
+// NOTE: Serves until killed. Returns only if the socket can't be set up.
+static int
+RunServer(char *Path, compile_cache *Cache, int NumWorkers)
+{
+    sockaddr_un Address;
+    if(!MakeSocketAddress(&Address, Path))
+    {
+        fprintf(stdout, "Error: Socket path is too long.\n");
+        return 1;
+    }
+    
+    // NOTE: A client that goes away mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    
+    server *Server = new server();
+    Server->Cache = Cache;
+    Server->Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    
+    // NOTE: A socket file left over from a previous server is stale
+    unlink(Path);
+    if((Server->Listener < 0) ||
+       (bind(Server->Listener, (sockaddr *)&Address, sizeof(Address)) != 0) ||
+       (listen(Server->Listener, 128) != 0))
+    {
+        fprintf(stdout, "Error: Could not listen on \'%s\'.\n", Path);
+        return 1;
+    }
+    
+    if(NumWorkers <= 0)
+    {
+        unsigned int NumCores = std::thread::hardware_concurrency();
+        NumWorkers = (NumCores > 0) ? (int)NumCores : 1;
+    }
+    
+    fprintf(stdout, "Listening on %s with %d threads\n", Path, NumWorkers);
+    fflush(stdout);
+    
+    std::thread *Workers = new std::thread[NumWorkers];
+    for(int WorkerIndex = 0;
+        WorkerIndex < NumWorkers;
+        WorkerIndex++)
+    {
+        Workers[WorkerIndex] = std::thread(ServerWorker, Server);
+    }
+    for(int WorkerIndex = 0;
+        WorkerIndex < NumWorkers;
+        WorkerIndex++)
+    {
+        Workers[WorkerIndex].join();
+    }
+    
+    fprintf(stdout, "Error: Could not accept connections.\n");
+    return 1;
+}
+
+//
+// --Client
+//
+
+// NOTE: One request. On success the output file name is in FileName and the
+// generated code in Output; Message holds an error to print (if any).
+static bool
+SendCompileRequest(char *Path, int ArgCount, char **Args, char *Source, size_t SourceSize,
+               output_buffer *Message, output_buffer *FileName, output_buffer *Output)
+{
+    bool Result = false;
+    
+    int Socket = ConnectToServer(Path);
+    if(Socket >= 0)
+    {
+        unsigned int NumArgs = (unsigned int)ArgCount;
+        bool Sent = SendAll(Socket, &NumArgs, sizeof(NumArgs));
+        for(int ArgIndex = 0;
+            Sent && (ArgIndex < ArgCount);
+            ArgIndex++)
+        {
+            Sent = SendBlock(Socket, Args[ArgIndex], strlen(Args[ArgIndex]));
+        }
+        Sent = Sent && SendBlock(Socket, Source, SourceSize);
+        
+        unsigned int Status;
+        if(Sent &&
+           ReceiveAll(Socket, &Status, sizeof(Status)) &&
+           ReceiveBlock(Socket, Message, MaxErrorLength) &&
+           ReceiveBlock(Socket, FileName, MaxServerArgLength) &&
+           ReceiveBlock(Socket, Output, 0x7FFFFFFF))
+        {
+            Result = true;
+        }
+        close(Socket);
+    }
+    
+    return Result;
+}
+
+static int
+RunClient(char *Path, int ArgCount, char **Args)
+{
+    // NOTE: The source is sent, not its name, so the server's working
+    // directory doesn't matter
+    char *InputFileName = 0;
+    for(int ArgIndex = 0;
+        ArgIndex < ArgCount;
+        ArgIndex++)
+    {
+        if(Args[ArgIndex][0] != '-')
+        {
+            InputFileName = Args[ArgIndex];
+        }
+    }
+    
+    FILE *InputStream = stdin;
+    if(InputFileName)
+    {
+        InputStream = fopen(InputFileName, "rb");
+        if(!InputStream)
+        {
+            fprintf(stdout, "Error: Could not open input file.\n");
+            return 0;
+        }
+    }
+    
+    size_t SourceSize;
+    char *Source = ReadEntireFile(InputStream, &SourceSize);
+    if(InputStream != stdin)
+    {
+        fclose(InputStream);
+    }
+    
+    int ExitCode = 0;
+    output_buffer Message = {};
+    output_buffer FileName = {};
+    output_buffer Output = {};
+    if(!SendCompileRequest(Path, ArgCount, Args, Source, SourceSize, &Message, &FileName, &Output))
+    {
+        fprintf(stdout, "Error: No compile server at \'%s\'.\n", Path);
+        ExitCode = 1;
+    }
+    else if(Message.Size)
+    {
+        fprintf(stdout, "%s\n", Message.Data);
+    }
+    else
+    {
+        FILE *OutputStream = fopen(FileName.Data, "w");
+        if(OutputStream)
+        {
+            fwrite(Output.Data, 1, Output.Size, OutputStream);
+            fclose(OutputStream);
+        }
+    }
+    
+    free(Message.Data);
+    free(FileName.Data);
+    free(Output.Data);
+    free(Source);
+    
+    return ExitCode;
+}
+
+//
+// --Benchmark
+//
+
+// NOTE: Runs Args to completion with stdout discarded, returns milliseconds
+static double
+TimeProcess(char **Args)
+{
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    
+    pid_t Child = fork();
+    if(Child == 0)
+    {
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, 1);
+        execv(Args[0], Args);
+        _exit(127);
+    }
+    
+    int Status;
+    waitpid(Child, &Status, 0);
+    
+    std::chrono::duration<double, std::milli> Elapsed = std::chrono::steady_clock::now() - Start;
+    return Elapsed.count();
+}
+
+static void
+PrintLatencies(char *Name, double *Latencies, int Count)
+{
+    qsort(Latencies, Count, sizeof(double), CompareDoubles);
+    fprintf(stdout, "%-24s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", Name,
+            Percentile(Latencies, Count, 0.50),
+            Percentile(Latencies, Count, 0.90),
+            Percentile(Latencies, Count, 0.99),
+            Latencies[Count - 1]);
+}
+
+// NOTE: tiny --server-bench <socket> <n> <source file> times <n> compiles of
+// the file three ways: a cold "tiny <file>" process, a "tiny --client" process
+// and a request sent straight from this process (the floor for a build system
+// that talks to the server itself). Output files land in the working directory.
+static int
+RunServerBenchmark(char *Path, int Count, char *InputFileName)
+{
+    if(Count <= 0)
+    {
+        Count = 1;
+    }
+    
+    FILE *InputStream = fopen(InputFileName, "rb");
+    if(!InputStream)
+    {
+        fprintf(stdout, "Error: Could not open input file.\n");
+        return 1;
+    }
+    size_t SourceSize;
+    char *Source = ReadEntireFile(InputStream, &SourceSize);
+    fclose(InputStream);
+    
+    char Self[1024] = "";
+    ssize_t SelfLength = readlink("/proc/self/exe", Self, sizeof(Self) - 1);
+    if(SelfLength <= 0)
+    {
+        fprintf(stdout, "Error: Could not find the tiny executable.\n");
+        return 1;
+    }
+    Self[SelfLength] = 0;
+    
+    char *ColdArgs[] = {Self, InputFileName, 0};
+    char *ClientArgs[] = {Self, "--client", Path, InputFileName, 0};
+    
+    output_buffer Message = {};
+    output_buffer FileName = {};
+    output_buffer Output = {};
+    if(!SendCompileRequest(Path, 1, &InputFileName, Source, SourceSize, &Message, &FileName, &Output))
+    {
+        fprintf(stdout, "Error: No compile server at \'%s\'.\n", Path);
+        return 1;
+    }
+    
+    double *Latencies = (double *)malloc(Count*sizeof(double));
+    
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        Latencies[Index] = TimeProcess(ColdArgs);
+    }
+    PrintLatencies("cold process", Latencies, Count);
+    
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        Latencies[Index] = TimeProcess(ClientArgs);
+    }
+    PrintLatencies("client process", Latencies, Count);
+    
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+        SendCompileRequest(Path, 1, &InputFileName, Source, SourceSize, &Message, &FileName, &Output);
+        std::chrono::duration<double, std::milli> Elapsed = std::chrono::steady_clock::now() - Start;
+        Latencies[Index] = Elapsed.count();
+    }
+    PrintLatencies("in-process request", Latencies, Count);
+    
+    free(Latencies);
+    free(Message.Data);
+    free(FileName.Data);
+    free(Output.Data);
+    free(Source);
+    
+    return 0;
+}
+
+#else
+
+static int
+RunServer(char *Path, compile_cache *Cache, int NumWorkers)
+{
+    fprintf(stdout, "Error: --server needs Unix domain sockets.\n");
+    return 1;
+}
+
+static int
+RunClient(char *Path, int ArgCount, char **Args)
+{
+    fprintf(stdout, "Error: --client needs Unix domain sockets.\n");
+    return 1;
+}
+
+static int
+RunServerBenchmark(char *Path, int Count, char *InputFileName)
+{
+    fprintf(stdout, "Error: --server-bench needs Unix domain sockets.\n");
+    return 1;
+}
+
+#endif
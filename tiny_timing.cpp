@@ -0,0 +1,195 @@
+// NOTE: Per-phase timing and counters (--time-report).
+//
+// The compiler is a single pass, so phases interleave token by token. Instead
+// of bracketing each phase once, the time between two phase switches is
+// charged to whichever phase was current: Next switches to Phase_Lex and back,
+// Print and EmitOp to Phase_Emit and back, and everything else inside Compile
+// is Phase_Parse. Reading the input happens before Compile (the whole file is
+// read up front, GetChar only indexes it), so the caller brackets that with
+// Phase_Read. With Context->Timing zero every switch is one test and branch.
+//
+// Enabled, each switch reads the steady clock, which is a vDSO call rather
+// than a system call on Linux, so the finest phases (lexing, emission) grow
+// by a few tens of nanoseconds per token and line. Thread CPU time is a
+// system call, far too slow for that: Compile reads it on entry and exit, so
+// CPU time is only reported for compilation as a whole.
+
+#include <chrono>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+enum compile_phase
+{
+    Phase_Read,
+    Phase_Lex,
+    Phase_Parse,
+    
+    // NOTE: After parsing, currently bytecode label resolution and loop discovery
+    Phase_Passes,
+    
+    Phase_Emit,
+    
+    // NOTE: Not timed, also the number of timed phases
+    Phase_Idle
+};
+
+static char *PhaseNames[] = {"read", "lex", "parse", "passes", "emit"};
+
+struct time_report
+{
+    compile_phase Phase;
+    double PhaseStart;
+    
+    double Wall[Phase_Idle];
+    
+    // NOTE: Spent inside Compile, not split up by phase
+    double Cpu;
+    
+    long long Compilations;
+    long long Characters;
+    long long Tokens;
+    long long Symbols;
+    long long Labels;
+    long long Instructions;
+};
+
+static double
+WallSeconds()
+{
+    std::chrono::duration<double> Now = std::chrono::steady_clock::now().time_since_epoch();
+    return Now.count();
+}
+
+// NOTE: CPU time of the calling thread, so batch workers don't see each other
+static double
+CpuSeconds()
+{
+#if defined(_WIN32)
+    FILETIME Creation, Exit, Kernel, User;
+    GetThreadTimes(GetCurrentThread(), &Creation, &Exit, &Kernel, &User);
+    
+    ULARGE_INTEGER KernelTime, UserTime;
+    KernelTime.LowPart = Kernel.dwLowDateTime;
+    KernelTime.HighPart = Kernel.dwHighDateTime;
+    UserTime.LowPart = User.dwLowDateTime;
+    UserTime.HighPart = User.dwHighDateTime;
+    
+    double Result = (KernelTime.QuadPart + UserTime.QuadPart) / 10000000.0;
+#else
+    timespec Time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time);
+    
+    double Result = Time.tv_sec + Time.tv_nsec / 1000000000.0;
+#endif
+    
+    return Result;
+}
+
+// NOTE: Charges the time since the last switch to the current phase
+static void
+SwitchPhase(time_report *Report, compile_phase Phase)
+{
+    double Wall = WallSeconds();
+    if(Report->Phase != Phase_Idle)
+    {
+        Report->Wall[Report->Phase] += Wall - Report->PhaseStart;
+    }
+    
+    Report->Phase = Phase;
+    Report->PhaseStart = Wall;
+}
+
+// NOTE: Returns the phase to go back to with another EnterPhase
+static compile_phase
+EnterPhase(compiler_context *Context, compile_phase Phase)
+{
+    compile_phase Result = Phase_Idle;
+    
+    time_report *Report = Context->Timing;
+    if(Report)
+    {
+        Result = Report->Phase;
+        if(Result != Phase)
+        {
+            SwitchPhase(Report, Phase);
+        }
+    }
+    
+    return Result;
+}
+
+static void
+InitTimeReport(time_report *Report)
+{
+    *Report = {};
+    Report->Phase = Phase_Idle;
+}
+
+static void
+MergeTimeReport(time_report *Total, time_report *Report)
+{
+    for(int Phase = 0;
+        Phase < Phase_Idle;
+        Phase++)
+    {
+        Total->Wall[Phase] += Report->Wall[Phase];
+    }
+    
+    Total->Cpu += Report->Cpu;
+    Total->Compilations += Report->Compilations;
+    Total->Characters += Report->Characters;
+    Total->Tokens += Report->Tokens;
+    Total->Symbols += Report->Symbols;
+    Total->Labels += Report->Labels;
+    Total->Instructions += Report->Instructions;
+}
+
+static void
+PrintTimeReport(FILE *Stream, time_report *Report, bool Json)
+{
+    double TotalWall = 0;
+    for(int Phase = 0;
+        Phase < Phase_Idle;
+        Phase++)
+    {
+        TotalWall += Report->Wall[Phase];
+    }
+    
+    if(Json)
+    {
+        fprintf(Stream, "{\"phases\": {");
+        for(int Phase = 0;
+            Phase < Phase_Idle;
+            Phase++)
+        {
+            fprintf(Stream, "%s\"%s\": {\"wall_ms\": %.3f}", Phase ? ", " : "",
+                    PhaseNames[Phase], Report->Wall[Phase]*1000.0);
+        }
+        fprintf(Stream, "}, \"total\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}", TotalWall*1000.0, Report->Cpu*1000.0);
+        fprintf(Stream, ", \"counters\": {\"compilations\": %lld, \"characters\": %lld, \"tokens\": %lld, "
+                "\"symbols\": %lld, \"labels\": %lld, \"instructions\": %lld}}\n",
+                Report->Compilations, Report->Characters, Report->Tokens,
+                Report->Symbols, Report->Labels, Report->Instructions);
+    }
+    else
+    {
+        fprintf(Stream, "%-8s %12s %12s %7s\n", "Phase", "Wall (ms)", "CPU (ms)", "Wall %");
+        for(int Phase = 0;
+            Phase < Phase_Idle;
+            Phase++)
+        {
+            fprintf(Stream, "%-8s %12.3f %12s %6.1f%%\n", PhaseNames[Phase],
+                    Report->Wall[Phase]*1000.0, "",
+                    (TotalWall > 0) ? 100.0*Report->Wall[Phase]/TotalWall : 0.0);
+        }
+        fprintf(Stream, "%-8s %12.3f %12.3f\n", "total", TotalWall*1000.0, Report->Cpu*1000.0);
+        fprintf(Stream, "\n%lld compilations, %lld characters, %lld tokens, %lld symbols, "
+                "%lld labels, %lld instructions\n",
+                Report->Compilations, Report->Characters, Report->Tokens,
+                Report->Symbols, Report->Labels, Report->Instructions);
+    }
+}
@@ -0,0 +1,1019 @@
+// NOTE: Loop vectorizer for the JIT.
+//
+// A WHILE loop of the shape
+//     WHILE i < n                 (or <=; n a constant or a variable the loop doesn't change)
+//         A[i] = <expression>;
+//         s = s + <expression>;
+//         ...
+//         i = i + 1
+//     ENDWHILE
+// (or the FOR i = ... TO n whose bytecode is that loop, see For)
+// where the expressions only combine B[i], i, constants and variables the
+// loop doesn't change with + - * & | ^, comparisons, unary - and !, runs
+// 4 (SSE2) or 8 (AVX2) iterations at a time. Every element is indexed by the
+// counter itself, so iteration k only touches element k of each array and the
+// lanes don't depend on each other; a statement that reads A[i] after another
+// stored it sees the stored lanes, as it would one iteration at a time. INT
+// additions wrap, so a sum can be split over the lanes and added up at the end.
+//
+// The vector code is matched on the bytecode and emitted out of line after the
+// exit stubs. Falling into the loop's head jumps there; it runs as many whole
+// vectors as the limit allows (and, with --check-bounds, as the shortest
+// checked array allows, after making sure i >= 0), stores i and the sums back
+// and jumps to the ordinary scalar code for the loop, which does whatever is
+// left, one iteration at a time, including any index error. The back-edge
+// goes straight to the scalar code.
+//
+// Only xmm0-xmm5 are used, so on Win64 (where xmm6-xmm15 are callee-saved)
+// the native code still needn't save anything. Sums and the counter vector
+// (i, i+1, ...) get a register each for the whole loop, the rest is a stack
+// of registers for the expressions.
+
+#define MaxVectorNodes 64
+#define MaxVectorStatements 16
+#define NumVectorRegisters 6
+
+enum vector_node_kind
+{
+    VectorNode_Constant,
+    VectorNode_Invariant,
+    VectorNode_Element,
+    VectorNode_Counter,
+    VectorNode_Unary,
+    VectorNode_Binary,
+};
+
+struct vector_node
+{
+    vector_node_kind Kind;
+    
+    // NOTE: The op for unary and binary nodes, Op_LoadVariable or
+    // Op_LoadLocal for invariants
+    op_code Code;
+    
+    // NOTE: Constant, variable slot or array slot
+    int Operand;
+    
+    int Left;
+    int Right;
+};
+
+struct vector_statement
+{
+    // NOTE: Op_StoreElement stores Value into array Target at i, Op_Store and
+    // Op_StoreLocal add it to the INT variable Target
+    op_code Code;
+    int Target;
+    int Value;
+};
+
+struct vector_loop
+{
+    int Head;
+    int BackEdge;
+    
+    // NOTE: Op_LoadVariable or Op_LoadLocal
+    op_code CounterCode;
+    int Counter;
+    
+    // NOTE: Op_LoadConstant, Op_LoadVariable or Op_LoadLocal
+    op_code LimitCode;
+    int Limit;
+    bool OrEqual;
+    
+    // NOTE: Length of the shortest array an Op_CheckIndex checks, 0 if none
+    int CheckedLength;
+    
+    bool UsesCounter;
+    int NumSums;
+    
+    // NOTE: Registers the deepest expression needs
+    int ExpressionRegisters;
+    
+    int NumNodes;
+    vector_node Nodes[MaxVectorNodes];
+    int NumStatements;
+    vector_statement Statements[MaxVectorStatements];
+};
+
+// NOTE: Lanes the host can do, 8 with AVX2 and 4 with SSE2, which every x86-64 has
+static int
+BestVectorWidth(void)
+{
+    int Result = 0;
+
+#if JitSupported
+    Result = 4;
+#if defined(_MSC_VER)
+    int Info[4];
+    __cpuid(Info, 1);
+    bool SavesYmm = ((Info[2] & (1 << 27)) != 0) && ((_xgetbv(0) & 6) == 6);
+    __cpuidex(Info, 7, 0);
+    if(SavesYmm && (Info[1] & (1 << 5)))
+    {
+        Result = 8;
+    }
+#else
+    if(__builtin_cpu_supports("avx2"))
+    {
+        Result = 8;
+    }
+#endif
+#endif
+    
+    return Result;
+}
+
+//
+// --Matching
+//
+
+struct vector_parser
+{
+    bytecode *Program;
+    vector_loop *Loop;
+    int PC;
+    bool Ok;
+};
+
+static bool
+IsCounterLoad(vector_parser *Parser, int PC)
+{
+    op *Op = Parser->Program->Ops + PC;
+    bool Result = ((Op->Code == Parser->Loop->CounterCode) && (Op->Operand == Parser->Loop->Counter));
+    
+    return Result;
+}
+
+static int
+AddVectorNode(vector_parser *Parser, vector_node_kind Kind, op_code Code, int Operand, int Left = -1, int Right = -1)
+{
+    int Result = -1;
+    
+    vector_loop *Loop = Parser->Loop;
+    if(Loop->NumNodes < MaxVectorNodes)
+    {
+        Result = Loop->NumNodes++;
+        vector_node *Node = Loop->Nodes + Result;
+        Node->Kind = Kind;
+        Node->Code = Code;
+        Node->Operand = Operand;
+        Node->Left = Left;
+        Node->Right = Right;
+    }
+    else
+    {
+        Parser->Ok = false;
+    }
+    
+    return Result;
+}
+
+static void
+NoteCheckedLength(vector_loop *Loop, int Length)
+{
+    if(!Loop->CheckedLength || (Length < Loop->CheckedLength))
+    {
+        Loop->CheckedLength = Length;
+    }
+}
+
+// NOTE: A constant, a variable, i, or B[i]
+static int
+ParseVectorLeaf(vector_parser *Parser)
+{
+    int Result = -1;
+    
+    op *Op = Parser->Program->Ops + Parser->PC;
+    if(IsCounterLoad(Parser, Parser->PC))
+    {
+        Parser->PC++;
+        op *Next = Parser->Program->Ops + Parser->PC;
+        int Checked = 0;
+        if(Next->Code == Op_CheckIndex)
+        {
+            Checked = Next->Operand;
+            Next++;
+        }
+        
+        if(Next->Code == Op_LoadElement)
+        {
+            if(Checked)
+            {
+                NoteCheckedLength(Parser->Loop, Checked);
+                Parser->PC++;
+            }
+            Result = AddVectorNode(Parser, VectorNode_Element, Op_LoadElement, Next->Operand);
+            Parser->PC++;
+        }
+        else if(!Checked)
+        {
+            Result = AddVectorNode(Parser, VectorNode_Counter, Op->Code, Op->Operand);
+            Parser->Loop->UsesCounter = true;
+        }
+        else
+        {
+            Parser->Ok = false;
+        }
+    }
+    else if(Op->Code == Op_LoadConstant)
+    {
+        Result = AddVectorNode(Parser, VectorNode_Constant, Op->Code, Op->Operand);
+        Parser->PC++;
+    }
+    else if((Op->Code == Op_LoadVariable) || (Op->Code == Op_LoadLocal))
+    {
+        Result = AddVectorNode(Parser, VectorNode_Invariant, Op->Code, Op->Operand);
+        Parser->PC++;
+    }
+    else
+    {
+        Parser->Ok = false;
+    }
+    
+    return Result;
+}
+
+static bool
+IsVectorBinary(op_code Code)
+{
+    bool Result = false;
+    switch(Code)
+    {
+        case Op_PopAdd:
+        case Op_PopSub:
+        case Op_PopMul:
+        case Op_PopAnd:
+        case Op_PopOr:
+        case Op_PopXor:
+        case Op_SetEqual:
+        case Op_SetNotEqual:
+        case Op_SetLessThan:
+        case Op_SetGreaterThan:
+        case Op_SetLessThanOrEqual:
+        case Op_SetGreaterThanOrEqual:
+        {
+            Result = true;
+        } break;
+        
+        default: break;
+    }
+    
+    return Result;
+}
+
+// NOTE: The ops of an expression leave it in the accumulator; a binary op
+// pushes the left side, computes the right side and pops the left again
+static int
+ParseVectorExpression(vector_parser *Parser)
+{
+    int Result = ParseVectorLeaf(Parser);
+    
+    op *Ops = Parser->Program->Ops;
+    while(Parser->Ok && (Parser->PC < Parser->Loop->BackEdge))
+    {
+        op_code Code = Ops[Parser->PC].Code;
+        if((Code == Op_Negate) || (Code == Op_Not))
+        {
+            Result = AddVectorNode(Parser, VectorNode_Unary, Code, 0, Result);
+            Parser->PC++;
+        }
+        else if(Code == Op_Push)
+        {
+            Parser->PC++;
+            int Right = ParseVectorExpression(Parser);
+            if(Parser->Ok && IsVectorBinary(Ops[Parser->PC].Code))
+            {
+                Result = AddVectorNode(Parser, VectorNode_Binary, Ops[Parser->PC].Code, 0, Result, Right);
+                Parser->PC++;
+            }
+            else
+            {
+                Parser->Ok = false;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    
+    return Result;
+}
+
+// NOTE: A[i] = <expression>
+static bool
+ParseElementStore(vector_parser *Parser)
+{
+    bool Result = false;
+    
+    op *Ops = Parser->Program->Ops;
+    int PC = Parser->PC;
+    int Checked = 0;
+    if(IsCounterLoad(Parser, PC))
+    {
+        PC++;
+        if(Ops[PC].Code == Op_CheckIndex)
+        {
+            Checked = Ops[PC++].Operand;
+        }
+        if(Ops[PC].Code == Op_Push)
+        {
+            // NOTE: A scalar statement can start the same way, undo what
+            // the expression added if this turns out to be one
+            vector_loop *Loop = Parser->Loop;
+            int NumNodes = Loop->NumNodes;
+            bool UsesCounter = Loop->UsesCounter;
+            int CheckedLength = Loop->CheckedLength;
+            
+            vector_parser Try = *Parser;
+            Try.PC = PC + 1;
+            int Value = ParseVectorExpression(&Try);
+            if(Try.Ok && (Ops[Try.PC].Code == Op_StoreElement) &&
+               (Parser->Loop->NumStatements < MaxVectorStatements))
+            {
+                if(Checked)
+                {
+                    NoteCheckedLength(Parser->Loop, Checked);
+                }
+                vector_statement *Statement = Parser->Loop->Statements + Parser->Loop->NumStatements++;
+                Statement->Code = Op_StoreElement;
+                Statement->Target = Ops[Try.PC].Operand;
+                Statement->Value = Value;
+                
+                *Parser = Try;
+                Parser->PC++;
+                Result = true;
+            }
+            else
+            {
+                Loop->NumNodes = NumNodes;
+                Loop->UsesCounter = UsesCounter;
+                Loop->CheckedLength = CheckedLength;
+            }
+        }
+    }
+    
+    return Result;
+}
+
+static bool
+IsVectorVariable(vector_node *Node, op_code StoreCode, int Slot)
+{
+    op_code LoadCode = (StoreCode == Op_Store) ? Op_LoadVariable : Op_LoadLocal;
+    bool Result = ((Node->Kind == VectorNode_Invariant) && (Node->Code == LoadCode) && (Node->Operand == Slot));
+    
+    return Result;
+}
+
+// NOTE: True if the node or anything under it reads the variable
+static bool
+VectorNodeReads(vector_loop *Loop, int NodeIndex, op_code StoreCode, int Slot)
+{
+    vector_node *Node = Loop->Nodes + NodeIndex;
+    bool Result = IsVectorVariable(Node, StoreCode, Slot);
+    if(!Result && (Node->Left >= 0))
+    {
+        Result = VectorNodeReads(Loop, Node->Left, StoreCode, Slot);
+    }
+    if(!Result && (Node->Right >= 0))
+    {
+        Result = VectorNodeReads(Loop, Node->Right, StoreCode, Slot);
+    }
+    
+    return Result;
+}
+
+// NOTE: Registers needed to compute the node into the bottom one of a stack
+// of registers, SSE2's multiply needs two more for the odd lanes
+static int
+VectorNodeRegisters(vector_loop *Loop, int NodeIndex)
+{
+    int Result = 1;
+    
+    vector_node *Node = Loop->Nodes + NodeIndex;
+    if(Node->Kind == VectorNode_Unary)
+    {
+        Result = VectorNodeRegisters(Loop, Node->Left);
+        if(Result < 2)
+        {
+            Result = 2;
+        }
+    }
+    else if(Node->Kind == VectorNode_Binary)
+    {
+        int Left = VectorNodeRegisters(Loop, Node->Left);
+        int Right = 1 + VectorNodeRegisters(Loop, Node->Right);
+        Result = (Left > Right) ? Left : Right;
+        if((Node->Code == Op_PopMul) && (Result < 4))
+        {
+            Result = 4;
+        }
+    }
+    
+    return Result;
+}
+
+// NOTE: Fills Result if the loop from Head to BackEdge can be vectorized, see
+// the top of the file for what that takes
+static bool
+MatchVectorLoop(bytecode *Program, loop *Source, vector_loop *Result)
+{
+    *Result = {};
+    Result->Head = Source->Head;
+    Result->BackEdge = Source->BackEdge;
+    
+    op *Ops = Program->Ops;
+    int PC = Source->Head;
+    if(Source->BackEdge - Source->Head < 10)
+    {
+        return false;
+    }
+    
+    // NOTE: i; Push; n; SetLessThan(OrEqual); BranchFalse past the loop
+    op *Counter = Ops + PC;
+    op *Limit = Ops + PC + 2;
+    op_code Compare = Ops[PC + 3].Code;
+    if(((Counter->Code != Op_LoadVariable) && (Counter->Code != Op_LoadLocal)) ||
+       (Ops[PC + 1].Code != Op_Push) ||
+       ((Limit->Code != Op_LoadConstant) && (Limit->Code != Op_LoadVariable) && (Limit->Code != Op_LoadLocal)) ||
+       ((Limit->Code == Counter->Code) && (Limit->Operand == Counter->Operand)) ||
+       ((Compare != Op_SetLessThan) && (Compare != Op_SetLessThanOrEqual)) ||
+       (Ops[PC + 4].Code != Op_BranchFalse) || (Ops[PC + 4].Operand != Source->BackEdge + 1) ||
+       (Ops[Source->BackEdge].Code != Op_Branch) || (Ops[Source->BackEdge].Operand != Source->Head))
+    {
+        return false;
+    }
+    Result->CounterCode = Counter->Code;
+    Result->Counter = Counter->Operand;
+    Result->LimitCode = Limit->Code;
+    Result->Limit = Limit->Operand;
+    Result->OrEqual = (Compare == Op_SetLessThanOrEqual);
+    
+    vector_parser Parser = {Program, Result, PC + 5, true};
+    op_code CounterStore = (Counter->Code == Op_LoadVariable) ? Op_Store : Op_StoreLocal;
+    bool Incremented = false;
+    while(Parser.Ok && !Incremented && (Parser.PC < Source->BackEdge))
+    {
+        // NOTE: The closing i = i + 1, for a FOR followed by the test that
+        // leaves the loop when i wrapped around (Push; INT_MIN; PopAdd;
+        // BranchFalse past the loop). The vector code stops short of the
+        // limit, so the scalar code does that.
+        int At = Parser.PC;
+        if(IsCounterLoad(&Parser, At) && (Ops[At + 1].Code == Op_Push) &&
+           (Ops[At + 2].Code == Op_LoadConstant) && (Ops[At + 2].Operand == 1) &&
+           (Ops[At + 3].Code == Op_PopAdd) && (Ops[At + 4].Code == CounterStore) &&
+           (Ops[At + 4].Operand == Result->Counter))
+        {
+            bool WrapTest = ((At + 9 == Source->BackEdge) && (Ops[At + 5].Code == Op_Push) &&
+                             (Ops[At + 6].Code == Op_LoadConstant) && (Ops[At + 6].Operand == INT_MIN) &&
+                             (Ops[At + 7].Code == Op_PopAdd) && (Ops[At + 8].Code == Op_BranchFalse) &&
+                             (Ops[At + 8].Operand == Source->BackEdge + 1));
+            if((At + 5 == Source->BackEdge) || WrapTest)
+            {
+                Incremented = true;
+                break;
+            }
+        }
+        
+        if(ParseElementStore(&Parser))
+        {
+            continue;
+        }
+        
+        // NOTE: s = s + <expression>
+        int Value = ParseVectorExpression(&Parser);
+        op *Store = Ops + Parser.PC;
+        if(!Parser.Ok || ((Store->Code != Op_Store) && (Store->Code != Op_StoreLocal)))
+        {
+            Parser.Ok = false;
+            break;
+        }
+        
+        vector_node *Node = Result->Nodes + Value;
+        bool Sum = ((Node->Kind == VectorNode_Binary) && (Node->Code == Op_PopAdd) &&
+                    IsVectorVariable(Result->Nodes + Node->Left, Store->Code, Store->Operand));
+        if(Sum && (Result->NumStatements < MaxVectorStatements))
+        {
+            vector_statement *Statement = Result->Statements + Result->NumStatements++;
+            Statement->Code = Store->Code;
+            Statement->Target = Store->Operand;
+            Statement->Value = Node->Right;
+            Result->NumSums++;
+        }
+        else
+        {
+            Parser.Ok = false;
+        }
+        Parser.PC++;
+    }
+    if(!Parser.Ok || !Incremented || !Result->NumStatements)
+    {
+        return false;
+    }
+    
+    // NOTE: The only variables written are i and the sums. Nothing else may
+    // read them (a sum only in its own statement), and the limit isn't one.
+    for(int StatementIndex = 0;
+        StatementIndex < Result->NumStatements;
+        StatementIndex++)
+    {
+        vector_statement *Statement = Result->Statements + StatementIndex;
+        if(Statement->Code == Op_StoreElement)
+        {
+            continue;
+        }
+        
+        op_code LoadCode = (Statement->Code == Op_Store) ? Op_LoadVariable : Op_LoadLocal;
+        if((LoadCode == Result->LimitCode) && (Statement->Target == Result->Limit))
+        {
+            return false;
+        }
+        for(int Other = 0;
+            Other < Result->NumStatements;
+            Other++)
+        {
+            vector_statement *OtherStatement = Result->Statements + Other;
+            if(VectorNodeReads(Result, OtherStatement->Value, Statement->Code, Statement->Target) ||
+               ((Other != StatementIndex) && (OtherStatement->Code == Statement->Code) &&
+                (OtherStatement->Target == Statement->Target)))
+            {
+                return false;
+            }
+        }
+    }
+    
+    int Available = NumVectorRegisters - Result->NumSums - (Result->UsesCounter ? 1 : 0);
+    for(int StatementIndex = 0;
+        StatementIndex < Result->NumStatements;
+        StatementIndex++)
+    {
+        int Needed = VectorNodeRegisters(Result, Result->Statements[StatementIndex].Value);
+        if(Needed > Result->ExpressionRegisters)
+        {
+            Result->ExpressionRegisters = Needed;
+        }
+    }
+    
+    return (Result->ExpressionRegisters <= Available);
+}
+
+//
+// --Code generation
+//
+
+// NOTE: SSE2 ops in their legacy encoding (Destination is also the first
+// source), AVX2 ones in the three byte VEX form. Map 1 is 0F, 2 0F38, 3 0F3A.
+struct vector_target
+{
+    code_buffer *Buffer;
+    bool Avx;
+    int Width;
+};
+
+static int
+VexPrefixBits(int Prefix)
+{
+    int Result = (Prefix == 0x66) ? 1 : ((Prefix == 0xF3) ? 2 : 0);
+    return Result;
+}
+
+static void
+VectorOpcode(vector_target *Target, int Prefix, int Map, int Opcode, int Source1, bool Wide, int RexBits)
+{
+    code_buffer *Buffer = Target->Buffer;
+    if(Target->Avx)
+    {
+        // NOTE: R, X and B are stored inverted, RexBits has B in bit 0
+        Byte(Buffer, 0xC4);
+        Byte(Buffer, (0xE0 ^ ((RexBits & 1) << 5)) | Map);
+        Byte(Buffer, ((~Source1 & 15) << 3) | (Wide ? 4 : 0) | VexPrefixBits(Prefix));
+    }
+    else
+    {
+        if(Prefix)
+        {
+            Byte(Buffer, Prefix);
+        }
+        if(RexBits)
+        {
+            Byte(Buffer, 0x40 | RexBits);
+        }
+        Byte(Buffer, 0x0F);
+        if(Map == 2)
+        {
+            Byte(Buffer, 0x38);
+        }
+        else if(Map == 3)
+        {
+            Byte(Buffer, 0x3A);
+        }
+    }
+    Byte(Buffer, Opcode);
+}
+
+// NOTE: op Destination, Source1, Source2 (all registers)
+static void
+VectorRR(vector_target *Target, int Prefix, int Map, int Opcode, int Destination, int Source1, int Source2, bool Wide = true)
+{
+    VectorOpcode(Target, Prefix, Map, Opcode, Source1, Wide, 0);
+    Byte(Target->Buffer, 0xC0 | (Destination << 3) | Source2);
+}
+
+// NOTE: The Register field with element i of the array at Slot, [r8 + rcx*4 + disp32]
+static void
+VectorElement(vector_target *Target, int Prefix, int Opcode, int Register, int Slot)
+{
+    VectorOpcode(Target, Prefix, 1, Opcode, 0, true, 1);
+    Bytes(Target->Buffer, 2, 0x84 | (Register << 3), 0x88);
+    Int32(Target->Buffer, Slot*4);
+}
+
+static void
+VectorMove(vector_target *Target, int Destination, int Source)
+{
+    if(Destination != Source)
+    {
+        VectorRR(Target, 0x66, 1, 0x6F, Destination, 0, Source);     // movdqa
+    }
+}
+
+static void
+VectorAllOnes(vector_target *Target, int Register)
+{
+    VectorRR(Target, 0x66, 1, 0x76, Register, Register, Register);   // pcmpeqd
+}
+
+// NOTE: eax into every lane of Register
+static void
+VectorBroadcastEax(vector_target *Target, int Register)
+{
+    VectorOpcode(Target, 0x66, 1, 0x6E, 0, false, 0);                // movd xmm, eax
+    Byte(Target->Buffer, 0xC0 | (Register << 3));
+    if(Target->Avx)
+    {
+        VectorRR(Target, 0x66, 2, 0x58, Register, 0, Register);      // vpbroadcastd
+    }
+    else
+    {
+        VectorRR(Target, 0x66, 1, 0x70, Register, 0, Register);      // pshufd, 0
+        Byte(Target->Buffer, 0x00);
+    }
+}
+
+static void
+EmitVectorNode(vector_target *Target, vector_loop *Loop, int NodeIndex, int Register, int CounterRegister)
+{
+    code_buffer *Buffer = Target->Buffer;
+    vector_node *Node = Loop->Nodes + NodeIndex;
+    int Next = Register + 1;
+    
+    switch(Node->Kind)
+    {
+        case VectorNode_Constant:
+        {
+            if(Node->Operand == 0)
+            {
+                VectorRR(Target, 0x66, 1, 0xEF, Register, Register, Register); // pxor
+            }
+            else
+            {
+                Byte(Buffer, 0xB8);                                // mov eax, imm32
+                Int32(Buffer, Node->Operand);
+                VectorBroadcastEax(Target, Register);
+            }
+        } break;
+        
+        case VectorNode_Invariant:
+        {
+            if(Node->Code == Op_LoadVariable)
+            {
+                Bytes(Buffer, 3, 0x41, 0x8B, 0x80);                 // mov eax, [r8 + disp32]
+                Int32(Buffer, Node->Operand*4);
+            }
+            else
+            {
+                Bytes(Buffer, 3, 0x41, 0x8B, 0x82);                 // mov eax, [r10 + disp32]
+                Int32(Buffer, Node->Operand*8);
+            }
+            VectorBroadcastEax(Target, Register);
+        } break;
+        
+        case VectorNode_Element:
+        {
+            VectorElement(Target, 0xF3, 0x6F, Register, Node->Operand);   // movdqu load
+        } break;
+        
+        case VectorNode_Counter:
+        {
+            VectorMove(Target, Register, CounterRegister);
+        } break;
+        
+        case VectorNode_Unary:
+        {
+            EmitVectorNode(Target, Loop, Node->Left, Register, CounterRegister);
+            if(Node->Code == Op_Negate)
+            {
+                VectorRR(Target, 0x66, 1, 0xEF, Next, Next, Next);           // pxor
+                VectorRR(Target, 0x66, 1, 0xFA, Next, Next, Register);       // psubd
+                VectorMove(Target, Register, Next);
+            }
+            else
+            {
+                VectorAllOnes(Target, Next);
+                VectorRR(Target, 0x66, 1, 0xEF, Register, Register, Next);   // pxor
+            }
+        } break;
+        
+        case VectorNode_Binary:
+        {
+            EmitVectorNode(Target, Loop, Node->Left, Register, CounterRegister);
+            EmitVectorNode(Target, Loop, Node->Right, Next, CounterRegister);
+            
+            // NOTE: Left in Register, right in Next
+            bool Invert = false;
+            switch(Node->Code)
+            {
+                case Op_PopAdd: { VectorRR(Target, 0x66, 1, 0xFE, Register, Register, Next); } break;
+                case Op_PopSub: { VectorRR(Target, 0x66, 1, 0xFA, Register, Register, Next); } break;
+                case Op_PopAnd: { VectorRR(Target, 0x66, 1, 0xDB, Register, Register, Next); } break;
+                case Op_PopOr:  { VectorRR(Target, 0x66, 1, 0xEB, Register, Register, Next); } break;
+                case Op_PopXor: { VectorRR(Target, 0x66, 1, 0xEF, Register, Register, Next); } break;
+                
+                case Op_PopMul:
+                {
+                    if(Target->Avx)
+                    {
+                        VectorRR(Target, 0x66, 2, 0x40, Register, Register, Next); // vpmulld
+                    }
+                    else
+                    {
+                        // NOTE: pmuludq multiplies lanes 0 and 2, the odd lanes
+                        // are shifted down into two more registers first
+                        int Odd = Register + 2;
+                        int OddRight = Register + 3;
+                        VectorRR(Target, 0x66, 1, 0x70, Odd, 0, Register);        // pshufd
+                        Byte(Buffer, 0xF5);
+                        VectorRR(Target, 0x66, 1, 0x70, OddRight, 0, Next);       // pshufd
+                        Byte(Buffer, 0xF5);
+                        VectorRR(Target, 0x66, 1, 0xF4, Register, Register, Next); // pmuludq
+                        VectorRR(Target, 0x66, 1, 0xF4, Odd, Odd, OddRight);      // pmuludq
+                        VectorRR(Target, 0x66, 1, 0x70, Register, 0, Register);   // pshufd
+                        Byte(Buffer, 0x08);
+                        VectorRR(Target, 0x66, 1, 0x70, Odd, 0, Odd);             // pshufd
+                        Byte(Buffer, 0x08);
+                        VectorRR(Target, 0x66, 1, 0x62, Register, Register, Odd); // punpckldq
+                    }
+                } break;
+                
+                // NOTE: pcmpgtd sets the lanes where the first source is greater to -1,
+                // TINY's true; the others are the inverse of one of those
+                case Op_SetEqual:    { VectorRR(Target, 0x66, 1, 0x76, Register, Register, Next); } break;
+                case Op_SetNotEqual: { VectorRR(Target, 0x66, 1, 0x76, Register, Register, Next); Invert = true; } break;
+                case Op_SetGreaterThan: { VectorRR(Target, 0x66, 1, 0x66, Register, Register, Next); } break;
+                case Op_SetLessThanOrEqual: { VectorRR(Target, 0x66, 1, 0x66, Register, Register, Next); Invert = true; } break;
+                
+                case Op_SetLessThan:
+                case Op_SetGreaterThanOrEqual:
+                {
+                    VectorRR(Target, 0x66, 1, 0x66, Next, Next, Register);       // pcmpgtd
+                    VectorMove(Target, Register, Next);
+                    Invert = (Node->Code == Op_SetGreaterThanOrEqual);
+                } break;
+                
+                default: break;
+            }
+            
+            if(Invert)
+            {
+                VectorAllOnes(Target, Next);
+                VectorRR(Target, 0x66, 1, 0xEF, Register, Register, Next);       // pxor
+            }
+        } break;
+    }
+}
+
+// NOTE: Adds up the lanes of Register into eax, using Scratch
+static void
+EmitVectorSum(vector_target *Target, int Register, int Scratch)
+{
+    code_buffer *Buffer = Target->Buffer;
+    if(Target->Avx)
+    {
+        VectorRR(Target, 0x66, 3, 0x39, Register, 0, Scratch);              // vextracti128
+        Byte(Buffer, 1);
+        VectorRR(Target, 0x66, 1, 0xFE, Register, Register, Scratch, false); // vpaddd xmm
+    }
+    VectorRR(Target, 0x66, 1, 0x70, Scratch, 0, Register, false);           // pshufd
+    Byte(Buffer, 0x4E);
+    VectorRR(Target, 0x66, 1, 0xFE, Register, Register, Scratch, false);    // paddd
+    VectorRR(Target, 0x66, 1, 0x70, Scratch, 0, Register, false);           // pshufd
+    Byte(Buffer, 0xB1);
+    VectorRR(Target, 0x66, 1, 0xFE, Register, Register, Scratch, false);    // paddd
+    VectorOpcode(Target, 0x66, 1, 0x7E, 0, false, 0);                       // movd eax, xmm
+    Byte(Buffer, 0xC0 | (Register << 3));
+}
+
+// NOTE: Emits a jcc/jmp rel32 (Opcode 0 for jmp) and returns where its rel32 is
+static int
+VectorJump(code_buffer *Buffer, int Opcode)
+{
+    if(Opcode)
+    {
+        Bytes(Buffer, 2, 0x0F, Opcode);
+    }
+    else
+    {
+        Byte(Buffer, 0xE9);
+    }
+    int Result = Buffer->Size;
+    Int32(Buffer, 0);
+    
+    return Result;
+}
+
+// NOTE: Emits the vector code for Loop, ending with a jump to Scalar (the
+// loop's ordinary code). Returns true if it loads the lane index table, with
+// LanesAt set to where the rel32 of that load is.
+static bool
+EmitVectorLoop(code_buffer *Buffer, vector_loop *Loop, int Width, int Scalar, int *LanesAt)
+{
+    vector_target Target = {Buffer, (Width == 8), Width};
+    
+    int CounterRegister = NumVectorRegisters - 1 - Loop->NumSums;
+    int Scale = (Width == 8) ? 3 : 2;
+    
+    // NOTE: rcx = i, rdx = the last i a whole vector can start at
+    if(Loop->CounterCode == Op_LoadVariable)
+    {
+        Bytes(Buffer, 3, 0x49, 0x63, 0x88);                 // movsxd rcx, [r8 + disp32]
+        Int32(Buffer, Loop->Counter*4);
+    }
+    else
+    {
+        Bytes(Buffer, 3, 0x49, 0x8B, 0x8A);                 // mov rcx, [r10 + disp32]
+        Int32(Buffer, Loop->Counter*8);
+    }
+    switch(Loop->LimitCode)
+    {
+        case Op_LoadConstant:
+        {
+            Bytes(Buffer, 3, 0x48, 0xC7, 0xC2);             // mov rdx, imm32
+            Int32(Buffer, Loop->Limit);
+        } break;
+        
+        case Op_LoadVariable:
+        {
+            Bytes(Buffer, 3, 0x49, 0x63, 0x90);             // movsxd rdx, [r8 + disp32]
+            Int32(Buffer, Loop->Limit*4);
+        } break;
+        
+        default:
+        {
+            Bytes(Buffer, 3, 0x49, 0x8B, 0x92);             // mov rdx, [r10 + disp32]
+            Int32(Buffer, Loop->Limit*8);
+        } break;
+    }
+    if(Loop->OrEqual)
+    {
+        Bytes(Buffer, 3, 0x48, 0xFF, 0xC2);                 // inc rdx
+    }
+    int NegativeAt = -1;
+    if(Loop->CheckedLength)
+    {
+        Bytes(Buffer, 3, 0x48, 0x85, 0xC9);                 // test rcx, rcx
+        NegativeAt = VectorJump(Buffer, 0x88);              // js <scalar>
+        Bytes(Buffer, 3, 0x49, 0xC7, 0xC1);                 // mov r9, imm32
+        Int32(Buffer, Loop->CheckedLength);
+        Bytes(Buffer, 3, 0x4C, 0x39, 0xCA);                 // cmp rdx, r9
+        Bytes(Buffer, 4, 0x49, 0x0F, 0x4F, 0xD1);           // cmovg rdx, r9
+    }
+    Bytes(Buffer, 4, 0x48, 0x83, 0xEA, Width);              // sub rdx, Width
+    Bytes(Buffer, 3, 0x48, 0x39, 0xD1);                     // cmp rcx, rdx
+    int ShortAt = VectorJump(Buffer, 0x8F);                 // jg <scalar>
+    
+    for(int Sum = 0;
+        Sum < Loop->NumSums;
+        Sum++)
+    {
+        int Register = NumVectorRegisters - 1 - Sum;
+        VectorRR(&Target, 0x66, 1, 0xEF, Register, Register, Register); // pxor
+    }
+    if(Loop->UsesCounter)
+    {
+        // NOTE: (i, i+1, ...) from i and the lane index table
+        Byte(Buffer, 0x89);                                 // mov eax, ecx
+        Byte(Buffer, 0xC8);
+        VectorBroadcastEax(&Target, CounterRegister);
+        VectorOpcode(&Target, 0xF3, 1, 0x6F, 0, true, 0);   // movdqu xmm0, [rip + disp32]
+        Byte(Buffer, 0x05);
+        *LanesAt = Buffer->Size;
+        Int32(Buffer, 0);
+        VectorRR(&Target, 0x66, 1, 0xFE, CounterRegister, CounterRegister, 0); // paddd
+    }
+    
+    int Body = Buffer->Size;
+    int NextSum = 0;
+    for(int StatementIndex = 0;
+        StatementIndex < Loop->NumStatements;
+        StatementIndex++)
+    {
+        vector_statement *Statement = Loop->Statements + StatementIndex;
+        EmitVectorNode(&Target, Loop, Statement->Value, 0, CounterRegister);
+        if(Statement->Code == Op_StoreElement)
+        {
+            VectorElement(&Target, 0xF3, 0x7F, 0, Statement->Target);    // movdqu store
+        }
+        else
+        {
+            int Register = NumVectorRegisters - 1 - NextSum++;
+            VectorRR(&Target, 0x66, 1, 0xFE, Register, Register, 0);    // paddd
+        }
+    }
+    Bytes(Buffer, 4, 0x48, 0x83, 0xC1, Width);              // add rcx, Width
+    if(Loop->UsesCounter)
+    {
+        // NOTE: Width in every lane: all ones, shifted down to 1, then up
+        VectorAllOnes(&Target, 0);
+        VectorRR(&Target, 0x66, 1, 0x72, 2, 0, 0);          // psrld xmm0, 31
+        Byte(Buffer, 31);
+        VectorRR(&Target, 0x66, 1, 0x72, 6, 0, 0);          // pslld xmm0, Scale
+        Byte(Buffer, Scale);
+        VectorRR(&Target, 0x66, 1, 0xFE, CounterRegister, CounterRegister, 0); // paddd
+    }
+    Bytes(Buffer, 3, 0x48, 0x39, 0xD1);                     // cmp rcx, rdx
+    int BodyAt = VectorJump(Buffer, 0x8E);                  // jle <body>
+    PatchInt32(Buffer, BodyAt, Body - (BodyAt + 4));
+    
+    // NOTE: Hand i and the sums back to the scalar code
+    if(Loop->CounterCode == Op_LoadVariable)
+    {
+        Bytes(Buffer, 3, 0x41, 0x89, 0x88);                 // mov [r8 + disp32], ecx
+        Int32(Buffer, Loop->Counter*4);
+    }
+    else
+    {
+        Bytes(Buffer, 3, 0x49, 0x89, 0x8A);                 // mov [r10 + disp32], rcx
+        Int32(Buffer, Loop->Counter*8);
+    }
+    NextSum = 0;
+    for(int StatementIndex = 0;
+        StatementIndex < Loop->NumStatements;
+        StatementIndex++)
+    {
+        vector_statement *Statement = Loop->Statements + StatementIndex;
+        if(Statement->Code == Op_StoreElement)
+        {
+            continue;
+        }
+        
+        EmitVectorSum(&Target, NumVectorRegisters - 1 - NextSum++, 0);
+        if(Statement->Code == Op_Store)
+        {
+            Bytes(Buffer, 3, 0x41, 0x01, 0x80);             // add [r8 + disp32], eax
+            Int32(Buffer, Statement->Target*4);
+        }
+        else
+        {
+            Bytes(Buffer, 3, 0x41, 0x03, 0x82);             // add eax, [r10 + disp32]
+            Int32(Buffer, Statement->Target*8);
+            Bytes(Buffer, 3, 0x48, 0x63, 0xC0);             // movsxd rax, eax
+            Bytes(Buffer, 3, 0x49, 0x89, 0x82);             // mov [r10 + disp32], rax
+            Int32(Buffer, Statement->Target*8);
+        }
+    }
+    if(Target.Avx)
+    {
+        Bytes(Buffer, 3, 0xC5, 0xF8, 0x77);                 // vzeroupper
+    }
+    
+    int Skip = Buffer->Size;
+    PatchInt32(Buffer, ShortAt, Skip - (ShortAt + 4));
+    if(NegativeAt >= 0)
+    {
+        PatchInt32(Buffer, NegativeAt, Skip - (NegativeAt + 4));
+    }
+    int ScalarAt = VectorJump(Buffer, 0);                   // jmp <scalar>
+    PatchInt32(Buffer, ScalarAt, Scalar - (ScalarAt + 4));
+    
+    return Loop->UsesCounter;
+}
+
+// NOTE: 0, 1, ... 7 for the counter vector, after the vector loops
+static void
+EmitVectorLanes(code_buffer *Buffer, int *LanesAt, int NumLanesAt)
+{
+    int Lanes = Buffer->Size;
+    for(int Lane = 0;
+        Lane < 8;
+        Lane++)
+    {
+        Int32(Buffer, Lane);
+    }
+    for(int Index = 0;
+        Index < NumLanesAt;
+        Index++)
+    {
+        PatchInt32(Buffer, LanesAt[Index], Lanes - (LanesAt[Index] + 4));
+    }
+}
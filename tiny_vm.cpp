@@ -0,0 +1,2093 @@
+// NOTE: Tiered execution.
+//
+// With Target_Bytecode the code generation routines append one op each to
+// Bytecode instead of writing assembly, so the ops are the same stack machine
+// the MASM backend targets (accumulator = eax, Push/Pop = the machine stack).
+// RunBytecode interprets them. Every backward Branch is a WHILE back-edge;
+// once a loop has gone around JitThreshold times its ops are translated to
+// x86-64 and the interpreter jumps into the native code at the back-edge
+// (on-stack replacement). Interpreter and native code share the global slots
+// that Alloc declares. The native code keeps its expression stack on the
+// machine stack, and when it leaves for the interpreter in the middle of a
+// loop (a side exit, at a READ, WRITE, call or RETURN) the exit hands the
+// accumulator and whatever it had pushed back to the interpreter.
+//
+// The accumulator and the stack are 64 bits wide. INT ops only look at, and
+// only produce, the low 32 bits; a LONG is brought in by its own ops and by
+// Op_Extend/Op_ExtendStacked, which sign extend an INT operand first. A LONG
+// global takes two slots, an array one or two per element.
+//
+// A PROCEDURE or FUNCTION call gets a frame of 64-bit slots holding its
+// parameters, an INT sign extended. Native code reaches the current frame
+// through the pointer it is called with.
+//
+// Counted loops over arrays are vectorized when they're compiled, see
+// tiny_vector.cpp.
+//
+// Loops are compiled on background JIT workers while the interpreter keeps
+// going. A worker publishes the finished code with an atomic store into the
+// loop's slot, which the interpreter picks up at the next back-edge.
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <limits.h>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JitSupported 1
+#else
+#define JitSupported 0
+#endif
+
+#define MaxOps 65536
+#define MaxLabels 65536
+#define MaxLoops 1024
+#define MaxGlobals (1 << 20)
+#define MaxVMStack 4096
+#define MaxJitRequests 4096
+#define MaxLongConstants 4096
+#define MaxProcedures 1024
+#define MaxFrameSlots 65536
+#define MaxCallDepth 65536
+#define MaxSpilled 256
+#define MaxCaseTables 4096
+#define MaxCaseEntries 65536
+
+enum op_code
+{
+    Op_LoadConstant,
+    Op_LoadVariable,
+    Op_Store,
+    Op_Push,
+    Op_Negate,
+    Op_Not,
+    Op_PopAdd,
+    Op_PopSub,
+    Op_PopMul,
+    Op_PopDiv,
+    Op_PopAnd,
+    Op_PopOr,
+    Op_PopXor,
+    Op_SetEqual,
+    Op_SetNotEqual,
+    Op_SetLessThan,
+    Op_SetGreaterThan,
+    Op_SetLessThanOrEqual,
+    Op_SetGreaterThanOrEqual,
+    Op_Branch,
+    Op_BranchFalse,
+    Op_BranchTrue,
+    Op_Read,
+    Op_Write,
+    
+    // NOTE: LONG versions of the ops above. Op_LoadLongConstant's operand
+    // indexes bytecode::LongConstants; Op_Extend sign extends the accumulator,
+    // Op_ExtendStacked the top of the stack; Op_TestLong turns the accumulator
+    // into an INT truth value for Op_BranchFalse.
+    Op_LoadLongConstant,
+    Op_LoadLong,
+    Op_StoreLong,
+    Op_Extend,
+    Op_ExtendStacked,
+    Op_NegateLong,
+    Op_NotLong,
+    Op_PopAddLong,
+    Op_PopSubLong,
+    Op_PopMulLong,
+    Op_PopDivLong,
+    Op_PopAndLong,
+    Op_PopOrLong,
+    Op_PopXorLong,
+    Op_SetEqualLong,
+    Op_SetNotEqualLong,
+    Op_SetLessThanLong,
+    Op_SetGreaterThanLong,
+    Op_SetLessThanOrEqualLong,
+    Op_SetGreaterThanOrEqualLong,
+    Op_TestLong,
+    Op_ReadLong,
+    Op_WriteLong,
+    
+    // NOTE: Routines. Op_Call's operand indexes bytecode::Procedures, it takes
+    // the last argument from the accumulator and the others off the stack.
+    // The *Local ops address the current frame.
+    Op_Call,
+    Op_Return,
+    Op_LoadLocal,
+    Op_StoreLocal,
+    Op_StoreLocalLong,
+    Op_ReadLocal,
+    Op_ReadLocalLong,
+    Op_WriteLocal,
+    
+    // NOTE: Arrays. The operand is the array's first slot, the index is the
+    // accumulator (loads) or was pushed before the value (stores).
+    // Op_CheckIndex stops the program unless the accumulator is in [0, Operand).
+    Op_LoadElement,
+    Op_LoadElementLong,
+    Op_StoreElement,
+    Op_StoreElementLong,
+    Op_CheckIndex,
+    
+    // NOTE: CASE, jumps by the accumulator through bytecode::CaseTables[Operand]
+    Op_Case,
+    
+    // NOTE: --instrument, increments vm::Counters[Operand]
+    Op_Count,
+    
+    Op_Halt
+};
+
+struct op
+{
+    op_code Code;
+    
+    // NOTE: Constant, global slot or (label -> program counter after FinishBytecode)
+    int Operand;
+    
+    // NOTE: Index into bytecode::Loops for WHILE back-edges, -1 otherwise
+    int Loop;
+    
+    // NOTE: Source line, for the profiler support
+    int Line;
+};
+
+struct loop
+{
+    int Head;
+    int BackEdge;
+};
+
+struct case_entry
+{
+    int Value;
+    
+    // NOTE: Label -> program counter after FinishBytecode, as for a branch
+    int Target;
+};
+
+// NOTE: The entries are sorted by value. A dense table has one for every
+// value from Low on (the missing labels go to Default) and is indexed, a
+// sparse one is searched.
+struct case_table
+{
+    int FirstEntry;
+    int NumEntries;
+    bool Dense;
+    int Low;
+    int Default;
+};
+
+struct procedure
+{
+    int Entry;
+    int NumParameters;
+    
+    // NOTE: Bit n is set if parameter n is a LONG
+    int LongParameters;
+    int FrameSize;
+};
+
+struct bytecode
+{
+    int NumOps;
+    op Ops[MaxOps];
+    
+    // NOTE: Where the main program starts, the routines come before it
+    int Entry;
+    
+    int LabelAddress[MaxLabels];
+    
+    int NumGlobals;
+    int GlobalInit[MaxGlobals];
+    
+    int NumLongConstants;
+    long long LongConstants[MaxLongConstants];
+    
+    int NumLoops;
+    loop Loops[MaxLoops];
+    
+    int NumProcedures;
+    procedure Procedures[MaxProcedures];
+    
+    int NumCaseTables;
+    case_table CaseTables[MaxCaseTables];
+    int NumCaseEntries;
+    case_entry CaseEntries[MaxCaseEntries];
+    
+    char SourceName[256];
+};
+
+// NOTE: Native code for a loop is called with the current frame and returns
+// the program counter the interpreter resumes at, or -(PC + 1) when the op at
+// PC hit a runtime error.
+typedef int (*jit_code)(long long *Frame);
+
+struct loop_slot
+{
+    // NOTE: Only touched by the thread running the vm
+    int Count;
+    
+    // NOTE: Stored once by a JIT worker, loaded by the interpreter at every back-edge
+    std::atomic<jit_code> Code;
+    int CodeSize;
+};
+
+struct vm
+{
+    bytecode *Program;
+    
+    bool JitEnabled;
+    int JitThreshold;
+    
+    // NOTE: Lanes of the vectorized loops, 0 to not vectorize, see tiny_vector.cpp
+    int VectorWidth;
+    
+    FILE *Input;
+    FILE *Output;
+    
+    alignas(8) int Globals[MaxGlobals];
+    
+    // NOTE: Native code reaches these relative to Globals, see Op_Count in TranslateLoop
+    unsigned long long Counters[MaxCounters];
+    
+    // NOTE: Left by native code at an exit, also relative to Globals: the
+    // accumulator and the NumSpilled values it had pushed, oldest first
+    long long ExitAccumulator;
+    int NumSpilled;
+    long long Spilled[MaxSpilled];
+    
+    long long Frames[MaxFrameSlots];
+    
+    // NOTE: Per active call, the caller's program counter and frame
+    int ReturnPC[MaxCallDepth];
+    int ReturnFrame[MaxCallDepth];
+    
+    loop_slot Slots[MaxLoops];
+    
+    // NOTE: Guarded by jit_queue::Mutex
+    int PendingCompiles;
+};
+
+struct jit_request
+{
+    // NOTE: Null once the vm has finished and the request was cancelled
+    vm *Machine;
+    int Loop;
+};
+
+struct jit_queue
+{
+    std::mutex Mutex;
+    std::condition_variable Changed;
+    
+    int NumWorkers;
+    int First;
+    int Count;
+    jit_request Requests[MaxJitRequests];
+};
+
+// NOTE: Never freed, the workers are detached and live until the process exits
+static jit_queue *JitQueue = 0;
+
+//
+// --Bytecode emission
+//
+
+static void
+ResetBytecode(bytecode *Program)
+{
+    Program->NumOps = 0;
+    Program->Entry = 0;
+    Program->NumGlobals = 0;
+    Program->NumLongConstants = 0;
+    Program->NumLoops = 0;
+    Program->NumProcedures = 0;
+    Program->NumCaseTables = 0;
+    Program->NumCaseEntries = 0;
+}
+
+static void
+EmitOp(compiler_context *Context, op_code Code, int Operand = 0)
+{
+    bytecode *Program = Context->Bytecode;
+    if(Program->NumOps >= MaxOps)
+    {
+        Abort(Context, "Program too large");
+    }
+    
+    compile_phase Previous = EnterPhase(Context, Phase_Emit);
+    Context->NumInstructions++;
+    
+    op *Op = Program->Ops + Program->NumOps++;
+    Op->Code = Code;
+    Op->Operand = Operand;
+    Op->Loop = -1;
+    Op->Line = Context->StatementLine;
+    
+    EnterPhase(Context, Previous);
+}
+
+static int
+LabelIndex(char *Label)
+{
+    // NOTE: Labels come from NewLabel ("L<n>"), anything else (MAIN) is not a branch target
+    int Result = -1;
+    
+    if(Label[0] == 'L')
+    {
+        Result = atoi(Label + 1);
+        Assert(Result < MaxLabels);
+    }
+    
+    return Result;
+}
+
+static void
+PostBytecodeLabel(compiler_context *Context, char *Label)
+{
+    int Index = LabelIndex(Label);
+    if(Index >= 0)
+    {
+        Context->Bytecode->LabelAddress[Index] = Context->Bytecode->NumOps;
+    }
+    else if(!strcmp(Label, "MAIN"))
+    {
+        Context->Bytecode->Entry = Context->Bytecode->NumOps;
+    }
+}
+
+static int
+AddLongConstant(compiler_context *Context, long long Value)
+{
+    bytecode *Program = Context->Bytecode;
+    if(Program->NumLongConstants >= MaxLongConstants)
+    {
+        Abort(Context, "Too many LONG constants");
+    }
+    
+    int Result = Program->NumLongConstants++;
+    Program->LongConstants[Result] = Value;
+    return Result;
+}
+
+static void
+DeclareGlobal(compiler_context *Context, symbol *Symbol, long long InitialValue)
+{
+    if(Context->Target != Target_Bytecode)
+    {
+        return;
+    }
+    
+    bytecode *Program = Context->Bytecode;
+    int Size = ((Symbol->Type == Type_Long) ? 2 : 1)*(Symbol->Length ? Symbol->Length : 1);
+    if(Symbol->Slot + Size > MaxGlobals)
+    {
+        Abort(Context, "Too many variables");
+    }
+    
+    if(Symbol->Length)
+    {
+        memset(Program->GlobalInit + Symbol->Slot, 0, Size*sizeof(int));
+    }
+    else if(Symbol->Type == Type_Long)
+    {
+        memcpy(Program->GlobalInit + Symbol->Slot, &InitialValue, sizeof(InitialValue));
+    }
+    else
+    {
+        Program->GlobalInit[Symbol->Slot] = (int)InitialValue;
+    }
+    if(Program->NumGlobals < Symbol->Slot + Size)
+    {
+        Program->NumGlobals = Symbol->Slot + Size;
+    }
+}
+
+// NOTE: A slot for a FOR's limit, which only the compiler knows about: a
+// global in the main program, past the locals in a routine's frame
+static int
+DeclareForLimit(compiler_context *Context)
+{
+    bytecode *Program = Context->Bytecode;
+    int Result = 0;
+    
+    if(Context->Routine)
+    {
+        Result = Program->Procedures[Context->Routine->Slot].FrameSize++;
+    }
+    else
+    {
+        if(Context->NumGlobalSlots >= MaxGlobals)
+        {
+            Abort(Context, "Too many variables");
+        }
+        Result = Context->NumGlobalSlots++;
+        Program->GlobalInit[Result] = 0;
+        if(Program->NumGlobals < Result + 1)
+        {
+            Program->NumGlobals = Result + 1;
+        }
+    }
+    
+    return Result;
+}
+
+// NOTE: Returns the index Op_Case takes. Labels are sorted by value, the arm
+// with index n starts at label L<FirstArmLabel + n>.
+static int
+DeclareCaseTable(compiler_context *Context, case_label *Labels, int NumLabels, bool Dense,
+                 int FirstArmLabel, char *DefaultLabel)
+{
+    bytecode *Program = Context->Bytecode;
+    int Low = Labels[0].Value;
+    int NumEntries = Dense ? (Labels[NumLabels - 1].Value - Low + 1) : NumLabels;
+    if((Program->NumCaseTables >= MaxCaseTables) ||
+       (Program->NumCaseEntries + NumEntries > MaxCaseEntries))
+    {
+        Abort(Context, "Too many CASE labels");
+    }
+    
+    int Result = Program->NumCaseTables++;
+    case_table *Table = Program->CaseTables + Result;
+    Table->FirstEntry = Program->NumCaseEntries;
+    Table->NumEntries = NumEntries;
+    Table->Dense = Dense;
+    Table->Low = Low;
+    Table->Default = LabelIndex(DefaultLabel);
+    
+    case_entry *Entries = Program->CaseEntries + Table->FirstEntry;
+    if(Dense)
+    {
+        for(int Entry = 0;
+            Entry < NumEntries;
+            Entry++)
+        {
+            Entries[Entry].Value = Low + Entry;
+            Entries[Entry].Target = Table->Default;
+        }
+    }
+    for(int Label = 0;
+        Label < NumLabels;
+        Label++)
+    {
+        case_entry *Entry = Entries + (Dense ? (Labels[Label].Value - Low) : Label);
+        Entry->Value = Labels[Label].Value;
+        Entry->Target = FirstArmLabel + Labels[Label].Arm;
+    }
+    Program->NumCaseEntries += NumEntries;
+    
+    return Result;
+}
+
+// NOTE: Returns the index Op_Call takes, Routine's code starts at the next op
+static int
+DeclareProcedure(compiler_context *Context, symbol *Routine)
+{
+    if(Context->Target != Target_Bytecode)
+    {
+        return 0;
+    }
+    
+    bytecode *Program = Context->Bytecode;
+    if(Program->NumProcedures >= MaxProcedures)
+    {
+        Abort(Context, "Too many routines");
+    }
+    
+    int Result = Program->NumProcedures++;
+    procedure *Procedure = Program->Procedures + Result;
+    Procedure->Entry = Program->NumOps;
+    Procedure->NumParameters = Routine->NumParameters;
+    Procedure->LongParameters = 0;
+    Procedure->FrameSize = Routine->NumParameters + Routine->NumLocals;
+    for(int Parameter = 0;
+        Parameter < Routine->NumParameters;
+        Parameter++)
+    {
+        if(Routine->ParameterTypes[Parameter] == Type_Long)
+        {
+            Procedure->LongParameters |= (1 << Parameter);
+        }
+    }
+    
+    return Result;
+}
+
+static void
+FinishBytecode(compiler_context *Context)
+{
+    EmitOp(Context, Op_Halt);
+    
+    bytecode *Program = Context->Bytecode;
+    for(int PC = 0;
+        PC < Program->NumOps;
+        PC++)
+    {
+        op *Op = Program->Ops + PC;
+        if((Op->Code == Op_Branch) || (Op->Code == Op_BranchFalse) || (Op->Code == Op_BranchTrue))
+        {
+            Op->Operand = Program->LabelAddress[Op->Operand];
+            
+            if((Op->Code == Op_Branch) && (Op->Operand <= PC))
+            {
+                if(Program->NumLoops >= MaxLoops)
+                {
+                    Abort(Context, "Too many loops");
+                }
+                Op->Loop = Program->NumLoops++;
+                
+                loop *Loop = Program->Loops + Op->Loop;
+                Loop->Head = Op->Operand;
+                Loop->BackEdge = PC;
+            }
+        }
+    }
+    
+    for(int Table = 0;
+        Table < Program->NumCaseTables;
+        Table++)
+    {
+        Program->CaseTables[Table].Default = Program->LabelAddress[Program->CaseTables[Table].Default];
+    }
+    for(int Entry = 0;
+        Entry < Program->NumCaseEntries;
+        Entry++)
+    {
+        Program->CaseEntries[Entry].Target = Program->LabelAddress[Program->CaseEntries[Entry].Target];
+    }
+}
+
+//
+// --JIT (x86-64)
+//
+
+// NOTE: Register use in native loops:
+//   eax (rax for a LONG) = accumulator, ecx = popped operand, edx:r9d = division,
+//   r8 = base of vm::Globals, r10 = the current frame, r11 = rsp on entry
+//   (restored by every exit).
+// Only registers that are volatile in both the SysV and Win64 conventions are
+// touched, so the code needs no prologue beyond loading r8, r10 and r11.
+
+struct code_buffer
+{
+    unsigned char *Base;
+    int Size;
+    int Max;
+};
+
+struct jump_fixup
+{
+    // NOTE: Offset of the rel32 field, and the op (or exit stub) it jumps to
+    int At;
+    int Target;
+    bool ToExit;
+};
+
+static void *
+AllocateExecutable(int Size)
+{
+    void *Result = 0;
+
+#if defined(_WIN32)
+    Result = VirtualAlloc(0, Size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    Result = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(Result == MAP_FAILED)
+    {
+        Result = 0;
+    }
+#endif
+    
+    return Result;
+}
+
+static bool
+ProtectExecutable(void *Memory, int Size)
+{
+#if defined(_WIN32)
+    DWORD OldProtect;
+    bool Result = VirtualProtect(Memory, Size, PAGE_EXECUTE_READ, &OldProtect) != 0;
+#else
+    bool Result = (mprotect(Memory, Size, PROT_READ | PROT_EXEC) == 0);
+#endif
+    
+    return Result;
+}
+
+static void
+FreeExecutable(void *Memory, int Size)
+{
+#if defined(_WIN32)
+    VirtualFree(Memory, 0, MEM_RELEASE);
+#else
+    munmap(Memory, Size);
+#endif
+}
+
+static void
+Byte(code_buffer *Buffer, int Value)
+{
+    if(Buffer->Size < Buffer->Max)
+    {
+        Buffer->Base[Buffer->Size] = (unsigned char)Value;
+    }
+    Buffer->Size++;
+}
+
+static void
+Bytes(code_buffer *Buffer, int Count, int B0, int B1 = 0, int B2 = 0, int B3 = 0)
+{
+    int Values[4] = {B0, B1, B2, B3};
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        Byte(Buffer, Values[Index]);
+    }
+}
+
+static void
+Int32(code_buffer *Buffer, int Value)
+{
+    unsigned int Bits = (unsigned int)Value;
+    Byte(Buffer, Bits & 0xFF);
+    Byte(Buffer, (Bits >> 8) & 0xFF);
+    Byte(Buffer, (Bits >> 16) & 0xFF);
+    Byte(Buffer, (Bits >> 24) & 0xFF);
+}
+
+static void
+PatchInt32(code_buffer *Buffer, int At, int Value)
+{
+    if(At + 4 <= Buffer->Max)
+    {
+        unsigned int Bits = (unsigned int)Value;
+        Buffer->Base[At + 0] = (unsigned char)(Bits & 0xFF);
+        Buffer->Base[At + 1] = (unsigned char)((Bits >> 8) & 0xFF);
+        Buffer->Base[At + 2] = (unsigned char)((Bits >> 16) & 0xFF);
+        Buffer->Base[At + 3] = (unsigned char)((Bits >> 24) & 0xFF);
+    }
+}
+
+// NOTE: Fills in the rel32 just emitted (as 0) later: to the op at PC if it's
+// in the loop, through an exit back to the interpreter otherwise
+static void
+AddJumpFixup(code_buffer *Buffer, loop *Loop, int PC, jump_fixup *Fixups, int *NumFixups,
+             int *ExitPC, int *ExitDepth, int *NumExits)
+{
+    jump_fixup *Fixup = Fixups + (*NumFixups)++;
+    Fixup->At = Buffer->Size - 4;
+    if((PC >= Loop->Head) && (PC <= Loop->BackEdge))
+    {
+        Fixup->Target = PC;
+        Fixup->ToExit = false;
+    }
+    else
+    {
+        Fixup->Target = *NumExits;
+        Fixup->ToExit = true;
+        ExitDepth[*NumExits] = 0;
+        ExitPC[(*NumExits)++] = PC;
+    }
+}
+
+static void
+EmitCompareAndSet(code_buffer *Buffer, int SetOpcode, bool Long = false)
+{
+    Bytes(Buffer, 1, 0x59);                 // pop rcx
+    if(Long)
+    {
+        Bytes(Buffer, 3, 0x48, 0x39, 0xC1); // cmp rcx, rax
+    }
+    else
+    {
+        Bytes(Buffer, 2, 0x39, 0xC1);       // cmp ecx, eax
+    }
+    Bytes(Buffer, 3, 0x0F, SetOpcode, 0xC0); // setcc al
+    Bytes(Buffer, 3, 0x0F, 0xB6, 0xC0);     // movzx eax, al
+    Bytes(Buffer, 2, 0xF7, 0xD8);           // neg eax
+}
+
+#include "tiny_vector.cpp"
+
+// NOTE: Returns the size of the code, or 0 if the loop can't be compiled.
+// Called twice: once with Buffer->Max == 0 to size it, once to fill it.
+// OpOffsets (if not 0) receives the native offset of every op in the loop.
+static int
+TranslateLoop(vm *Machine, loop *Loop, code_buffer *Buffer, int *OpOffsets = 0)
+{
+    bytecode *Program = Machine->Program;
+    
+    int NumRegionOps = Loop->BackEdge - Loop->Head + 1;
+    
+    // NOTE: One jump per op, but a division has two and an Op_Case one per
+    // entry and one per empty range of entries between them, see below
+    int NumJumps = NumRegionOps + 1;
+    for(int PC = Loop->Head;
+        PC <= Loop->BackEdge;
+        PC++)
+    {
+        op_code Code = Program->Ops[PC].Code;
+        if(Code == Op_Case)
+        {
+            NumJumps += 2*Program->CaseTables[Program->Ops[PC].Operand].NumEntries + 1;
+        }
+        else if((Code == Op_PopDiv) || (Code == Op_PopDivLong))
+        {
+            NumJumps++;
+        }
+    }
+    
+    int *NativeOffset = (int *)malloc(NumRegionOps * sizeof(int));
+    jump_fixup *Fixups = (jump_fixup *)malloc(NumJumps * sizeof(jump_fixup));
+    int *ExitPC = (int *)malloc(NumJumps * sizeof(int));
+    
+    // NOTE: Values on the machine stack at each exit, handed to the interpreter
+    int *ExitDepth = (int *)malloc(NumJumps * sizeof(int));
+    int NumFixups = 0;
+    int NumExits = 0;
+    int Depth = 0;
+    bool Ok = true;
+    
+    // NOTE: mov r8, Globals / mov r11, rsp / mov r10, <the frame argument>
+    Bytes(Buffer, 2, 0x49, 0xB8);
+    unsigned long long GlobalsAddress = (unsigned long long)(size_t)Machine->Globals;
+    Int32(Buffer, (int)(GlobalsAddress & 0xFFFFFFFF));
+    Int32(Buffer, (int)(GlobalsAddress >> 32));
+    Bytes(Buffer, 3, 0x49, 0x89, 0xE3);
+#if defined(_WIN32)
+    Bytes(Buffer, 3, 0x49, 0x89, 0xCA);
+#else
+    Bytes(Buffer, 3, 0x49, 0x89, 0xFA);
+#endif
+    
+    // NOTE: The loops in the region (the loop itself included) that get a
+    // vector version, entered by a jump at their head
+    int NumVectors = 0;
+    vector_loop *Vectors = 0;
+    int *VectorJumpAt = 0;
+    if(Machine->VectorWidth)
+    {
+        int NumCandidates = 0;
+        for(int LoopIndex = 0;
+            LoopIndex < Program->NumLoops;
+            LoopIndex++)
+        {
+            loop *Inner = Program->Loops + LoopIndex;
+            NumCandidates += ((Inner->Head >= Loop->Head) && (Inner->BackEdge <= Loop->BackEdge)) ? 1 : 0;
+        }
+        Vectors = (vector_loop *)malloc(NumCandidates*sizeof(vector_loop));
+        VectorJumpAt = (int *)malloc(NumCandidates*sizeof(int));
+        for(int LoopIndex = 0;
+            LoopIndex < Program->NumLoops;
+            LoopIndex++)
+        {
+            loop *Inner = Program->Loops + LoopIndex;
+            if((Inner->Head >= Loop->Head) && (Inner->BackEdge <= Loop->BackEdge) &&
+               MatchVectorLoop(Program, Inner, Vectors + NumVectors))
+            {
+                NumVectors++;
+            }
+        }
+    }
+    
+    for(int PC = Loop->Head;
+        Ok && (PC <= Loop->BackEdge);
+        PC++)
+    {
+        op *Op = Program->Ops + PC;
+        NativeOffset[PC - Loop->Head] = Buffer->Size;
+        for(int VectorIndex = 0;
+            VectorIndex < NumVectors;
+            VectorIndex++)
+        {
+            if(Vectors[VectorIndex].Head == PC)
+            {
+                // NOTE: Only falling in goes through the vector code, jumps
+                // to the head (the back-edge) land after this
+                Byte(Buffer, 0xE9);                    // jmp <vector code>
+                VectorJumpAt[VectorIndex] = Buffer->Size;
+                Int32(Buffer, 0);
+                NativeOffset[PC - Loop->Head] = Buffer->Size;
+            }
+        }
+        
+        switch(Op->Code)
+        {
+            case Op_LoadConstant:
+            {
+                Byte(Buffer, 0xB8);                    // mov eax, imm32
+                Int32(Buffer, Op->Operand);
+            } break;
+            
+            case Op_LoadVariable:
+            {
+                Bytes(Buffer, 3, 0x41, 0x8B, 0x80);     // mov eax, [r8 + disp32]
+                Int32(Buffer, Op->Operand*4);
+            } break;
+            
+            case Op_Store:
+            {
+                Bytes(Buffer, 3, 0x41, 0x89, 0x80);     // mov [r8 + disp32], eax
+                Int32(Buffer, Op->Operand*4);
+            } break;
+            
+            case Op_Push:
+            {
+                Byte(Buffer, 0x50);                    // push rax
+                Depth++;
+            } break;
+            
+            case Op_Negate:
+            {
+                Bytes(Buffer, 2, 0xF7, 0xD8);           // neg eax
+            } break;
+            
+            case Op_Not:
+            {
+                Bytes(Buffer, 2, 0xF7, 0xD0);           // not eax
+            } break;
+            
+            case Op_PopAdd:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 2, 0x01, 0xC8);           // add eax, ecx
+                Depth--;
+            } break;
+            
+            case Op_PopSub:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 2, 0x29, 0xC1);           // sub ecx, eax
+                Bytes(Buffer, 2, 0x89, 0xC8);           // mov eax, ecx
+                Depth--;
+            } break;
+            
+            case Op_PopMul:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x0F, 0xAF, 0xC1);     // imul eax, ecx
+                Depth--;
+            } break;
+            
+            case Op_PopDiv:
+            case Op_PopDivLong:
+            {
+                bool Long = (Op->Code == Op_PopDivLong);
+                
+                // NOTE: idiv traps on the smallest value over -1, which is
+                // left to the interpreter: a side exit back to this op
+                if(Depth > MaxSpilled)
+                {
+                    Ok = false;
+                    break;
+                }
+                if(Long)
+                {
+                    Byte(Buffer, 0x48);                // REX.W
+                }
+                Bytes(Buffer, 3, 0x83, 0xF8, 0xFF);     // cmp eax, -1
+                Bytes(Buffer, 2, 0x0F, 0x84);           // jz <side exit>
+                Fixups[NumFixups].At = Buffer->Size;
+                Fixups[NumFixups].Target = NumExits;
+                Fixups[NumFixups].ToExit = true;
+                NumFixups++;
+                ExitDepth[NumExits] = Depth;
+                ExitPC[NumExits++] = PC;
+                Int32(Buffer, 0);
+                
+                Byte(Buffer, 0x59);                    // pop rcx
+                if(Long)
+                {
+                    Byte(Buffer, 0x48);                // REX.W
+                }
+                Bytes(Buffer, 2, 0x85, 0xC0);           // test eax, eax
+                Bytes(Buffer, 2, 0x0F, 0x84);           // jz <error exit>
+                Fixups[NumFixups].At = Buffer->Size;
+                Fixups[NumFixups].Target = NumExits;
+                Fixups[NumFixups].ToExit = true;
+                NumFixups++;
+                ExitDepth[NumExits] = 0;
+                ExitPC[NumExits++] = -(PC + 1);
+                Int32(Buffer, 0);
+                if(Long)
+                {
+                    Bytes(Buffer, 3, 0x49, 0x89, 0xC1); // mov r9, rax
+                    Bytes(Buffer, 3, 0x48, 0x89, 0xC8); // mov rax, rcx
+                    Bytes(Buffer, 2, 0x48, 0x99);       // cqo
+                    Bytes(Buffer, 3, 0x49, 0xF7, 0xF9); // idiv r9
+                }
+                else
+                {
+                    Bytes(Buffer, 3, 0x41, 0x89, 0xC1); // mov r9d, eax
+                    Bytes(Buffer, 2, 0x89, 0xC8);       // mov eax, ecx
+                    Byte(Buffer, 0x99);                // cdq
+                    Bytes(Buffer, 3, 0x41, 0xF7, 0xF9); // idiv r9d
+                }
+                Depth--;
+            } break;
+            
+            case Op_PopAnd:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 2, 0x21, 0xC8);           // and eax, ecx
+                Depth--;
+            } break;
+            
+            case Op_PopOr:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 2, 0x09, 0xC8);           // or eax, ecx
+                Depth--;
+            } break;
+            
+            case Op_PopXor:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 2, 0x31, 0xC8);           // xor eax, ecx
+                Depth--;
+            } break;
+            
+            case Op_SetEqual:              { EmitCompareAndSet(Buffer, 0x94); Depth--; } break;
+            case Op_SetNotEqual:           { EmitCompareAndSet(Buffer, 0x95); Depth--; } break;
+            case Op_SetLessThan:           { EmitCompareAndSet(Buffer, 0x9C); Depth--; } break;
+            case Op_SetGreaterThanOrEqual: { EmitCompareAndSet(Buffer, 0x9D); Depth--; } break;
+            case Op_SetLessThanOrEqual:    { EmitCompareAndSet(Buffer, 0x9E); Depth--; } break;
+            case Op_SetGreaterThan:        { EmitCompareAndSet(Buffer, 0x9F); Depth--; } break;
+            
+            case Op_LoadLongConstant:
+            {
+                unsigned long long Value = (unsigned long long)Program->LongConstants[Op->Operand];
+                Bytes(Buffer, 2, 0x48, 0xB8);           // mov rax, imm64
+                Int32(Buffer, (int)(Value & 0xFFFFFFFF));
+                Int32(Buffer, (int)(Value >> 32));
+            } break;
+            
+            case Op_LoadLong:
+            {
+                Bytes(Buffer, 3, 0x49, 0x8B, 0x80);     // mov rax, [r8 + disp32]
+                Int32(Buffer, Op->Operand*4);
+            } break;
+            
+            case Op_StoreLong:
+            {
+                Bytes(Buffer, 3, 0x49, 0x89, 0x80);     // mov [r8 + disp32], rax
+                Int32(Buffer, Op->Operand*4);
+            } break;
+            
+            case Op_Extend:
+            {
+                Bytes(Buffer, 3, 0x48, 0x63, 0xC0);     // movsxd rax, eax
+            } break;
+            
+            case Op_ExtendStacked:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x63, 0xC9);     // movsxd rcx, ecx
+                Byte(Buffer, 0x51);                    // push rcx
+            } break;
+            
+            case Op_NegateLong:
+            {
+                Bytes(Buffer, 3, 0x48, 0xF7, 0xD8);     // neg rax
+            } break;
+            
+            case Op_NotLong:
+            {
+                Bytes(Buffer, 3, 0x48, 0xF7, 0xD0);     // not rax
+            } break;
+            
+            case Op_PopAddLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x01, 0xC8);     // add rax, rcx
+                Depth--;
+            } break;
+            
+            case Op_PopSubLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x29, 0xC1);     // sub rcx, rax
+                Bytes(Buffer, 3, 0x48, 0x89, 0xC8);     // mov rax, rcx
+                Depth--;
+            } break;
+            
+            case Op_PopMulLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 4, 0x48, 0x0F, 0xAF, 0xC1); // imul rax, rcx
+                Depth--;
+            } break;
+            
+            case Op_PopAndLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x21, 0xC8);     // and rax, rcx
+                Depth--;
+            } break;
+            
+            case Op_PopOrLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x09, 0xC8);     // or rax, rcx
+                Depth--;
+            } break;
+            
+            case Op_PopXorLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x31, 0xC8);     // xor rax, rcx
+                Depth--;
+            } break;
+            
+            case Op_SetEqualLong:              { EmitCompareAndSet(Buffer, 0x94, true); Depth--; } break;
+            case Op_SetNotEqualLong:           { EmitCompareAndSet(Buffer, 0x95, true); Depth--; } break;
+            case Op_SetLessThanLong:           { EmitCompareAndSet(Buffer, 0x9C, true); Depth--; } break;
+            case Op_SetGreaterThanOrEqualLong: { EmitCompareAndSet(Buffer, 0x9D, true); Depth--; } break;
+            case Op_SetLessThanOrEqualLong:    { EmitCompareAndSet(Buffer, 0x9E, true); Depth--; } break;
+            case Op_SetGreaterThanLong:        { EmitCompareAndSet(Buffer, 0x9F, true); Depth--; } break;
+            
+            case Op_TestLong:
+            {
+                Bytes(Buffer, 3, 0x48, 0x85, 0xC0);     // test rax, rax
+                Bytes(Buffer, 3, 0x0F, 0x95, 0xC0);     // setne al
+                Bytes(Buffer, 3, 0x0F, 0xB6, 0xC0);     // movzx eax, al
+                Bytes(Buffer, 2, 0xF7, 0xD8);           // neg eax
+            } break;
+            
+            case Op_Branch:
+            case Op_BranchFalse:
+            case Op_BranchTrue:
+            {
+                if(Depth != 0)
+                {
+                    Ok = false;
+                    break;
+                }
+                
+                if(Op->Code == Op_Branch)
+                {
+                    Byte(Buffer, 0xE9);                // jmp rel32
+                }
+                else if(Op->Code == Op_BranchFalse)
+                {
+                    Bytes(Buffer, 2, 0x85, 0xC0);       // test eax, eax
+                    Bytes(Buffer, 2, 0x0F, 0x84);       // jz rel32
+                }
+                else
+                {
+                    Bytes(Buffer, 2, 0x85, 0xC0);       // test eax, eax
+                    Bytes(Buffer, 2, 0x0F, 0x85);       // jnz rel32
+                }
+                Int32(Buffer, 0);
+                AddJumpFixup(Buffer, Loop, Op->Operand, Fixups, &NumFixups, ExitPC, ExitDepth, &NumExits);
+            } break;
+            
+            case Op_Case:
+            {
+                if(Depth != 0)
+                {
+                    Ok = false;
+                    break;
+                }
+                
+                // NOTE: A balanced binary search of compares, dense tables
+                // too: the code buffer has no room for a table of addresses.
+                // Each pending range of entries is a subtree, with the jg
+                // into it (-1 for the root) to patch once it's placed.
+                case_table *Table = Program->CaseTables + Op->Operand;
+                case_entry *Entries = Program->CaseEntries + Table->FirstEntry;
+                int PendingFirst[64];
+                int PendingLast[64];
+                int PendingJump[64];
+                int NumPending = 1;
+                PendingFirst[0] = 0;
+                PendingLast[0] = Table->NumEntries - 1;
+                PendingJump[0] = -1;
+                while(NumPending)
+                {
+                    NumPending--;
+                    int First = PendingFirst[NumPending];
+                    int Last = PendingLast[NumPending];
+                    if(PendingJump[NumPending] >= 0)
+                    {
+                        PatchInt32(Buffer, PendingJump[NumPending], Buffer->Size - (PendingJump[NumPending] + 4));
+                    }
+                    
+                    if(First > Last)
+                    {
+                        Byte(Buffer, 0xE9);            // jmp <default>
+                        Int32(Buffer, 0);
+                        AddJumpFixup(Buffer, Loop, Table->Default, Fixups, &NumFixups, ExitPC, ExitDepth, &NumExits);
+                        continue;
+                    }
+                    
+                    int Middle = First + (Last - First)/2;
+                    Byte(Buffer, 0x3D);                // cmp eax, imm32
+                    Int32(Buffer, Entries[Middle].Value);
+                    Bytes(Buffer, 2, 0x0F, 0x84);       // jz <arm>
+                    Int32(Buffer, 0);
+                    AddJumpFixup(Buffer, Loop, Entries[Middle].Target, Fixups, &NumFixups, ExitPC, ExitDepth, &NumExits);
+                    
+                    Bytes(Buffer, 2, 0x0F, 0x8F);       // jg <upper half>
+                    Int32(Buffer, 0);
+                    PendingFirst[NumPending] = Middle + 1;
+                    PendingLast[NumPending] = Last;
+                    PendingJump[NumPending++] = Buffer->Size - 4;
+                    PendingFirst[NumPending] = First;
+                    PendingLast[NumPending] = Middle - 1;
+                    PendingJump[NumPending++] = -1;
+                }
+            } break;
+            
+            case Op_Count:
+            {
+                int Offset = (int)((char *)(Machine->Counters + Op->Operand) - (char *)Machine->Globals);
+                Bytes(Buffer, 3, 0x49, 0xFF, 0x80);     // inc qword [r8 + disp32]
+                Int32(Buffer, Offset);
+            } break;
+            
+            case Op_LoadLocal:
+            {
+                Bytes(Buffer, 3, 0x49, 0x8B, 0x82);     // mov rax, [r10 + disp32]
+                Int32(Buffer, Op->Operand*8);
+            } break;
+            
+            case Op_StoreLocal:
+            case Op_StoreLocalLong:
+            {
+                if(Op->Code == Op_StoreLocal)
+                {
+                    Bytes(Buffer, 3, 0x48, 0x63, 0xC0); // movsxd rax, eax
+                }
+                Bytes(Buffer, 3, 0x49, 0x89, 0x82);     // mov [r10 + disp32], rax
+                Int32(Buffer, Op->Operand*8);
+            } break;
+            
+            case Op_LoadElement:
+            case Op_LoadElementLong:
+            {
+                Bytes(Buffer, 3, 0x48, 0x63, 0xC0);     // movsxd rax, eax
+                if(Op->Code == Op_LoadElement)
+                {
+                    Bytes(Buffer, 4, 0x41, 0x8B, 0x84, 0x80); // mov eax, [r8 + rax*4 + disp32]
+                }
+                else
+                {
+                    Bytes(Buffer, 4, 0x49, 0x8B, 0x84, 0xC0); // mov rax, [r8 + rax*8 + disp32]
+                }
+                Int32(Buffer, Op->Operand*4);
+            } break;
+            
+            case Op_StoreElement:
+            case Op_StoreElementLong:
+            {
+                Byte(Buffer, 0x59);                    // pop rcx
+                Bytes(Buffer, 3, 0x48, 0x63, 0xC9);     // movsxd rcx, ecx
+                if(Op->Code == Op_StoreElement)
+                {
+                    Bytes(Buffer, 4, 0x41, 0x89, 0x84, 0x88); // mov [r8 + rcx*4 + disp32], eax
+                }
+                else
+                {
+                    Bytes(Buffer, 4, 0x49, 0x89, 0x84, 0xC8); // mov [r8 + rcx*8 + disp32], rax
+                }
+                Int32(Buffer, Op->Operand*4);
+                Depth--;
+            } break;
+            
+            case Op_CheckIndex:
+            {
+                Byte(Buffer, 0x3D);                    // cmp eax, imm32
+                Int32(Buffer, Op->Operand);
+                Bytes(Buffer, 2, 0x0F, 0x83);           // jae <error exit>
+                Fixups[NumFixups].At = Buffer->Size;
+                Fixups[NumFixups].Target = NumExits;
+                Fixups[NumFixups].ToExit = true;
+                NumFixups++;
+                ExitDepth[NumExits] = 0;
+                ExitPC[NumExits++] = -(PC + 1);
+                Int32(Buffer, 0);
+            } break;
+            
+            case Op_Read:
+            case Op_Write:
+            case Op_ReadLong:
+            case Op_WriteLong:
+            case Op_ReadLocal:
+            case Op_ReadLocalLong:
+            case Op_WriteLocal:
+            case Op_Call:
+            case Op_Return:
+            {
+                // NOTE: Side exit, the interpreter performs the I/O or the
+                // call and re-enters the native code at the next back-edge.
+                if(Depth > MaxSpilled)
+                {
+                    Ok = false;
+                    break;
+                }
+                
+                Byte(Buffer, 0xE9);
+                jump_fixup *Fixup = Fixups + NumFixups++;
+                Fixup->At = Buffer->Size;
+                Fixup->Target = NumExits;
+                Fixup->ToExit = true;
+                ExitDepth[NumExits] = Depth;
+                ExitPC[NumExits++] = PC;
+                Int32(Buffer, 0);
+                
+                // NOTE: The ops after a call see the arguments gone
+                if(Op->Code == Op_Call)
+                {
+                    int NumParameters = Program->Procedures[Op->Operand].NumParameters;
+                    Depth -= (NumParameters > 0) ? (NumParameters - 1) : 0;
+                }
+            } break;
+            
+            default:
+            {
+                Ok = false;
+            } break;
+        }
+    }
+    
+    // NOTE: Exit stubs store the accumulator and copy the values pushed since
+    // entry, which sit below r11 oldest first, for the interpreter
+    int ExitAccumulatorOffset = (int)((char *)&Machine->ExitAccumulator - (char *)Machine->Globals);
+    int NumSpilledOffset = (int)((char *)&Machine->NumSpilled - (char *)Machine->Globals);
+    int SpilledOffset = (int)((char *)Machine->Spilled - (char *)Machine->Globals);
+    int *ExitOffset = (int *)malloc((NumExits + 1) * sizeof(int));
+    for(int ExitIndex = 0;
+        Ok && (ExitIndex < NumExits);
+        ExitIndex++)
+    {
+        ExitOffset[ExitIndex] = Buffer->Size;
+        Bytes(Buffer, 3, 0x49, 0x89, 0x80);             // mov [r8 + disp32], rax
+        Int32(Buffer, ExitAccumulatorOffset);
+        for(int Spill = 0;
+            Spill < ExitDepth[ExitIndex];
+            Spill++)
+        {
+            Bytes(Buffer, 3, 0x49, 0x8B, 0x8B);         // mov rcx, [r11 + disp32]
+            Int32(Buffer, -8*(Spill + 1));
+            Bytes(Buffer, 3, 0x49, 0x89, 0x88);         // mov [r8 + disp32], rcx
+            Int32(Buffer, SpilledOffset + 8*Spill);
+        }
+        Bytes(Buffer, 3, 0x41, 0xC7, 0x80);             // mov dword [r8 + disp32], imm32
+        Int32(Buffer, NumSpilledOffset);
+        Int32(Buffer, ExitDepth[ExitIndex]);
+        Bytes(Buffer, 3, 0x4C, 0x89, 0xDC);             // mov rsp, r11
+        Byte(Buffer, 0xB8);                            // mov eax, imm32
+        Int32(Buffer, ExitPC[ExitIndex]);
+        Byte(Buffer, 0xC3);                            // ret
+    }
+    
+    int *LanesAt = (int *)malloc((NumVectors + 1) * sizeof(int));
+    int NumLanesAt = 0;
+    for(int VectorIndex = 0;
+        Ok && (VectorIndex < NumVectors);
+        VectorIndex++)
+    {
+        vector_loop *Vector = Vectors + VectorIndex;
+        PatchInt32(Buffer, VectorJumpAt[VectorIndex], Buffer->Size - (VectorJumpAt[VectorIndex] + 4));
+        if(EmitVectorLoop(Buffer, Vector, Machine->VectorWidth, NativeOffset[Vector->Head - Loop->Head], LanesAt + NumLanesAt))
+        {
+            NumLanesAt++;
+        }
+    }
+    if(Ok && NumLanesAt)
+    {
+        EmitVectorLanes(Buffer, LanesAt, NumLanesAt);
+    }
+    
+    for(int FixupIndex = 0;
+        Ok && (FixupIndex < NumFixups);
+        FixupIndex++)
+    {
+        jump_fixup *Fixup = Fixups + FixupIndex;
+        int Target = (Fixup->ToExit ?
+                      ExitOffset[Fixup->Target] :
+                      NativeOffset[Fixup->Target - Loop->Head]);
+        PatchInt32(Buffer, Fixup->At, Target - (Fixup->At + 4));
+    }
+    
+    if(Ok && OpOffsets)
+    {
+        memcpy(OpOffsets, NativeOffset, NumRegionOps*sizeof(int));
+    }
+    
+    free(LanesAt);
+    free(VectorJumpAt);
+    free(Vectors);
+    free(ExitOffset);
+    free(ExitDepth);
+    free(ExitPC);
+    free(Fixups);
+    free(NativeOffset);
+    
+    int Result = Ok ? Buffer->Size : 0;
+    return Result;
+}
+
+#include "tiny_perf.cpp"
+
+static jit_code
+CompileLoop(vm *Machine, loop *Loop, int *CodeSize)
+{
+    jit_code Result = 0;
+
+#if JitSupported
+    code_buffer Sizing = {};
+    int Size = TranslateLoop(Machine, Loop, &Sizing);
+    if(Size > 0)
+    {
+        code_buffer Buffer = {};
+        Buffer.Base = (unsigned char *)AllocateExecutable(Size);
+        Buffer.Max = Size;
+        int *OpOffsets = (int *)malloc((Loop->BackEdge - Loop->Head + 1)*sizeof(int));
+        if(Buffer.Base)
+        {
+            if((TranslateLoop(Machine, Loop, &Buffer, OpOffsets) == Size) &&
+               ProtectExecutable(Buffer.Base, Size))
+            {
+                Result = (jit_code)(void *)Buffer.Base;
+                *CodeSize = Size;
+                if(PerfOutput)
+                {
+                    ReportJitCode(Machine, Loop, Buffer.Base, Size, OpOffsets);
+                }
+            }
+            else
+            {
+                FreeExecutable(Buffer.Base, Size);
+            }
+        }
+        free(OpOffsets);
+    }
+#endif
+    
+    return Result;
+}
+
+//
+// --JIT workers
+//
+
+static void
+JitWorker()
+{
+    for(;;)
+    {
+        jit_request Request;
+        {
+            std::unique_lock<std::mutex> Lock(JitQueue->Mutex);
+            while(JitQueue->Count == 0)
+            {
+                JitQueue->Changed.wait(Lock);
+            }
+            
+            Request = JitQueue->Requests[JitQueue->First];
+            JitQueue->First = (JitQueue->First + 1) % MaxJitRequests;
+            JitQueue->Count--;
+        }
+        
+        vm *Machine = Request.Machine;
+        if(Machine)
+        {
+            loop_slot *Slot = Machine->Slots + Request.Loop;
+            int CodeSize = 0;
+            jit_code Code = CompileLoop(Machine, Machine->Program->Loops + Request.Loop, &CodeSize);
+            Slot->CodeSize = CodeSize;
+            Slot->Code.store(Code, std::memory_order_release);
+            
+            {
+                std::lock_guard<std::mutex> Lock(JitQueue->Mutex);
+                Machine->PendingCompiles--;
+            }
+            JitQueue->Changed.notify_all();
+        }
+    }
+}
+
+static void
+StartJitWorkers(int Count)
+{
+    if(!JitQueue)
+    {
+        JitQueue = new jit_queue();
+    }
+    
+    for(int WorkerIndex = 0;
+        WorkerIndex < Count;
+        WorkerIndex++)
+    {
+        std::thread(JitWorker).detach();
+        JitQueue->NumWorkers++;
+    }
+}
+
+// NOTE: Returns false if the loop should be compiled on the calling thread
+static bool
+RequestCompile(vm *Machine, int Loop)
+{
+    bool Result = false;
+    
+    if(JitQueue && (JitQueue->NumWorkers > 0))
+    {
+        std::lock_guard<std::mutex> Lock(JitQueue->Mutex);
+        if(JitQueue->Count < MaxJitRequests)
+        {
+            jit_request *Request = JitQueue->Requests + (JitQueue->First + JitQueue->Count) % MaxJitRequests;
+            Request->Machine = Machine;
+            Request->Loop = Loop;
+            JitQueue->Count++;
+            Machine->PendingCompiles++;
+            Result = true;
+        }
+        else
+        {
+            // NOTE: Queue is full, try again after another JitThreshold iterations
+            Machine->Slots[Loop].Count = 0;
+            Result = true;
+        }
+    }
+    
+    if(Result)
+    {
+        JitQueue->Changed.notify_all();
+    }
+    
+    return Result;
+}
+
+// NOTE: Cancels queued requests for Machine and waits for the ones in flight,
+// so no worker touches the vm after this returns.
+static void
+DrainJit(vm *Machine)
+{
+    if(JitQueue)
+    {
+        std::unique_lock<std::mutex> Lock(JitQueue->Mutex);
+        for(int Index = 0;
+            Index < JitQueue->Count;
+            Index++)
+        {
+            jit_request *Request = JitQueue->Requests + (JitQueue->First + Index) % MaxJitRequests;
+            if(Request->Machine == Machine)
+            {
+                Request->Machine = 0;
+                Machine->PendingCompiles--;
+            }
+        }
+        
+        while(Machine->PendingCompiles > 0)
+        {
+            JitQueue->Changed.wait(Lock);
+        }
+    }
+}
+
+//
+// --Interpreter
+//
+
+static void
+InitVM(vm *Machine, bytecode *Program)
+{
+    Machine->Program = Program;
+    Machine->JitEnabled = JitSupported;
+    Machine->JitThreshold = 1000;
+    Machine->VectorWidth = BestVectorWidth();
+    Machine->Input = stdin;
+    Machine->Output = stdout;
+    Machine->PendingCompiles = 0;
+    
+    memcpy(Machine->Globals, Program->GlobalInit, Program->NumGlobals*sizeof(int));
+    memset(Machine->Counters, 0, sizeof(Machine->Counters));
+    for(int LoopIndex = 0;
+        LoopIndex < Program->NumLoops;
+        LoopIndex++)
+    {
+        loop_slot *Slot = Machine->Slots + LoopIndex;
+        Slot->Count = 0;
+        Slot->Code.store(0, std::memory_order_relaxed);
+        Slot->CodeSize = 0;
+    }
+}
+
+static void
+FreeVM(vm *Machine)
+{
+    DrainJit(Machine);
+    
+    for(int LoopIndex = 0;
+        LoopIndex < Machine->Program->NumLoops;
+        LoopIndex++)
+    {
+        loop_slot *Slot = Machine->Slots + LoopIndex;
+        jit_code Code = Slot->Code.load(std::memory_order_acquire);
+        if(Code)
+        {
+            FreeExecutable((void *)Code, Slot->CodeSize);
+            Slot->Code.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// NOTE: Stops the program with status 1, as the compiled runtimes'
+// tiny_index_error does, and with the same message for an index
+static int
+RuntimeError(op *Ops, int PC)
+{
+    if(Ops[PC].Code == Op_CheckIndex)
+    {
+        fprintf(stdout, "Error: Index out of bounds.\n");
+    }
+    else
+    {
+        fprintf(stdout, "Error: Division by zero (op %d).\n", PC);
+    }
+    exit(1);
+    
+    return 0;
+}
+
+// NOTE: Counts a trip around the loop Op closes, returns its native code once
+// there is some
+static jit_code
+LoopCode(vm *Machine, op *Op)
+{
+    loop_slot *Slot = Machine->Slots + Op->Loop;
+    jit_code Result = Slot->Code.load(std::memory_order_acquire);
+    if(!Result && (++Slot->Count == Machine->JitThreshold))
+    {
+        if(!RequestCompile(Machine, Op->Loop))
+        {
+            int CodeSize = 0;
+            Result = CompileLoop(Machine, Machine->Program->Loops + Op->Loop, &CodeSize);
+            Slot->CodeSize = CodeSize;
+            Slot->Code.store(Result, std::memory_order_release);
+        }
+    }
+    
+    return Result;
+}
+
+// NOTE: The program counter Op_Case goes to for Value
+static int
+CaseTarget(bytecode *Program, int TableIndex, int Value)
+{
+    case_table *Table = Program->CaseTables + TableIndex;
+    case_entry *Entries = Program->CaseEntries + Table->FirstEntry;
+    int Result = Table->Default;
+    
+    if(Table->Dense)
+    {
+        unsigned int Entry = (unsigned int)Value - (unsigned int)Table->Low;
+        if(Entry < (unsigned int)Table->NumEntries)
+        {
+            Result = Entries[Entry].Target;
+        }
+    }
+    else
+    {
+        int First = 0;
+        int Last = Table->NumEntries - 1;
+        while(First <= Last)
+        {
+            int Middle = First + (Last - First)/2;
+            if(Entries[Middle].Value == Value)
+            {
+                Result = Entries[Middle].Target;
+                break;
+            }
+            else if(Entries[Middle].Value < Value)
+            {
+                First = Middle + 1;
+            }
+            else
+            {
+                Last = Middle - 1;
+            }
+        }
+    }
+    
+    return Result;
+}
+
+// NOTE: What scanf("%d") does with a value out of range is up to the C
+// library, so READ parses its own: white space, an optional sign, digits.
+// Out of range values saturate to Min or Max like the compiled runtimes', and
+// a failed read leaves the variable alone.
+static bool
+ReadInteger(FILE *Input, long long Min, long long Max, long long *Value)
+{
+    int C = getc(Input);
+    while((C == ' ') || ((C >= '\t') && (C <= '\r')))
+    {
+        C = getc(Input);
+    }
+    
+    bool Negative = (C == '-');
+    if(Negative || (C == '+'))
+    {
+        C = getc(Input);
+    }
+    
+    bool Result = ((C >= '0') && (C <= '9'));
+    unsigned long long Magnitude = 0;
+    while((C >= '0') && (C <= '9'))
+    {
+        // NOTE: Anything past 2^63 saturates either way
+        Magnitude = (Magnitude < 922337203685477581ULL) ? (Magnitude*10 + (C - '0')) : (1ULL << 63);
+        C = getc(Input);
+    }
+    if(C != EOF)
+    {
+        ungetc(C, Input);
+    }
+    
+    if(Result)
+    {
+        unsigned long long MinMagnitude = (unsigned long long)-(Min + 1) + 1;
+        if(Negative)
+        {
+            *Value = (Magnitude >= MinMagnitude) ? Min : -(long long)Magnitude;
+        }
+        else
+        {
+            *Value = (Magnitude >= (unsigned long long)Max) ? Max : (long long)Magnitude;
+        }
+    }
+    
+    return Result;
+}
+
+static void
+StackOverflow(char *Which)
+{
+    fprintf(stdout, "Error: %s stack overflow.\n", Which);
+    exit(1);
+}
+
+static void
+RunBytecode(vm *Machine)
+{
+    op *Ops = Machine->Program->Ops;
+    long long *LongConstants = Machine->Program->LongConstants;
+    procedure *Procedures = Machine->Program->Procedures;
+    int *Globals = Machine->Globals;
+    long long *Frames = Machine->Frames;
+    
+    long long Stack[MaxVMStack];
+    int Top = 0;
+    long long Accumulator = 0;
+    int PC = Machine->Program->Entry;
+    
+    int FrameBase = 0;
+    int FrameTop = 0;
+    int NumCalls = 0;
+    
+    for(;;)
+    {
+        op *Op = Ops + PC++;
+        switch(Op->Code)
+        {
+            case Op_LoadConstant: { Accumulator = Op->Operand; } break;
+            case Op_LoadVariable: { Accumulator = Globals[Op->Operand]; } break;
+            case Op_Store: { Globals[Op->Operand] = (int)Accumulator; } break;
+            
+            case Op_Push:
+            {
+                if(Top >= MaxVMStack)
+                {
+                    StackOverflow("Expression");
+                }
+                Stack[Top++] = Accumulator;
+            } break;
+            
+            // NOTE: Unsigned arithmetic so overflow wraps the way the native code does
+            case Op_Negate: { Accumulator = (int)(0u - (unsigned)Accumulator); } break;
+            case Op_Not: { Accumulator = ~(int)Accumulator; } break;
+            case Op_PopAdd: { Accumulator = (int)((unsigned)Stack[--Top] + (unsigned)Accumulator); } break;
+            case Op_PopSub: { Accumulator = (int)((unsigned)Stack[--Top] - (unsigned)Accumulator); } break;
+            case Op_PopMul: { Accumulator = (int)((unsigned)Stack[--Top] * (unsigned)Accumulator); } break;
+            
+            // NOTE: The smallest value over -1 wraps around, as it does in the
+            // compiled code
+            case Op_PopDiv:
+            {
+                int Left = (int)Stack[--Top];
+                int Right = (int)Accumulator;
+                if(Right == 0)
+                {
+                    RuntimeError(Ops, PC - 1);
+                }
+                Accumulator = (Right == -1) ? (int)(0u - (unsigned)Left) : Left / Right;
+            } break;
+            
+            case Op_PopAnd: { Accumulator = (int)Stack[--Top] & (int)Accumulator; } break;
+            case Op_PopOr: { Accumulator = (int)Stack[--Top] | (int)Accumulator; } break;
+            case Op_PopXor: { Accumulator = (int)Stack[--Top] ^ (int)Accumulator; } break;
+            
+            case Op_SetEqual: { Accumulator = ((int)Stack[--Top] == (int)Accumulator) ? -1 : 0; } break;
+            case Op_SetNotEqual: { Accumulator = ((int)Stack[--Top] != (int)Accumulator) ? -1 : 0; } break;
+            case Op_SetLessThan: { Accumulator = ((int)Stack[--Top] < (int)Accumulator) ? -1 : 0; } break;
+            case Op_SetGreaterThan: { Accumulator = ((int)Stack[--Top] > (int)Accumulator) ? -1 : 0; } break;
+            case Op_SetLessThanOrEqual: { Accumulator = ((int)Stack[--Top] <= (int)Accumulator) ? -1 : 0; } break;
+            case Op_SetGreaterThanOrEqual: { Accumulator = ((int)Stack[--Top] >= (int)Accumulator) ? -1 : 0; } break;
+            
+            case Op_LoadLongConstant: { Accumulator = LongConstants[Op->Operand]; } break;
+            case Op_LoadLong: { memcpy(&Accumulator, Globals + Op->Operand, sizeof(Accumulator)); } break;
+            case Op_StoreLong: { memcpy(Globals + Op->Operand, &Accumulator, sizeof(Accumulator)); } break;
+            case Op_Extend: { Accumulator = (int)Accumulator; } break;
+            case Op_ExtendStacked: { Stack[Top - 1] = (int)Stack[Top - 1]; } break;
+            
+            case Op_NegateLong: { Accumulator = (long long)(0ull - (unsigned long long)Accumulator); } break;
+            case Op_NotLong: { Accumulator = ~Accumulator; } break;
+            case Op_PopAddLong: { Accumulator = (long long)((unsigned long long)Stack[--Top] + (unsigned long long)Accumulator); } break;
+            case Op_PopSubLong: { Accumulator = (long long)((unsigned long long)Stack[--Top] - (unsigned long long)Accumulator); } break;
+            case Op_PopMulLong: { Accumulator = (long long)((unsigned long long)Stack[--Top] * (unsigned long long)Accumulator); } break;
+            
+            case Op_PopDivLong:
+            {
+                long long Left = Stack[--Top];
+                if(Accumulator == 0)
+                {
+                    RuntimeError(Ops, PC - 1);
+                }
+                Accumulator = (Accumulator == -1) ? (long long)(0ull - (unsigned long long)Left) : Left / Accumulator;
+            } break;
+            
+            case Op_PopAndLong: { Accumulator = Stack[--Top] & Accumulator; } break;
+            case Op_PopOrLong: { Accumulator = Stack[--Top] | Accumulator; } break;
+            case Op_PopXorLong: { Accumulator = Stack[--Top] ^ Accumulator; } break;
+            
+            case Op_SetEqualLong: { Accumulator = (Stack[--Top] == Accumulator) ? -1 : 0; } break;
+            case Op_SetNotEqualLong: { Accumulator = (Stack[--Top] != Accumulator) ? -1 : 0; } break;
+            case Op_SetLessThanLong: { Accumulator = (Stack[--Top] < Accumulator) ? -1 : 0; } break;
+            case Op_SetGreaterThanLong: { Accumulator = (Stack[--Top] > Accumulator) ? -1 : 0; } break;
+            case Op_SetLessThanOrEqualLong: { Accumulator = (Stack[--Top] <= Accumulator) ? -1 : 0; } break;
+            case Op_SetGreaterThanOrEqualLong: { Accumulator = (Stack[--Top] >= Accumulator) ? -1 : 0; } break;
+            case Op_TestLong: { Accumulator = (Accumulator != 0) ? -1 : 0; } break;
+            
+            case Op_Branch:
+            {
+                jit_code Code = 0;
+                if((Op->Loop >= 0) && Machine->JitEnabled)
+                {
+                    Code = LoopCode(Machine, Op);
+                }
+                
+                if(Code)
+                {
+                    PC = Code(Frames + FrameBase);
+                    if(PC < 0)
+                    {
+                        PC = RuntimeError(Ops, -(PC + 1));
+                    }
+                    
+                    // NOTE: Pick up what the native code had in flight
+                    if(Top + Machine->NumSpilled > MaxVMStack)
+                    {
+                        StackOverflow("Expression");
+                    }
+                    memcpy(Stack + Top, Machine->Spilled, Machine->NumSpilled*sizeof(long long));
+                    Top += Machine->NumSpilled;
+                    Accumulator = Machine->ExitAccumulator;
+                }
+                else
+                {
+                    PC = Op->Operand;
+                }
+            } break;
+            
+            case Op_BranchFalse:
+            {
+                if((int)Accumulator == 0)
+                {
+                    PC = Op->Operand;
+                }
+            } break;
+            
+            case Op_BranchTrue:
+            {
+                if((int)Accumulator != 0)
+                {
+                    PC = Op->Operand;
+                }
+            } break;
+            
+            case Op_Read:
+            {
+                long long Number;
+                if(ReadInteger(Machine->Input, INT_MIN, INT_MAX, &Number))
+                {
+                    Globals[Op->Operand] = (int)Number;
+                }
+            } break;
+            
+            case Op_Write:
+            {
+                fprintf(Machine->Output, "%d\n", Globals[Op->Operand]);
+            } break;
+            
+            case Op_ReadLong:
+            {
+                long long Number;
+                if(ReadInteger(Machine->Input, LLONG_MIN, LLONG_MAX, &Number))
+                {
+                    memcpy(Globals + Op->Operand, &Number, sizeof(Number));
+                }
+            } break;
+            
+            case Op_WriteLong:
+            {
+                long long Number;
+                memcpy(&Number, Globals + Op->Operand, sizeof(Number));
+                fprintf(Machine->Output, "%lld\n", Number);
+            } break;
+            
+            case Op_Call:
+            {
+                procedure *Procedure = Procedures + Op->Operand;
+                if((NumCalls >= MaxCallDepth) || (FrameTop + Procedure->FrameSize > MaxFrameSlots))
+                {
+                    StackOverflow("Call");
+                }
+                
+                long long *Frame = Frames + FrameTop;
+                for(int Parameter = Procedure->NumParameters - 1;
+                    Parameter >= 0;
+                    Parameter--)
+                {
+                    long long Argument = (Parameter == Procedure->NumParameters - 1) ? Accumulator : Stack[--Top];
+                    Frame[Parameter] = (Procedure->LongParameters & (1 << Parameter)) ? Argument : (int)Argument;
+                }
+                
+                Machine->ReturnPC[NumCalls] = PC;
+                Machine->ReturnFrame[NumCalls] = FrameBase;
+                NumCalls++;
+                FrameBase = FrameTop;
+                FrameTop += Procedure->FrameSize;
+                PC = Procedure->Entry;
+            } break;
+            
+            case Op_Return:
+            {
+                FrameTop = FrameBase;
+                NumCalls--;
+                FrameBase = Machine->ReturnFrame[NumCalls];
+                PC = Machine->ReturnPC[NumCalls];
+            } break;
+            
+            case Op_LoadLocal: { Accumulator = Frames[FrameBase + Op->Operand]; } break;
+            case Op_StoreLocal: { Frames[FrameBase + Op->Operand] = (int)Accumulator; } break;
+            case Op_StoreLocalLong: { Frames[FrameBase + Op->Operand] = Accumulator; } break;
+            
+            case Op_ReadLocal:
+            {
+                long long Number;
+                if(ReadInteger(Machine->Input, INT_MIN, INT_MAX, &Number))
+                {
+                    Frames[FrameBase + Op->Operand] = Number;
+                }
+            } break;
+            
+            case Op_ReadLocalLong:
+            {
+                long long Number;
+                if(ReadInteger(Machine->Input, LLONG_MIN, LLONG_MAX, &Number))
+                {
+                    Frames[FrameBase + Op->Operand] = Number;
+                }
+            } break;
+            
+            case Op_WriteLocal:
+            {
+                // NOTE: An INT is sign extended in its slot, so this prints either type
+                fprintf(Machine->Output, "%lld\n", Frames[FrameBase + Op->Operand]);
+            } break;
+            
+            case Op_LoadElement: { Accumulator = Globals[Op->Operand + (int)Accumulator]; } break;
+            case Op_LoadElementLong: { memcpy(&Accumulator, Globals + Op->Operand + 2*(int)Accumulator, sizeof(Accumulator)); } break;
+            case Op_StoreElement: { Globals[Op->Operand + (int)Stack[--Top]] = (int)Accumulator; } break;
+            case Op_StoreElementLong: { memcpy(Globals + Op->Operand + 2*(int)Stack[--Top], &Accumulator, sizeof(Accumulator)); } break;
+            
+            case Op_CheckIndex:
+            {
+                if((unsigned)Accumulator >= (unsigned)Op->Operand)
+                {
+                    RuntimeError(Ops, PC - 1);
+                }
+            } break;
+            
+            case Op_Case: { PC = CaseTarget(Machine->Program, Op->Operand, (int)Accumulator); } break;
+            case Op_Count: { Machine->Counters[Op->Operand]++; } break;
+            
+            case Op_Halt:
+            {
+                return;
+            }
+        }
+    }
+}
+
+//
+// --JIT stress test
+//
+
+// NOTE: Runs Count copies of the parsed program at once, each on its own vm
+// with a low JIT threshold, so the workers compile and install code for many
+// programs concurrently. Every copy's output has to match an interpreter-only
+// run. READ sees an empty input.
+
+struct stress_run
+{
+    vm *Machine;
+    FILE *Output;
+    
+    // NOTE: Loops that reached the threshold, and the ones of those with
+    // native code installed by the end
+    int HotLoops;
+    int CompiledLoops;
+};
+
+static void
+StressRun(stress_run *Run)
+{
+    vm *Machine = Run->Machine;
+    RunBytecode(Machine);
+    
+    DrainJit(Machine);
+    for(int LoopIndex = 0;
+        LoopIndex < Machine->Program->NumLoops;
+        LoopIndex++)
+    {
+        loop_slot *Slot = Machine->Slots + LoopIndex;
+        bool Compiled = (Slot->Code.load(std::memory_order_acquire) != 0);
+        if(Compiled || (Slot->Count >= Machine->JitThreshold))
+        {
+            Run->HotLoops++;
+        }
+        Run->CompiledLoops += Compiled ? 1 : 0;
+    }
+    
+    FreeVM(Machine);
+}
+
+static char *
+ReadBack(FILE *File, size_t *Size)
+{
+    fflush(File);
+    rewind(File);
+    
+    char *Result = ReadEntireFile(File, Size);
+    return Result;
+}
+
+static bool
+RunJitStress(bytecode *Program, int Count, int JitThreshold, int VectorWidth)
+{
+    FILE *EmptyInput = tmpfile();
+    
+    vm *Reference = new vm();
+    InitVM(Reference, Program);
+    Reference->JitEnabled = false;
+    Reference->Input = EmptyInput;
+    Reference->Output = tmpfile();
+    RunBytecode(Reference);
+    size_t ExpectedSize;
+    char *Expected = ReadBack(Reference->Output, &ExpectedSize);
+    
+    unsigned int NumCores = std::thread::hardware_concurrency();
+    StartJitWorkers((NumCores > 1) ? (int)NumCores : 2);
+    
+    stress_run *Runs = new stress_run[Count];
+    std::thread *Threads = new std::thread[Count];
+    for(int RunIndex = 0;
+        RunIndex < Count;
+        RunIndex++)
+    {
+        stress_run *Run = Runs + RunIndex;
+        Run->HotLoops = 0;
+        Run->CompiledLoops = 0;
+        Run->Machine = new vm();
+        InitVM(Run->Machine, Program);
+        Run->Machine->JitEnabled = JitSupported;
+        Run->Machine->JitThreshold = JitThreshold;
+        if(VectorWidth >= 0)
+        {
+            Run->Machine->VectorWidth = VectorWidth;
+        }
+        Run->Machine->Input = EmptyInput;
+        Run->Machine->Output = Run->Output = tmpfile();
+    }
+    
+    for(int RunIndex = 0;
+        RunIndex < Count;
+        RunIndex++)
+    {
+        Threads[RunIndex] = std::thread(StressRun, Runs + RunIndex);
+    }
+    
+    int Mismatches = 0;
+    int HotLoops = 0;
+    int CompiledLoops = 0;
+    for(int RunIndex = 0;
+        RunIndex < Count;
+        RunIndex++)
+    {
+        Threads[RunIndex].join();
+        HotLoops += Runs[RunIndex].HotLoops;
+        CompiledLoops += Runs[RunIndex].CompiledLoops;
+        
+        size_t Size;
+        char *Output = ReadBack(Runs[RunIndex].Output, &Size);
+        if((Size != ExpectedSize) || memcmp(Output, Expected, Size))
+        {
+            fprintf(stderr, "JIT stress: run %d output differs from the interpreter\n", RunIndex);
+            Mismatches++;
+        }
+        
+        free(Output);
+        fclose(Runs[RunIndex].Output);
+        delete Runs[RunIndex].Machine;
+    }
+    
+    fprintf(stdout, "JIT stress: %d runs, %d loops each, %d hot, %d compiled, %d mismatches\n",
+            Count, Program->NumLoops, HotLoops, CompiledLoops, Mismatches);
+    
+    // NOTE: Matching output proves nothing if the interpreter ran everything
+    bool Compiled = (!JitSupported || (HotLoops == 0) || (CompiledLoops > 0));
+    if(!Compiled)
+    {
+        fprintf(stderr, "JIT stress: loops got hot but none was compiled\n");
+    }
+    
+    delete[] Threads;
+    delete[] Runs;
+    free(Expected);
+    fclose(Reference->Output);
+    delete Reference;
+    fclose(EmptyInput);
+    
+    return (Mismatches == 0) && Compiled;
+}
+
+#include "tiny_cost.cpp"